@@ -138,4 +138,20 @@ static inline int atomic_inc_return(atomic_t *v) {
   return __sync_add_and_fetch(&v->counter, 1);
 }
 
+// Adds @a to @v unless it is @u. Returns non-zero if added.
+static inline int atomic_add_unless(atomic_t *v, int a, int u) {
+  int c = atomic_read(v), old;
+  while (c != u) {
+    old = __sync_val_compare_and_swap(&v->counter, c, c + a);
+    if (old == c) return 1;
+    c = old;
+  }
+  return 0;
+}
+
+// Sets @v to @new if it is @old. Returns the value before.
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new) {
+  return __sync_val_compare_and_swap(&v->counter, old, new);
+}
+
 #endif
@@ -0,0 +1,125 @@
+// Helpers shared by the in-process benchmarks, which are linked against
+// the user-space build of the core.
+
+#ifndef CINQUAIN_META_BENCH_H_
+#define CINQUAIN_META_BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cinq_meta.h"
+
+#define BENCH_DIR_MODE \
+    ((CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU | S_IRGRP)
+#define BENCH_FILE_MODE \
+    ((CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU | S_IRGRP)
+
+struct bench_hist {
+  u64 count;
+  u64 errors;
+  u64 buckets[CINQ_HIST_BUCKETS];
+};
+
+static inline void bench_hist_add(struct bench_hist *hist, u64 start,
+                                  int err) {
+  ++hist->count;
+  if (err) ++hist->errors;
+  ++hist->buckets[cinq_hist_bucket(cinq_stat_clock() - start)];
+}
+
+static inline void bench_hist_merge(struct bench_hist *to,
+                                    const struct bench_hist *from) {
+  int b;
+  to->count += from->count;
+  to->errors += from->errors;
+  for (b = 0; b < CINQ_HIST_BUCKETS; ++b) {
+    to->buckets[b] += from->buckets[b];
+  }
+}
+
+static inline u64 bench_percentile(const struct bench_hist *hist,
+                                   int per_mille) {
+  u64 seen = 0;
+  int b;
+  for (b = 0; b < CINQ_HIST_BUCKETS; ++b) {
+    seen += hist->buckets[b];
+    if (seen * 1000 >= hist->count * per_mille) return cinq_hist_bound(b);
+  }
+  return cinq_hist_bound(CINQ_HIST_BUCKETS - 1);
+}
+
+static inline void bench_report_head(void) {
+  fprintf(stdout, "%-8s %10s %8s %12s %10s %10s %10s\n", "op", "ops",
+          "errors", "ops/s", "p50_ns", "p99_ns", "p999_ns");
+}
+
+static inline void bench_report_row(const char *name,
+                                    const struct bench_hist *hist,
+                                    double secs) {
+  fprintf(stdout, "%-8s %10llu %8llu %12.0f %10llu %10llu %10llu\n",
+          name, (unsigned long long)hist->count,
+          (unsigned long long)hist->errors, hist->count / secs,
+          (unsigned long long)bench_percentile(hist, 500),
+          (unsigned long long)bench_percentile(hist, 990),
+          (unsigned long long)bench_percentile(hist, 999));
+}
+
+// Benchmark dentries stay out of the d_subdirs of their parents,
+// so making and dropping them costs no dcache lock.
+static inline struct dentry *bench_dentry_new(struct dentry *parent,
+                                              const char *name) {
+  const struct qstr qname =
+      { .name = (unsigned char *)name, .len = strlen(name) };
+  struct dentry *dentry = d_alloc(NULL, &qname);
+  if (!dentry) {
+    fprintf(stderr, "Out of memory for dentries.\n");
+    exit(-1);
+  }
+  dentry->d_parent = parent;
+  dentry->d_sb = parent->d_sb;
+  return dentry;
+}
+
+// Drops the alias and the inode reference it holds, which may evict
+// the inode back into its tag.
+static inline void bench_dentry_free(struct dentry *dentry) {
+  struct inode *inode = dentry->d_inode;
+  if (inode) {
+    spin_lock(&inode->i_lock);
+    list_del_init(&dentry->d_alias);
+    spin_unlock(&inode->i_lock);
+    iput(inode);
+  }
+  free((char *)dentry->d_name.name);
+  free(dentry);
+}
+
+static inline struct dentry *bench_lookup(struct dentry *parent,
+                                          const char *name) {
+  struct dentry *dentry = bench_dentry_new(parent, name);
+  struct inode *dir = parent->d_inode;
+  dir->i_op->lookup(dir, dentry, NULL);
+  return dentry;
+}
+
+// Counts the entries into @dirent, a long.
+static inline int bench_filldir(void *dirent, const char *name, int name_len,
+                                loff_t pos, u64 ino, unsigned dt_type) {
+  ++*(long *)dirent;
+  return 0;
+}
+
+static inline int bench_readdir(struct dentry *dentry) {
+  struct file *filp = dentry_open(dentry, NULL, 0, NULL);
+  long entries = 0;
+  int err = filp->f_op->readdir(filp, &entries, bench_filldir);
+  filp->f_op->release(NULL, filp);
+  put_filp(filp);
+  return err;
+}
+
+// VM-fleet workload generator and trace replayer (fleet.c)
+extern int fleet_main(int argc, char *argv[]);
+
+#endif // CINQUAIN_META_BENCH_H_
@@ -0,0 +1,567 @@
+// VM-fleet workload: clone VMs over a few golden images, as in production.
+//
+// The generator emits a trace in four phases:
+//   golden  golden image fsnodes g<i> make the same dir tree with files;
+//   clone   each golden gets an inheritance chain of layers g<i>l<j>,
+//           and VMs vm<k> are cloned from the last layer of a golden;
+//   boot    all VMs read the same boot dirs at once;
+//   run     VMs keep reading the image and diverge from it by creating,
+//           unlinking (whiteouts) and making dirs at a configurable rate.
+// The trace is then run against the user-space build, and can be saved
+// with the times ops started (-o) to be replayed at full speed later (-i).
+//
+// A trace line is "time_ns phase op fsnode path", where fsnew ops give the
+// parent fsnode (or META_FS) as path. Within a phase, fsnew ops run first
+// in one thread; the others are spread over threads by fsnode, so the ops
+// of any fsnode keep their order.
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+enum fleet_op_type {
+  FLEET_FSNEW = 0,
+  FLEET_LOOKUP,
+  FLEET_READDIR,
+  FLEET_MKDIR,
+  FLEET_CREATE,
+  FLEET_UNLINK,
+  FLEET_NUM_OPS
+};
+
+static const char *fleet_op_names[FLEET_NUM_OPS] = {
+  "fsnew", "lookup", "readdir", "mkdir", "create", "unlink"
+};
+
+#define FLEET_MAX_PHASES 16
+#define FLEET_MAX_DEPTH 32 // path components
+#define FLEET_PATH_LEN 4096
+
+struct fleet_op {
+  u64 time; // ns since the run began, filled when run
+  char *fs; // name of the requesting fsnode
+  char *path; // or the parent fsnode name for FLEET_FSNEW
+  short type;
+  short phase;
+};
+
+struct fleet_trace {
+  struct fleet_op *ops; // grouped by phase
+  long num_ops;
+  long cap;
+  char *phases[FLEET_MAX_PHASES];
+  int num_phases;
+};
+
+struct fleet_config {
+  int threads;
+  int goldens;
+  int layers; // between a golden and its VMs
+  int vms;
+  int fanout; // dirs per dir of an image
+  int levels;
+  int files; // per dir of an image
+  int boot_dirs;
+  long run_ops; // per VM
+  int diverge_pct; // of run ops that write
+  const char *record;
+  const char *replay;
+};
+
+static struct fleet_config fleet_config = {
+  .threads = 4, .goldens = 2, .layers = 1, .vms = 64, .fanout = 4,
+  .levels = 3, .files = 8, .boot_dirs = 8, .run_ops = 200,
+  .diverge_pct = 10
+};
+
+/* Traces */
+
+static void trace_add_(struct fleet_trace *trace, const char *phase,
+                       int type, const char *fs, const char *path) {
+  struct fleet_op *op;
+  if (!trace->num_phases ||
+      strcmp(trace->phases[trace->num_phases - 1], phase)) {
+    if (trace->num_phases == FLEET_MAX_PHASES) {
+      fprintf(stderr, "Too many phases: %s.\n", phase);
+      exit(-1);
+    }
+    trace->phases[trace->num_phases++] = strdup(phase);
+  }
+  if (trace->num_ops == trace->cap) {
+    trace->cap = trace->cap ? trace->cap * 2 : 4096;
+    trace->ops = realloc(trace->ops, trace->cap * sizeof(struct fleet_op));
+    if (!trace->ops) {
+      fprintf(stderr, "Out of memory at %ld ops.\n", trace->num_ops);
+      exit(-1);
+    }
+  }
+  op = &trace->ops[trace->num_ops++];
+  op->time = 0;
+  op->fs = strdup(fs);
+  op->path = strdup(path);
+  op->type = type;
+  op->phase = trace->num_phases - 1;
+}
+
+static int by_time_(const void *a, const void *b) {
+  const struct fleet_op *x = a, *y = b;
+  if (x->time != y->time) return x->time < y->time ? -1 : 1;
+  return 0;
+}
+
+// Writes the ops of each phase in the order they started.
+static int trace_save_(struct fleet_trace *trace, const char *file_name) {
+  FILE *file = fopen(file_name, "w");
+  struct fleet_op *op;
+  long begin, end;
+
+  if (!file) return -errno;
+  fprintf(file, "# cinquain fleet trace: time_ns phase op fsnode path\n");
+  for (begin = 0; begin < trace->num_ops; begin = end) {
+    for (end = begin; end < trace->num_ops &&
+         trace->ops[end].phase == trace->ops[begin].phase; ++end);
+    qsort(trace->ops + begin, end - begin, sizeof(struct fleet_op),
+          by_time_);
+  }
+  for (op = trace->ops; op < trace->ops + trace->num_ops; ++op) {
+    fprintf(file, "%llu %s %s %s %s\n", (unsigned long long)op->time,
+            trace->phases[op->phase], fleet_op_names[op->type],
+            op->fs, op->path);
+  }
+  fclose(file);
+  return 0;
+}
+
+static int trace_load_(struct fleet_trace *trace, const char *file_name) {
+  char line[FLEET_PATH_LEN + 2 * MAX_NAME_LEN + 64];
+  char phase[MAX_NAME_LEN + 1], op[16], fs[MAX_NAME_LEN + 1];
+  char path[FLEET_PATH_LEN];
+  unsigned long long time;
+  FILE *file = fopen(file_name, "r");
+  int type;
+
+  if (!file) return -errno;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "%llu %255s %15s %255s %4095s",
+               &time, phase, op, fs, path) != 5) {
+      fprintf(stderr, "Bad trace line: %s", line);
+      fclose(file);
+      return -EINVAL;
+    }
+    for (type = 0; type < FLEET_NUM_OPS; ++type) {
+      if (!strcmp(op, fleet_op_names[type])) break;
+    }
+    if (type == FLEET_NUM_OPS) {
+      fprintf(stderr, "Unknown op in trace: %s.\n", op);
+      fclose(file);
+      return -EINVAL;
+    }
+    trace_add_(trace, phase, type, fs, path);
+    trace->ops[trace->num_ops - 1].time = time;
+  }
+  fclose(file);
+  return 0;
+}
+
+/* Generator */
+
+// Paths of the dirs of an image, breadth first from "/".
+static char **image_dirs_(long *num_dirs) {
+  const struct fleet_config *cfg = &fleet_config;
+  char **dirs;
+  long n = 1, level_n = 1, i, begin, end;
+  int l, f;
+
+  for (l = 0; l < cfg->levels; ++l) {
+    level_n *= cfg->fanout;
+    n += level_n;
+  }
+  dirs = malloc(n * sizeof(char *));
+  dirs[0] = strdup("/");
+  for (l = 0, begin = 0, end = 1, i = 1; l < cfg->levels; ++l, end = i) {
+    for (; begin < end; ++begin) {
+      for (f = 0; f < cfg->fanout; ++f) {
+        dirs[i] = malloc(strlen(dirs[begin]) + 16);
+        sprintf(dirs[i++], "%s%sd%d", dirs[begin],
+                begin ? "/" : "", f);
+      }
+    }
+  }
+  *num_dirs = n;
+  return dirs;
+}
+
+static void file_path_(char *path, const char *dir, const char *name) {
+  sprintf(path, "%s%s%s", dir, strcmp(dir, "/") ? "/" : "", name);
+}
+
+static void fleet_generate_(struct fleet_trace *trace) {
+  const struct fleet_config *cfg = &fleet_config;
+  long num_dirs, i, s, pick;
+  char **dirs = image_dirs_(&num_dirs);
+  char fs[MAX_NAME_LEN + 1], parent[MAX_NAME_LEN + 1];
+  char name[32], path[FLEET_PATH_LEN];
+  unsigned int *seeds = malloc(cfg->vms * sizeof(unsigned int));
+  long *unlinked = calloc(cfg->vms, sizeof(long)); // golden files by a VM
+  long *seq = calloc(cfg->vms, sizeof(long));
+  const long num_files = num_dirs * cfg->files;
+  int g, l, v, f;
+
+  for (g = 0; g < cfg->goldens; ++g) {
+    sprintf(fs, "g%d", g);
+    trace_add_(trace, "golden", FLEET_FSNEW, fs, "META_FS");
+    for (i = 0; i < num_dirs; ++i) {
+      if (i) trace_add_(trace, "golden", FLEET_MKDIR, fs, dirs[i]);
+      for (f = 0; f < cfg->files; ++f) {
+        sprintf(name, "f%d", f);
+        file_path_(path, dirs[i], name);
+        trace_add_(trace, "golden", FLEET_CREATE, fs, path);
+      }
+    }
+  }
+
+  for (g = 0; g < cfg->goldens; ++g) {
+    sprintf(parent, "g%d", g);
+    for (l = 1; l <= cfg->layers; ++l) {
+      sprintf(fs, "g%dl%d", g, l);
+      trace_add_(trace, "clone", FLEET_FSNEW, fs, parent);
+      strcpy(parent, fs);
+    }
+  }
+  for (v = 0; v < cfg->vms; ++v) {
+    g = v % cfg->goldens;
+    if (cfg->layers) sprintf(parent, "g%dl%d", g, cfg->layers);
+    else sprintf(parent, "g%d", g);
+    sprintf(fs, "vm%d", v);
+    trace_add_(trace, "clone", FLEET_FSNEW, fs, parent);
+    seeds[v] = v * 7919 + 1;
+  }
+
+  // VMs take turns op by op, as they boot at once.
+  for (i = 0; i < cfg->boot_dirs && i < num_dirs; ++i) {
+    for (f = -1; f < cfg->files; ++f) {
+      if (f >= 0) {
+        sprintf(name, "f%d", f);
+        file_path_(path, dirs[i], name);
+      }
+      for (v = 0; v < cfg->vms; ++v) {
+        sprintf(fs, "vm%d", v);
+        if (f < 0) trace_add_(trace, "boot", FLEET_READDIR, fs, dirs[i]);
+        else trace_add_(trace, "boot", FLEET_LOOKUP, fs, path);
+      }
+    }
+  }
+
+  for (s = 0; s < cfg->run_ops; ++s) {
+    for (v = 0; v < cfg->vms; ++v) {
+      unsigned int *seed = &seeds[v];
+      const int dice = rand_r(seed) % 100;
+      const char *dir = dirs[rand_r(seed) % num_dirs];
+      sprintf(fs, "vm%d", v);
+      if (dice >= cfg->diverge_pct) { // reads
+        if (dice % 10) {
+          sprintf(name, "f%d", rand_r(seed) % cfg->files);
+          file_path_(path, dir, name);
+          trace_add_(trace, "run", FLEET_LOOKUP, fs, path);
+        } else {
+          trace_add_(trace, "run", FLEET_READDIR, fs, dir);
+        }
+      } else if (dice % 10 < 3 && unlinked[v] < num_files) {
+        // walks over the golden files from a point of its own
+        pick = (v * 104729L + unlinked[v]++) % num_files;
+        sprintf(name, "f%ld", pick % cfg->files);
+        file_path_(path, dirs[pick / cfg->files], name);
+        trace_add_(trace, "run", FLEET_UNLINK, fs, path);
+      } else if (dice % 10 < 5) {
+        sprintf(name, "n%ld", seq[v]++);
+        file_path_(path, dir, name);
+        trace_add_(trace, "run", FLEET_MKDIR, fs, path);
+      } else {
+        sprintf(name, "v%ld", seq[v]++);
+        file_path_(path, dir, name);
+        trace_add_(trace, "run", FLEET_CREATE, fs, path);
+      }
+    }
+  }
+
+  for (i = 0; i < num_dirs; ++i) free(dirs[i]);
+  free(dirs);
+  free(seeds);
+  free(unlinked);
+  free(seq);
+}
+
+/* Executor */
+
+struct fleet_fs {
+  char name[MAX_NAME_LEN + 1];
+  struct dentry *root;
+  UT_hash_handle hh;
+};
+
+// Only added to between phases, so worker threads read it without a lock.
+static struct fleet_fs *fleet_fses_;
+static struct dentry *fleet_meta_;
+
+struct fleet_walk {
+  struct dentry *dentries[FLEET_MAX_DEPTH];
+  int depth;
+};
+
+// Looks up @path from @root one component at a time, as the VFS would.
+// With @last, the final component is left to the caller. Returns the
+// dentry reached, or NULL if a component is missing.
+static struct dentry *walk_(struct fleet_walk *walk, struct dentry *root,
+                            char *path, char **last) {
+  struct dentry *dentry = root;
+  char *pos, *name = strtok_r(path, "/", &pos), *next;
+
+  walk->depth = 0;
+  if (last) *last = NULL;
+  for (; name; name = next) {
+    next = strtok_r(NULL, "/", &pos);
+    if (!next && last) {
+      *last = name;
+      break;
+    }
+    if (walk->depth == FLEET_MAX_DEPTH) return NULL;
+    dentry = bench_lookup(dentry, name);
+    walk->dentries[walk->depth++] = dentry;
+    if (!dentry->d_inode) return NULL;
+  }
+  return dentry;
+}
+
+static void walk_put_(struct fleet_walk *walk) {
+  while (walk->depth) bench_dentry_free(walk->dentries[--walk->depth]);
+}
+
+static int fleet_fsnew_(struct fleet_op *op) {
+  char name[2 * MAX_NAME_LEN + 2];
+  struct inode *dir = fleet_meta_->d_inode;
+  struct dentry *dentry;
+  struct fleet_fs *fs;
+  int err;
+
+  sprintf(name, "%s.%s", op->path, op->fs);
+  dentry = bench_dentry_new(fleet_meta_, name);
+  err = dir->i_op->mkdir(dir, dentry, BENCH_DIR_MODE);
+  if (err) return err;
+  fs = calloc(1, sizeof(struct fleet_fs));
+  strncpy(fs->name, op->fs, MAX_NAME_LEN);
+  fs->root = dentry;
+  HASH_ADD_STR(fleet_fses_, name, fs);
+  return 0;
+}
+
+static int fleet_exec_(struct fleet_op *op) {
+  char path[FLEET_PATH_LEN], *last;
+  struct fleet_walk walk = { .depth = 0 };
+  struct dentry *parent, *dentry;
+  struct inode *dir;
+  struct fleet_fs *fs;
+  int err = 0;
+
+  HASH_FIND_STR(fleet_fses_, op->fs, fs);
+  if (!fs) return -ENOENT;
+  strncpy(path, op->path, FLEET_PATH_LEN - 1);
+  path[FLEET_PATH_LEN - 1] = '\0';
+
+  switch (op->type) {
+    case FLEET_LOOKUP:
+      err = walk_(&walk, fs->root, path, NULL) ? 0 : -ENOENT;
+      break;
+    case FLEET_READDIR:
+      parent = walk_(&walk, fs->root, path, NULL);
+      err = parent ? bench_readdir(parent) : -ENOENT;
+      break;
+    case FLEET_MKDIR:
+    case FLEET_CREATE:
+    case FLEET_UNLINK:
+      parent = walk_(&walk, fs->root, path, &last);
+      if (!parent || !last) {
+        err = -ENOENT;
+        break;
+      }
+      dir = parent->d_inode;
+      if (op->type == FLEET_MKDIR) {
+        dentry = bench_dentry_new(parent, last);
+        err = dir->i_op->mkdir(dir, dentry, BENCH_DIR_MODE);
+      } else if (op->type == FLEET_CREATE) {
+        dentry = bench_dentry_new(parent, last);
+        err = dir->i_op->create(dir, dentry, BENCH_FILE_MODE, NULL);
+      } else {
+        dentry = bench_lookup(parent, last);
+        if (dentry->d_inode) {
+          err = dir->i_op->unlink(dir, dentry);
+        } else {
+          err = -ENOENT;
+        }
+      }
+      bench_dentry_free(dentry);
+      break;
+    default:
+      err = -EINVAL;
+  }
+  walk_put_(&walk);
+  return err;
+}
+
+struct fleet_thread {
+  pthread_t thread;
+  struct fleet_op **ops;
+  long num_ops;
+  struct bench_hist hist[FLEET_NUM_OPS];
+};
+
+static u64 fleet_begin_;
+
+static void fleet_time_(struct fleet_op *op, struct bench_hist *hist,
+                        int (*exec)(struct fleet_op *)) {
+  const u64 start = cinq_stat_clock();
+  const int err = exec(op);
+  op->time = start - fleet_begin_;
+  bench_hist_add(&hist[op->type], start, err);
+}
+
+static void *fleet_worker_(void *arg) {
+  struct fleet_thread *t = arg;
+  long i;
+  for (i = 0; i < t->num_ops; ++i) {
+    fleet_time_(t->ops[i], t->hist, fleet_exec_);
+  }
+  return NULL;
+}
+
+static unsigned int name_hash_(const char *name) {
+  unsigned int hash = 5381;
+  while (*name) hash = hash * 33 + (unsigned char)*name++;
+  return hash;
+}
+
+static void fleet_run_(struct fleet_trace *trace) {
+  const int n = fleet_config.threads;
+  struct fleet_thread *threads = calloc(n, sizeof(struct fleet_thread));
+  struct bench_hist hist, total;
+  struct fleet_op *op;
+  long begin, end, i;
+  u64 start;
+  double secs;
+  int type, t;
+
+  for (t = 0; t < n; ++t) {
+    threads[t].ops = malloc(trace->num_ops * sizeof(struct fleet_op *));
+  }
+  fleet_begin_ = cinq_stat_clock();
+  for (begin = 0; begin < trace->num_ops; begin = end) {
+    for (end = begin; end < trace->num_ops &&
+         trace->ops[end].phase == trace->ops[begin].phase; ++end);
+
+    start = cinq_stat_clock();
+    for (t = 0; t < n; ++t) {
+      threads[t].num_ops = 0;
+      memset(threads[t].hist, 0, sizeof(threads[t].hist));
+    }
+    for (i = begin; i < end; ++i) {
+      op = &trace->ops[i];
+      if (op->type == FLEET_FSNEW) {
+        fleet_time_(op, threads[0].hist, fleet_fsnew_);
+      } else {
+        t = name_hash_(op->fs) % n;
+        threads[t].ops[threads[t].num_ops++] = op;
+      }
+    }
+    for (t = 0; t < n; ++t) {
+      pthread_create(&threads[t].thread, NULL, fleet_worker_, &threads[t]);
+    }
+    for (t = 0; t < n; ++t) {
+      pthread_join(threads[t].thread, NULL);
+    }
+    secs = (cinq_stat_clock() - start) / 1e9;
+
+    fprintf(stdout, "\nphase %s: %ld ops in %.3f s\n",
+            trace->phases[trace->ops[begin].phase], end - begin, secs);
+    bench_report_head();
+    memset(&total, 0, sizeof(total));
+    for (type = 0; type < FLEET_NUM_OPS; ++type) {
+      memset(&hist, 0, sizeof(hist));
+      for (t = 0; t < n; ++t) {
+        bench_hist_merge(&hist, &threads[t].hist[type]);
+      }
+      if (!hist.count) continue;
+      bench_report_row(fleet_op_names[type], &hist, secs);
+      bench_hist_merge(&total, &hist);
+    }
+    bench_report_row("total", &total, secs);
+  }
+  for (t = 0; t < n; ++t) free(threads[t].ops);
+  free(threads);
+}
+
+static void fleet_usage_(void) {
+  fprintf(stdout, "Usage: ./bench fleet [-t threads] [-g goldens] "
+          "[-c layers] [-v VMs] [-f fanout] [-l levels]\n"
+          "                     [-k files per dir] [-b boot dirs] "
+          "[-n run ops per VM] [-x divergence %%]\n"
+          "                     [-o trace to record] [-i trace to replay]\n");
+}
+
+int fleet_main(int argc, char *argv[]) {
+  struct fleet_config *cfg = &fleet_config;
+  struct fleet_trace trace = { 0 };
+  int opt, err;
+
+  while ((opt = getopt(argc, argv, "t:g:c:v:f:l:k:b:n:x:o:i:h")) != -1) {
+    switch (opt) {
+      case 't': cfg->threads = atoi(optarg); break;
+      case 'g': cfg->goldens = atoi(optarg); break;
+      case 'c': cfg->layers = atoi(optarg); break;
+      case 'v': cfg->vms = atoi(optarg); break;
+      case 'f': cfg->fanout = atoi(optarg); break;
+      case 'l': cfg->levels = atoi(optarg); break;
+      case 'k': cfg->files = atoi(optarg); break;
+      case 'b': cfg->boot_dirs = atoi(optarg); break;
+      case 'n': cfg->run_ops = atol(optarg); break;
+      case 'x': cfg->diverge_pct = atoi(optarg); break;
+      case 'o': cfg->record = optarg; break;
+      case 'i': cfg->replay = optarg; break;
+      default: fleet_usage_(); return -1;
+    }
+  }
+  if (cfg->threads < 1 || cfg->goldens < 1 || cfg->layers < 0 ||
+      cfg->vms < 1 || cfg->fanout < 1 || cfg->levels < 0 ||
+      cfg->files < 1 || cfg->run_ops < 0 || cfg->diverge_pct < 0) {
+    fleet_usage_();
+    return -1;
+  }
+
+  if (cfg->replay) {
+    err = trace_load_(&trace, cfg->replay);
+    if (err) {
+      fprintf(stderr, "Failed to load trace %s: %d.\n", cfg->replay, err);
+      return -1;
+    }
+    fprintf(stdout, "Replay %ld ops of %s by %d threads\n",
+            trace.num_ops, cfg->replay, cfg->threads);
+  } else {
+    fleet_generate_(&trace);
+    fprintf(stdout, "%d VMs over %d golden images (%d layers each), "
+            "%d threads, %ld ops\n", cfg->vms, cfg->goldens, cfg->layers,
+            cfg->threads, trace.num_ops);
+  }
+
+  fleet_meta_ = cinqfs.mount((struct file_system_type *)&cinqfs, 0, NULL,
+                             NULL);
+  fleet_run_(&trace);
+
+  if (cfg->record) {
+    err = trace_save_(&trace, cfg->record);
+    if (err) {
+      fprintf(stderr, "Failed to save trace %s: %d.\n", cfg->record, err);
+      return -1;
+    }
+  }
+  return 0;
+}
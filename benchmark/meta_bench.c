@@ -0,0 +1,448 @@
+// In-process benchmark of the metadata core, linked against the user-space
+// build (make -f Makefile.user bench). Ops are invoked through the inode
+// and file operations as the VFS would, but without any dcache, so the
+// numbers reflect the core alone.
+//
+// An inheritance chain of fsnodes b0 <- b1 <- ... is built and b0 makes a
+// directory tree, which the leaf fsnode works on, looking up through the
+// whole chain. "./bench scale" repeats the lookup, create and mix
+// workloads at growing thread counts, with threads pinned to CPUs, and
+// "./bench fleet" runs the VM-fleet workload of fleet.c.
+
+#define _GNU_SOURCE // for CPU affinity
+#include <sched.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+enum bench_op {
+  BENCH_LOOKUP = 0,
+  BENCH_READDIR,
+  BENCH_MKDIR,
+  BENCH_CREATE,
+  BENCH_UNLINK,
+  BENCH_MOVE,
+  BENCH_NUM_OPS
+};
+
+static const char *op_names[BENCH_NUM_OPS] = {
+  "lookup", "readdir", "mkdir", "create", "unlink", "move"
+};
+
+enum bench_workload {
+  WORK_MIX = BENCH_NUM_OPS // single ops take their bench_op values
+};
+
+struct bench_config {
+  int threads;
+  long ops; // per thread
+  int depth; // of the fsnode chain
+  int fanout; // dirs per dir
+  int levels; // of the dir tree
+  int workload;
+  int read_pct; // of the mix
+  int pin; // threads to CPUs
+};
+
+struct bench_thread {
+  pthread_t thread;
+  int id;
+  int cpu; // pinned to, or -1
+  unsigned int seed;
+  u64 seq; // of the names made
+  struct cinq_fsnode *spare; // moved by BENCH_MOVE
+  struct dentry **files; // created but not yet unlinked
+  long num_files;
+  struct bench_hist hist[BENCH_NUM_OPS];
+};
+
+static struct bench_config config = {
+  .threads = 4, .ops = 100000, .depth = 4, .fanout = 8, .levels = 3,
+  .workload = WORK_MIX, .read_pct = 90, .pin = 1
+};
+
+static struct dentry **dirs; // of the dir tree, as seen by the leaf fsnode
+static long num_dirs;
+static long num_inner_dirs; // those with children, which come first
+static struct cinq_fsnode *chain[2]; // the chain root and its child
+
+static struct dentry *mkdir_(struct dentry *parent, const char *name) {
+  struct dentry *dentry = bench_dentry_new(parent, name);
+  struct inode *dir = parent->d_inode;
+  if (dir->i_op->mkdir(dir, dentry, BENCH_DIR_MODE)) {
+    fprintf(stderr, "Failed to make dir %s.\n", name);
+    exit(-1);
+  }
+  return dentry;
+}
+
+// Makes the fsnode chain and b0's dir tree, then resolves the tree
+// for the leaf fsnode.
+static void setup_(struct dentry *meta) {
+  struct dentry *dentry, *root = NULL;
+  char name[MAX_NAME_LEN + 1];
+  long i, begin, end;
+  int l, f;
+
+  for (i = 0; i < config.depth; ++i) {
+    if (i) sprintf(name, "b%ld.b%ld", i - 1, i);
+    else sprintf(name, "META_FS.b0");
+    dentry = mkdir_(meta, name);
+    if (i == 0) root = dentry;
+    if (i < 2) chain[i] = dentry->d_fsdata;
+  }
+  if (!chain[1]) chain[1] = fsnode_new(chain[0], "bench_move");
+
+  num_dirs = 1;
+  for (l = 0, i = 1; l < config.levels; ++l) {
+    i *= config.fanout;
+    num_dirs += i;
+  }
+  num_inner_dirs = (num_dirs - 1) / config.fanout;
+  dirs = malloc(num_dirs * sizeof(struct dentry *));
+  struct dentry **made = malloc(num_dirs * sizeof(struct dentry *));
+  made[0] = root;
+  for (begin = 0, end = 1; end < num_dirs; begin = end, end = i) {
+    for (i = end, l = begin; l < end; ++l) {
+      for (f = 0; f < config.fanout; ++f) {
+        sprintf(name, "%d", f);
+        made[i++] = mkdir_(made[l], name);
+      }
+    }
+  }
+  free(made);
+
+  // Children follow their parents at the same positions as in made.
+  sprintf(name, "b%d", config.depth - 1);
+  dirs[0] = bench_lookup(meta, name);
+  for (l = 0, i = 1; l < num_inner_dirs; ++l) {
+    for (f = 0; f < config.fanout; ++f) {
+      sprintf(name, "%d", f);
+      dirs[i] = bench_lookup(dirs[l], name);
+      if (!dirs[i]->d_inode) {
+        fprintf(stderr, "Leaf fsnode fails to look up dir %ld.\n", i);
+        exit(-1);
+      }
+      ++i;
+    }
+  }
+}
+
+static inline void record_(struct bench_thread *t, enum bench_op op,
+                           u64 start, int err) {
+  bench_hist_add(&t->hist[op], start, err);
+}
+
+static void do_lookup_(struct bench_thread *t) {
+  const long parent = rand_r(&t->seed) % num_inner_dirs;
+  char name[16];
+  struct dentry *dentry;
+  struct inode *dir = dirs[parent]->d_inode;
+  u64 start;
+
+  sprintf(name, "%d", rand_r(&t->seed) % config.fanout);
+  dentry = bench_dentry_new(dirs[parent], name);
+  start = cinq_stat_clock();
+  dir->i_op->lookup(dir, dentry, NULL);
+  record_(t, BENCH_LOOKUP, start, !dentry->d_inode);
+  bench_dentry_free(dentry);
+}
+
+static void do_readdir_(struct bench_thread *t) {
+  struct dentry *dentry = dirs[rand_r(&t->seed) % num_dirs];
+  struct file *filp = dentry_open(dentry, NULL, 0, NULL);
+  long entries = 0;
+  u64 start = cinq_stat_clock();
+  int err = filp->f_op->readdir(filp, &entries, bench_filldir);
+  record_(t, BENCH_READDIR, start, err);
+  filp->f_op->release(NULL, filp);
+  put_filp(filp);
+}
+
+static void do_mkdir_(struct bench_thread *t) {
+  struct dentry *parent = dirs[rand_r(&t->seed) % num_dirs];
+  struct inode *dir = parent->d_inode;
+  char name[32];
+  struct dentry *dentry;
+  u64 start;
+
+  sprintf(name, "m%d.%llu", t->id, (unsigned long long)t->seq++);
+  dentry = bench_dentry_new(parent, name);
+  start = cinq_stat_clock();
+  record_(t, BENCH_MKDIR, start,
+          dir->i_op->mkdir(dir, dentry, BENCH_DIR_MODE));
+}
+
+static void do_create_(struct bench_thread *t) {
+  struct dentry *parent = dirs[rand_r(&t->seed) % num_dirs];
+  struct inode *dir = parent->d_inode;
+  char name[32];
+  struct dentry *dentry;
+  u64 start;
+  int err;
+
+  sprintf(name, "c%d.%llu", t->id, (unsigned long long)t->seq++);
+  dentry = bench_dentry_new(parent, name);
+  start = cinq_stat_clock();
+  err = dir->i_op->create(dir, dentry, BENCH_FILE_MODE, NULL);
+  record_(t, BENCH_CREATE, start, err);
+  if (err) bench_dentry_free(dentry);
+  else t->files[t->num_files++] = dentry;
+}
+
+static void do_unlink_(struct bench_thread *t) {
+  struct dentry *dentry = t->files[--t->num_files];
+  struct inode *dir = dentry->d_parent->d_inode;
+  u64 start = cinq_stat_clock();
+  record_(t, BENCH_UNLINK, start, dir->i_op->unlink(dir, dentry));
+  bench_dentry_free(dentry);
+}
+
+static void do_move_(struct bench_thread *t) {
+  struct cinq_fsnode *to =
+      t->spare->fs_parent == chain[0] ? chain[1] : chain[0];
+  u64 start = cinq_stat_clock();
+  fsnode_move(t->spare, to);
+  record_(t, BENCH_MOVE, start, t->spare->fs_parent != to);
+}
+
+static void do_mix_(struct bench_thread *t) {
+  if (rand_r(&t->seed) % 100 < config.read_pct) {
+    if (rand_r(&t->seed) % 10) do_lookup_(t);
+    else do_readdir_(t);
+  } else if (t->num_files && rand_r(&t->seed) % 2) {
+    do_unlink_(t);
+  } else {
+    do_create_(t);
+  }
+}
+
+static void *bench_run_(void *arg) {
+  struct bench_thread *t = arg;
+  cpu_set_t cpus;
+  long i;
+  if (t->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(t->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  for (i = 0; i < config.ops; ++i) {
+    switch (config.workload) {
+      case BENCH_LOOKUP: do_lookup_(t); break;
+      case BENCH_READDIR: do_readdir_(t); break;
+      case BENCH_MKDIR: do_mkdir_(t); break;
+      case BENCH_CREATE: do_create_(t); break;
+      case BENCH_UNLINK: do_unlink_(t); break;
+      case BENCH_MOVE: do_move_(t); break;
+      default: do_mix_(t); break;
+    }
+  }
+  return NULL;
+}
+
+static void bench_prepare_(struct bench_thread *t) {
+  char name[32];
+  t->seed = t->id * 7919 + 1;
+  t->files = malloc(config.ops * sizeof(struct dentry *));
+  if (config.workload == BENCH_MOVE) {
+    sprintf(name, "bench_spare%d", t->id);
+    t->spare = fsnode_new(chain[0], name);
+  } else if (config.workload == BENCH_UNLINK) { // files to unlink
+    while (t->num_files < config.ops) do_create_(t);
+    memset(t->hist, 0, sizeof(t->hist));
+  }
+}
+
+static u64 total_ops_(struct bench_thread *threads) {
+  u64 ops = 0;
+  int op, i;
+  for (i = 0; i < config.threads; ++i) {
+    for (op = 0; op < BENCH_NUM_OPS; ++op) ops += threads[i].hist[op].count;
+  }
+  return ops;
+}
+
+static void report_(struct bench_thread *threads, double secs) {
+  struct bench_hist hist, total = { 0 };
+  int op, i;
+
+  bench_report_head();
+  for (op = 0; op < BENCH_NUM_OPS; ++op) {
+    memset(&hist, 0, sizeof(hist));
+    for (i = 0; i < config.threads; ++i) {
+      bench_hist_merge(&hist, &threads[i].hist[op]);
+    }
+    if (!hist.count) continue;
+    bench_report_row(op_names[op], &hist, secs);
+    bench_hist_merge(&total, &hist);
+  }
+  bench_report_row("total", &total, secs);
+}
+
+// Thread i is pinned to the i-th CPU the process may run on, wrapping
+// around when there are more threads than CPUs.
+static void pin_threads_(struct bench_thread *threads) {
+  cpu_set_t allowed;
+  int cpus[CPU_SETSIZE];
+  int num_cpus = 0, c, i;
+
+  if (!config.pin || sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    for (i = 0; i < config.threads; ++i) threads[i].cpu = -1;
+    return;
+  }
+  for (c = 0; c < CPU_SETSIZE; ++c) {
+    if (CPU_ISSET(c, &allowed)) cpus[num_cpus++] = c;
+  }
+  for (i = 0; i < config.threads; ++i) {
+    threads[i].cpu = num_cpus ? cpus[i % num_cpus] : -1;
+  }
+}
+
+// Runs config.threads threads of config.workload and returns the seconds
+// they take, excluding setup.
+static double run_(struct bench_thread *threads) {
+  u64 start;
+  int i;
+
+  memset(threads, 0, config.threads * sizeof(struct bench_thread));
+  for (i = 0; i < config.threads; ++i) {
+    threads[i].id = i;
+    bench_prepare_(&threads[i]);
+  }
+  pin_threads_(threads);
+  start = cinq_stat_clock();
+  for (i = 0; i < config.threads; ++i) {
+    pthread_create(&threads[i].thread, NULL, bench_run_, &threads[i]);
+  }
+  for (i = 0; i < config.threads; ++i) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  return (cinq_stat_clock() - start) / 1e9;
+}
+
+// Unlinks the files left by a run, so that later runs see the same tree.
+static void cleanup_(struct bench_thread *threads) {
+  int i;
+  for (i = 0; i < config.threads; ++i) {
+    while (threads[i].num_files) do_unlink_(&threads[i]);
+    free(threads[i].files);
+  }
+}
+
+// Thread counts of the scaling runs: powers of 2 up to the maximum,
+// which is always included.
+static int next_threads_(int threads, int max) {
+  return threads * 2 < max ? threads * 2 : (threads < max ? max : 0);
+}
+
+static void scale_(int max_threads) {
+  static const int workloads[] = { BENCH_LOOKUP, BENCH_CREATE, WORK_MIX };
+  const int num_workloads = sizeof(workloads) / sizeof(workloads[0]);
+  struct bench_thread *threads =
+      calloc(max_threads, sizeof(struct bench_thread));
+  double secs, tput, base, best;
+  const char *name;
+  int w, n, best_n;
+
+  fprintf(stdout, "%-8s %8s %12s %8s %6s\n", "workload", "threads",
+          "ops/s", "speedup", "eff%");
+  for (w = 0; w < num_workloads; ++w) {
+    config.workload = workloads[w];
+    name = config.workload == WORK_MIX ? "mix" : op_names[config.workload];
+    base = best = 0;
+    best_n = 1;
+    for (n = 1; n; n = next_threads_(n, max_threads)) {
+      config.threads = n;
+      secs = run_(threads);
+      tput = total_ops_(threads) / secs;
+      cleanup_(threads);
+      if (n == 1) base = tput;
+      fprintf(stdout, "%-8s %8d %12.0f %8.2f %6.0f", name, n, tput,
+              tput / base, tput / base / n * 100);
+      // Throughput falling below that at fewer threads means the locks
+      // cost more than the added cores bring.
+      if (tput < best * 0.9) fprintf(stdout, "  <- collapse");
+      else if (n > 1 && tput / base / n < 0.5) fprintf(stdout, "  <- poor");
+      fprintf(stdout, "\n");
+      if (tput > best) {
+        best = tput;
+        best_n = n;
+      }
+    }
+    fprintf(stdout, "%-8s peaks at %d threads\n\n", name, best_n);
+  }
+  free(threads);
+}
+
+static void usage_(void) {
+  fprintf(stdout, "Usage: ./bench [-t threads] [-n ops per thread] "
+          "[-d fsnode depth] [-f fanout] [-l levels]\n"
+          "               [-w lookup|readdir|mkdir|create|unlink|move|mix] "
+          "[-r read %% of mix] [-p pin 0|1]\n"
+          "       ./bench scale [-t max threads] [options above but -w]\n"
+          "       ./bench fleet -h\n");
+}
+
+static int parse_workload_(const char *name) {
+  int op;
+  if (!strcmp(name, "mix")) return WORK_MIX;
+  for (op = 0; op < BENCH_NUM_OPS; ++op) {
+    if (!strcmp(name, op_names[op])) return op;
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_thread *threads;
+  struct dentry *meta;
+  double secs;
+  int opt, scale = 0;
+
+  if (argc > 1 && !strcmp(argv[1], "fleet")) {
+    return fleet_main(argc - 1, argv + 1);
+  }
+  if (argc > 1 && !strcmp(argv[1], "scale")) {
+    scale = 1;
+    --argc;
+    ++argv;
+  }
+  while ((opt = getopt(argc, argv, "t:n:d:f:l:w:r:p:h")) != -1) {
+    switch (opt) {
+      case 't': config.threads = atoi(optarg); break;
+      case 'n': config.ops = atol(optarg); break;
+      case 'd': config.depth = atoi(optarg); break;
+      case 'f': config.fanout = atoi(optarg); break;
+      case 'l': config.levels = atoi(optarg); break;
+      case 'w': config.workload = parse_workload_(optarg); break;
+      case 'r': config.read_pct = atoi(optarg); break;
+      case 'p': config.pin = atoi(optarg); break;
+      default: usage_(); return -1;
+    }
+  }
+  if (config.threads < 1 || config.ops < 1 || config.depth < 1 ||
+      config.fanout < 1 || config.levels < 1 || config.workload < 0) {
+    usage_();
+    return -1;
+  }
+
+  meta = cinqfs.mount((struct file_system_type *)&cinqfs, 0, NULL, NULL);
+  setup_(meta);
+  fprintf(stdout, "%s%d threads x %ld ops, fsnode depth %d, "
+          "%ld dirs (fanout %d, %d levels), read %d%%\n",
+          scale ? "up to " : "", config.threads, config.ops, config.depth,
+          num_dirs, config.fanout, config.levels, config.read_pct);
+  fprintf(stdout, "%zu bytes per entry and its name (cnode %zu, tag %zu), "
+          "plus %zu for an inode in core\n",
+          sizeof(struct cinq_inode) + sizeof(struct cinq_tag),
+          sizeof(struct cinq_inode), sizeof(struct cinq_tag),
+          sizeof(struct inode));
+  if (scale) {
+    scale_(config.threads);
+    return 0;
+  }
+
+  threads = calloc(config.threads, sizeof(struct bench_thread));
+  secs = run_(threads);
+  report_(threads, secs);
+  return 0;
+}
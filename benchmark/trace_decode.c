@@ -0,0 +1,112 @@
+// Decodes a binary trace saved by cinq_trace_save(), e.g. from
+// /proc/fs/cinqfs_trace, into one line per event in time order,
+// or into a per-op summary with -s.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../trace.h"
+
+static const char *op_names[] = CINQ_TRACE_OP_NAMES;
+
+static int by_time(const void *a, const void *b) {
+  const struct cinq_trace_rec *x = a, *y = b;
+  if (x->tr_time != y->tr_time) return x->tr_time < y->tr_time ? -1 : 1;
+  return (int)x->tr_thread - (int)y->tr_thread;
+}
+
+static const char *op_name(unsigned int op) {
+  return op < CINQ_TRACE_NUM_OPS ? op_names[op] : "?";
+}
+
+static void print_events(struct cinq_trace_rec *recs, long n) {
+  long i;
+  printf("%14s %6s %-8s %10s %10s %12s %10s\n", "time_us", "thread", "op",
+         "cnode", "fs", "latency_ns", "result");
+  for (i = 0; i < n; ++i) {
+    printf("%14.3f %6u %-8s %10llu %10u %12u %10d\n",
+           (recs[i].tr_time - recs[0].tr_time) / 1000.0, recs[i].tr_thread,
+           op_name(recs[i].tr_op), (unsigned long long)recs[i].tr_cnode,
+           recs[i].tr_fs, recs[i].tr_latency, recs[i].tr_result);
+  }
+}
+
+static void print_summary(struct cinq_trace_rec *recs, long n) {
+  unsigned long long count[CINQ_TRACE_NUM_OPS] = { 0 };
+  unsigned long long errors[CINQ_TRACE_NUM_OPS] = { 0 };
+  unsigned long long total[CINQ_TRACE_NUM_OPS] = { 0 };
+  unsigned int max[CINQ_TRACE_NUM_OPS] = { 0 };
+  long i;
+  int op;
+
+  for (i = 0; i < n; ++i) {
+    op = recs[i].tr_op;
+    if (op >= CINQ_TRACE_NUM_OPS) continue;
+    ++count[op];
+    if (recs[i].tr_result < 0) ++errors[op];
+    total[op] += recs[i].tr_latency;
+    if (recs[i].tr_latency > max[op]) max[op] = recs[i].tr_latency;
+  }
+  printf("%-8s %10s %8s %12s %12s\n", "op", "count", "errors", "avg_ns",
+         "max_ns");
+  for (op = 0; op < CINQ_TRACE_NUM_OPS; ++op) {
+    if (!count[op]) continue;
+    printf("%-8s %10llu %8llu %12llu %12u\n", op_names[op], count[op],
+           errors[op], total[op] / count[op], max[op]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct cinq_trace_header header;
+  struct cinq_trace_rec *recs = NULL;
+  long n = 0, cap = 0;
+  int summary = 0;
+  FILE *in;
+
+  if (argc > 1 && !strcmp(argv[1], "-s")) {
+    summary = 1;
+    --argc;
+    ++argv;
+  }
+  if (argc != 2) {
+    fprintf(stdout, "Usage: ./trace_decode [-s] [trace file]\n");
+    return -1;
+  }
+  in = fopen(argv[1], "rb");
+  if (!in) {
+    fprintf(stderr, "Failed to open %s.\n", argv[1]);
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      header.th_magic != CINQ_TRACE_MAGIC) {
+    fprintf(stderr, "Not a cinquain trace: %s.\n", argv[1]);
+    return -1;
+  }
+  if (header.th_version != CINQ_TRACE_VERSION ||
+      header.th_rec_size != sizeof(struct cinq_trace_rec)) {
+    fprintf(stderr, "Unsupported trace version %u with %u-byte records.\n",
+            header.th_version, header.th_rec_size);
+    return -1;
+  }
+
+  for (;;) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 4096;
+      recs = realloc(recs, cap * sizeof(struct cinq_trace_rec));
+      if (!recs) {
+        fprintf(stderr, "Out of memory at %ld records.\n", n);
+        return -1;
+      }
+    }
+    n += fread(recs + n, sizeof(struct cinq_trace_rec), cap - n, in);
+    if (n < cap) break;
+  }
+  fclose(in);
+
+  qsort(recs, n, sizeof(struct cinq_trace_rec), by_time);
+  if (summary) print_summary(recs, n);
+  else print_events(recs, n);
+  free(recs);
+  return 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  chunk.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "chunk.h"
+
+#ifdef __KERNEL__
+
+#include <crypto/hash.h>
+#include <crypto/sha.h>
+
+#define refs_malloc_(n) ((struct cinq_chunk_ref *)kmalloc( \
+    (n) * sizeof(struct cinq_chunk_ref), GFP_KERNEL))
+#define refs_realloc_(p, n) ((struct cinq_chunk_ref *)krealloc(p, \
+    (n) * sizeof(struct cinq_chunk_ref), GFP_KERNEL))
+#define refs_free_(p) (kfree(p))
+
+#else
+
+#define refs_malloc_(n) \
+    ((struct cinq_chunk_ref *)malloc((n) * sizeof(struct cinq_chunk_ref)))
+#define refs_realloc_(p, n) \
+    ((struct cinq_chunk_ref *)realloc(p, (n) * sizeof(struct cinq_chunk_ref)))
+#define refs_free_(p) (free(p))
+
+#define SHA256_DIGEST_SIZE 32
+
+#endif // __KERNEL__
+
+static u64 gear_[256];
+
+// The table is fixed across mounts and hosts so that the same content
+// is always cut at the same places.
+static void gear_init_(void) {
+  u64 x = 0x3122;
+  int i;
+  for (i = 0; i < 256; ++i) { // splitmix64
+    u64 z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    gear_[i] = z ^ (z >> 31);
+  }
+}
+
+size_t chunk_cut(const char *buf, size_t len, size_t prev, u64 *hash) {
+  const unsigned char *p = (const unsigned char *)buf;
+  u64 h = *hash;
+  size_t i = 0;
+
+  if (prev + len >= CHUNK_MAX_SIZE) { // cut at the maximum size at the latest
+    *hash = 0;
+    len = CHUNK_MAX_SIZE - prev;
+  }
+  if (prev < CHUNK_MIN_SIZE) { // no boundary within the minimum size
+    i = CHUNK_MIN_SIZE - prev < len ? CHUNK_MIN_SIZE - prev : len;
+  }
+  for (; i < len; ++i) {
+    h = (h << 1) + gear_[p[i]];
+    if (!(h >> (64 - CHUNK_AVG_BITS))) {
+      *hash = 0;
+      return i + 1;
+    }
+  }
+  if (prev + len == CHUNK_MAX_SIZE) return len;
+  *hash = h;
+  return 0;
+}
+
+/* Chunk fingerprints are SHA-256 digests, taken through the crypto API in
+ * the kernel and by the implementation below in user space. */
+
+#ifdef __KERNEL__
+
+static struct crypto_shash *sha256_tfm_;
+
+int chunk_init(void) {
+  gear_init_();
+  if (sha256_tfm_) return 0;
+  sha256_tfm_ = crypto_alloc_shash("sha256", 0, 0);
+  if (IS_ERR(sha256_tfm_)) {
+    int err = PTR_ERR(sha256_tfm_);
+    sha256_tfm_ = NULL;
+    return err;
+  }
+  return 0;
+}
+
+void chunk_exit(void) {
+  if (sha256_tfm_) crypto_free_shash(sha256_tfm_);
+  sha256_tfm_ = NULL;
+}
+
+static void sha256_digest_(const char *buf, size_t len,
+                           unsigned char digest[SHA256_DIGEST_SIZE]) {
+  struct {
+    struct shash_desc shash;
+    char ctx[crypto_shash_descsize(sha256_tfm_)];
+  } desc;
+  desc.shash.tfm = sha256_tfm_;
+  desc.shash.flags = 0;
+  crypto_shash_digest(&desc.shash, buf, len, digest);
+}
+
+#else
+
+#define SHA256_ROR_(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const u32 sha256_k_[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+int chunk_init(void) {
+  gear_init_();
+  return 0;
+}
+
+void chunk_exit(void) {
+}
+
+static void sha256_block_(u32 state[8], const unsigned char *p) {
+  u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+  for (i = 0; i < 16; ++i) {
+    w[i] = ((u32)p[i * 4] << 24) | (p[i * 4 + 1] << 16) |
+        (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+  }
+  for (; i < 64; ++i) {
+    w[i] = w[i - 16] + w[i - 7] +
+        (SHA256_ROR_(w[i - 15], 7) ^ SHA256_ROR_(w[i - 15], 18) ^
+         (w[i - 15] >> 3)) +
+        (SHA256_ROR_(w[i - 2], 17) ^ SHA256_ROR_(w[i - 2], 19) ^
+         (w[i - 2] >> 10));
+  }
+  a = state[0]; b = state[1]; c = state[2]; d = state[3];
+  e = state[4]; f = state[5]; g = state[6]; h = state[7];
+  for (i = 0; i < 64; ++i) {
+    t1 = h + (SHA256_ROR_(e, 6) ^ SHA256_ROR_(e, 11) ^ SHA256_ROR_(e, 25)) +
+        (g ^ (e & (f ^ g))) + sha256_k_[i] + w[i];
+    t2 = (SHA256_ROR_(a, 2) ^ SHA256_ROR_(a, 13) ^ SHA256_ROR_(a, 22)) +
+        ((a & b) | (c & (a | b)));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_digest_(const char *buf, size_t len,
+                           unsigned char digest[SHA256_DIGEST_SIZE]) {
+  u32 state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  unsigned char tail[128];
+  const u64 bits = (u64)len << 3;
+  size_t n = len & ~(size_t)63, rest = len - n, pad;
+  size_t i;
+
+  for (i = 0; i < n; i += 64) {
+    sha256_block_(state, (const unsigned char *)buf + i);
+  }
+  memcpy(tail, buf + n, rest);
+  tail[rest] = 0x80;
+  pad = rest < 56 ? 64 : 128;
+  memset(tail + rest + 1, 0, pad - rest - 1);
+  for (i = 0; i < 8; ++i) {
+    tail[pad - 1 - i] = (unsigned char)(bits >> (i * 8));
+  }
+  sha256_block_(state, tail);
+  if (pad == 128) sha256_block_(state, tail + 64);
+
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+    digest[i] = (unsigned char)(state[i >> 2] >> ((3 - (i & 3)) * 8));
+  }
+}
+
+#endif // __KERNEL__
+
+// The cache key holds FILE_HASH_WIDTH bytes, so the digest is truncated.
+void chunk_fingerprint(const char *buf, size_t len,
+                       unsigned char value[FILE_HASH_WIDTH]) {
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  sha256_digest_(buf, len, digest);
+  memcpy(value, digest, FILE_HASH_WIDTH);
+}
+
+void chunk_map_init(struct cinq_chunk_map *map) {
+  rwlock_init(&map->cm_lock);
+  map->cm_num = 0;
+  map->cm_max = 0;
+  map->cm_refs = NULL;
+}
+
+void chunk_map_destroy(struct cinq_chunk_map *map) {
+  refs_free_(map->cm_refs);
+  map->cm_refs = NULL;
+  map->cm_num = map->cm_max = 0;
+}
+
+static inline loff_t ref_end_(const struct cinq_chunk_ref *ref) {
+  return ref->cr_off + ref->cr_len;
+}
+
+// Index of the first ref ending after @pos. Called with cm_lock held.
+static int chunk_map_search_(struct cinq_chunk_map *map, loff_t pos) {
+  int lo = 0, hi = map->cm_num, mid;
+  while (lo < hi) {
+    mid = (lo + hi) >> 1;
+    if (ref_end_(&map->cm_refs[mid]) <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Replaces whatever is mapped in [start, end) with @refs, which lie
+// within the range. Refs straddling either end are trimmed.
+static int chunk_map_replace_(struct cinq_chunk_map *map,
+                              loff_t start, loff_t end,
+                              const struct cinq_chunk_ref *refs, int n) {
+  struct cinq_chunk_ref left, right, *grown;
+  int i, j, has_left, has_right, num;
+
+  write_lock(&map->cm_lock);
+  i = chunk_map_search_(map, start);
+  for (j = i; j < map->cm_num && map->cm_refs[j].cr_off < end; ++j);
+
+  has_left = i < j && map->cm_refs[i].cr_off < start;
+  if (has_left) {
+    left = map->cm_refs[i];
+    left.cr_len = start - left.cr_off;
+  }
+  has_right = i < j && ref_end_(&map->cm_refs[j - 1]) > end;
+  if (has_right) {
+    right = map->cm_refs[j - 1];
+    right.cr_skip += end - right.cr_off;
+    right.cr_len = ref_end_(&right) - end;
+    right.cr_off = end;
+  }
+
+  num = map->cm_num - (j - i) + has_left + n + has_right;
+  if (num > map->cm_max) {
+    int max = map->cm_max ? map->cm_max : 8;
+    while (max < num) max <<= 1;
+    grown = refs_realloc_(map->cm_refs, max);
+    if (unlikely(!grown)) wr_release_return(&map->cm_lock, -ENOMEM);
+    map->cm_refs = grown;
+    map->cm_max = max;
+  }
+  memmove(map->cm_refs + i + has_left + n + has_right, map->cm_refs + j,
+          (map->cm_num - j) * sizeof(struct cinq_chunk_ref));
+  if (has_left) map->cm_refs[i++] = left;
+  if (n) memcpy(map->cm_refs + i, refs, n * sizeof(struct cinq_chunk_ref));
+  if (has_right) map->cm_refs[i + n] = right;
+  map->cm_num = num;
+  write_unlock(&map->cm_lock);
+  return 0;
+}
+
+int chunk_map_set(struct cinq_chunk_map *map,
+                  const struct cinq_chunk_ref *refs, int n) {
+  return chunk_map_replace_(map, refs[0].cr_off, ref_end_(&refs[n - 1]),
+                            refs, n);
+}
+
+int chunk_map_punch(struct cinq_chunk_map *map, loff_t start, loff_t end) {
+  if (start >= end) return 0;
+  return chunk_map_replace_(map, start, end, NULL, 0);
+}
+
+int chunk_map_get(struct cinq_chunk_map *map, loff_t pos, loff_t end,
+                  struct cinq_chunk_ref **refs_p) {
+  struct cinq_chunk_ref *refs, *ref;
+  int i, j, n;
+
+  read_lock(&map->cm_lock);
+  i = chunk_map_search_(map, pos);
+  for (j = i; j < map->cm_num && map->cm_refs[j].cr_off < end; ++j);
+  n = j - i;
+  if (!n) {
+    *refs_p = NULL;
+    rd_release_return(&map->cm_lock, 0);
+  }
+  refs = refs_malloc_(n);
+  if (unlikely(!refs)) rd_release_return(&map->cm_lock, -ENOMEM);
+  memcpy(refs, map->cm_refs + i, n * sizeof(struct cinq_chunk_ref));
+  read_unlock(&map->cm_lock);
+
+  if (refs[0].cr_off < pos) {
+    ref = &refs[0];
+    ref->cr_skip += pos - ref->cr_off;
+    ref->cr_len -= pos - ref->cr_off;
+    ref->cr_off = pos;
+  }
+  if (ref_end_(&refs[n - 1]) > end) {
+    ref = &refs[n - 1];
+    ref->cr_len = end - ref->cr_off;
+  }
+  *refs_p = refs;
+  return n;
+}
+
+void chunk_refs_free(struct cinq_chunk_ref *refs) {
+  refs_free_(refs);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  chunk.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_CHUNK_H_
+#define CINQUAIN_META_CHUNK_H_
+
+#include "util.h"
+
+/* Content-defined chunking and per-file chunk maps for deduplication */
+
+// Boundaries are cut where a gear hash of the recent bytes has its top
+// CHUNK_AVG_BITS bits cleared, so identical content yields identical
+// chunks regardless of its offset in the file.
+#define CHUNK_MIN_SIZE (2 * 1024)
+#define CHUNK_AVG_BITS 13 // 8KB on average
+#define CHUNK_MAX_SIZE (64 * 1024)
+
+// A range of the file backed by a part of a chunk.
+struct cinq_chunk_ref {
+  loff_t cr_off; // file offset
+  __u32 cr_len;
+  __u32 cr_skip; // offset of the range in the chunk
+  unsigned char cr_fp[FILE_HASH_WIDTH]; // SHA-256 of the whole chunk
+};
+
+// Refs are sorted by file offset and never overlap.
+// Ranges not covered by any ref read as zeros.
+struct cinq_chunk_map {
+  rwlock_t cm_lock;
+  int cm_num;
+  int cm_max;
+  struct cinq_chunk_ref *cm_refs;
+};
+
+// Fills the gear table and sets up fingerprinting.
+// Called before any chunking; returns a negative error code on failure.
+extern int chunk_init(void);
+extern void chunk_exit(void);
+
+// Scans @len bytes of @buf that follow @prev bytes of the current chunk.
+// Returns the number of bytes up to and including the boundary,
+// or 0 if the chunk does not end within @buf.
+// @hash: rolling state of the current chunk, zero at its start.
+extern size_t chunk_cut(const char *buf, size_t len, size_t prev, u64 *hash);
+
+// Takes the SHA-256 digest of a chunk, truncated to the cache key width.
+extern void chunk_fingerprint(const char *buf, size_t len,
+                              unsigned char value[FILE_HASH_WIDTH]);
+
+extern void chunk_map_init(struct cinq_chunk_map *map);
+extern void chunk_map_destroy(struct cinq_chunk_map *map);
+
+// Maps the contiguous range covered by @refs onto them,
+// replacing or trimming whatever was mapped there before.
+extern int chunk_map_set(struct cinq_chunk_map *map,
+                         const struct cinq_chunk_ref *refs, int n);
+
+// Drops whatever is mapped in [start, end), leaving a hole.
+extern int chunk_map_punch(struct cinq_chunk_map *map,
+                           loff_t start, loff_t end);
+
+// Gets copies of refs overlapping [pos, end), trimmed to the range.
+// Returns the number of refs and the array in @refs_p to be freed by
+// chunk_refs_free(), or a negative error code.
+extern int chunk_map_get(struct cinq_chunk_map *map, loff_t pos, loff_t end,
+                         struct cinq_chunk_ref **refs_p);
+extern void chunk_refs_free(struct cinq_chunk_ref *refs);
+
+#endif // CINQUAIN_META_CHUNK_H_
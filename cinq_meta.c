@@ -64,8 +64,12 @@ const struct inode_operations cinq_symlink_inode_operations = {
 const struct file_operations cinq_file_operations = {
   .read     = cinq_file_read,
   .write		= cinq_file_write,
+#ifdef __KERNEL__
+  .aio_write = cinq_file_aio_write,
+#endif
   .fsync    = noop_fsync,
-  .llseek   = generic_file_llseek
+  .llseek   = cinq_file_llseek,
+  .fallocate = cinq_file_fallocate
 };
 
 // Refers to fs/libfs.c. Also used by ramfs.
@@ -80,15 +84,15 @@ const struct file_operations cinq_dir_operations = {
 };
 
 const struct export_operations cinq_export_operations = {
-#ifdef __KERNEL__
 	.get_parent     = cinq_get_parent,
+	.get_name       = cinq_get_name,
 	.encode_fh      = cinq_encode_fh,
 	.fh_to_dentry   = cinq_fh_to_dentry,
-#endif
+	.fh_to_parent   = cinq_fh_to_parent,
 };
 
 struct backing_dev_info cinq_backing_dev_info  __read_mostly = {
-	.ra_pages	= 0,	/* No readahead */
+	.ra_pages	= 0,	/* cinq_file_ra() reads ahead instead */
 	.capabilities	= BDI_CAP_NO_ACCT_AND_WRITEBACK | BDI_CAP_SWAP_BACKED,
 #ifdef __OLD_KERNEL__
   .unplug_io_fn	= default_unplug_io_fn,
@@ -106,9 +110,6 @@ static int __init init_cinq_fs(void) {
   err = bdi_init(&cinq_backing_dev_info);
 	if (err) goto destroy_bdi;
 
-  err = init_cnode_cache();
-  if (err) goto free_cnode;
-
   err = init_tag_cache();
   if (err) goto free_tag;
 
@@ -127,9 +128,30 @@ static int __init init_cinq_fs(void) {
   err = register_filesystem(&cinqfs);
   if (err) goto unregister;
 
+  err = cinq_trace_init();
+  if (err) goto free_hash;
+#ifdef CINQ_STATS
+  err = cinq_stats_proc_init();
+  if (err) goto trace_exit;
+#endif
+#ifdef CINQ_LOCK_PROF
+  err = lockprof_proc_init();
+  if (err) goto stats_exit;
+#endif
+
   DEBUG_("sinqfs: loaded successfully.");
   return 0;
 
+#ifdef CINQ_LOCK_PROF
+stats_exit:
+#endif
+#ifdef CINQ_STATS
+  cinq_stats_proc_exit();
+trace_exit:
+#endif
+#if defined(CINQ_STATS) || defined(CINQ_LOCK_PROF)
+  cinq_trace_exit();
+#endif
 free_hash:
   destroy_UT_hash_table_cache();
 free_jentry:
@@ -140,8 +162,6 @@ free_inode:
   destroy_inode_cache();
 free_tag:
   destroy_tag_cache();
-free_cnode:
-  destroy_cnode_cache();
 unregister:
   unregister_filesystem(&cinqfs);
 destroy_bdi:
@@ -150,8 +170,14 @@ destroy_bdi:
 }
 
 static void __exit exit_cinq_fs(void) {
+  cinq_trace_exit();
+#ifdef CINQ_STATS
+  cinq_stats_proc_exit();
+#endif
+#ifdef CINQ_LOCK_PROF
+  lockprof_proc_exit();
+#endif
   bdi_destroy(&cinq_backing_dev_info);
-  destroy_cnode_cache();
   destroy_fsnode_cache();
   destroy_jentry_cache();
   destroy_UT_hash_table_cache();
@@ -15,6 +15,11 @@
 
 #include "vfs.h"
 #include "journal.h"
+#include "idtable.h"
+#include "chunk.h"
+#include "rangelock.h"
+#include "extent.h"
+#include "trace.h"
 
 /* Cinquain File System Data Structures and Operations */
 
@@ -24,6 +29,14 @@ struct cinq_fsnode {
   struct cinq_fsnode *fs_parent;
   struct dentry *fs_root;
   spinlock_t lock; // used for fs holders
+
+  struct list_head fs_tags; // own tags in the order made, for diffs
+  spinlock_t fs_tags_lock;
+  atomic_t fs_spilled; // own tags out in the tier file
+
+  struct cinq_fsnode *fs_live; // that took over, if frozen by a snapshot
+  struct rw_semaphore fs_snap_sem; // read by changes, written by snapshots
+  int fs_readonly; // a snapshot
   
   // Using hash table to store children
   struct cinq_fsnode *fs_children;
@@ -37,6 +50,28 @@ static inline int fsnode_is_root(const struct cinq_fsnode *fsnode) {
   return fsnode->fs_parent == NULL;
 }
 
+// Returns the view that takes requests made through @fs, which is @fs
+// itself unless a snapshot has frozen it.
+static inline struct cinq_fsnode *fsnode_live(struct cinq_fsnode *fs) {
+  while (unlikely(fs && fs != META_FS && fs->fs_live)) fs = fs->fs_live;
+  return fs;
+}
+
+// Returns the view of @dentry, moving the dentry over to the live one
+// first if its own has been frozen since it was made.
+static inline struct cinq_fsnode *dentry_fs(struct dentry *dentry) {
+  struct cinq_fsnode *fs = dentry->d_fsdata;
+  if (unlikely(fs && fs != META_FS && fs->fs_live)) {
+    dentry->d_fsdata = fs = fsnode_live(fs);
+  }
+  return fs;
+}
+
+// IDT_NONE for META_FS or no fsnode.
+static inline unsigned long fsnode_id(const struct cinq_fsnode *fsnode) {
+  return fsnode && fsnode != META_FS ? fsnode->fs_id : IDT_NONE;
+}
+
 /* fsnode.c */
 
 // Creates a fsnode.
@@ -56,6 +91,18 @@ extern void fsnode_move(struct cinq_fsnode *child,
 // Removes the fsnode and connect its single child to its parent
 extern void fsnode_bridge(struct cinq_fsnode *out);
 
+// Snapshots @fs in O(1). Its tags stay where they are, so @fs itself is
+// frozen as a base out of the name table, under which two empty views
+// are made: the snapshot named @name, read-only, and the view that takes
+// over the name, the root dentry and the requests of @fs, including those
+// through dentries and file handles got before. Changes in flight
+// through @fs are waited for, so each lands on one side. Child views of
+// @fs stay with the frozen state. An inode the live view shares with the
+// snapshot is copied up on its first change; see cinq_change_get().
+// Returns the snapshot, or ERR_PTR.
+extern struct cinq_fsnode *fsnode_snapshot(struct cinq_fsnode *fs,
+                                           const char *name);
+
 enum cinq_visibility {
   CINQ_VISIBLE = 0,
   CINQ_INVISIBLE = 1
@@ -115,16 +162,58 @@ static inline void cfs_rm_syn(struct cinq_file_systems *cfs,
 
 struct cinq_inode;
 
+// Data-side state of a regular file
+struct cinq_fdata {
+  struct cinq_range_tree fd_ranges; // held by writers and truncation
+  struct cinq_extent_map fd_extents; // written ranges
+  spinlock_t fd_ra_lock;
+  struct cinq_read_set *fd_ra[2]; // windows read ahead, newest first
+  unsigned int fd_ra_gen; // bumped whenever the windows are dropped
+#ifdef CINQ_DEDUP
+  struct cinq_chunk_map fd_chunks;
+#else
+  struct cinq_tag *fd_origin; // frozen inode copied up from, held, or NULL
+  struct cinq_extent_map fd_own; // of fd_extents, what was written since
+                                 // the copy-up; the rest is the origin's
+#endif
+};
+
+// Attributes of an inode, kept in its tag while no VFS inode is in core.
+// Packed to 64 bytes, against 80 in struct timespec and dev_t fields
+// and several hundred in a struct inode. Seconds are signed, as in
+// struct timespec, so times before 1970 are kept.
+struct cinq_attr {
+  union {
+    loff_t a_size;
+    u32 a_rdev; // of special files, which have no size
+  };
+  s64 a_atime, a_mtime, a_ctime; // seconds
+  u32 a_atime_ns, a_mtime_ns, a_ctime_ns;
+  uid_t a_uid;
+  gid_t a_gid;
+  u32 a_nlink;
+  u16 a_mode;
+};
+
+/* A tag names its cnode in a file system view. The inode it refers to is
+ * identified by the tag t_ino, which is the tag itself unless the name was
+ * made by link or rename. The VFS inode of that tag is a cache object:
+ * it holds no reference from the tag, so it is evicted with its last
+ * dentry and rebuilt from t_attr by cinq_iget(). */
 struct cinq_tag {
   struct cinq_fsnode *t_fs; // key for hh
   struct cinq_inode *t_host; // who holds the hash table this tag belongs to
-  struct inode *t_inode; // whose i_no points to this tag
+  struct cinq_tag *t_ino; // whose inode this name refers to, NULL if negative
+  struct inode *t_inode; // in core with i_ino pointing to this tag, or NULL
+  struct cinq_attr t_attr; // saved on eviction of t_inode
 
   atomic_t t_nchild;
   atomic_t t_count;
+  atomic_t t_nref; // other tags whose t_ino is this one
   enum cinq_visibility t_mode;
-  unsigned char t_file_handle[FILE_HASH_WIDTH];
   char *t_symname;
+  struct cinq_fdata *t_data; // made on the first write to a regular file
+  struct list_head t_fs_tags; // in fs_tags of t_fs
 
   UT_hash_handle hh; // default handle name
 };
@@ -138,14 +227,12 @@ static inline struct cinq_fsnode *i_fs(const struct inode *inode) {
 }
 
 static inline int negative(const struct cinq_tag *tag) {
-  return tag->t_inode == NULL;
+  return tag->t_ino == NULL;
 }
 
-static inline struct inode *cinq_iget(struct super_block *sb,
-                                      unsigned long int ino) {
-  struct cinq_tag *tag = (struct cinq_tag *)ino;
-  return tag->t_inode;
-}
+// Gets a referenced inode of the tag at @ino, building it from the
+// attributes in the tag if none is in core. Returns NULL without memory.
+extern struct inode *cinq_iget(struct super_block *sb, unsigned long ino);
 
 static inline int impenetrable(const struct cinq_tag *tag,
                                const struct cinq_fsnode *req_fs) {
@@ -155,18 +242,89 @@ static inline int impenetrable(const struct cinq_tag *tag,
 
 struct cinq_inode {
   unsigned long ci_id;
-  char ci_name[MAX_NAME_LEN + 1];
 
   struct cinq_tag *ci_tags; // hash table of tags
   rwlock_t ci_tags_lock;
   
   struct cinq_inode *ci_parent;
   struct cinq_inode *ci_children; // hash table of children
+  struct cinq_dirindex *ci_index; // sorted children instead, if many
   UT_hash_handle ci_child;
   rwlock_t ci_children_lock;
   atomic_t ci_count;
+  u32 ci_atime; // seconds of the last lookup, kept only when tiering
+
+  struct cinq_spill *ci_spill; // where the children are, if not in core
+  char ci_name[]; // allocated to its length
+};
+
+// A subtree of cnodes moved out to the tier file, for its root cnode
+// that stays in core (see tier.c)
+struct cinq_spill {
+  loff_t sp_pos; // of the segment in the file
+  u32 sp_len; // bytes
+  u32 sp_cnodes;
+  struct cinq_inode *sp_stub;
+  struct list_head sp_stubs; // of all stubs
 };
 
+// Takes the cnode locks, timing the wait under CINQ_STATS and naming
+// the lock after the cnode for CINQ_LOCK_PROF.
+// They are released by plain read_unlock() and write_unlock().
+#define tags_read_lock(cnode) \
+    stat_lock_(read_lock_named(&(cnode)->ci_tags_lock, "tags", \
+                               (cnode)->ci_name), CINQ_STAT_TAGS_WAIT)
+#define tags_write_lock(cnode) \
+    stat_lock_(write_lock_named(&(cnode)->ci_tags_lock, "tags", \
+                                (cnode)->ci_name), CINQ_STAT_TAGS_WAIT)
+#define children_read_lock(cnode) \
+    stat_lock_(read_lock_named(&(cnode)->ci_children_lock, "children", \
+                               (cnode)->ci_name), CINQ_STAT_CHILDREN_WAIT)
+#define children_write_lock(cnode) \
+    stat_lock_(write_lock_named(&(cnode)->ci_children_lock, "children", \
+                                (cnode)->ci_name), CINQ_STAT_CHILDREN_WAIT)
+
+extern int cinq_tier_on; // tier.c
+
+// Brings the spilled children of @cnode back in core.
+// Returns 0 if they are in core already, or -errno.
+extern int cinq_tier_fault(struct cinq_inode *cnode);
+
+// Takes the children lock of @cnode with its children in core,
+// faulting them in first if they have been spilled.
+// Returns -errno without the lock if they cannot be read back.
+static inline int children_read_lock_in(struct cinq_inode *cnode) {
+  int err;
+  children_read_lock(cnode);
+  while (unlikely(cnode->ci_spill)) {
+    read_unlock(&cnode->ci_children_lock);
+    err = cinq_tier_fault(cnode);
+    if (err) return err;
+    children_read_lock(cnode);
+  }
+  return 0;
+}
+
+static inline int children_write_lock_in(struct cinq_inode *cnode) {
+  int err;
+  children_write_lock(cnode);
+  while (unlikely(cnode->ci_spill)) {
+    write_unlock(&cnode->ci_children_lock);
+    err = cinq_tier_fault(cnode);
+    if (err) return err;
+    children_write_lock(cnode);
+  }
+  return 0;
+}
+
+// Marks @cnode as recently used. A store at most once per second.
+static inline void cnode_touch(struct cinq_inode *cnode) {
+  u32 now;
+  if (likely(!cinq_tier_on)) return;
+  now = get_seconds();
+  if (cnode->ci_atime != now) cnode->ci_atime = now;
+}
+
 // No inode cache is necessary since cinq_inodes are in memory.
 // Therefore no public alloc/free-like functions are provided.
 
@@ -186,6 +344,8 @@ static inline int inode_meta_root(const struct inode *inode) {
 
 /* super.c */
 extern struct cinq_file_systems file_systems;
+extern struct cinq_idtable fsnode_ids; // fs_id ==> cinq_fsnode
+extern struct cinq_idtable cnode_ids; // ci_id ==> cinq_inode
 
 extern struct dentry *cinq_mount (struct file_system_type *fs_type, int flags,
                                   const char *dev_name, void *data);
@@ -203,8 +363,83 @@ extern void journal_inode(struct inode *inode, enum journal_action action);
 
 
 /* cnode.c */
-extern struct inode *cnode_lookup_inode(struct cinq_inode *cnode,
-                                        struct cinq_fsnode *fs);
+
+// Returns the tag t_ino seen through @fs on @cnode, or NULL if none.
+extern struct cinq_tag *cnode_lookup_tag(struct cinq_inode *cnode,
+                                         struct cinq_fsnode *fs);
+
+// Returns the tag that decides what @fs sees on @cnode, positive or not,
+// or NULL if none. Called under the tags lock of @cnode.
+extern struct cinq_tag *cnode_deciding_tag(struct cinq_inode *cnode,
+                                           struct cinq_fsnode *fs);
+
+// Whether @cnode can be spilled, i.e., not used since @cutoff (seconds)
+// and pinned by no inode, open dir, file data or link from outside.
+extern int cnode_cold(struct cinq_inode *cnode, u32 cutoff);
+
+// Moves the subtree under @cnode, all cold since @cutoff, to the tier
+// file, leaving @cnode as its stub. Returns the number of cnodes spilled
+// or -errno. Called under the tier mutex.
+extern long cnode_spill(struct cinq_inode *cnode, u32 cutoff);
+
+// Reads back the subtree spilled under @cnode. Called under the tier mutex.
+extern int cnode_fault(struct cinq_inode *cnode);
+
+// Frees the cnodes spilled so far. Called under the tier mutex, after a
+// grace period since the last spill.
+extern void cnode_limbo_flush(void);
+
+// Returns a cnode with children spilled, or NULL if none.
+// Called under the tier mutex.
+extern struct cinq_inode *cnode_any_stub(void);
+
+// Takes @tag off if it is a whiteout that hides nothing, i.e., the views
+// above see nothing at its cnode either, or one a create has replaced,
+// along with the cnode if that is left with neither tags nor children.
+// Tags with an inode in core, links to them or readdir cursors are kept.
+// Returns 0 if kept, 1 if taken off, or 2 with the cnode too.
+// Called with sweeps paused.
+extern int cnode_reap(struct cinq_tag *tag);
+
+// Frees what cnode_reap() has taken off, after a grace period.
+// Returns the number of cnodes. Called with sweeps going on, outside
+// any read section.
+extern long cnode_reap_flush(void);
+
+// Tags @cnode for @fs with a new inode whose attributes are copied from
+// what @from sees there. Returns the tag, or NULL.
+extern struct cinq_tag *cnode_copy_tag(struct cinq_inode *cnode,
+                                       struct cinq_fsnode *from,
+                                       struct cinq_fsnode *fs);
+
+// Writes the path of @cnode from the root into @buf of @size bytes.
+// Returns its length, or -ENAMETOOLONG.
+extern int cnode_path(const struct cinq_inode *cnode, char *buf, int size);
+
+struct cinq_export_rec;
+
+// Fills @rec with the kind, visibility, child count and attributes of
+// @tag, and points @link to the tag whose inode it shares, or NULL.
+// Returns -ENOENT if @tag is no longer that of its view on its cnode.
+extern int cnode_export_tag(struct cinq_tag *tag, struct cinq_export_rec *rec,
+                            struct cinq_tag **link);
+
+// Puts a tag of @fs as described by @rec at @path under @root, making
+// the missing cnodes on the way, or updates the tag @fs has there made
+// along with the view. A link takes the inode @fs sees at @link, or a
+// copy of the attributes in @rec if none. Returns the tag or ERR_PTR.
+extern struct cinq_tag *cnode_graft(struct cinq_inode *root,
+                                    struct cinq_fsnode *fs,
+                                    const struct cinq_export_rec *rec,
+                                    const char *path, const char *link,
+                                    const char *symname);
+
+// Returns the child of @parent after @child, in name order if @parent is
+// indexed, or the first one if @child is null. @child may have been
+// removed meanwhile. Called under the children lock of @parent.
+extern struct cinq_inode *cnode_next_child(struct cinq_inode *parent,
+                                           struct cinq_inode *child);
+
 // @dentry: a negative dentry, namely whose d_inode is null.
 //    dentry->d_fsdata should better contains cinq_fsnode.fs_id that specifies
 //    the file system (cinq_fsnode) to take the operation. Otherwise,
@@ -242,6 +477,23 @@ extern int cinq_rename(struct inode *old_dir, struct dentry *old_dentry,
                        struct inode *new_dir, struct dentry *new_dentry);
 extern int cinq_setattr(struct dentry *dentry, struct iattr *attr);
 
+// An inode owned by a view frozen by a snapshot is never changed, or the
+// snapshot would see it. The first change through a live view copies it
+// up into that view, tag and data, and lookups through the view find
+// the copy from then on.
+
+// Gets the inode a change through @dentry lands on, copying it up first if
+// need be, and holds the view against snapshots until cinq_change_put().
+// Returns a referenced inode, or ERR_PTR, -EROFS through a snapshot.
+extern struct inode *cinq_change_get(struct dentry *dentry,
+                                     struct cinq_fsnode **fs_p);
+extern void cinq_change_put(struct inode *inode, struct cinq_fsnode *fs);
+
+// Gets the inode @dentry stands for in its view now, which is a copy of
+// d_inode if a change has copied it up since @dentry was got.
+// Returns a referenced inode, or ERR_PTR.
+extern struct inode *cinq_view_inode(struct dentry *dentry);
+
 extern void cinq_destroy_inode(struct inode *inode);
 
 // @dentry: contains cinq_fsnode.fs_id in its d_fsdata, which specifies
@@ -254,19 +506,165 @@ extern int cinq_mkdir(struct inode *dir, struct dentry *dentry, int mode);
 extern struct inode *cnode_make_tree(struct super_block *sb);
 
 extern void cnode_evict_all(struct cinq_inode *root);
+extern void cnode_evict_tree(struct cinq_inode *root);
 
 
 /* file.c */
+
+// Layout of file handles produced by cinq_encode_fh, in __u32 words.
+// A META_FS dentry is encoded with fs_id IDT_NONE.
+struct cinq_fh {
+  __u32 fs_id;
+  __u32 fs_gen;
+  __u32 ci_id;
+  __u32 ci_gen;
+  __u32 parent_id; // only in connectable handles
+  __u32 parent_gen;
+};
+
+#define CINQ_FH_TYPE 1
+#define CINQ_FH_TYPE_PARENT 2 // connectable, with the parent cnode
+#define CINQ_FH_LEN 4
+#define CINQ_FH_PARENT_LEN 6
+
 extern struct dentry *cinq_fh_to_dentry(struct super_block *sb,
                                         struct fid *fid, int fh_len, int fh_type);
 extern int cinq_encode_fh(struct dentry *dentry, __u32 *fh, int *len,
                           int connectable);
+extern struct dentry *cinq_fh_to_parent(struct super_block *sb,
+                                        struct fid *fid, int fh_len, int fh_type);
 extern struct dentry *cinq_get_parent(struct dentry *child);
+extern int cinq_get_name(struct dentry *parent, char *name,
+                         struct dentry *child);
+
+struct data_set;
+
+// Segments of cached file data handed out without copying.
+// Holes are described by segments of a shared zero page.
+// Segments are read-only and stay valid until the last reference is put.
+struct cinq_read_set {
+  atomic_t rs_count;
+  struct data_set **rs_sets; // holding the cache entries rs_vec points to
+  int rs_nsets;
+  loff_t rs_pos;
+  size_t rs_len; // total length of all segments
+  int rs_nvec;
+  struct iovec rs_vec[0];
+};
+
+// Gets segments covering [pos, pos + len), clipped to the file size.
+// Returns NULL when pos is beyond the end of file.
+extern struct cinq_read_set *cinq_read_get(struct dentry *dentry,
+                                           size_t len, loff_t pos);
+
+static inline struct cinq_read_set *cinq_file_read_get(struct file *filp,
+                                                       size_t len, loff_t pos) {
+  return cinq_read_get(filp->f_path.dentry, len, pos);
+}
+
+static inline void cinq_read_set_hold(struct cinq_read_set *rs) {
+  atomic_inc(&rs->rs_count);
+}
+
+extern void cinq_read_set_put(struct cinq_read_set *rs);
+
+// Gets [pos, pos + len) and keeps it as a window for cinq_file_read() to
+// serve from, until the data in it changes or a newer window displaces it.
+extern void cinq_read_ahead(struct dentry *dentry, size_t len, loff_t pos);
+
+extern void cinq_fdata_free(struct cinq_fdata *fdata);
+
+// Makes the data of a copy-up of the frozen inode of @from, which has some.
+// Only the maps are copied. Until rewritten, ranges of the copy are read
+// from the cached data of @from. Returns the copy, or ERR_PTR.
+extern struct cinq_fdata *cinq_fdata_copy(struct cinq_tag *from);
 
 extern ssize_t cinq_file_read(struct file *filp, char *buf, size_t len,
                               loff_t *ppos);
 extern ssize_t cinq_file_write(struct file *filp, const char *buf, size_t len,
                                loff_t *ppos);
+
+#define CINQ_WRITE_STAGE (64 * 1024) // max bytes merged into one cache entry
+
+// Writes the segments at *ppos as one contiguous range. Adjacent small
+// segments are merged into cache entries of up to CINQ_WRITE_STAGE bytes,
+// while large ones are handed to the cache without copying.
+extern ssize_t cinq_file_writev(struct file *filp, const struct iovec *iov,
+                                unsigned long nr_segs, loff_t *ppos);
+
+#ifdef __KERNEL__
+// Entry of writev(2) and aio, served by cinq_file_writev() synchronously.
+extern ssize_t cinq_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                                   unsigned long nr_segs, loff_t pos);
+#endif
+
+#ifndef __KERNEL__
+
+// Asynchronous writes through a submission/completion ring.
+// A worker thread drains submitted entries and merges runs on the same file
+// at contiguous positions into a single cinq_file_writev() call.
+// The buffer of an entry must stay valid until its completion is reaped.
+// Entries are got and submitted by a single thread.
+
+#define CINQ_WRING_MAX_RUN 64 // max SQEs merged into one vectored write
+
+struct cinq_wsqe {
+  struct file *filp;
+  const char *buf;
+  size_t len;
+  loff_t pos;
+  __u64 user_data; // copied to the completion
+};
+
+struct cinq_wcqe {
+  __u64 user_data;
+  ssize_t res; // bytes written or negative error code
+};
+
+struct cinq_wring {
+  unsigned int mask; // number of entries minus one
+  unsigned int sq_head; // next SQE for the worker
+  unsigned int sq_submitted; // SQEs before this are visible to the worker
+  unsigned int sq_tail; // next SQE to hand out
+  unsigned int cq_head; // next CQE to reap
+  unsigned int cq_tail;
+  struct cinq_wsqe *sq;
+  struct cinq_wcqe *cq;
+  spinlock_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  pthread_t worker;
+  int stop;
+};
+
+// @entries: rounded up to a power of two.
+extern int cinq_wring_init(struct cinq_wring *ring, unsigned int entries);
+extern void cinq_wring_exit(struct cinq_wring *ring);
+// Returns NULL when all entries are in flight or not yet reaped.
+extern struct cinq_wsqe *cinq_wring_get_sqe(struct cinq_wring *ring);
+// Returns the number of newly submitted entries.
+extern int cinq_wring_submit(struct cinq_wring *ring);
+// @wait: blocks until a completion arrives if non-zero.
+// Returns -EAGAIN when no completion is ready and none is in flight
+// (or @wait is zero).
+extern int cinq_wring_wait_cqe(struct cinq_wring *ring,
+                               struct cinq_wcqe **cqe_p, int wait);
+extern void cinq_wring_cqe_seen(struct cinq_wring *ring);
+
+#endif // __KERNEL__
+
+// Sets the size of a regular file, unmapping its data beyond a smaller one.
+// @inode: got by cinq_change_get() and held meanwhile
+extern void cinq_file_truncate(struct inode *inode, loff_t size);
+
+// Supports FALLOC_FL_PUNCH_HOLE (with FALLOC_FL_KEEP_SIZE) and plain size
+// extension. There is nothing to preallocate in front of the cache.
+extern long cinq_file_fallocate(struct file *filp, int mode,
+                                loff_t offset, loff_t len);
+
+// Adds SEEK_DATA and SEEK_HOLE on top of generic_file_llseek.
+extern loff_t cinq_file_llseek(struct file *filp, loff_t offset, int origin);
+
 extern int cinq_dir_open(struct inode *inode, struct file *file);
 
 extern int cinq_dir_release(struct inode * inode, struct file * filp);
@@ -275,9 +673,243 @@ extern loff_t cinq_dir_lseek(struct file *filp, loff_t offset, int origin);
 
 extern int cinq_readdir(struct file * filp, void * dirent, filldir_t filldir);
 
+// A scan over the children of a directory in name order, which resumes
+// where the last call on it stopped
+struct cinq_scan {
+  char sc_from[MAX_NAME_LEN + 1]; // the least name left
+  char sc_to[MAX_NAME_LEN + 1]; // names before which, or no bound if empty
+  int sc_after; // whether sc_from itself is done
+  loff_t sc_pos; // entries filled
+};
+
+// Sets @scan to the names in [@from, @to), with no bound if @to is null.
+extern void cinq_scan_range(struct cinq_scan *scan,
+                            const char *from, const char *to);
+
+// Sets @scan to the names starting with @prefix.
+extern void cinq_scan_prefix(struct cinq_scan *scan, const char *prefix);
+
+// Fills @filldir, in name order, with the children of @dir seen through
+// @fs that are left in @scan, until the range ends or @filldir returns
+// < 0, and moves @scan past them. Returns the number filled, 0 when done,
+// or -errno. Costs O(log n + k) on an indexed directory, and sorts the
+// children in range otherwise.
+extern int cinq_scan_dir(struct inode *dir, struct cinq_fsnode *fs,
+                         struct cinq_scan *scan, void *dirent,
+                         filldir_t filldir);
+
 extern int cinq_dir_release(struct inode * inode, struct file * filp);
 
 
+/* readahead.c */
+
+#define CINQ_RA_MIN_PAGES 4 // initial window of a sequential stream
+#define CINQ_RA_MAX_PAGES 128 // 1MB with 8KB pages
+#define CINQ_RA_MAX_QUEUE 64 // pending windows of all files
+
+extern void cinq_ra_init(void);
+extern void cinq_ra_fini(void);
+
+// Feeds a read of [pos, pos + len) to the access pattern detector in
+// filp->f_ra, which prefetches the coming windows of sequential streams
+// asynchronously.
+extern void cinq_file_ra(struct file *filp, loff_t pos, size_t len);
+
+
+/* tier.c */
+
+#define CINQ_TIER_MIN_CNODES 8 // smallest subtree worth a segment
+#define CINQ_TIER_BATCH 256 // subtrees spilled at most per sweep
+
+// Starts tiering the tree under @root. In the kernel it is turned on
+// by the module parameters tier_file and tier_idle.
+extern void cinq_tier_init(struct cinq_inode *root);
+extern void cinq_tier_fini(void);
+
+// Opens @path, truncated, as the tier file. Subtrees idle for @idle_secs
+// are then spilled by a sweeper thread, or by cinq_tier_sweep() if zero.
+extern int cinq_tier_start(const char *path, unsigned int idle_secs);
+
+// Spills the largest subtrees not used for @idle_secs.
+// Returns the number of cnodes spilled.
+extern long cinq_tier_sweep(unsigned int idle_secs);
+
+// Hold off sweeps, so no tag is spilled or freed in between,
+// and let them go on.
+extern void cinq_tier_pause(void);
+extern void cinq_tier_resume(void);
+
+// Brings all spilled subtrees back in core. Returns 0 or -errno.
+extern int cinq_tier_fault_all(void);
+
+// Segment I/O on the tier file, for cnode.c.
+extern int cinq_tier_store(const void *buf, u32 len, loff_t *pos);
+extern int cinq_tier_load(void *buf, u32 len, loff_t pos);
+extern void cinq_tier_release(loff_t pos, u32 len);
+
+/* dirblk.c */
+
+#define CINQ_DIRBLK_ENTRIES 32 // children per block at most
+
+extern unsigned int cinq_dirindex_min; // children to index a dir at
+
+struct cinq_dirblk;
+
+// Children of a big directory in sorted blocks of front-coded names
+struct cinq_dirindex {
+  u32 di_count; // children
+  u32 di_nblks;
+  u32 di_cap; // of di_blks
+  struct cinq_dirblk **di_blks; // in name order
+};
+
+// A place in a directory index, with the name there decoded
+struct cinq_dirpos {
+  u32 dp_blk;
+  u16 dp_ent; // in the block
+  u16 dp_off; // of the next coded name in the block
+  u8 dp_len;
+  char dp_name[MAX_NAME_LEN + 1];
+};
+
+extern struct cinq_dirindex *dirindex_new(void);
+extern void dirindex_free(struct cinq_dirindex *index);
+
+// Returns the child named @name, or NULL. Binary search over the blocks
+// by their first names, then a scan of one block.
+extern struct cinq_inode *dirindex_find(const struct cinq_dirindex *index,
+                                        const char *name);
+
+// Puts @cnode in by its ci_name, which must not be in the index yet.
+extern void dirindex_insert(struct cinq_dirindex *index,
+                            struct cinq_inode *cnode);
+
+extern void dirindex_remove(struct cinq_dirindex *index,
+                            struct cinq_inode *cnode);
+
+// Places @pos at the first child not less than @name, or at the first
+// of all if @name is null, and returns it, or NULL if there is none.
+// Its name is then in @pos->dp_name.
+extern struct cinq_inode *dirindex_seek(const struct cinq_dirindex *index,
+                                        const char *name,
+                                        struct cinq_dirpos *pos);
+
+// Moves @pos to the next child in name order and returns it, or NULL.
+extern struct cinq_inode *dirindex_next(const struct cinq_dirindex *index,
+                                        struct cinq_dirpos *pos);
+
+/* diff.c */
+
+enum cinq_diff_kind {
+  CINQ_DIFF_ADDED, // seen by the view but not by the base
+  CINQ_DIFF_MODIFIED, // seen by both but as another inode; see diff.c
+  CINQ_DIFF_REMOVED // whited out by the view
+};
+
+// Receives an entry that differs, with the tag of the view making the
+// difference. A nonzero return stops the diff.
+typedef int (*cinq_diff_fn)(void *arg, struct cinq_inode *cnode,
+                            struct cinq_tag *tag, enum cinq_diff_kind kind);
+
+// Streams to @fn the entries that @fs sees differently from its
+// ancestor @base, or from an empty view if @base is META_FS. Driven by
+// the tags of @fs and the views between, so it costs in proportion to
+// them rather than the tree. Spilled subtrees are faulted in first if
+// they hold any of those tags. Both views must stay during the call.
+// Returns 0, the nonzero return of @fn, or -errno.
+extern int cinq_view_diff(struct cinq_fsnode *fs, struct cinq_fsnode *base,
+                          cinq_diff_fn fn, void *arg);
+
+/* export.c */
+
+#define CINQ_EXPORT_MAGIC 0x43455850 // "CEXP"
+#define CINQ_EXPORT_VERSION 1
+#define CINQ_EXPORT_PATH_MAX 4096 // of a path or symlink target
+
+/* The export of a view is a header followed by a record for each tag the
+ * view has, in the order made, and an end record. A record is followed by
+ * the path of its cnode, the path of the linked one and the symlink
+ * target, each ended by '\0' and empty if none. Fields are in host
+ * order, so the two ends must share it. */
+
+struct cinq_export_head {
+  u32 eh_magic;
+  u16 eh_version;
+  u16 eh_rec_size; // sizeof(struct cinq_export_rec) of the writer
+  char eh_name[MAX_NAME_LEN + 1]; // of the view
+};
+
+enum cinq_export_kind {
+  CINQ_EXPORT_END, // with the number of records before in er_nchild
+  CINQ_EXPORT_INODE, // a tag of its own inode
+  CINQ_EXPORT_LINK, // a tag of the inode at er_link
+  CINQ_EXPORT_WHITEOUT // a negative tag
+};
+
+struct cinq_export_rec {
+  u16 er_kind;
+  u16 er_mode; // enum cinq_visibility
+  u16 er_path_len;
+  u16 er_link_len;
+  u32 er_sym_len;
+  u32 er_nchild;
+  struct cinq_attr er_attr; // of the inode, linked or not
+};
+
+// Receives the next @len bytes of an export. A nonzero return stops it.
+typedef int (*cinq_export_fn)(void *arg, const void *buf, size_t len);
+
+// Streams the tags of @fs to @fn, a record per call, with a buffer of
+// a record at most. Tiering is paused meanwhile, and subtrees of @fs
+// spilled are faulted in first. Returns 0, the return of @fn, or -errno.
+extern int cinq_export(struct cinq_fsnode *fs, cinq_export_fn fn, void *arg);
+
+// Loads an export as a new view named im_name, or as in the export if
+// empty, made under the view named im_parent, or "META_FS", by a mkdir on
+// the meta root im_root. Tags are then put in place directly, without
+// dentries or inodes.
+struct cinq_import {
+  struct dentry *im_root;
+  char im_parent[MAX_NAME_LEN + 1];
+  char im_name[MAX_NAME_LEN + 1];
+  struct cinq_fsnode *im_fs; // made on the header
+  char *im_buf; // of the piece being read
+  u32 im_len; // bytes in im_buf
+  u32 im_need; // bytes of the piece
+  long im_recs; // read
+  int im_err;
+  int im_done; // after the end record
+};
+
+// @name: of the new view, or NULL for that in the export.
+extern int cinq_import_init(struct cinq_import *im, struct dentry *meta_root,
+                            const char *parent, const char *name);
+
+// Takes the next @len bytes of an export in @im, in any pieces, and puts
+// each record in place once whole. Made a cinq_export_fn, so an export
+// can be piped straight in. Returns 0 or -errno, which sticks to @im.
+extern int cinq_import_feed(void *im, const void *buf, size_t len);
+
+// Frees the buffer of @im and returns 0 if the export was whole, or
+// -errno. A view that fails to load is left as far as it got.
+extern int cinq_import_fini(struct cinq_import *im);
+
+/* compact.c */
+
+// Starts compaction every compact_interval seconds, 300 unless the
+// module parameter says otherwise in the kernel.
+extern void cinq_compact_init(void);
+extern void cinq_compact_fini(void);
+
+// Runs compaction on a thread every @interval_secs.
+extern void cinq_compact_start(unsigned int interval_secs);
+
+// Takes off the whiteouts of all views that hide nothing, and frees
+// what the last pass took off. A name made later in a view above then
+// shows through, as it would have if never made here. Returns the
+// number of whiteouts taken off.
+extern long cinq_compact(void);
+
 /* cinq_meta.c */
 extern struct file_system_type cinqfs;
 extern const struct super_operations cinq_super_operations;
@@ -291,9 +923,6 @@ extern const struct export_operations cinq_export_operations;
 
 #ifdef __KERNEL__
 
-extern int init_cnode_cache(void);
-extern void destroy_cnode_cache(void);
-
 extern int init_tag_cache(void);
 extern void destroy_tag_cache(void);
 
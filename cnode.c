@@ -12,13 +12,14 @@
 
 #include "cinq_meta.h"
 #include "util.h"
+#include "thread.h"
 
 #ifdef __KERNEL__
 
-static struct kmem_cache *cinq_inode_cachep;
-#define cnode_malloc_() \
-    ((struct cinq_inode *)kmem_cache_alloc(cinq_inode_cachep, GFP_KERNEL))
-#define cnode_free_(p) (kmem_cache_free(cinq_inode_cachep, p))
+// Cnodes are sized to their names.
+#define cnode_malloc_(len) ((struct cinq_inode *)kmalloc( \
+    offsetof(struct cinq_inode, ci_name) + (len) + 1, GFP_KERNEL))
+#define cnode_free_(p) (kfree(p))
 
 static struct kmem_cache *cinq_tag_cachep;
 #define tag_malloc_() \
@@ -33,8 +34,8 @@ static struct kmem_cache *vfs_inode_cachep;
 /*
 #else
 
-#define cnode_malloc_() \
-    ((struct cinq_inode *)malloc(sizeof(struct cinq_inode)))
+#define cnode_malloc_(len) ((struct cinq_inode *)malloc( \
+    offsetof(struct cinq_inode, ci_name) + (len) + 1))
 #define cnode_free_(p) (free(p))
 
 #define tag_malloc_() \
@@ -47,6 +48,19 @@ static struct kmem_cache *vfs_inode_cachep;
 */
 #endif // __KERNEL__
 
+// Stubs and segment buffers of tiering
+#ifdef __KERNEL__
+#define tier_malloc_(n) (kmalloc(n, GFP_KERNEL))
+#define tier_free_(p) (kfree(p))
+#define seg_malloc_(n) (vmalloc(n))
+#define seg_free_(p) (vfree(p))
+#else
+#define tier_malloc_(n) (malloc(n))
+#define tier_free_(p) (free(p))
+#define seg_malloc_(n) (malloc(n))
+#define seg_free_(p) (free(p))
+#endif // __KERNEL__
+
 static inline int cnode_is_root_(const struct cinq_inode *cnode) {
   return cnode->ci_parent == cnode;
 }
@@ -66,41 +80,189 @@ struct inode *cinq_alloc_inode(struct super_block *sb) {
   return inode;
 }
 
-// Not actually delete inodes since they are in-memory
+static inline int attr_special_(const struct cinq_attr *attr) {
+  return !S_ISREG(attr->a_mode) && !S_ISDIR(attr->a_mode) &&
+      !S_ISLNK(attr->a_mode);
+}
+
+static inline void attr_set_time_(s64 *sec, u32 *nsec, struct timespec ts) {
+  *sec = ts.tv_sec;
+  *nsec = ts.tv_nsec;
+}
+
+static inline struct timespec attr_time_(s64 sec, u32 nsec) {
+  return (struct timespec) { sec, nsec };
+}
+
+// Sets up the attributes of a new inode of @mode under @dir,
+// in the way of inode_init_owner().
+static void attr_init_(struct cinq_attr *attr, const struct inode *dir,
+                       int mode, dev_t dev) {
+  attr->a_uid = current_fsuid();
+  if (dir && (dir->i_mode & S_ISGID)) {
+    attr->a_gid = dir->i_gid;
+    if (S_ISDIR(mode)) mode |= S_ISGID;
+  } else {
+    attr->a_gid = current_fsgid();
+  }
+  attr->a_mode = mode;
+  /* directory inodes start off with i_nlink == 2 (for "." entry) */
+  attr->a_nlink = S_ISDIR(mode) ? 2 : 1;
+  if (attr_special_(attr)) {
+    attr->a_rdev = dev;
+  } else {
+    attr->a_size = 0;
+  }
+  attr_set_time_(&attr->a_atime, &attr->a_atime_ns, CURRENT_TIME);
+  attr->a_mtime = attr->a_ctime = attr->a_atime;
+  attr->a_mtime_ns = attr->a_ctime_ns = attr->a_atime_ns;
+}
+
+static void attr_load_(struct inode *inode, const struct cinq_attr *attr) {
+  inode->i_mode = attr->a_mode;
+  inode->i_uid = attr->a_uid;
+  inode->i_gid = attr->a_gid;
+  inode->i_nlink = attr->a_nlink;
+  inode->i_size = attr_special_(attr) ? 0 : attr->a_size;
+  inode->i_atime = attr_time_(attr->a_atime, attr->a_atime_ns);
+  inode->i_mtime = attr_time_(attr->a_mtime, attr->a_mtime_ns);
+  inode->i_ctime = attr_time_(attr->a_ctime, attr->a_ctime_ns);
+  switch (attr->a_mode & S_IFMT) {
+    default:
+      init_special_inode(inode, attr->a_mode, attr->a_rdev);
+      break;
+    case S_IFREG:
+      inode->i_op = &cinq_file_inode_operations;
+      inode->i_fop = &cinq_file_operations;
+      break;
+    case S_IFDIR:
+      inode->i_op = &cinq_dir_inode_operations;
+      inode->i_fop = &cinq_dir_operations;
+      break;
+    case S_IFLNK:
+      inode->i_op = &cinq_symlink_inode_operations;
+      break;
+  }
+}
+
+static void attr_save_(struct cinq_attr *attr, const struct inode *inode) {
+  attr->a_mode = inode->i_mode;
+  attr->a_uid = inode->i_uid;
+  attr->a_gid = inode->i_gid;
+  attr->a_nlink = inode->i_nlink;
+  if (!attr_special_(attr)) attr->a_size = inode->i_size;
+  attr_set_time_(&attr->a_atime, &attr->a_atime_ns, inode->i_atime);
+  attr_set_time_(&attr->a_mtime, &attr->a_mtime_ns, inode->i_mtime);
+  attr_set_time_(&attr->a_ctime, &attr->a_ctime_ns, inode->i_ctime);
+}
+
+// Reads the attributes of the inode of @tag, from the inode if in core.
+// Called under the tags lock of the cnode holding @tag.
+static inline void tag_attr_(const struct cinq_tag *tag,
+                             struct cinq_attr *attr) {
+  if (tag->t_inode) attr_save_(attr, tag->t_inode);
+  else *attr = tag->t_attr;
+}
+
+// Called on the last iput, after which cinq_iget() rebuilds the inode
+// from the attributes saved here.
 void cinq_evict_inode(struct inode *inode) {
+  struct cinq_tag *tag = i_tag(inode);
+#ifdef __KERNEL__
+  truncate_inode_pages(&inode->i_data, 0);
+  end_writeback(inode);
+#endif
+  if (unlikely(!tag)) return; // lost the race in cinq_iget()
 
+  tags_write_lock(tag->t_host);
+  attr_save_(&tag->t_attr, inode);
+  tag->t_inode = NULL;
+  write_unlock(&tag->t_host->ci_tags_lock);
 }
 
-// TODO
 void cinq_destroy_inode(struct inode *inode) {
+  inode_free_(inode);
+#ifdef CINQ_DEBUG
+  atomic_dec(&num_inode_);
+#endif // CINQ_DEBUG
+}
 
+struct inode *cinq_iget(struct super_block *sb, unsigned long ino) {
+  struct cinq_tag *tag = (struct cinq_tag *)ino;
+  struct cinq_inode *host = tag->t_host;
+  struct inode *inode, *new;
+
+again:
+  tags_read_lock(host);
+  while ((inode = tag->t_inode)) {
+    spin_lock(&inode->i_lock);
+    if (likely(!(inode->i_state & I_FREEING))) {
+      atomic_inc(&inode->i_count);
+      spin_unlock(&inode->i_lock);
+      rd_release_return(&host->ci_tags_lock, inode);
+    }
+    // Waits for the eviction to save the attributes and leave.
+    spin_unlock(&inode->i_lock);
+    read_unlock(&host->ci_tags_lock);
+    cpu_relax();
+    tags_read_lock(host);
+  }
+  read_unlock(&host->ci_tags_lock);
+
+  new = new_inode(sb);
+  if (unlikely(!new)) return NULL;
+#ifdef __KERNEL__
+  new->i_generation = get_seconds();
+  new->i_mapping->backing_dev_info = &cinq_backing_dev_info;
+#endif
+  tags_write_lock(host);
+  if (unlikely(tag->t_inode)) { // made by another one meanwhile
+    write_unlock(&host->ci_tags_lock);
+    iput(new); // with i_ino unset
+    goto again;
+  }
+  new->i_ino = ino;
+  attr_load_(new, &tag->t_attr);
+  tag->t_inode = new;
+  write_unlock(&host->ci_tags_lock);
+  return new;
 }
 
-// creates a new tag without associating inode to it
+// Creates a tag that refers to the inode of @ino, or a negative one.
 static inline struct cinq_tag *tag_new_with_(const struct cinq_fsnode *fs,
-                                             struct inode *inode,
+                                             struct cinq_tag *ino,
                                              enum cinq_visibility mode) {
   struct cinq_tag *tag = tag_malloc_();
   if (unlikely(!tag)) {
     return NULL;
   }
   tag->t_fs = (void *)fs;
-  tag->t_inode = (void *)inode;
-  if (likely(inode)) ihold(inode);
+  tag->t_ino = ino;
+  if (ino) atomic_inc(&ino->t_nref);
+  tag->t_inode = NULL;
   tag->t_mode = mode;
   tag->t_host = NULL;
   atomic_set(&tag->t_nchild, 0);
   atomic_set(&tag->t_count, 0);
+  atomic_set(&tag->t_nref, 0);
   tag->t_symname = NULL;
+  tag->t_data = NULL;
+  INIT_LIST_HEAD(&tag->t_fs_tags);
   return tag;
 }
 
-// @inode: whose i_ino is set to address of new tag.
+// Creates a tag of a new inode of @mode under @dir,
+// which is got by cinq_iget() on the tag.
 static inline struct cinq_tag *tag_new_(const struct cinq_fsnode *fs,
-                                        struct inode *inode,
-                                        enum cinq_visibility mode) {
-  struct cinq_tag *tag = tag_new_with_(fs, inode, mode);
-  inode->i_ino = (unsigned long) tag;
+                                        enum cinq_visibility vis,
+                                        const struct inode *dir,
+                                        int mode, dev_t dev) {
+  struct cinq_tag *tag = tag_new_with_(fs, NULL, vis);
+  if (unlikely(!tag)) {
+    return NULL;
+  }
+  tag->t_ino = tag;
+  attr_init_(&tag->t_attr, dir, mode, dev);
   return tag;
 }
 
@@ -112,20 +274,34 @@ static inline void drop_nchild_(struct cinq_tag *tag) {
   atomic_dec(&tag->t_nchild);
 }
 
-static inline void tag_drop_inode_(struct cinq_tag *tag) {
-  if (unlikely(!tag->t_inode)) {
-    DEBUG_("[Warn@tag_drop_inode_] drop nonexistent one: %s\n",
+// Counts a link on the inode that @tag refers to, in core or in its
+// attributes. Called under the tags lock of the cnode holding @tag.
+static inline void tag_inc_nlink_(struct cinq_tag *tag) {
+  struct cinq_tag *ino = tag->t_ino;
+  if (ino->t_inode) inc_nlink(ino->t_inode);
+  else ++ino->t_attr.a_nlink;
+}
+
+static inline void tag_drop_nlink_(struct cinq_tag *tag) {
+  struct cinq_tag *ino = tag->t_ino;
+  if (ino->t_inode) drop_nlink(ino->t_inode);
+  else if (ino->t_attr.a_nlink) --ino->t_attr.a_nlink;
+}
+
+static inline void tag_drop_ino_(struct cinq_tag *tag) {
+  if (unlikely(!tag->t_ino)) {
+    DEBUG_("[Warn@tag_drop_ino_] drop nonexistent one: %s\n",
            tag->t_host->ci_name);
     return;
   }
-  iput(tag->t_inode);
-  tag->t_inode = NULL;
+  if (tag->t_ino != tag) atomic_dec(&tag->t_ino->t_nref);
+  tag->t_ino = NULL;
 }
 
-static inline void tag_reset_inode_(struct cinq_tag *tag, struct inode *inode) {
-  tag_drop_inode_(tag);
-  ihold(inode);
-  tag->t_inode = inode;
+static inline void tag_reset_ino_(struct cinq_tag *tag, struct cinq_tag *ino) {
+  tag_drop_ino_(tag);
+  tag->t_ino = ino;
+  if (ino != tag) atomic_inc(&ino->t_nref);
 }
 
 static inline struct cinq_tag *cnode_find_tag_(const struct cinq_inode *cnode,
@@ -138,21 +314,41 @@ static inline struct cinq_tag *cnode_find_tag_(const struct cinq_inode *cnode,
 static inline struct cinq_tag *cnode_find_tag_syn(struct cinq_inode *cnode,
                                                   struct cinq_fsnode *fs) {
   struct cinq_tag *tag;
-  read_lock(&cnode->ci_tags_lock);
+  tags_read_lock(cnode);
   tag = cnode_find_tag_(cnode, fs);
   read_unlock(&cnode->ci_tags_lock);
   return tag;
 }
 
+// Lists @tag in its view for diffs. The list lock is taken last.
+static inline void tag_list_(struct cinq_tag *tag) {
+  struct cinq_fsnode *fs = tag->t_fs;
+  if (fs == META_FS) return;
+  spin_lock(&fs->fs_tags_lock);
+  list_add_tail(&tag->t_fs_tags, &fs->fs_tags);
+  spin_unlock(&fs->fs_tags_lock);
+}
+
+// Returns 0 if @tag is not listed, as that of META_FS or a removed view.
+static inline int tag_unlist_(struct cinq_tag *tag) {
+  struct cinq_fsnode *fs = tag->t_fs;
+  if (list_empty(&tag->t_fs_tags)) return 0;
+  spin_lock(&fs->fs_tags_lock);
+  list_del_init(&tag->t_fs_tags);
+  spin_unlock(&fs->fs_tags_lock);
+  return 1;
+}
+
 static inline void cnode_add_tag_(struct cinq_inode *cnode,
                                   struct cinq_tag *tag) {
   HASH_ADD_PTR(cnode->ci_tags, t_fs, tag);
   tag->t_host = cnode;
+  tag_list_(tag);
 }
 
 static inline void cnode_add_tag_syn(struct cinq_inode *cnode,
                                      struct cinq_tag *tag) {
-  write_lock(&cnode->ci_tags_lock);
+  tags_write_lock(cnode);
   cnode_add_tag_(cnode, tag);
   write_unlock(&cnode->ci_tags_lock);
 }
@@ -165,7 +361,7 @@ static inline void cnode_rm_tag_(struct cinq_inode *cnode,
 
 static inline void cnode_rm_tag_syn(struct cinq_inode *cnode,
                                     struct cinq_tag* tag) {
-  write_lock(&cnode->ci_tags_lock);
+  tags_write_lock(cnode);
   cnode_rm_tag_(cnode, tag);
   write_unlock(&cnode->ci_tags_lock);
 }
@@ -180,87 +376,196 @@ static inline void tag_evict(struct cinq_tag *tag) {
 #endif // CINQ_DEBUG
   }
   cnode_rm_tag_syn(tag->t_host, tag);
+  tag_unlist_(tag);
+  cinq_fdata_free(tag->t_data);
   tag_free_(tag);
 }
 
-static struct cinq_inode *cnode_new_(char *name) {
+// Makes a cnode without ID
+static struct cinq_inode *cnode_alloc_(const char *name) {
   
-  struct cinq_inode *cnode = cnode_malloc_();
+  struct cinq_inode *cnode = cnode_malloc_(strlen(name));
   if (unlikely(!cnode)) {
     DEBUG_("[Error@cnode_new] allocation fails: %s.\n", name);
     return NULL;
   }
   
   // Initializes cnode
-  cnode->ci_id = (unsigned long)cnode;
   strcpy(cnode->ci_name, name);
   atomic_set(&cnode->ci_count, 0);
   cnode->ci_tags = NULL;
   cnode->ci_children = NULL;
+  cnode->ci_index = NULL;
   rwlock_init(&cnode->ci_tags_lock);
   rwlock_init(&cnode->ci_children_lock);
   cnode->ci_parent = NULL;
+  cnode->ci_atime = get_seconds();
+  cnode->ci_spill = NULL;
   
   return cnode;
 }
 
+static struct cinq_inode *cnode_new_(char *name) {
+  struct cinq_inode *cnode = cnode_alloc_(name);
+  if (unlikely(!cnode)) return NULL;
+  cnode->ci_id = idtable_alloc(&cnode_ids, cnode);
+  if (unlikely(cnode->ci_id == IDT_NONE)) {
+    cnode_free_(cnode);
+    return NULL;
+  }
+  return cnode;
+}
+
 static inline struct cinq_inode *cnode_find_child_(struct cinq_inode *parent,
                                                    const char *name) {
   struct cinq_inode *child;
-  HASH_FIND_BY_STR(ci_child, parent->ci_children, name, child);
+  if (parent->ci_index) {
+    child = dirindex_find(parent->ci_index, name);
+  } else {
+    HASH_FIND_BY_STR(ci_child, parent->ci_children, name, child);
+  }
+  if (child) cnode_touch(child);
   return child;
 }
 
 static inline struct cinq_inode *cnode_find_child_syn(struct cinq_inode *parent,
                                                       const char *name) {
   struct cinq_inode *child;
-  read_lock(&parent->ci_children_lock);
+  if (unlikely(children_read_lock_in(parent))) return NULL;
   child = cnode_find_child_(parent, name);
   read_unlock(&parent->ci_children_lock);
   return child;
 }
 
+// Moves the children of @parent from the hash table into an index.
+static void cnode_index_children_(struct cinq_inode *parent) {
+  struct cinq_dirindex *index = dirindex_new();
+  struct cinq_inode *child, *tmp;
+  HASH_ITER(ci_child, parent->ci_children, child, tmp) {
+    dirindex_insert(index, child);
+  }
+  HASH_CLEAR(ci_child, parent->ci_children);
+  parent->ci_index = index;
+  DEBUG_("cnode_index_children_: %u children of %s in %u blocks.\n",
+         index->di_count, parent->ci_name, index->di_nblks);
+}
+
 static inline void cnode_add_child_(struct cinq_inode *parent, struct cinq_inode *child) {
-  HASH_ADD_BY_STR(ci_child, parent->ci_children, ci_name, child);
+  if (parent->ci_index) {
+    dirindex_insert(parent->ci_index, child);
+  } else {
+    HASH_ADD_BY_STR(ci_child, parent->ci_children, ci_name, child);
+    if (unlikely(cinq_dirindex_min &&
+                 HASH_CNT(ci_child, parent->ci_children) >= cinq_dirindex_min)) {
+      cnode_index_children_(parent);
+    }
+  }
   child->ci_parent = parent;
 }
 
 static inline void cnode_add_child_syn(struct cinq_inode *parent,
                                        struct cinq_inode *child) {
-  write_lock(&parent->ci_children_lock);
+  children_write_lock(parent);
   cnode_add_child_(parent, child);
   write_unlock(&parent->ci_children_lock);
 }
 
 static inline void cnode_rm_child_(struct cinq_inode *parent, struct cinq_inode* child) {
-  HASH_DELETE(ci_child, parent->ci_children, child);
+  if (parent->ci_index) {
+    dirindex_remove(parent->ci_index, child);
+  } else {
+    HASH_DELETE(ci_child, parent->ci_children, child);
+  }
   child->ci_parent = NULL;
 }
 
 static inline void cnode_rm_child_syn(struct cinq_inode *parent, struct cinq_inode* child) {
-  write_lock(&parent->ci_children_lock);
+  children_write_lock(parent);
   cnode_rm_child_(parent, child);
   write_unlock(&parent->ci_children_lock);
 }
 
-struct inode *cnode_lookup_inode(struct cinq_inode *cnode, struct cinq_fsnode *req_fs) {
+struct cinq_inode *cnode_next_child(struct cinq_inode *parent,
+                                    struct cinq_inode *child) {
+  struct cinq_inode *next;
+  struct cinq_dirpos pos;
+  if (!parent->ci_index) {
+    return child ? child->ci_child.next : parent->ci_children;
+  }
+  if (!child) return dirindex_seek(parent->ci_index, NULL, &pos);
+  next = dirindex_seek(parent->ci_index, child->ci_name, &pos);
+  return next == child ? dirindex_next(parent->ci_index, &pos) : next;
+}
+
+int cnode_path(const struct cinq_inode *cnode, char *buf, int size) {
+  char *p = buf + size;
+  int len;
+  if (unlikely(size < 2)) return -ENAMETOOLONG;
+  *--p = '\0';
+  for (; !cnode_is_root_(cnode); cnode = cnode->ci_parent) {
+    len = strlen(cnode->ci_name);
+    if (p - buf < len + 1) return -ENAMETOOLONG;
+    p -= len;
+    memcpy(p, cnode->ci_name, len);
+    *--p = '/';
+  }
+  if (!*p) *--p = '/'; // of the root
+  len = buf + size - 1 - p;
+  memmove(buf, p, len + 1);
+  return len;
+}
+
+struct cinq_tag *cnode_deciding_tag(struct cinq_inode *cnode,
+                                    struct cinq_fsnode *fs) {
+  struct cinq_tag *tag;
+  foreach_ancestor_tag(fs, tag, cnode) {
+    if (tag) return tag;
+  }
+  return fs == META_FS ? NULL : tag; // or impenetrable
+}
+
+struct cinq_tag *cnode_copy_tag(struct cinq_inode *cnode,
+                                struct cinq_fsnode *from,
+                                struct cinq_fsnode *fs) {
+  struct cinq_tag *tag = tag_new_with_(fs, NULL, CINQ_VISIBLE);
+  struct cinq_tag *src;
+  if (unlikely(!tag)) return NULL;
+  tag->t_ino = tag;
+
+  tags_write_lock(cnode);
+  src = cnode_deciding_tag(cnode, from);
+  if (src && !negative(src)) {
+    tag->t_mode = src->t_mode;
+    atomic_set(&tag->t_nchild, atomic_read(&src->t_nchild));
+    tag_attr_(src, &tag->t_attr); // of a view root, never a link
+  } else {
+    attr_init_(&tag->t_attr, NULL, S_IFDIR | S_IRWXU, 0);
+  }
+  cnode_add_tag_(cnode, tag);
+  write_unlock(&cnode->ci_tags_lock);
+  return tag;
+}
+
+struct cinq_tag *cnode_lookup_tag(struct cinq_inode *cnode,
+                                  struct cinq_fsnode *req_fs) {
   struct cinq_tag *tag;
   struct cinq_fsnode *fs = req_fs;
-  read_lock(&cnode->ci_tags_lock);
+  tags_read_lock(cnode);
   foreach_ancestor_tag(fs, tag, cnode) {
     if (tag) {
-      rd_release_return(&cnode->ci_tags_lock, tag->t_inode);
+      rd_release_return(&cnode->ci_tags_lock, tag->t_ino);
     }
   }
   read_unlock(&cnode->ci_tags_lock);
-  DEBUG_("cnode_lookup_inode: failed to find tag of FS '%s' on %s.\n",
+  DEBUG_("cnode_lookup_tag: failed to find tag of FS '%s' on %s.\n",
          req_fs->fs_name, cnode->ci_name);
   return NULL;
 }
 
 static void cnode_evict(struct cinq_inode *cnode) {
   struct cinq_inode *parent;
-  if (cnode->ci_tags || cnode->ci_children) {
+  if (cnode->ci_tags || cnode->ci_children ||
+      (cnode->ci_index && cnode->ci_index->di_count)) {
     DEBUG_("[Error@cnode_evict] failed to delete cnode %lx "
            "who still has tags or children.\n", cnode->ci_id);
     return;
@@ -269,15 +574,22 @@ static void cnode_evict(struct cinq_inode *cnode) {
   if (!cnode_is_root_(cnode) && parent) {
     cnode_rm_child_syn(parent, cnode);
   }
+  idtable_free(&cnode_ids, cnode->ci_id);
+  if (cnode->ci_spill) { // the file is gone
+    list_del(&cnode->ci_spill->sp_stubs);
+    tier_free_(cnode->ci_spill);
+  }
+  if (cnode->ci_index) dirindex_free(cnode->ci_index);
   cnode_free_(cnode);
 }
 
 // This function is NOT thread safe, since it is used in the end,
 // and a single thread is proper then.
 void cnode_evict_all(struct cinq_inode *root) {
-  if (root->ci_children) {
-    struct cinq_inode *cur, *tmp;
-    HASH_ITER(ci_child, root->ci_children, cur, tmp) {
+  if (root->ci_children || root->ci_index) {
+    struct cinq_inode *cur, *next;
+    for (cur = cnode_next_child(root, NULL); cur; cur = next) {
+      next = cnode_next_child(root, cur);
       cnode_evict_all(cur);
     }
     DEBUG_ON_(root->ci_children != NULL,
@@ -285,6 +597,12 @@ void cnode_evict_all(struct cinq_inode *root) {
   }
   if (root->ci_tags) {
     struct cinq_tag *cur, *tmp;
+    // The data of a copy-up holds the tag it was copied from, of the
+    // same cnode, so all data goes before any tag.
+    HASH_ITER(hh, root->ci_tags, cur, tmp) {
+      cinq_fdata_free(cur->t_data);
+      cur->t_data = NULL;
+    }
     HASH_ITER(hh, root->ci_tags, cur, tmp) {
       tag_evict(cur);
     }
@@ -294,46 +612,6 @@ void cnode_evict_all(struct cinq_inode *root) {
   cnode_evict(root);
 }
 
-// @dir: can be containing directory when adding new inode in it,
-//       or contained directory when its parents are being tagged.
-static struct inode *cinq_get_inode_(const struct inode *dir, int mode,
-                                     dev_t dev) {
-  struct super_block *sb = dir->i_sb;
-  struct inode * inode = new_inode(sb);
-  
-  if (inode) {
-#ifdef __KERNEL__
-    inode->i_generation = get_seconds();
-    inode->i_mapping->backing_dev_info = &cinq_backing_dev_info;
-#endif
-
-    inode_init_owner(inode, dir, mode);
-    // inode->i_ino is set when host tag is allocated
-    inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
-    // insert_inode_hash(inode);
-    switch (mode & S_IFMT) {
-      default:
-        init_special_inode(inode, mode, dev);
-        break;
-      case S_IFREG:
-        inode->i_op = &cinq_file_inode_operations;
-        inode->i_fop = &cinq_file_operations;
-        break;
-      case S_IFDIR:
-        inode->i_op = &cinq_dir_inode_operations;
-        inode->i_fop = &cinq_dir_operations;
-        /* directory inodes start off with i_nlink == 2 (for "." entry) */
-        inc_nlink(inode);
-        break;
-      case S_IFLNK:
-        inode->i_op = &cinq_symlink_inode_operations;
-        break;
-    }
-  }
-  atomic_set(&inode->i_count, 1000000000); // prevents it from being evicted
-  return inode;
-}
-
 // Contrary to convention that derives childen from parent
 static void cnode_tag_ancestors_(const struct dentry *dentry) {
   struct inode *child = dentry->d_inode;
@@ -343,12 +621,12 @@ static void cnode_tag_ancestors_(const struct dentry *dentry) {
   struct cinq_tag *tag;
   int to_ln_parent = S_ISDIR(child->i_mode) ? 1 : 0;
   while (!cnode_is_root_(ci_child) && ci_parent) {
-    write_lock(&ci_parent->ci_tags_lock);
+    tags_write_lock(ci_parent);
     tag = cnode_find_tag_(ci_parent, fs);
     if (tag) {
       inc_nchild_(tag);
       if (to_ln_parent) {
-        inc_nlink(tag->t_inode);
+        tag_inc_nlink_(tag);
       } else {
         to_ln_parent = 1;
       }
@@ -356,24 +634,23 @@ static void cnode_tag_ancestors_(const struct dentry *dentry) {
       break;
     }
     
-    struct inode *parent = cinq_get_inode_(child,
-    		(child->i_mode & ~S_IFMT) | S_IFDIR, 0);
-    if (!parent) {
-      DEBUG_("[Error@cnode_tag_ancestors_] inode allocation failed "
+    // No inode is made for the ancestor until it is looked up.
+    tag = tag_new_(fs, CINQ_VISIBLE, child,
+                   (child->i_mode & ~S_IFMT) | S_IFDIR, 0);
+    if (!tag) {
+      DEBUG_("[Error@cnode_tag_ancestors_] tag allocation failed "
              "when tagging ancestors of %s.\n", i_cnode(child)->ci_name);
       write_unlock(&ci_parent->ci_tags_lock);
       return;
     }
-    tag = tag_new_(fs, parent, CINQ_VISIBLE);
     cnode_add_tag_(ci_parent, tag);
-    write_unlock(&ci_parent->ci_tags_lock);
-    
     inc_nchild_(tag);
     if (to_ln_parent) {
-      inc_nlink(tag->t_inode);
+      tag_inc_nlink_(tag);
     } else {
       to_ln_parent = 1;
     }
+    write_unlock(&ci_parent->ci_tags_lock);
     
     ci_child = ci_parent;
     ci_parent = ci_child->ci_parent;
@@ -392,7 +669,7 @@ static inline void local_inc_ref(struct inode *dir, struct dentry *dentry) {
   } else {
     inc_nchild_(dir_tag);
     if (S_ISDIR(inode->i_mode)) {
-      inc_nlink(dir_tag->t_inode);
+      inc_nlink(dir); // the inode of dir_tag
     }
   }
 }
@@ -414,37 +691,171 @@ static inline void local_drop_ref(struct inode *dir, struct dentry *dentry) {
   }
   drop_nchild_(tag);
   if (S_ISDIR(inode->i_mode)) {
-    drop_nlink(tag->t_inode);
+    tags_write_lock(tag->t_host);
+    tag_drop_nlink_(tag);
+    write_unlock(&tag->t_host->ci_tags_lock);
   }
 }
 
 struct inode *cnode_make_tree(struct super_block *sb) {
   int mode = S_IFDIR | S_IRWXUGO | S_ISVTX;
   struct cinq_inode *croot = cnode_new_("/");
+  struct inode *iroot;
   croot->ci_parent = croot;
   
   // Construct a root inode independant of any file system
-  struct inode * iroot = new_inode(sb);
-  if (!iroot) {
+  struct cinq_tag *tag = tag_new_(META_FS, CINQ_INVISIBLE, NULL, mode, 0);
+  if (!tag) {
     return ERR_PTR(-ENOMEM);
   }
-  inode_init_owner(iroot, NULL, mode);
-  iroot->i_blocks = 0;
-  iroot->i_uid = current_fsuid();
-  iroot->i_gid = current_fsgid();
-  iroot->i_mtime = iroot->i_atime = iroot->i_ctime = CURRENT_TIME;
+  cnode_add_tag_syn(croot, tag);
+  iroot = cinq_iget(sb, (unsigned long)tag);
+  return iroot ? iroot : ERR_PTR(-ENOMEM);
+}
+
+// Sets the view of @dentry for a change to that of @from, or the live
+// one if it has been frozen, and holds it against snapshots until
+// view_put_(), so the change lands wholly on either side of one.
+static int view_get_(struct dentry *dentry, struct dentry *from,
+                     struct cinq_fsnode **fs_p) {
+  struct cinq_fsnode *fs;
+  for (;;) {
+    fs = dentry_fs(from);
+    if (unlikely(!fs)) {
+      DEBUG_("[Error@view_get_] no fsnode is specified for %s.\n",
+             dentry->d_name.name);
+      return -EINVAL;
+    }
+    if (fs == META_FS) break;
+    down_read(&fs->fs_snap_sem);
+    if (likely(!fs->fs_live)) break;
+    up_read(&fs->fs_snap_sem); // frozen meanwhile
+  }
+  if (unlikely(fs != META_FS && fs->fs_readonly)) {
+    up_read(&fs->fs_snap_sem);
+    return -EROFS;
+  }
+  dentry->d_fsdata = fs;
+  *fs_p = fs;
+  return 0;
+}
+
+static inline void view_put_(struct cinq_fsnode *fs) {
+  if (fs != META_FS) up_read(&fs->fs_snap_sem);
+}
+
+static inline int tag_frozen_(const struct cinq_tag *tag) {
+  return tag->t_fs != META_FS && tag->t_fs->fs_live;
+}
+
+// Finds the copy of the frozen inode of @tag made for @fs.
+static struct cinq_tag *copy_find_(struct cinq_tag *tag,
+                                   struct cinq_fsnode *fs) {
+  struct cinq_tag *own, *ino = NULL;
+  tags_read_lock(tag->t_host);
+  own = cnode_find_tag_(tag->t_host, fs);
+  if (own && !negative(own)) ino = own->t_ino;
+  read_unlock(&tag->t_host->ci_tags_lock);
+  return ino;
+}
+
+// Copies the inode of @src, tag and data, into the view of @dentry, unless
+// another change has done so meanwhile. The ancestors are tagged in the
+// view as on a create, for lookups through it to reach the copy.
+// Returns the tag of the copy, or ERR_PTR.
+static struct cinq_tag *copy_up_(struct dentry *dentry, struct cinq_tag *src) {
+  struct cinq_fsnode *fs = dentry->d_fsdata;
+  struct cinq_inode *host = src->t_host;
+  struct cinq_tag *tag, *own;
+  struct cinq_fdata *fdata = NULL;
+
+  tag = tag_new_with_(fs, NULL, src->t_mode);
+  if (unlikely(!tag)) return ERR_PTR(-ENOMEM);
+  tag->t_ino = tag;
+  if (src->t_symname) {
+    tag->t_symname = tier_malloc_(strlen(src->t_symname) + 1);
+    if (unlikely(!tag->t_symname)) {
+      tag_free_(tag);
+      return ERR_PTR(-ENOMEM);
+    }
+    strcpy(tag->t_symname, src->t_symname);
+  }
+  // What the copy writes is cached under its own key, which is its tag.
+  if (src->t_data) fdata = cinq_fdata_copy(src);
+  if (unlikely(IS_ERR(fdata))) {
+    if (tag->t_symname) tier_free_(tag->t_symname);
+    tag_free_(tag);
+    return ERR_PTR(PTR_ERR(fdata));
+  }
+  tag->t_data = fdata;
+
+  tags_write_lock(host);
+  own = cnode_find_tag_(host, fs);
+  if (likely(!own)) {
+    tag_attr_(src, &tag->t_attr);
+    atomic_set(&tag->t_nchild, atomic_read(&src->t_nchild));
+    cnode_add_tag_(host, tag);
+  }
+  write_unlock(&host->ci_tags_lock);
+  if (likely(!own)) {
+    cnode_tag_ancestors_(dentry);
+    return tag;
+  }
+
+  cinq_fdata_free(tag->t_data);
+  if (tag->t_symname) tier_free_(tag->t_symname);
+  tag_free_(tag);
+  return negative(own) ? ERR_PTR(-ENOENT) : own->t_ino;
+}
+
+struct inode *cinq_view_inode(struct dentry *dentry) {
+  struct inode *inode = dentry->d_inode;
+  struct cinq_tag *tag = i_tag(inode), *ino;
+
+  if (likely(!tag_frozen_(tag)) ||
+      !(ino = copy_find_(tag, dentry_fs(dentry)))) {
+    ihold(inode);
+    return inode;
+  }
+  inode = cinq_iget(inode->i_sb, (unsigned long)ino);
+  return inode ? inode : ERR_PTR(-ENOMEM);
+}
+
+// An inode named also by links or renames is changed in place, as a copy
+// would part it from its other names.
+struct inode *cinq_change_get(struct dentry *dentry,
+                              struct cinq_fsnode **fs_p) {
+  struct inode *inode = dentry->d_inode, *copy;
+  struct cinq_tag *tag = i_tag(inode), *ino;
+  int err = view_get_(dentry, dentry, fs_p);
+
+  if (unlikely(err)) return ERR_PTR(err);
+  if (likely(!tag_frozen_(tag)) || atomic_read(&tag->t_nref)) {
+    ihold(inode);
+    return inode;
+  }
+  ino = copy_find_(tag, *fs_p);
+  if (!ino) {
+    ino = copy_up_(dentry, tag);
+    if (unlikely(IS_ERR(ino))) {
+      view_put_(*fs_p);
+      return ERR_PTR(PTR_ERR(ino));
+    }
 #ifdef __KERNEL__
-  iroot->i_generation = get_seconds();
-  iroot->i_mapping->backing_dev_info = &cinq_backing_dev_info;
+    d_drop(dentry); // looked up again, it finds the copy
 #endif
-  // insert_inode_hash(inode);
-  inc_nlink(iroot); // as dir
-  iroot->i_op = &cinq_dir_inode_operations;
-  iroot->i_fop = &cinq_dir_operations;
+  }
+  copy = cinq_iget(inode->i_sb, (unsigned long)ino);
+  if (unlikely(!copy)) {
+    view_put_(*fs_p);
+    return ERR_PTR(-ENOMEM);
+  }
+  return copy;
+}
 
-  struct cinq_tag *tag = tag_new_(META_FS, iroot, CINQ_INVISIBLE);
-  cnode_add_tag_syn(croot, tag);
-  return iroot;
+void cinq_change_put(struct inode *inode, struct cinq_fsnode *fs) {
+  iput(inode);
+  view_put_(fs);
 }
 
 static int cinq_mkinode_(struct inode *dir, struct dentry *dentry,
@@ -454,6 +865,7 @@ static int cinq_mkinode_(struct inode *dir, struct dentry *dentry,
   struct inode *inode;
   struct cinq_tag *tag;
   struct cinq_fsnode *req_fs = dentry->d_fsdata;
+  int err;
   
   char *name = (char *)dentry->d_name.name;
   if (unlikely(dentry->d_name.len > MAX_NAME_LEN)) {
@@ -461,53 +873,55 @@ static int cinq_mkinode_(struct inode *dir, struct dentry *dentry,
     return -ENAMETOOLONG;
   }
   
-  inode = cinq_get_inode_(dir, mode, dev);
-  if (unlikely(!inode)) {
-    return -ENOSPC;
-  }
-  tag = tag_new_(req_fs, inode, mode >> CINQ_MODE_SHIFT);
+  tag = tag_new_(req_fs, mode >> CINQ_MODE_SHIFT, dir, mode, dev);
   if (unlikely(!tag)) {
-    iput(inode);
     return -ENOSPC;
   }
   
-  write_lock(&parent->ci_children_lock);
+  err = children_write_lock_in(parent);
+  if (unlikely(err)) {
+    tag_free_(tag);
+    return err;
+  }
   child = cnode_find_child_(parent, name);
   if (child) {
 	struct cinq_tag *old_tag;
+    // Tagged before the parent lets go, or a bare one may be reaped.
+    tags_write_lock(child);
     write_unlock(&parent->ci_children_lock);
-    DEBUG_(">>> cinq_mkinode_(1): tag existing cnode %s with %s.\n",
-           child->ci_name, req_fs->fs_name);
     
-    write_lock(&child->ci_tags_lock);
     old_tag = cnode_find_tag_(child, req_fs);
     if (unlikely(old_tag)) {
+      // A whiteout stays listed until the next cinq_compact() pass,
+      // run periodically from mount, frees it.
       if (negative(old_tag)) cnode_rm_tag_(child, old_tag);
       else {
         DEBUG_("[Error@cinq_mkinode_] cinq_mkinode_ meets existing '%s'.\n",
                old_tag->t_host->ci_name);
-        wr_release_return(&child->ci_tags_lock, -EINVAL);
+        write_unlock(&child->ci_tags_lock);
+        tag_free_(tag);
+        return -EINVAL;
       }
     }
     cnode_add_tag_(child, tag);
     write_unlock(&child->ci_tags_lock);
   } else {
     child = cnode_new_(name);
-    if (unlikely(!child)) wr_release_return(&parent->ci_children_lock, -ENOSPC);
+    if (unlikely(!child)) {
+      write_unlock(&parent->ci_children_lock);
+      tag_free_(tag);
+      return -ENOSPC;
+    }
     cnode_add_tag_(child, tag);
     cnode_add_child_(parent, child);
     write_unlock(&parent->ci_children_lock);
-    DEBUG_(">>> cinq_mkinode_(2): create %s under cnode %s by FS %s.\n",
-           child->ci_name, parent->ci_name, req_fs->fs_name);
   }
   
-  d_instantiate(dentry, tag->t_inode);
-  // to pin the dentry in core
-  if (dentry) {
-    spin_lock(&dentry->d_lock);
-    dentry->d_count = 0x7fffffff;
-    spin_unlock(&dentry->d_lock);
+  inode = cinq_iget(dir->i_sb, (unsigned long)tag);
+  if (unlikely(!inode)) {
+    return -ENOMEM;
   }
+  d_instantiate(dentry, inode);
   dir->i_mtime = dir->i_ctime = CURRENT_TIME;
   
   local_inc_ref(dir, dentry);
@@ -517,48 +931,53 @@ static int cinq_mkinode_(struct inode *dir, struct dentry *dentry,
 // Refer to definition comments in cinq_meta.h
 int cinq_create(struct inode *dir, struct dentry *dentry,
                 int mode, struct nameidata *nameidata) {
-  dentry->d_fsdata = nameidata ?
-      nameidata->path.dentry->d_fsdata :
-      dentry->d_parent->d_fsdata;
-  if (!dentry->d_fsdata) {
-    DEBUG_("[Error@cinq_create] no fsnode is specified.\n");
-    return -EINVAL;
+  TRACE_BEGIN_(t);
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, nameidata ? nameidata->path.dentry :
+                      dentry->d_parent, &fs);
+  if (likely(!err)) {
+    err = cinq_mkinode_(dir, dentry, mode | S_IFREG, 0);
+    view_put_(fs);
   }
-  return cinq_mkinode_(dir, dentry, mode | S_IFREG, 0);
+  STAT_END_(CINQ_STAT_CREATE, t, err);
+  TRACE_END_(CINQ_STAT_CREATE, t, i_cnode(dir)->ci_id,
+             fsnode_id(dentry->d_fsdata), err);
+  return err;
 }
 
 int cinq_mknod(struct inode *dir, struct dentry *dentry, int mode, dev_t dev) {
-  dentry->d_fsdata = dentry->d_parent->d_fsdata;
-  if (unlikely(!dentry->d_fsdata)) {
-    DEBUG_("[Error@cinq_mknod] null fsnode for %s under dir %lx.\n",
-           dentry->d_name.name, dir->i_ino);
-    return -EINVAL;
-  }
-  return cinq_mkinode_(dir, dentry, mode, dev);
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, dentry->d_parent, &fs);
+  if (unlikely(err)) return err;
+  err = cinq_mkinode_(dir, dentry, mode, dev);
+  view_put_(fs);
+  return err;
 }
 
 int cinq_symlink(struct inode *dir, struct dentry *dentry,
                  const char *symname) {
-  dentry->d_fsdata = dentry->d_parent->d_fsdata;
-  if (unlikely(!dentry->d_fsdata)) {
-    DEBUG_("[Error@cinq_symlink] no fsnode is specified.\n");
-    return -EINVAL;
-  }
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, dentry->d_parent, &fs);
+  if (unlikely(err)) return err;
   
-  int err = cinq_mkinode_(dir, dentry, S_IFLNK | S_IRWXUGO, 0);
+  err = cinq_mkinode_(dir, dentry, S_IFLNK | S_IRWXUGO, 0);
   if (!err) {
     struct inode *inode = dentry->d_inode;
     struct cinq_tag *tag = i_tag(inode);
     int len = strlen(symname);
     tag->t_symname = (char *)malloc(len + 1);
-    if (!tag->t_symname) return -ENOSPC;
-    strncpy(tag->t_symname, symname, len + 1);
-    DEBUG_("cinq_symlink: symlink to '%s'.\n", tag->t_symname);
+    if (tag->t_symname) {
+      strncpy(tag->t_symname, symname, len + 1);
+      DEBUG_("cinq_symlink: symlink to '%s'.\n", tag->t_symname);
+    } else {
+      err = -ENOSPC;
+    }
   }
+  view_put_(fs);
   return err;
 }
 
-int cinq_mkdir(struct inode *dir, struct dentry *dentry, int mode) {
+static int cinq_do_mkdir_(struct inode *dir, struct dentry *dentry, int mode) {
   mode |= S_IFDIR;
   if (unlikely(inode_meta_root(dir))) { // not actually make dir
 	struct cinq_inode *dir_cnode;
@@ -598,23 +1017,24 @@ int cinq_mkdir(struct inode *dir, struct dentry *dentry, int mode) {
     dir_cnode = i_cnode(dir);
     if (!child_fs) { // makes new file system node
       struct cinq_tag *tag;
-      struct inode *iroot = cinq_get_inode_(dir, mode, 0);
-      if (unlikely(!iroot)) {
-        DEBUG_("[Error@cinq_mkdir] failed to allocate root inode for FS view %s.\n",
-               child_fs->fs_name);
-        return -ENOSPC;
-      }
+      struct inode *iroot;
       child_fs = fsnode_new(parent_fs, child_name);
-      tag = tag_new_(child_fs, iroot, mode >> CINQ_MODE_SHIFT);
+      tag = tag_new_(child_fs, mode >> CINQ_MODE_SHIFT, dir, mode, 0);
       if (unlikely(!tag)) {
         DEBUG_("[Error@cinq_mkdir] failed to allocate root tag for FS view %s.\n",
                child_fs->fs_name);
         return -ENOSPC;
       }
       cnode_add_tag_syn(dir_cnode, tag);
+      iroot = cinq_iget(dir->i_sb, (unsigned long)tag);
+      if (unlikely(!iroot)) {
+        DEBUG_("[Error@cinq_mkdir] failed to allocate root inode for FS view %s.\n",
+               child_fs->fs_name);
+        return -ENOMEM;
+      }
       
       d_instantiate(dentry, iroot);
-      dget(dentry); // extra count to pin the dentry in core
+      dget(dentry); // held by the fsnode as its root
       child_fs->fs_root = dentry;
       dentry->d_fsdata = child_fs; // source of request ID (1)
       dir->i_mtime = dir->i_ctime = CURRENT_TIME;
@@ -632,25 +1052,33 @@ int cinq_mkdir(struct inode *dir, struct dentry *dentry, int mode) {
     }
     return 0;
   }
-               
-  dentry->d_fsdata = dentry->d_parent->d_fsdata; // source of request ID (2)
-  if (unlikely(!dentry->d_fsdata)) {
-   DEBUG_("[Error@cinq_mkdir] null fsnode for %s under dir %lx.\n",
-          dentry->d_name.name, dir->i_ino);
-   return -EINVAL;
-  }
 
-  DEBUG_("<<< cinq_mkdir: new dir %s under inode %lx on cnode %s by %s.\n",
-         dentry->d_name.name, dir->i_ino, i_cnode(dir)->ci_name,
-         ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name);
+  // The view is set from the parent by cinq_mkdir(): source of request ID (2)
   return cinq_mkinode_(dir, dentry, mode, 0);
 }
 
-// Looking up a directory or file
-static inline struct inode *cinq_lookup_(const struct inode *dir,
+int cinq_mkdir(struct inode *dir, struct dentry *dentry, int mode) {
+  TRACE_BEGIN_(t);
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, dentry->d_parent, &fs);
+  if (likely(!err)) {
+    err = cinq_do_mkdir_(dir, dentry, mode);
+    view_put_(fs);
+  }
+  STAT_END_(CINQ_STAT_MKDIR, t, err);
+  TRACE_END_(CINQ_STAT_MKDIR, t, i_cnode(dir)->ci_id,
+             fsnode_id(dentry->d_fsdata), err);
+  return err;
+}
+
+// Looking up a directory or file under the dir of @dir_tag
+static inline struct inode *cinq_lookup_(struct super_block *sb,
+                                         const struct cinq_tag *dir_tag,
                                          const char *name) {
-  struct cinq_inode *parent = i_cnode(dir);
+  struct cinq_inode *parent = dir_tag->t_host;
   struct cinq_fsnode *fs;
+  struct cinq_tag *ino;
+  struct inode *inode;
 
   struct cinq_inode *child = cnode_find_child_syn(parent, name);
   if (unlikely(!child)) {
@@ -659,88 +1087,103 @@ static inline struct inode *cinq_lookup_(const struct inode *dir,
     return NULL;
   }
   
-  fs = i_fs(dir);
+  fs = dir_tag->t_fs;
   if (unlikely(!fs)) {
-    DEBUG_("[Error@cinq_lookup_] fs is NOT found for inode at %p.\n", dir);
+    DEBUG_("[Error@cinq_lookup_] fs is NOT found for tag at %p.\n", dir_tag);
     return NULL;
   }
-  return cnode_lookup_inode(child, fs);
+  ino = cnode_lookup_tag(child, fs);
+  if (!ino) return NULL;
 
-  // Since we directly read meta data in memory, there is no iget-like function.
-  // No inodes are cached or added to super_block inode list.
+  // Inodes are kept in their tags instead of the inode hash.
+  inode = cinq_iget(sb, (unsigned long)ino);
+  return inode ? inode : ERR_PTR(-ENOMEM);
 }
 
-// Refer to definition comments in cinq-meta.h
-struct dentry *cinq_lookup(struct inode *dir, struct dentry *dentry,
-                           struct nameidata *nameidata) {
+static struct dentry *cinq_do_lookup_(struct inode *dir,
+                                      struct dentry *dentry,
+                                      struct nameidata *nameidata) {
   if (dentry->d_name.len >= MAX_NAME_LEN)
     return ERR_PTR(-ENAMETOOLONG);
   char *name = (char *)dentry->d_name.name;
   
   struct inode *inode;
   if (inode_meta_root(dir)) {
-    DEBUG_(">>> cinq_lookup(1): to look up FS view %s.\n", name);
     struct cinq_fsnode *fs = cfs_find_syn(&file_systems, name);
     if (!fs) return NULL;
     inode = fs->fs_root->d_inode;
+    ihold(inode);
     dentry->d_fsdata = fs;
   } else {
     struct cinq_inode *cnode = i_cnode(dir);
-    struct cinq_tag *tag;
+    struct cinq_tag *tag, *dir_tag = i_tag(dir);
+    // Whiteouts and cnodes found here may be taken off by compaction,
+    // and subtrees by a sweep, but are not freed until the exit.
+    const int grace = cinq_grace_enter();
 	// pass the request ID on
 	dentry->d_fsdata = nameidata ?
-	    nameidata->path.dentry->d_fsdata : dentry->d_parent->d_fsdata;
+	    dentry_fs(nameidata->path.dentry) : dentry_fs(dentry->d_parent);
     // Check request FS to prevent overlooking its recent updates
 	tag = cnode_find_tag_syn(cnode, dentry->d_fsdata);
 	if (tag) {
-      if (negative(tag)) return NULL; // the parent is removed
-      dir = tag->t_inode; // change to the view of request FS
+      if (negative(tag)) { // the parent is removed
+        cinq_grace_exit(grace);
+        return NULL;
+      }
+      dir_tag = tag->t_ino; // change to the view of request FS
 	}
-    DEBUG_(">>> cinq_lookup(2): to look up %s by FS %s under inode %lx on cnode %s.\n",
-           name, ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name,
-           dir->i_ino, i_cnode(dir)->ci_name);
-    inode = cinq_lookup_(dir, name);
+    inode = cinq_lookup_(dir->i_sb, dir_tag, name);
+    cinq_grace_exit(grace);
   }
 
-  if (!inode) {
-    DEBUG_("<<< cinq_lookup: FAILED to locate %s by FS %s under inode %lx on cnode %s.\n",
-           dentry->d_name.name, ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name,
-           dir->i_ino, i_cnode(dir)->ci_name);
-    return NULL;
-  }
+  if (!inode || IS_ERR(inode)) return (struct dentry *)inode;
   return d_splice_alias(inode, dentry);
 }
 
+// Refer to definition comments in cinq-meta.h
+struct dentry *cinq_lookup(struct inode *dir, struct dentry *dentry,
+                           struct nameidata *nameidata) {
+  TRACE_BEGIN_(t);
+  struct dentry *ret = cinq_do_lookup_(dir, dentry, nameidata);
+  STAT_END_(CINQ_STAT_LOOKUP, t, IS_ERR(ret));
+  TRACE_END_(CINQ_STAT_LOOKUP, t, i_cnode(dir)->ci_id,
+             fsnode_id(dentry->d_fsdata),
+             IS_ERR(ret) ? PTR_ERR(ret) : (dentry->d_inode ? 0 : -ENOENT));
+  return ret;
+}
+
 // Finds or creates a tag specified by dir and dentry.
-// Associates the tag with the specified inode.
+// Associates the tag with the inode of @ino.
 static int cinq_tag_with_(struct inode *dir, struct dentry *dentry,
-                          struct inode *inode) {
+                          struct cinq_tag *ino) {
   char *name = (char *)dentry->d_name.name;
   struct cinq_inode *dir_cnode = i_cnode(dir);
   struct cinq_fsnode *req_fs = dentry->d_fsdata;
   struct cinq_inode *child;
   struct cinq_tag *tag;
+  int err;
   
-  write_lock(&dir_cnode->ci_children_lock);
+  err = children_write_lock_in(dir_cnode);
+  if (unlikely(err)) return err;
   child = cnode_find_child_(dir_cnode, name);
   if (child) {
+    tags_write_lock(child); // see cinq_mkinode_()
     write_unlock(&dir_cnode->ci_children_lock);
     
-    write_lock(&child->ci_tags_lock);
     tag = cnode_find_tag_(child, req_fs);
     if (!tag) {
-      tag = tag_new_with_(req_fs, inode, CINQ_VISIBLE);
+      tag = tag_new_with_(req_fs, ino, CINQ_VISIBLE);
       if (unlikely(!tag)) wr_release_return(&child->ci_tags_lock, -ENOSPC);
       cnode_add_tag_(child, tag);
     } else {
       DEBUG_("[Warn@cinq_tag_with_] re-link existing entry: %s.\n", name);
-      tag_reset_inode_(tag, inode);
+      tag_reset_ino_(tag, ino);
     }
     write_unlock(&child->ci_tags_lock);
   } else {
     child = cnode_new_(name);
     if (!child) wr_release_return(&dir_cnode->ci_children_lock, -ENOSPC);
-    tag = tag_new_with_(req_fs, inode, CINQ_VISIBLE);
+    tag = tag_new_with_(req_fs, ino, CINQ_VISIBLE);
     if (unlikely(!tag)) wr_release_return(&dir_cnode->ci_children_lock, -ENOSPC);
     cnode_add_tag_(child, tag);
     cnode_add_child_(dir_cnode, child);
@@ -749,8 +1192,8 @@ static int cinq_tag_with_(struct inode *dir, struct dentry *dentry,
   return 0;
 }
 
-int cinq_link(struct dentry *old_dentry, struct inode *dir,
-              struct dentry *dentry) {
+static int cinq_do_link_(struct dentry *old_dentry, struct inode *dir,
+                         struct dentry *dentry) {
   struct inode *inode = old_dentry->d_inode;
   if (unlikely(!inode)) {
     DEBUG_("[Error@cinq_link] link to invalid dentry without inode: %s.\n",
@@ -760,13 +1203,11 @@ int cinq_link(struct dentry *old_dentry, struct inode *dir,
   
   inode->i_ctime = dir->i_ctime = dir->i_mtime = CURRENT_TIME;
   inc_nlink(inode);
-  ihold(inode);
 
-  dentry->d_fsdata = dentry->d_parent->d_fsdata;
-  int err = cinq_tag_with_(dir, dentry, inode);
+  int err = cinq_tag_with_(dir, dentry, i_tag(inode));
   if (!err) {
+    ihold(inode); // for the new dentry
     d_instantiate(dentry, inode);
-    dget(dentry); // extra count to pin the dentry in core
     DEBUG_ON_(S_ISDIR(dentry->d_inode->i_mode),
               "[Warn@cinq_link] link to dir.\n");
     local_inc_ref(dir, dentry);
@@ -774,21 +1215,32 @@ int cinq_link(struct dentry *old_dentry, struct inode *dir,
   }
   
   drop_nlink(inode); // cancel inc_nlink(inode)
-  iput(inode); // cancel ihold(inode)
+  return err;
+}
+
+int cinq_link(struct dentry *old_dentry, struct inode *dir,
+              struct dentry *dentry) {
+  TRACE_BEGIN_(t);
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, dentry->d_parent, &fs);
+  if (likely(!err)) {
+    err = cinq_do_link_(old_dentry, dir, dentry);
+    view_put_(fs);
+  }
+  STAT_END_(CINQ_STAT_LINK, t, err);
+  TRACE_END_(CINQ_STAT_LINK, t, i_cnode(dir)->ci_id,
+             fsnode_id(dentry->d_fsdata), err);
   return err;
 }
 
 // Note that this parameter dentry should be an existing valid one,
 // slightly different from the convention.
-int cinq_unlink(struct inode *dir, struct dentry *dentry) {
+static int cinq_do_unlink_(struct inode *dir, struct dentry *dentry) {
   struct inode *inode = dentry->d_inode;
   struct cinq_inode *dir_cnode = i_cnode(dir);
   struct cinq_inode *cnode = cnode_find_child_syn(dir_cnode, dentry->d_name.name);
   struct cinq_tag *tag;
 
-  DEBUG_("cinq_unlink: to delete %s located on cnode %s\n",
-		  dentry->d_name.name, i_cnode(inode) ? i_cnode(inode)->ci_name : NULL);
-
   if (unlikely(!inode || !cnode)) {
     printk(KERN_ERR "[Error@cinq_unlink] unlink invalid dentry %s "
         "without inode (%p) or cnode (%p).\n",
@@ -796,16 +1248,14 @@ int cinq_unlink(struct inode *dir, struct dentry *dentry) {
     return -EINVAL;
   }
 
-  if (!dentry->d_fsdata) dentry->d_fsdata = dentry->d_parent->d_fsdata;
-
-  write_lock(&cnode->ci_tags_lock);
+  tags_write_lock(cnode);
   tag = cnode_find_tag_(cnode, dentry->d_fsdata);
   if (!tag) {
     tag = tag_new_with_(dentry->d_fsdata, NULL, CINQ_VISIBLE);
     if (unlikely(!tag)) wr_release_return(&cnode->ci_tags_lock, -ENOSPC);
     cnode_add_tag_(cnode, tag);
-  } else if (tag->t_inode) { // delete existing one
-    tag_drop_inode_(tag);
+  } else if (!negative(tag)) { // delete existing one
+    tag_drop_ino_(tag);
     // locking order: chld->ci_tags_lock ==> parent->ci_tags_lock
     local_drop_ref(dir, dentry);
   } else {
@@ -818,11 +1268,26 @@ int cinq_unlink(struct inode *dir, struct dentry *dentry) {
   return 0;
 }
 
+int cinq_unlink(struct inode *dir, struct dentry *dentry) {
+  TRACE_BEGIN_(t);
+  struct cinq_fsnode *fs;
+  int err = view_get_(dentry, dentry->d_fsdata ? dentry : dentry->d_parent,
+                      &fs);
+  if (likely(!err)) {
+    err = cinq_do_unlink_(dir, dentry);
+    view_put_(fs);
+  }
+  STAT_END_(CINQ_STAT_UNLINK, t, err);
+  TRACE_END_(CINQ_STAT_UNLINK, t, i_cnode(dir)->ci_id,
+             fsnode_id(dentry->d_fsdata), err);
+  return err;
+}
+
 static int cinq_empty_dir_(struct cinq_inode *dir_cnode,
                            struct cinq_fsnode *fs) {
   struct cinq_tag *tag;
   int num = 0;
-  read_lock(&dir_cnode->ci_tags_lock);
+  tags_read_lock(dir_cnode);
   foreach_ancestor_tag(fs, tag, dir_cnode) {
     if (tag) {
       num = atomic_read(&tag->t_nchild);
@@ -836,8 +1301,8 @@ static int cinq_empty_dir_(struct cinq_inode *dir_cnode,
 
 int cinq_rmdir(struct inode *dir, struct dentry *dentry) {
   struct inode *inode = dentry->d_inode;
-  if (!dentry->d_fsdata) dentry->d_fsdata = dentry->d_parent->d_fsdata;
-  struct cinq_fsnode *req_fs = dentry->d_fsdata;
+  struct cinq_fsnode *req_fs =
+      dentry_fs(dentry->d_fsdata ? dentry : dentry->d_parent);
   
   struct cinq_inode *cnode = cnode_find_child_syn(i_cnode(dir), dentry->d_name.name);
   if (!cinq_empty_dir_(cnode, req_fs)) {
@@ -859,8 +1324,8 @@ void *cinq_follow_link(struct dentry *dentry, struct nameidata *nd) {
   return NULL;
 }
 
-int cinq_rename(struct inode *old_dir, struct dentry *old_dentry,
-                struct inode *new_dir, struct dentry *new_dentry) {
+static int cinq_do_rename_(struct inode *old_dir, struct dentry *old_dentry,
+                           struct inode *new_dir, struct dentry *new_dentry) {
   struct inode *new_inode = new_dentry->d_inode;
   struct inode *old_inode = old_dentry->d_inode;
   struct cinq_tag *new_tag;
@@ -871,75 +1336,726 @@ int cinq_rename(struct inode *old_dir, struct dentry *old_dentry,
     return -EINVAL;
   }
 
-  DEBUG_("cinq_rename: dentry %s under cnode %p ==> dentry %s under cnode %p\n",
-		  old_dentry->d_name.name, i_cnode(old_dir),
-		  new_dentry->d_name.name, i_cnode(new_dir));
-
   if (new_inode && (new_tag = i_tag(new_inode), new_tag->t_fs == req_fs)) {
     if (S_ISDIR(new_inode->i_mode) && !cinq_empty_dir_(i_cnode(new_inode), req_fs)) {
       DEBUG_("cinq_rename: move to non-empty dir %lx on cnode %s\n",
           new_inode->i_ino, i_cnode(new_inode)->ci_name);
       return -ENOTEMPTY;
     }
-    tag_reset_inode_(new_tag, old_inode);
+    tag_reset_ino_(new_tag, i_tag(old_inode));
   } else {
-	cinq_tag_with_(new_dir, new_dentry, old_inode);
+	cinq_tag_with_(new_dir, new_dentry, i_tag(old_inode));
   }
 
-  cinq_unlink(old_dir, old_dentry);
+  cinq_do_unlink_(old_dir, old_dentry);
   return 0;
 }
 
-static inline int cinq_setsize_(struct inode *inode, loff_t newsize) {
+int cinq_rename(struct inode *old_dir, struct dentry *old_dentry,
+                struct inode *new_dir, struct dentry *new_dentry) {
+  TRACE_BEGIN_(t);
+  struct cinq_fsnode *fs;
+  int err = view_get_(new_dentry, old_dentry, &fs);
+  if (likely(!err)) {
+    err = cinq_do_rename_(old_dir, old_dentry, new_dir, new_dentry);
+    view_put_(fs);
+  }
+  STAT_END_(CINQ_STAT_RENAME, t, err);
+  TRACE_END_(CINQ_STAT_RENAME, t, i_cnode(old_dir)->ci_id,
+             fsnode_id(old_dentry->d_fsdata), err);
+  return err;
+}
 
+static inline int cinq_setsize_(struct inode *inode, loff_t newsize) {
   if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
       S_ISLNK(inode->i_mode)))
     return -EINVAL;
   if (i_tag(inode)->t_symname)
     return -EINVAL;
   
-  inode->i_size = newsize;
+  if (S_ISREG(inode->i_mode)) {
+    cinq_file_truncate(inode, newsize);
+  } else {
+    inode->i_size = newsize;
+  }
   inode->i_mtime = inode->i_ctime = CURRENT_TIME;
 
   return 0;
 }
 
 int cinq_setattr(struct dentry *dentry, struct iattr *attr) {
-  struct inode *inode = dentry->d_inode;
+  struct cinq_fsnode *fs;
+  struct inode *inode = cinq_change_get(dentry, &fs);
   int error;
 
+  if (IS_ERR(inode))
+    return PTR_ERR(inode);
   error = inode_change_ok(inode, attr);
   if (error)
-    return error;
+    goto out;
   
   if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != inode->i_size) {
     error = cinq_setsize_(inode, attr->ia_size);
     if (error)
-      return error;
+      goto out;
   }
   setattr_copy(inode, attr);
   
   DEBUG_("cinq_setattr: set %s(%s) size %lld.\n",
          i_cnode(inode)->ci_name,
          i_tag(inode)->t_fs->fs_name, inode->i_size);
+out:
+  cinq_change_put(inode, fs);
   return error;
 }
 
-#ifdef __KERNEL__
+/* Tiering. A spilled subtree is kept in the tier file as a segment of
+ * a header and the cnodes in pre-order, each followed by its tags, so that
+ * parents are decoded before their children. The file is per mount and
+ * written in host order. */
+
+#define SEG_MAGIC 0x43534547 // "CSEG"
+
+struct seg_head {
+  u32 sh_magic;
+  u32 sh_cnodes;
+};
+
+struct seg_cnode {
+  u32 sc_id; // ci_id, whose slot is held by the stub meanwhile
+  u32 sc_parent; // index in the segment from 1, or 0 for the stub
+  u32 sc_tags;
+  u32 sc_name_len;
+};
+
+struct seg_tag {
+  struct cinq_attr st_attr;
+  u32 st_fs; // fs_id and generation, not to revive tags of a removed view
+  u32 st_fs_gen;
+  u32 st_nchild;
+  u32 st_symlen;
+  u16 st_mode; // enum cinq_visibility
+  u16 st_negative;
+};
+
+// Subtrees detached by cnode_spill() wait here for the flush that ends
+// the sweep, after a grace period. Guarded by the tier mutex.
+struct cnode_limbo_ {
+  struct cinq_inode *children;
+  struct cnode_limbo_ *next;
+};
+
+static struct cnode_limbo_ *limbo_;
+
+static LIST_HEAD(stubs_); // guarded by the tier mutex
+
+static int cnode_cold_(struct cinq_inode *cnode, u32 cutoff, u32 *len) {
+  struct cinq_tag *tag, *tmp;
+  int cold = 1;
+  if (cnode->ci_spill || cnode->ci_index || atomic_read(&cnode->ci_count) ||
+      cnode->ci_atime > cutoff) {
+    return 0;
+  }
+  tags_read_lock(cnode);
+  HASH_ITER(hh, cnode->ci_tags, tag, tmp) {
+    if (tag->t_inode || tag->t_data || atomic_read(&tag->t_count) ||
+        atomic_read(&tag->t_nref) || (tag->t_ino && tag->t_ino != tag)) {
+      cold = 0;
+      break;
+    }
+    *len += sizeof(struct seg_tag);
+    if (tag->t_symname) *len += strlen(tag->t_symname);
+  }
+  read_unlock(&cnode->ci_tags_lock);
+  *len += sizeof(struct seg_cnode) + strlen(cnode->ci_name);
+  return cold;
+}
 
-int init_cnode_cache(void) {
-  cinq_inode_cachep = kmem_cache_create(
-      "cinq_inode_cache", sizeof(struct cinq_inode), 0,
-      (SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD), NULL);
-  if (cinq_inode_cachep == NULL)
-    return -ENOMEM;
+int cnode_cold(struct cinq_inode *cnode, u32 cutoff) {
+  u32 len = 0;
+  return cnode_cold_(cnode, cutoff, &len);
+}
+
+// Checks the hash table of @children and their descendants, adding up
+// the segment size in @len and cnodes in @count.
+static int subtree_cold_(struct cinq_inode *children, u32 cutoff,
+                         u32 *len, u32 *count) {
+  struct cinq_inode *child, *tmp;
+  int cold;
+  HASH_ITER(ci_child, children, child, tmp) {
+    if (!cnode_cold_(child, cutoff, len)) return 0;
+    children_read_lock(child);
+    cold = subtree_cold_(child->ci_children, cutoff, len, count);
+    read_unlock(&child->ci_children_lock);
+    if (!cold) return 0;
+    ++*count;
+  }
+  return 1;
+}
+
+static char *subtree_encode_(struct cinq_inode *children, u32 parent,
+                             char *p, u32 *index) {
+  struct cinq_inode *child, *tmp;
+  struct cinq_tag *tag, *ttmp;
+  struct seg_cnode sc;
+  struct seg_tag st;
+  HASH_ITER(ci_child, children, child, tmp) {
+    sc.sc_id = child->ci_id;
+    sc.sc_parent = parent;
+    sc.sc_tags = HASH_COUNT(child->ci_tags);
+    sc.sc_name_len = strlen(child->ci_name);
+    memcpy(p, &sc, sizeof(sc));
+    memcpy(p += sizeof(sc), child->ci_name, sc.sc_name_len);
+    p += sc.sc_name_len;
+    HASH_ITER(hh, child->ci_tags, tag, ttmp) {
+      memset(&st, 0, sizeof(st));
+      st.st_attr = tag->t_attr;
+      st.st_fs = fsnode_id(tag->t_fs);
+      if (st.st_fs != IDT_NONE) st.st_fs_gen = idtable_gen(&fsnode_ids, st.st_fs);
+      st.st_nchild = atomic_read(&tag->t_nchild);
+      st.st_symlen = tag->t_symname ? strlen(tag->t_symname) : 0;
+      st.st_mode = tag->t_mode;
+      st.st_negative = negative(tag);
+      memcpy(p, &st, sizeof(st));
+      memcpy(p += sizeof(st), tag->t_symname, st.st_symlen);
+      p += st.st_symlen;
+    }
+    p = subtree_encode_(child->ci_children, ++*index, p, index);
+  }
+  return p;
+}
+
+// Points the IDs of the subtree to @stub, or back to themselves if NULL,
+// so that file handles of spilled cnodes lead to the stub to fault in.
+static void subtree_rebind_(struct cinq_inode *children,
+                            struct cinq_inode *stub) {
+  struct cinq_inode *child, *tmp;
+  HASH_ITER(ci_child, children, child, tmp) {
+    idtable_rebind(&cnode_ids, child->ci_id, stub ? stub : child);
+    subtree_rebind_(child->ci_children, stub);
+  }
+}
+
+// Frees the hash table of @children and their descendants.
+static void subtree_free_(struct cinq_inode *children) {
+  struct cinq_inode *child, *tmp;
+  struct cinq_tag *tag, *ttmp;
+  HASH_ITER(ci_child, children, child, tmp) {
+    HASH_ITER(hh, child->ci_tags, tag, ttmp) {
+      HASH_DEL(child->ci_tags, tag);
+      tag_unlist_(tag);
+      if (tag->t_symname) tier_free_(tag->t_symname);
+      tag_free_(tag);
+    }
+    subtree_free_(child->ci_children);
+    HASH_DELETE(ci_child, children, child);
+    cnode_free_(child);
+  }
+}
+
+// Takes the tags under @children out of the lists of their views and
+// counts them as spilled, or, if @spilled is zero, uncounts those read
+// back, which cnode_add_tag_() has listed.
+static void subtree_account_(struct cinq_inode *children, int spilled) {
+  struct cinq_inode *child, *tmp;
+  struct cinq_tag *tag, *ttmp;
+  HASH_ITER(ci_child, children, child, tmp) {
+    HASH_ITER(hh, child->ci_tags, tag, ttmp) {
+      if (spilled) {
+        if (tag_unlist_(tag)) atomic_inc(&tag->t_fs->fs_spilled);
+      } else if (tag->t_fs != META_FS) {
+        atomic_dec(&tag->t_fs->fs_spilled);
+      }
+    }
+    subtree_account_(child->ci_children, spilled);
+  }
+}
+
+long cnode_spill(struct cinq_inode *cnode, u32 cutoff) {
+  struct cinq_spill *spill = tier_malloc_(sizeof(struct cinq_spill));
+  struct cnode_limbo_ *limbo = tier_malloc_(sizeof(struct cnode_limbo_));
+  struct seg_head sh = { SEG_MAGIC, 0 };
+  struct cinq_inode *children;
+  u32 len = sizeof(sh), index = 0, rechecked = 0;
+  char *buf = NULL;
+  int err = 0;
+
+  if (unlikely(!spill || !limbo)) {
+    err = -ENOMEM;
+    goto out;
+  }
+  children_write_lock(cnode);
+  if (cnode->ci_spill || !cnode->ci_children ||
+      !subtree_cold_(cnode->ci_children, cutoff, &len, &sh.sh_cnodes)) {
+    write_unlock(&cnode->ci_children_lock);
+    err = -EBUSY;
+    goto out;
+  }
+  children = cnode->ci_children;
+  cnode->ci_children = NULL;
+  spill->sp_len = len;
+  spill->sp_cnodes = sh.sh_cnodes;
+  cnode->ci_spill = spill; // lookups under it now wait for us to fault
+  write_unlock(&cnode->ci_children_lock);
+  subtree_rebind_(children, cnode);
+
+  buf = seg_malloc_(len);
+  if (unlikely(!buf)) {
+    err = -ENOMEM;
+  } else {
+    memcpy(buf, &sh, sizeof(sh));
+    subtree_encode_(children, 0, buf + sizeof(sh), &index);
+    err = cinq_tier_store(buf, len, &spill->sp_pos);
+  }
+  // One may have got a tag just before the subtree was detached.
+  if (!err && !subtree_cold_(children, cutoff, &len, &rechecked)) {
+    cinq_tier_release(spill->sp_pos, spill->sp_len);
+    err = -EBUSY;
+  }
+  if (err) {
+    children_write_lock(cnode);
+    cnode->ci_children = children;
+    cnode->ci_spill = NULL;
+    write_unlock(&cnode->ci_children_lock);
+    subtree_rebind_(children, NULL);
+    goto out;
+  }
+  subtree_account_(children, 1);
+  limbo->children = children;
+  limbo->next = limbo_;
+  limbo_ = limbo;
+  spill->sp_stub = cnode;
+  list_add(&spill->sp_stubs, &stubs_);
+  spill = NULL;
+  limbo = NULL;
+out:
+  if (spill) tier_free_(spill);
+  if (limbo) tier_free_(limbo);
+  if (buf) seg_free_(buf);
+  return err ? err : sh.sh_cnodes;
+}
+
+int cnode_fault(struct cinq_inode *cnode) {
+  struct cinq_spill *spill = cnode->ci_spill;
+  struct cinq_inode **made = NULL, *children = NULL, *child;
+  struct cinq_fsnode *fs;
+  struct cinq_tag *tag;
+  struct seg_head sh;
+  struct seg_cnode sc;
+  struct seg_tag st;
+  char name[MAX_NAME_LEN + 1];
+  const char *p;
+  char *buf;
+  u32 i, t, now = get_seconds();
+  int err;
+
+  if (!spill) return 0; // by another one meanwhile
+  buf = seg_malloc_(spill->sp_len);
+  made = seg_malloc_((spill->sp_cnodes + 1) * sizeof(*made));
+  if (unlikely(!buf || !made)) {
+    err = -ENOMEM;
+    goto out;
+  }
+  err = cinq_tier_load(buf, spill->sp_len, spill->sp_pos);
+  if (unlikely(err)) goto out;
+  memcpy(&sh, buf, sizeof(sh));
+  if (unlikely(sh.sh_magic != SEG_MAGIC || sh.sh_cnodes != spill->sp_cnodes)) {
+    DEBUG_("[Error@cnode_fault] bad segment at %lld for %s.\n",
+           (long long)spill->sp_pos, cnode->ci_name);
+    err = -EIO;
+    goto out;
+  }
+
+  p = buf + sizeof(sh);
+  for (i = 1; i <= sh.sh_cnodes; ++i) {
+    memcpy(&sc, p, sizeof(sc));
+    memcpy(name, p += sizeof(sc), sc.sc_name_len);
+    name[sc.sc_name_len] = '\0';
+    p += sc.sc_name_len;
+    child = made[i] = cnode_alloc_(name);
+    if (unlikely(!child)) {
+      err = -ENOMEM;
+      goto out;
+    }
+    child->ci_id = sc.sc_id;
+    child->ci_atime = now; // kept in core for an idle period at least
+    if (sc.sc_parent) { // as it was, not indexed
+      HASH_ADD_BY_STR(ci_child, made[sc.sc_parent]->ci_children, ci_name,
+                      child);
+      child->ci_parent = made[sc.sc_parent];
+    } else {
+      HASH_ADD_BY_STR(ci_child, children, ci_name, child);
+      child->ci_parent = cnode;
+    }
+    for (t = 0; t < sc.sc_tags; ++t) {
+      memcpy(&st, p, sizeof(st));
+      p += sizeof(st);
+      fs = st.st_fs == IDT_NONE ? META_FS :
+          idtable_find(&fsnode_ids, st.st_fs, st.st_fs_gen);
+      if (unlikely(!fs)) { // the view is removed
+        p += st.st_symlen;
+        continue;
+      }
+      tag = tag_new_with_(fs, NULL, st.st_mode);
+      if (unlikely(!tag)) {
+        err = -ENOMEM;
+        goto out;
+      }
+      if (!st.st_negative) tag->t_ino = tag;
+      tag->t_attr = st.st_attr;
+      atomic_set(&tag->t_nchild, st.st_nchild);
+      cnode_add_tag_(child, tag);
+      if (st.st_symlen) {
+        tag->t_symname = tier_malloc_(st.st_symlen + 1);
+        if (unlikely(!tag->t_symname)) {
+          err = -ENOMEM;
+          goto out;
+        }
+        memcpy(tag->t_symname, p, st.st_symlen);
+        tag->t_symname[st.st_symlen] = '\0';
+        p += st.st_symlen;
+      }
+    }
+  }
+
+  subtree_account_(children, 0);
+  children_write_lock(cnode);
+  cnode->ci_children = children;
+  cnode->ci_spill = NULL;
+  write_unlock(&cnode->ci_children_lock);
+  list_del(&spill->sp_stubs);
+  for (i = 1; i <= sh.sh_cnodes; ++i) {
+    idtable_rebind(&cnode_ids, made[i]->ci_id, made[i]);
+  }
+  cinq_tier_release(spill->sp_pos, spill->sp_len);
+  tier_free_(spill);
+  children = NULL;
+out:
+  if (children) subtree_free_(children);
+  if (made) seg_free_(made);
+  if (buf) seg_free_(buf);
+  return err;
+}
+
+struct cinq_inode *cnode_any_stub(void) {
+  if (list_empty(&stubs_)) return NULL;
+  return list_entry(stubs_.next, struct cinq_spill, sp_stubs)->sp_stub;
+}
+
+void cnode_limbo_flush(void) {
+  struct cnode_limbo_ *limbo;
+  while ((limbo = limbo_)) {
+    limbo_ = limbo->next;
+    subtree_free_(limbo->children);
+    tier_free_(limbo);
+  }
+}
+
+/* Migration of views (see export.c). Records are made of tags and put
+ * back in place here, while the stream is handled there. */
+
+int cnode_export_tag(struct cinq_tag *tag, struct cinq_export_rec *rec,
+                     struct cinq_tag **link) {
+  struct cinq_inode *host = tag->t_host;
+  struct cinq_tag *ino;
+
+  tags_read_lock(host);
+  if (cnode_find_tag_(host, tag->t_fs) != tag) {
+    rd_release_return(&host->ci_tags_lock, -ENOENT);
+  }
+  ino = tag->t_ino;
+  rec->er_mode = tag->t_mode;
+  rec->er_nchild = atomic_read(&tag->t_nchild);
+  if (!ino) {
+    rec->er_kind = CINQ_EXPORT_WHITEOUT;
+    memset(&rec->er_attr, 0, sizeof(rec->er_attr));
+  } else if (ino == tag) {
+    rec->er_kind = CINQ_EXPORT_INODE;
+    tag_attr_(tag, &rec->er_attr);
+  }
+  read_unlock(&host->ci_tags_lock);
+
+  *link = ino != tag ? ino : NULL;
+  if (ino && ino != tag) { // tags stay, so no need to hold @tag's lock
+    rec->er_kind = CINQ_EXPORT_LINK;
+    tags_read_lock(ino->t_host);
+    tag_attr_(ino, &rec->er_attr);
+    read_unlock(&ino->t_host->ci_tags_lock);
+  }
   return 0;
 }
 
-void destroy_cnode_cache(void) {
-  kmem_cache_destroy(cinq_inode_cachep);
+// Returns the cnode at @path under @root, making the missing ones on the
+// way if @make, or NULL if not found, or ERR_PTR.
+static struct cinq_inode *cnode_walk_(struct cinq_inode *root,
+                                      const char *path, int make) {
+  char name[MAX_NAME_LEN + 1];
+  struct cinq_inode *cnode = root, *child;
+  const char *start = path;
+  const char *end;
+  int len, err;
+
+again:
+  for (; *path; path = end) {
+    if (*path == '/') {
+      end = path + 1;
+      continue;
+    }
+    end = strchr(path, '/');
+    if (!end) end = path + strlen(path);
+    len = end - path;
+    if (unlikely(len > MAX_NAME_LEN)) return ERR_PTR(-ENAMETOOLONG);
+    memcpy(name, path, len);
+    name[len] = '\0';
+
+    err = make ? children_write_lock_in(cnode) : children_read_lock_in(cnode);
+    if (unlikely(err)) return ERR_PTR(err);
+    if (unlikely(!cnode->ci_parent)) { // reaped on the way
+      if (make) write_unlock(&cnode->ci_children_lock);
+      else read_unlock(&cnode->ci_children_lock);
+      cnode = root;
+      path = start;
+      goto again;
+    }
+    child = cnode_find_child_(cnode, name);
+    if (!child && make) {
+      child = cnode_new_(name);
+      if (likely(child)) cnode_add_child_(cnode, child);
+    }
+    if (make) write_unlock(&cnode->ci_children_lock);
+    else read_unlock(&cnode->ci_children_lock);
+    if (!child) return make ? ERR_PTR(-ENOSPC) : NULL;
+    cnode = child;
+  }
+  return cnode;
+}
+
+static struct cinq_tag *cnode_graft_(struct cinq_inode *root,
+                                     struct cinq_fsnode *fs,
+                                     const struct cinq_export_rec *rec,
+                                     const char *path, const char *link,
+                                     const char *symname) {
+  struct cinq_inode *cnode = cnode_walk_(root, path, 1);
+  struct cinq_tag *tag, *ino = NULL;
+  int len;
+
+  if (IS_ERR(cnode)) return (struct cinq_tag *)cnode;
+  if (rec->er_kind == CINQ_EXPORT_LINK) {
+    struct cinq_inode *target = cnode_walk_(root, link, 0);
+    if (IS_ERR(target)) return (struct cinq_tag *)target;
+    if (target) ino = cnode_lookup_tag(target, fs);
+  }
+
+  tags_write_lock(cnode);
+  if (unlikely(!cnode->ci_parent)) { // reaped while bare since the walk
+    write_unlock(&cnode->ci_tags_lock);
+    return cnode_graft_(root, fs, rec, path, link, symname);
+  }
+  tag = cnode_find_tag_(cnode, fs);
+  if (tag) { // the root of the view, or a duplicate
+    if (unlikely(cnode != root || rec->er_kind != CINQ_EXPORT_INODE)) {
+      write_unlock(&cnode->ci_tags_lock);
+      DEBUG_("[Error@cnode_graft] %s has a tag of %s already.\n",
+             path, fs->fs_name);
+      return ERR_PTR(-EEXIST);
+    }
+    if (tag->t_inode) attr_load_(tag->t_inode, &rec->er_attr);
+    else tag->t_attr = rec->er_attr;
+  } else {
+    tag = tag_new_with_(fs, ino, rec->er_mode);
+    if (unlikely(!tag)) {
+      wr_release_return(&cnode->ci_tags_lock, ERR_PTR(-ENOSPC));
+    }
+    if (rec->er_kind != CINQ_EXPORT_WHITEOUT && !ino) { // a copy if unlinked
+      tag->t_ino = tag;
+      tag->t_attr = rec->er_attr;
+    }
+    if (*symname) {
+      len = strlen(symname);
+      tag->t_symname = tier_malloc_(len + 1);
+      if (unlikely(!tag->t_symname)) {
+        write_unlock(&cnode->ci_tags_lock);
+        if (ino) atomic_dec(&ino->t_nref);
+        tag_free_(tag);
+        return ERR_PTR(-ENOSPC);
+      }
+      memcpy(tag->t_symname, symname, len + 1);
+    }
+    cnode_add_tag_(cnode, tag);
+  }
+  tag->t_mode = rec->er_mode;
+  atomic_set(&tag->t_nchild, rec->er_nchild);
+  write_unlock(&cnode->ci_tags_lock);
+  return tag;
+}
+
+// The walks pass cnodes that compaction may take off meanwhile.
+struct cinq_tag *cnode_graft(struct cinq_inode *root, struct cinq_fsnode *fs,
+                             const struct cinq_export_rec *rec,
+                             const char *path, const char *link,
+                             const char *symname) {
+  const int grace = cinq_grace_enter();
+  struct cinq_tag *tag = cnode_graft_(root, fs, rec, path, link, symname);
+  cinq_grace_exit(grace);
+  return tag;
 }
 
+/* Compaction of whiteouts (see compact.c). What is taken off waits here
+ * for the flush that ends the pass, which frees it after a grace period,
+ * as detached subtrees in the limbo are. Guarded by the sweep mutex,
+ * held by cinq_tier_pause(). */
+
+static LIST_HEAD(dead_tags_);
+static struct cinq_inode *dead_cnodes_; // hash table by ci_id
+
+int cnode_reap(struct cinq_tag *tag) {
+  struct cinq_inode *cnode = tag->t_host;
+  struct cinq_inode *parent = cnode->ci_parent;
+  struct cinq_tag *above;
+  int reap, bare = 0;
+
+  if (!negative(tag) || tag->t_fs == META_FS) return 0; // a peek
+  if (cnode_is_root_(cnode)) parent = NULL;
+
+  // The order of cinq_mkinode_(), with the children of @cnode in between
+  // as a walk under it would take them.
+  if (parent) children_write_lock(parent);
+  children_write_lock(cnode);
+  tags_write_lock(cnode);
+  reap = negative(tag) && !tag->t_inode && !atomic_read(&tag->t_nref) &&
+      !atomic_read(&tag->t_count);
+  if (reap && cnode_find_tag_(cnode, tag->t_fs) == tag) {
+    above = cnode_deciding_tag(cnode, tag->t_fs->fs_parent);
+    reap = !above || negative(above);
+    if (reap) cnode_rm_tag_(cnode, tag);
+  } // or replaced by a create already
+  if (reap && parent && !cnode->ci_tags && !cnode->ci_children &&
+      !cnode->ci_index && !cnode->ci_spill &&
+      !atomic_read(&cnode->ci_count)) {
+    cnode_rm_child_(parent, cnode); // clears ci_parent for the walks
+    idtable_free(&cnode_ids, cnode->ci_id);
+    HASH_ADD_BY_PTR(ci_child, dead_cnodes_, ci_id, cnode);
+    bare = 1;
+  }
+  write_unlock(&cnode->ci_tags_lock);
+  write_unlock(&cnode->ci_children_lock);
+  if (parent) write_unlock(&parent->ci_children_lock);
+
+  if (!reap) return 0;
+  tag_unlist_(tag);
+  list_add(&tag->t_fs_tags, &dead_tags_);
+  return 1 + bare;
+}
+
+// Lookups and handle decodes may still be at what was taken off, so the
+// grace period is waited for with sweeps going on.
+long cnode_reap_flush(void) {
+  struct cinq_tag *tag, *tmp;
+  struct cinq_inode *cnodes;
+  LIST_HEAD(tags);
+  long num;
+
+  cinq_tier_pause();
+  list_splice_init(&dead_tags_, &tags);
+  cnodes = dead_cnodes_;
+  dead_cnodes_ = NULL;
+  cinq_tier_resume();
+  if (list_empty(&tags) && !cnodes) return 0;
+
+  cinq_grace_wait();
+  num = HASH_CNT(ci_child, cnodes);
+  list_for_each_entry_safe(tag, tmp, &tags, t_fs_tags) {
+    list_del(&tag->t_fs_tags);
+    cinq_fdata_free(tag->t_data);
+    if (tag->t_symname) tier_free_(tag->t_symname);
+    tag_free_(tag);
+  }
+  subtree_free_(cnodes);
+  return num;
+}
+
+/* Teardown on the executor. The tree is cut at the first depth with a few
+ * subtrees per worker, which are evicted in parallel, and what is left
+ * above them goes on the caller as before. Subtrees only share the locks
+ * of the cnodes above, the fsnode tag lists and the ID table, all taken
+ * as in a running tree, and the list of stubs, which is emptied first. */
+
+#define EVICT_DEPTH_MAX 4
+#define EVICT_SPLIT 4 // subtrees per worker
+
+struct evict_work_ {
+  struct cinq_work ev_work;
+  struct cinq_inode **ev_roots; // shared by all
+  int ev_num;
+  int ev_first; // and every ev_step-th after
+  int ev_step;
+};
+
+// Counts, or gathers into @found if not NULL, the cnodes at @depth below
+// @cnode.
+static int evict_gather_(struct cinq_inode *cnode, int depth,
+                         struct cinq_inode **found) {
+  struct cinq_inode *child;
+  int num = 0;
+  for (child = cnode_next_child(cnode, NULL); child;
+       child = cnode_next_child(cnode, child)) {
+    if (depth) {
+      num += evict_gather_(child, depth - 1, found ? found + num : NULL);
+    } else {
+      if (found) found[num] = child;
+      ++num;
+    }
+  }
+  return num;
+}
+
+static void evict_work_fn_(struct cinq_work *work) {
+  struct evict_work_ *ev = container_of(work, struct evict_work_, ev_work);
+  int i;
+  for (i = ev->ev_first; i < ev->ev_num; i += ev->ev_step) {
+    cnode_evict_all(ev->ev_roots[i]);
+  }
+}
+
+// Like cnode_evict_all(), and as unsafe against anything else.
+void cnode_evict_tree(struct cinq_inode *root) {
+  const int target = cinq_exec_workers() * EVICT_SPLIT;
+  struct cinq_inode **roots = NULL;
+  struct evict_work_ *works = NULL;
+  struct cinq_spill *spill, *tmp;
+  int depth = 0, num = 0, nworks, i;
+
+  list_for_each_entry_safe(spill, tmp, &stubs_, sp_stubs) {
+    list_del_init(&spill->sp_stubs);
+  }
+  if (cinq_exec_workers() > 1) {
+    for (depth = 0; ; ++depth) {
+      num = evict_gather_(root, depth, NULL);
+      if (num >= target || depth == EVICT_DEPTH_MAX - 1) break;
+    }
+  }
+  if (num > 1) roots = seg_malloc_(num * sizeof(struct cinq_inode *));
+  nworks = num < target ? num : target;
+  if (roots) works = tier_malloc_(nworks * sizeof(struct evict_work_));
+  if (works) {
+    evict_gather_(root, depth, roots);
+    for (i = 0; i < nworks; ++i) {
+      cinq_work_init(&works[i].ev_work, evict_work_fn_, CINQ_PRIO_LOW);
+      works[i].ev_roots = roots;
+      works[i].ev_num = num;
+      works[i].ev_first = i;
+      works[i].ev_step = nworks;
+      cinq_exec_submit(&works[i].ev_work);
+    }
+    cinq_exec_flush();
+    tier_free_(works);
+  }
+  if (roots) seg_free_(roots);
+  cnode_evict_all(root);
+}
+
+#ifdef __KERNEL__
+
 int init_tag_cache(void) {
   cinq_tag_cachep = kmem_cache_create(
       "cinq_tag_cache", sizeof(struct cinq_tag), 0,
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  compact.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+#include "thread.h"
+
+/* Compaction of whiteouts. An unlink leaves a negative tag of its view to
+ * hide the name from what the views above have there, but most of those
+ * hide nothing: the name was made in the view itself, as temporary files
+ * are, or is gone above as well. They would stay for good, and make every
+ * lookup through the cnode go over them. A pass goes through the tags of
+ * each view, as a diff does, with sweeps paused, and takes such
+ * whiteouts off, along with those replaced by a create and the cnodes
+ * left bare. It frees them once a grace period has passed over the
+ * lookups that may have found them before. */
+
+static struct cinq_work compact_work_;
+static unsigned int compact_secs_; // between passes, or 0 if not periodic
+static int compact_stop_;
+
+// Seconds between passes in both builds, as only passes free whiteouts
+// and the tags they replace.
+static unsigned int compact_interval = 300;
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+module_param(compact_interval, uint, 0444);
+MODULE_PARM_DESC(compact_interval, "Seconds between whiteout compactions, "
+                 "off if zero");
+
+#endif // __KERNEL__
+
+// Goes through the tags of @fs in the order made. The one after each is
+// taken before the list lock is let go, as only passes unlist them.
+static void compact_view_(struct cinq_fsnode *fs, long *tags, long *cnodes) {
+  struct list_head *pos, *next;
+  int ret;
+
+  spin_lock(&fs->fs_tags_lock);
+  for (pos = fs->fs_tags.next; pos != &fs->fs_tags; pos = next) {
+    next = pos->next;
+    spin_unlock(&fs->fs_tags_lock);
+    ret = cnode_reap(list_entry(pos, struct cinq_tag, t_fs_tags));
+    if (ret) ++*tags;
+    if (ret > 1) ++*cnodes;
+    spin_lock(&fs->fs_tags_lock);
+  }
+  spin_unlock(&fs->fs_tags_lock);
+}
+
+long cinq_compact(void) {
+  struct cinq_fsnode *fs;
+  long tags = 0, cnodes = 0, freed;
+  u32 id;
+
+  cinq_tier_pause();
+  // Frozen views have no name, so all are found by ID.
+  for (id = 1; id < fsnode_ids.limit; ++id) {
+    fs = idtable_get(&fsnode_ids, id);
+    if (fs) compact_view_(fs, &tags, &cnodes);
+  }
+  cinq_tier_resume();
+  freed = cnode_reap_flush();
+  DEBUG_ON_(tags || freed, "cinq_compact: took off %ld whiteouts and %ld "
+            "cnodes, freed %ld cnodes.\n", tags, cnodes, freed);
+  return tags;
+}
+
+static void compact_work_fn_(struct cinq_work *work) {
+  cinq_compact();
+  if (!compact_stop_) cinq_exec_later(work, compact_secs_);
+}
+
+void cinq_compact_init(void) {
+  if (compact_interval) cinq_compact_start(compact_interval);
+}
+
+void cinq_compact_start(unsigned int interval_secs) {
+  if (!interval_secs || compact_secs_) return;
+  compact_secs_ = interval_secs;
+  compact_stop_ = 0;
+  cinq_work_init(&compact_work_, compact_work_fn_, CINQ_PRIO_LOW);
+  cinq_exec_later(&compact_work_, interval_secs);
+}
+
+// Frees what a cancelled pass may have left, before the views and
+// cnodes go.
+void cinq_compact_fini(void) {
+  if (compact_secs_) {
+    compact_stop_ = 1;
+    cinq_exec_cancel(&compact_work_);
+    compact_secs_ = 0;
+  }
+  cnode_reap_flush();
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  diff.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+
+/* Differences of a view from one of its ancestors. What a view sees on a
+ * cnode is decided by the first tag found going up from it, so the two
+ * views can only differ on cnodes tagged by the view or one between it
+ * and the ancestor. Those tags are listed in their fsnodes, and each
+ * cnode is reported once, for the tag the view sees there.
+ *
+ * An entry is modified when the view sees it as a different inode than
+ * the base does: a copy made by cinq_change_get() on the first write or
+ * setattr in the view, or a file created again over the name. Contents
+ * and attributes are not compared, so a change that was undone, or a
+ * setattr to the same values, still shows. Changes made in place to an
+ * inode the two views share (one named by links) show in neither. */
+
+static int diff_tag_(struct cinq_tag *tag, struct cinq_fsnode *fs,
+                     struct cinq_fsnode *base, cinq_diff_fn fn, void *arg) {
+  struct cinq_inode *cnode = tag->t_host;
+  struct cinq_tag *old = NULL;
+  int seen;
+
+  tags_read_lock(cnode);
+  seen = cnode_deciding_tag(cnode, fs) == tag;
+  if (seen && base != META_FS) old = cnode_deciding_tag(cnode, base);
+  read_unlock(&cnode->ci_tags_lock);
+  if (!seen) return 0; // covered by a nearer view or replaced
+
+  if (!negative(tag)) {
+    if (!old || negative(old)) return fn(arg, cnode, tag, CINQ_DIFF_ADDED);
+    if (old->t_ino != tag->t_ino) {
+      return fn(arg, cnode, tag, CINQ_DIFF_MODIFIED);
+    }
+  } else if (old && !negative(old)) {
+    return fn(arg, cnode, tag, CINQ_DIFF_REMOVED);
+  }
+  return 0;
+}
+
+// Goes through the tags of @own in the order made. The list lock is let
+// go around each one, which stays listed as nothing is spilled meanwhile.
+static int diff_view_(struct cinq_fsnode *own, struct cinq_fsnode *fs,
+                      struct cinq_fsnode *base, cinq_diff_fn fn, void *arg) {
+  struct list_head *pos;
+  int ret;
+
+  spin_lock(&own->fs_tags_lock);
+  for (pos = own->fs_tags.next; pos != &own->fs_tags; pos = pos->next) {
+    spin_unlock(&own->fs_tags_lock);
+    ret = diff_tag_(list_entry(pos, struct cinq_tag, t_fs_tags),
+                    fs, base, fn, arg);
+    if (ret) return ret;
+    spin_lock(&own->fs_tags_lock);
+  }
+  spin_unlock(&own->fs_tags_lock);
+  return 0;
+}
+
+int cinq_view_diff(struct cinq_fsnode *fs, struct cinq_fsnode *base,
+                   cinq_diff_fn fn, void *arg) {
+  struct cinq_fsnode *own;
+  int ret = 0;
+
+  for (own = fs; own != base; own = own->fs_parent) {
+    if (unlikely(own == META_FS)) {
+      DEBUG_("[Error@cinq_view_diff] %s is not an ancestor of %s.\n",
+             base->fs_name, fs->fs_name);
+      return -EINVAL;
+    }
+  }
+
+  cinq_tier_pause();
+  for (own = fs; own != base; own = own->fs_parent) {
+    if (atomic_read(&own->fs_spilled)) {
+      ret = cinq_tier_fault_all();
+      break;
+    }
+  }
+  for (own = fs; !ret && own != base; own = own->fs_parent) {
+    ret = diff_view_(own, fs, base, fn, arg);
+  }
+  cinq_tier_resume();
+  return ret;
+}
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  dirblk.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+
+/* Sorted children of big directories. A directory moves its children
+ * from the hash table into an index once it has cinq_dirindex_min of
+ * them, and keeps the index from then on. The index is an array of
+ * blocks in name order, each of up to CINQ_DIRBLK_ENTRIES children like
+ * a leaf of a B+-tree. A name in a block is coded as the length of the
+ * prefix it shares with the name before it, the length of the rest, and
+ * the rest. So the first name of a block is whole and serves as the key
+ * in the binary search over blocks, and the others are decoded in turn.
+ * Blocks are sized to their content and rewritten on every change, and
+ * are not merged, as a sparse one costs little.
+ * The index adds to the memory of a directory rather than saving it. The
+ * names here are copies of the ci_name of the children, kept together for
+ * the locality of lookup and readdir, and the children keep their hash
+ * handles, unused while indexed.
+ * All calls are made under the children lock of the directory. */
+
+unsigned int cinq_dirindex_min = 1024;
+
+// Children by name, followed by their coded names
+struct cinq_dirblk {
+  u16 db_count;
+  u16 db_bytes; // of the coded names
+  struct cinq_inode *db_cnodes[];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+module_param_named(dir_index_min, cinq_dirindex_min, uint, 0644);
+MODULE_PARM_DESC(dir_index_min, "Children to index a directory at, 0 for never");
+
+// Never short of memory, the same as the hash tables of children
+#define dirblk_malloc_(n) (kmalloc(n, GFP_KERNEL | __GFP_NOFAIL))
+#define dirblk_realloc_(p, n) (krealloc(p, n, GFP_KERNEL | __GFP_NOFAIL))
+#define dirblk_free_(p) (kfree(p))
+
+#else
+
+static inline void *dirblk_check_(void *p) {
+  if (unlikely(!p)) uthash_fatal("out of memory");
+  return p;
+}
+
+#define dirblk_malloc_(n) (dirblk_check_(malloc(n)))
+#define dirblk_realloc_(p, n) (dirblk_check_(realloc(p, n)))
+#define dirblk_free_(p) (free(p))
+
+#endif // __KERNEL__
+
+static inline unsigned char *blk_names_(const struct cinq_dirblk *blk) {
+  return (unsigned char *)(blk->db_cnodes + blk->db_count);
+}
+
+static struct cinq_dirblk *blk_alloc_(int count, int bytes) {
+  struct cinq_dirblk *blk = dirblk_malloc_(sizeof(struct cinq_dirblk) +
+      count * sizeof(struct cinq_inode *) + bytes);
+  blk->db_count = count;
+  blk->db_bytes = bytes;
+  return blk;
+}
+
+static inline int name_cmp_(const char *a, int a_len,
+                            const char *b, int b_len) {
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  return cmp ? cmp : a_len - b_len;
+}
+
+// Decodes the name at @pos->dp_off of @blk, moving the offset past it.
+static inline void pos_decode_(struct cinq_dirpos *pos,
+                               const struct cinq_dirblk *blk) {
+  const unsigned char *p = blk_names_(blk) + pos->dp_off;
+  memcpy(pos->dp_name + p[0], p + 2, p[1]);
+  pos->dp_len = p[0] + p[1];
+  pos->dp_name[pos->dp_len] = '\0';
+  pos->dp_off += 2 + p[1];
+}
+
+// Returns the last block whose first name is not greater than @name,
+// or the first block.
+static u32 index_search_(const struct cinq_dirindex *index,
+                         const char *name, int len) {
+  u32 lo = 0, hi = index->di_nblks, mid;
+  const unsigned char *first;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    first = blk_names_(index->di_blks[mid]);
+    if (name_cmp_((const char *)first + 2, first[1], name, len) <= 0) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Positions @pos at the first entry of block @b not less than @name,
+// or past the last one. Returns 0 if the entry has @name.
+static int blk_seek_(const struct cinq_dirindex *index, u32 b,
+                     const char *name, int len, struct cinq_dirpos *pos) {
+  const struct cinq_dirblk *blk = index->di_blks[b];
+  int cmp;
+  pos->dp_blk = b;
+  pos->dp_off = 0;
+  for (pos->dp_ent = 0; pos->dp_ent < blk->db_count; ++pos->dp_ent) {
+    pos_decode_(pos, blk);
+    cmp = name_cmp_(pos->dp_name, pos->dp_len, name, len);
+    if (cmp >= 0) return cmp;
+  }
+  return 1;
+}
+
+// Returns the child at @pos, moving to the next block if @pos is past
+// the end of its own, or NULL if there is no more.
+static struct cinq_inode *pos_child_(const struct cinq_dirindex *index,
+                                     struct cinq_dirpos *pos) {
+  const struct cinq_dirblk *blk = index->di_blks[pos->dp_blk];
+  if (pos->dp_ent < blk->db_count) return blk->db_cnodes[pos->dp_ent];
+  if (++pos->dp_blk >= index->di_nblks) return NULL;
+  blk = index->di_blks[pos->dp_blk];
+  pos->dp_ent = pos->dp_off = 0;
+  pos_decode_(pos, blk);
+  return blk->db_cnodes[0];
+}
+
+// Codes names into a block, or just adds up their size if @blk is null.
+struct blk_writer_ {
+  struct cinq_dirblk *blk;
+  int count;
+  int bytes;
+  int len; // of the last name
+  char last[MAX_NAME_LEN + 1];
+};
+
+static void writer_put_(struct blk_writer_ *w, const char *name, int len,
+                        struct cinq_inode *cnode) {
+  const int max = w->count ? (len < w->len ? len : w->len) : 0;
+  int shared = 0;
+  unsigned char *p;
+  while (shared < max && name[shared] == w->last[shared]) ++shared;
+  if (w->blk) {
+    p = blk_names_(w->blk) + w->bytes;
+    p[0] = shared;
+    p[1] = len - shared;
+    memcpy(p + 2, name + shared, len - shared);
+    w->blk->db_cnodes[w->count] = cnode;
+  }
+  memcpy(w->last + shared, name + shared, len - shared);
+  w->len = len;
+  w->bytes += 2 + len - shared;
+  ++w->count;
+}
+
+// Puts the entries of @blk through @w[0] for the first @split of them
+// and through @w[1] for the rest, with @cnode in at entry @at, or entry
+// @at left out if @cnode is null.
+static void blk_stream_(const struct cinq_dirblk *blk, int at,
+                        struct cinq_inode *cnode, int split,
+                        struct blk_writer_ *w, struct cinq_dirpos *pos) {
+  int i, n = 0;
+  pos->dp_off = 0;
+  for (i = 0; i <= blk->db_count; ++i) {
+    if (i == at && cnode) {
+      writer_put_(&w[n++ >= split], cnode->ci_name, strlen(cnode->ci_name),
+                  cnode);
+    }
+    if (i == blk->db_count) break;
+    pos_decode_(pos, blk);
+    if (i == at && !cnode) continue;
+    writer_put_(&w[n++ >= split], pos->dp_name, pos->dp_len,
+                blk->db_cnodes[i]);
+  }
+}
+
+static void index_put_blk_(struct cinq_dirindex *index, u32 b,
+                           struct cinq_dirblk *blk) {
+  if (index->di_nblks == index->di_cap) {
+    index->di_cap = index->di_cap ? index->di_cap * 2 : 4;
+    index->di_blks = dirblk_realloc_(index->di_blks,
+        index->di_cap * sizeof(struct cinq_dirblk *));
+  }
+  memmove(index->di_blks + b + 1, index->di_blks + b,
+          (index->di_nblks - b) * sizeof(struct cinq_dirblk *));
+  index->di_blks[b] = blk;
+  ++index->di_nblks;
+}
+
+// Rewrites block @b with @cnode put in at entry @at, or entry @at left
+// out if @cnode is null, splitting the block in halves when it is full.
+static void index_rewrite_(struct cinq_dirindex *index, u32 b, int at,
+                           struct cinq_inode *cnode) {
+  struct cinq_dirblk *old = index->di_blks[b];
+  const int n = old->db_count + (cnode ? 1 : -1);
+  const int split = n > CINQ_DIRBLK_ENTRIES ? n / 2 : n;
+  struct blk_writer_ w[2];
+  struct cinq_dirpos pos;
+  int i;
+
+  w[0].blk = w[1].blk = NULL;
+  w[0].count = w[1].count = w[0].bytes = w[1].bytes = 0;
+  blk_stream_(old, at, cnode, split, w, &pos); // sizes the blocks
+  for (i = 0; i < 2; ++i) {
+    if (w[i].count) w[i].blk = blk_alloc_(w[i].count, w[i].bytes);
+    w[i].count = w[i].bytes = 0;
+  }
+  blk_stream_(old, at, cnode, split, w, &pos);
+
+  if (w[0].blk) {
+    index->di_blks[b] = w[0].blk;
+  } else {
+    memmove(index->di_blks + b, index->di_blks + b + 1,
+            (--index->di_nblks - b) * sizeof(struct cinq_dirblk *));
+  }
+  if (w[1].blk) index_put_blk_(index, b + 1, w[1].blk);
+  dirblk_free_(old);
+}
+
+struct cinq_dirindex *dirindex_new(void) {
+  struct cinq_dirindex *index = dirblk_malloc_(sizeof(struct cinq_dirindex));
+  memset(index, 0, sizeof(struct cinq_dirindex));
+  return index;
+}
+
+void dirindex_free(struct cinq_dirindex *index) {
+  u32 b;
+  for (b = 0; b < index->di_nblks; ++b) {
+    dirblk_free_(index->di_blks[b]);
+  }
+  if (index->di_blks) dirblk_free_(index->di_blks);
+  dirblk_free_(index);
+}
+
+struct cinq_inode *dirindex_find(const struct cinq_dirindex *index,
+                                 const char *name) {
+  const int len = strlen(name);
+  struct cinq_dirpos pos;
+  if (unlikely(!index->di_nblks)) return NULL;
+  if (blk_seek_(index, index_search_(index, name, len), name, len, &pos)) {
+    return NULL;
+  }
+  return index->di_blks[pos.dp_blk]->db_cnodes[pos.dp_ent];
+}
+
+void dirindex_insert(struct cinq_dirindex *index, struct cinq_inode *cnode) {
+  const int len = strlen(cnode->ci_name);
+  struct cinq_dirpos pos;
+  u32 b;
+  if (unlikely(!index->di_nblks)) {
+    index_put_blk_(index, 0, blk_alloc_(0, 0));
+  }
+  b = index_search_(index, cnode->ci_name, len);
+  if (unlikely(!blk_seek_(index, b, cnode->ci_name, len, &pos))) {
+    DEBUG_("[Error@dirindex_insert] %s is in the index already.\n",
+           cnode->ci_name);
+    return;
+  }
+  index_rewrite_(index, b, pos.dp_ent, cnode);
+  ++index->di_count;
+}
+
+void dirindex_remove(struct cinq_dirindex *index, struct cinq_inode *cnode) {
+  const int len = strlen(cnode->ci_name);
+  struct cinq_dirpos pos;
+  u32 b;
+  if (likely(index->di_nblks)) {
+    b = index_search_(index, cnode->ci_name, len);
+    if (!blk_seek_(index, b, cnode->ci_name, len, &pos) &&
+        index->di_blks[b]->db_cnodes[pos.dp_ent] == cnode) {
+      index_rewrite_(index, b, pos.dp_ent, NULL);
+      --index->di_count;
+      return;
+    }
+  }
+  DEBUG_("[Error@dirindex_remove] %s is not in the index.\n", cnode->ci_name);
+}
+
+struct cinq_inode *dirindex_seek(const struct cinq_dirindex *index,
+                                 const char *name, struct cinq_dirpos *pos) {
+  if (unlikely(!index->di_nblks)) return NULL;
+  if (name) {
+    const int len = strlen(name);
+    blk_seek_(index, index_search_(index, name, len), name, len, pos);
+  } else {
+    pos->dp_blk = pos->dp_ent = pos->dp_off = 0;
+    pos_decode_(pos, index->di_blks[0]);
+  }
+  return pos_child_(index, pos);
+}
+
+struct cinq_inode *dirindex_next(const struct cinq_dirindex *index,
+                                 struct cinq_dirpos *pos) {
+  const struct cinq_dirblk *blk = index->di_blks[pos->dp_blk];
+  if (++pos->dp_ent < blk->db_count) pos_decode_(pos, blk);
+  return pos_child_(index, pos);
+}
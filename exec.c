@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  exec.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+#include "thread.h"
+
+/* Work-stealing executor of background work. Each worker has a deque per
+ * priority under its own lock. A work submitted by a worker goes to its
+ * own deque, where it is taken newest first while the data is still warm,
+ * and others go round-robin. An idle worker steals the oldest work of the
+ * highest priority found on any deque, so a burst submitted at one place
+ * spreads over all. Delayed works wait on a list of their own and are
+ * moved to the deques by whichever worker finds them due. Workers run
+ * what is queued before they stop. */
+
+struct exec_worker_ {
+  struct list_head ew_deque[CINQ_NUM_PRIOS];
+  spinlock_t ew_lock;
+  struct cinq_work *ew_current; // running, see cinq_exec_cancel()
+  struct thread_task ew_thread;
+  int ew_index;
+  char ew_name[24];
+};
+
+static struct exec_worker_ exec_workers_[CINQ_EXEC_MAX_WORKERS];
+static int exec_num_; // of workers, or 0 if works run on the submitter
+static atomic_t exec_next_; // for round-robin
+static atomic_t exec_queued_; // on the deques
+static atomic_t exec_pending_; // queued or running
+static LIST_HEAD(exec_delayed_);
+static unsigned long exec_due_; // the earliest of the delayed
+static int exec_stop_;
+
+#ifdef __KERNEL__
+
+#include <linux/cpumask.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+
+static DEFINE_SPINLOCK(exec_delay_lock_);
+static DECLARE_WAIT_QUEUE_HEAD(exec_wait_);
+static DECLARE_WAIT_QUEUE_HEAD(exec_done_);
+
+#define exec_mb_() smp_mb()
+#define exec_cpus_() num_online_cpus()
+#define exec_should_stop_() kthread_should_stop()
+#define exec_wake_() wake_up(&exec_wait_)
+#define exec_done_wake_() wake_up_all(&exec_done_)
+#define exec_done_wait_(cond) wait_event(exec_done_, cond)
+
+static struct exec_worker_ *exec_self_(void) {
+  int i;
+  for (i = 0; i < exec_num_; ++i) {
+    if (exec_workers_[i].ew_thread.thread == current) return &exec_workers_[i];
+  }
+  return NULL;
+}
+
+// Sleeps up to a second, after which delayed works may be due.
+static void exec_idle_wait_(void) {
+  wait_event_interruptible_timeout(exec_wait_, atomic_read(&exec_queued_) ||
+                                   kthread_should_stop(), HZ);
+}
+
+#else
+
+static spinlock_t exec_delay_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static mutex_t exec_wait_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exec_wait_ = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t exec_done_ = PTHREAD_COND_INITIALIZER;
+static atomic_t exec_idle_; // workers in exec_idle_wait_()
+static atomic_t exec_waiters_; // in exec_done_wait_()
+static __thread struct exec_worker_ *exec_current_;
+
+#define exec_mb_() __sync_synchronize()
+#define exec_cpus_() ((int)sysconf(_SC_NPROCESSORS_ONLN))
+#define exec_should_stop_() exec_stop_
+#define exec_self_() exec_current_
+
+// Either side counts itself in before it checks the other, so the lock
+// is only taken when someone sleeps.
+static void exec_idle_wait_(void) {
+  struct timespec ts = { .tv_sec = time(NULL) + 1, .tv_nsec = 0 };
+  mutex_lock(&exec_wait_lock_);
+  atomic_inc(&exec_idle_);
+  if (!atomic_read(&exec_queued_) && !exec_stop_) {
+    pthread_cond_timedwait(&exec_wait_, &exec_wait_lock_, &ts);
+  }
+  atomic_dec(&exec_idle_);
+  mutex_unlock(&exec_wait_lock_);
+}
+
+static void exec_wake_(void) {
+  if (!atomic_read(&exec_idle_)) return;
+  mutex_lock(&exec_wait_lock_);
+  pthread_cond_signal(&exec_wait_);
+  mutex_unlock(&exec_wait_lock_);
+}
+
+static void exec_done_wake_(void) {
+  if (!atomic_read(&exec_waiters_)) return;
+  mutex_lock(&exec_wait_lock_);
+  pthread_cond_broadcast(&exec_done_);
+  mutex_unlock(&exec_wait_lock_);
+}
+
+#define exec_done_wait_(cond) do { \
+  mutex_lock(&exec_wait_lock_); \
+  atomic_inc(&exec_waiters_); \
+  while (!(cond)) pthread_cond_wait(&exec_done_, &exec_wait_lock_); \
+  atomic_dec(&exec_waiters_); \
+  mutex_unlock(&exec_wait_lock_); \
+} while (0)
+
+#endif // __KERNEL__
+
+// @work is marked queued by the caller.
+static void exec_enqueue_(struct cinq_work *work) {
+  struct exec_worker_ *ew = exec_self_();
+  if (!ew) {
+    ew = &exec_workers_[(unsigned int)atomic_inc_return(&exec_next_) %
+                        exec_num_];
+  }
+  atomic_inc(&exec_pending_);
+  spin_lock(&ew->ew_lock);
+  list_add_tail(&work->w_list, &ew->ew_deque[work->w_prio]);
+  spin_unlock(&ew->ew_lock);
+  atomic_inc(&exec_queued_);
+  exec_mb_();
+  exec_wake_();
+}
+
+// Takes the newest work of @self or the oldest of another, whichever has
+// the higher priority. The work is idle from then on, but listed as the
+// current one of @self before, so a cancel finds it one way or the other.
+static struct cinq_work *exec_take_(struct exec_worker_ *self) {
+  struct exec_worker_ *ew;
+  struct list_head *deque;
+  struct cinq_work *work;
+  int prio, i;
+
+  if (!atomic_read(&exec_queued_)) return NULL;
+  for (prio = 0; prio < CINQ_NUM_PRIOS; ++prio) {
+    for (i = 0; i < exec_num_; ++i) {
+      ew = &exec_workers_[(self->ew_index + i) % exec_num_];
+      deque = &ew->ew_deque[prio];
+      if (list_empty(deque)) continue; // peeks without the lock
+      spin_lock(&ew->ew_lock);
+      if (list_empty(deque)) {
+        spin_unlock(&ew->ew_lock);
+        continue;
+      }
+      work = list_entry(ew == self ? deque->prev : deque->next,
+                        struct cinq_work, w_list);
+      list_del_init(&work->w_list);
+      self->ew_current = work;
+      exec_mb_();
+      atomic_set(&work->w_state, CINQ_WORK_IDLE);
+      spin_unlock(&ew->ew_lock);
+      atomic_dec(&exec_queued_);
+      return work;
+    }
+  }
+  return NULL;
+}
+
+static void exec_run_(struct exec_worker_ *self, struct cinq_work *work) {
+  work->w_fn(work);
+  self->ew_current = NULL;
+  exec_mb_();
+  atomic_dec(&exec_pending_);
+  exec_done_wake_();
+}
+
+// Moves the delayed works that are due to the deques.
+static void exec_promote_(void) {
+  const unsigned long now = get_seconds();
+  struct cinq_work *work, *tmp;
+
+  if (now < exec_due_) return; // racy but rechecked within a second
+  spin_lock(&exec_delay_lock_);
+  exec_due_ = ~0UL;
+  list_for_each_entry_safe(work, tmp, &exec_delayed_, w_list) {
+    if (work->w_due <= now) {
+      list_del_init(&work->w_list);
+      atomic_set(&work->w_state, CINQ_WORK_QUEUED);
+      exec_enqueue_(work);
+    } else if (work->w_due < exec_due_) {
+      exec_due_ = work->w_due;
+    }
+  }
+  spin_unlock(&exec_delay_lock_);
+}
+
+static THREAD_FUNC_(exec_worker_)(void *data) {
+  struct exec_worker_ *self = data;
+  struct cinq_work *work;
+#ifndef __KERNEL__
+  exec_current_ = self;
+#endif
+  while (!exec_should_stop_()) {
+    exec_promote_();
+    work = exec_take_(self);
+    if (work) {
+      exec_run_(self, work);
+    } else {
+      exec_idle_wait_();
+    }
+  }
+  while ((work = exec_take_(self))) { // drains before it goes
+    exec_run_(self, work);
+  }
+  THREAD_RETURN_;
+}
+
+void cinq_exec_init(void) {
+  struct exec_worker_ *ew;
+  int num = exec_cpus_(), i, prio;
+
+  if (exec_num_) return;
+  if (num < 1) num = 1;
+  if (num > CINQ_EXEC_MAX_WORKERS) num = CINQ_EXEC_MAX_WORKERS;
+  exec_stop_ = 0;
+  exec_due_ = ~0UL;
+  atomic_set(&exec_next_, 0);
+  atomic_set(&exec_queued_, 0);
+  atomic_set(&exec_pending_, 0);
+  for (i = 0; i < num; ++i) {
+    ew = &exec_workers_[i];
+    for (prio = 0; prio < CINQ_NUM_PRIOS; ++prio) {
+      INIT_LIST_HEAD(&ew->ew_deque[prio]);
+    }
+    spin_lock_init(&ew->ew_lock);
+    ew->ew_current = NULL;
+    ew->ew_index = i;
+    snprintf(ew->ew_name, sizeof(ew->ew_name), "cinquain-exec%d", i);
+    thread_init(&ew->ew_thread, exec_worker_, ew, ew->ew_name);
+  }
+  exec_num_ = num;
+  for (i = 0; i < num; ++i) {
+    thread_run(&exec_workers_[i].ew_thread);
+  }
+  DEBUG_("cinq_exec_init: %d workers.\n", num);
+}
+
+// Delayed works are dropped, as their owners have cancelled them by now.
+void cinq_exec_fini(void) {
+  struct cinq_work *work, *tmp;
+  int i;
+
+  if (!exec_num_) return;
+  spin_lock(&exec_delay_lock_);
+  list_for_each_entry_safe(work, tmp, &exec_delayed_, w_list) {
+    list_del_init(&work->w_list);
+    atomic_set(&work->w_state, CINQ_WORK_IDLE);
+  }
+  spin_unlock(&exec_delay_lock_);
+
+  exec_stop_ = 1;
+#ifndef __KERNEL__
+  mutex_lock(&exec_wait_lock_);
+  pthread_cond_broadcast(&exec_wait_);
+  mutex_unlock(&exec_wait_lock_);
+#endif
+  for (i = 0; i < exec_num_; ++i) {
+    thread_stop(&exec_workers_[i].ew_thread);
+  }
+  exec_num_ = 0;
+}
+
+int cinq_exec_workers(void) {
+  return exec_num_;
+}
+
+// Returns 0 if @work is pending already. Without workers it runs here.
+int cinq_exec_submit(struct cinq_work *work) {
+  if (atomic_cmpxchg(&work->w_state, CINQ_WORK_IDLE, CINQ_WORK_QUEUED) !=
+      CINQ_WORK_IDLE) {
+    return 0;
+  }
+  if (unlikely(!exec_num_)) {
+    atomic_set(&work->w_state, CINQ_WORK_IDLE);
+    work->w_fn(work);
+    return 1;
+  }
+  exec_enqueue_(work);
+  return 1;
+}
+
+// Queues @work in about @secs seconds. Returns 0 if it is pending already.
+int cinq_exec_later(struct cinq_work *work, unsigned int secs) {
+  int ret = 0;
+  if (!secs) return cinq_exec_submit(work);
+  spin_lock(&exec_delay_lock_);
+  if (atomic_cmpxchg(&work->w_state, CINQ_WORK_IDLE, CINQ_WORK_DELAYED) ==
+      CINQ_WORK_IDLE) {
+    work->w_due = get_seconds() + secs;
+    if (work->w_due < exec_due_) exec_due_ = work->w_due;
+    list_add_tail(&work->w_list, &exec_delayed_);
+    ret = 1;
+  }
+  spin_unlock(&exec_delay_lock_);
+  return ret;
+}
+
+static int exec_running_(struct cinq_work *work) {
+  int i;
+  exec_mb_();
+  for (i = 0; i < exec_num_; ++i) {
+    if (exec_workers_[i].ew_current == work) return 1;
+  }
+  return 0;
+}
+
+// Takes @work off if delayed, or else waits until it has run. An owner
+// that resubmits its work should tell it not to before. Not to be called
+// from the work itself.
+void cinq_exec_cancel(struct cinq_work *work) {
+  for (;;) {
+    spin_lock(&exec_delay_lock_);
+    if (atomic_read(&work->w_state) == CINQ_WORK_DELAYED) {
+      list_del_init(&work->w_list);
+      atomic_set(&work->w_state, CINQ_WORK_IDLE);
+    }
+    spin_unlock(&exec_delay_lock_);
+    if (atomic_read(&work->w_state) == CINQ_WORK_IDLE &&
+        !exec_running_(work)) {
+      return;
+    }
+    exec_done_wait_(atomic_read(&work->w_state) != CINQ_WORK_QUEUED &&
+                    !exec_running_(work));
+  }
+}
+
+// Waits until nothing is queued or running. Delayed works are not waited
+// for. Not to be called from a work.
+void cinq_exec_flush(void) {
+  exec_done_wait_(!atomic_read(&exec_pending_));
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  export.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+
+/* Migration of a view between metadata servers. What a view adds to the
+ * tree is all in its tags: cnodes are shared and made on demand, and the
+ * rest is seen through its ancestors. So an export is the list of its
+ * tags with their paths, and an import makes the view and grafts each
+ * tag at its path. Tags are listed in the order made, which puts parents
+ * before children and inodes before their links. Both ends hold a single
+ * record at a time, whatever the size of the view. */
+
+#define EXPORT_BUF_LEN (sizeof(struct cinq_export_rec) + \
+    3 * (CINQ_EXPORT_PATH_MAX + 1))
+
+#ifdef __KERNEL__
+
+#define export_malloc_() (kmalloc(EXPORT_BUF_LEN, GFP_KERNEL))
+#define export_free_(p) (kfree(p))
+
+#else
+
+#define export_malloc_() (malloc(EXPORT_BUF_LEN))
+#define export_free_(p) (free(p))
+
+#endif // __KERNEL__
+
+// Puts a string of @len bytes, or an empty one if @str is null, at @p.
+// Returns where the next one goes.
+static inline char *put_str_(char *p, const char *str, int len) {
+  if (str) memcpy(p, str, len);
+  p[len] = '\0';
+  return p + len + 1;
+}
+
+// Makes the record of @tag in @buf and hands it to @fn, counted in @num.
+static int export_tag_(struct cinq_tag *tag, char *buf,
+                       cinq_export_fn fn, void *arg, long *num) {
+  struct cinq_export_rec *rec = (struct cinq_export_rec *)buf;
+  char *p = buf + sizeof(struct cinq_export_rec);
+  const int size = CINQ_EXPORT_PATH_MAX + 1;
+  struct cinq_tag *link;
+  int len;
+
+  if (cnode_export_tag(tag, rec, &link)) return 0; // replaced
+  len = cnode_path(tag->t_host, p, size);
+  if (unlikely(len < 0)) return len;
+  rec->er_path_len = len;
+  p += len + 1;
+
+  len = link ? cnode_path(link->t_host, p, size) : 0;
+  if (unlikely(len < 0)) return len;
+  rec->er_link_len = len;
+  p = link ? p + len + 1 : put_str_(p, NULL, 0);
+
+  len = tag->t_symname ? strlen(tag->t_symname) : 0;
+  if (unlikely(len > CINQ_EXPORT_PATH_MAX)) return -ENAMETOOLONG;
+  rec->er_sym_len = len;
+  p = put_str_(p, tag->t_symname, len);
+
+  ++*num;
+  return fn(arg, buf, p - buf);
+}
+
+int cinq_export(struct cinq_fsnode *fs, cinq_export_fn fn, void *arg) {
+  struct cinq_export_head head;
+  struct cinq_export_rec *rec;
+  struct list_head *pos;
+  char *buf, *p;
+  long num = 0;
+  int ret;
+
+  buf = export_malloc_();
+  if (unlikely(!buf)) return -ENOMEM;
+  memset(&head, 0, sizeof(head));
+  head.eh_magic = CINQ_EXPORT_MAGIC;
+  head.eh_version = CINQ_EXPORT_VERSION;
+  head.eh_rec_size = sizeof(struct cinq_export_rec);
+  strncpy(head.eh_name, fs->fs_name, MAX_NAME_LEN);
+
+  cinq_tier_pause();
+  ret = atomic_read(&fs->fs_spilled) ? cinq_tier_fault_all() : 0;
+  if (!ret) ret = fn(arg, &head, sizeof(head));
+  // The same walk as a diff, see diff_view_().
+  spin_lock(&fs->fs_tags_lock);
+  for (pos = fs->fs_tags.next; !ret && pos != &fs->fs_tags;
+       pos = pos->next) {
+    spin_unlock(&fs->fs_tags_lock);
+    ret = export_tag_(list_entry(pos, struct cinq_tag, t_fs_tags),
+                      buf, fn, arg, &num);
+    spin_lock(&fs->fs_tags_lock);
+  }
+  spin_unlock(&fs->fs_tags_lock);
+  cinq_tier_resume();
+
+  if (!ret) {
+    rec = (struct cinq_export_rec *)buf;
+    memset(rec, 0, sizeof(struct cinq_export_rec));
+    rec->er_kind = CINQ_EXPORT_END;
+    rec->er_nchild = num;
+    p = buf + sizeof(struct cinq_export_rec);
+    p = put_str_(put_str_(put_str_(p, NULL, 0), NULL, 0), NULL, 0);
+    ret = fn(arg, buf, p - buf);
+  }
+  export_free_(buf);
+  DEBUG_ON_(ret, "[Error@cinq_export] %d after %ld tags of %s.\n",
+            ret, num, fs->fs_name);
+  return ret;
+}
+
+int cinq_import_init(struct cinq_import *im, struct dentry *meta_root,
+                     const char *parent, const char *name) {
+  memset(im, 0, sizeof(struct cinq_import));
+  im->im_root = meta_root;
+  strncpy(im->im_parent, parent, MAX_NAME_LEN);
+  if (name) strncpy(im->im_name, name, MAX_NAME_LEN);
+  im->im_need = sizeof(struct cinq_export_head);
+  im->im_buf = export_malloc_();
+  if (unlikely(!im->im_buf)) im->im_err = -ENOMEM;
+  return im->im_err;
+}
+
+// Makes the view by a mkdir of "parent.name" on the meta root, as a
+// client would.
+static int import_head_(struct cinq_import *im) {
+  struct cinq_export_head *head = (struct cinq_export_head *)im->im_buf;
+  const int mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU;
+  struct inode *dir = im->im_root->d_inode;
+  char name[MAX_NAME_LEN + 1];
+  struct dentry *dentry;
+  struct qstr qname;
+  int err;
+
+  if (head->eh_magic != CINQ_EXPORT_MAGIC ||
+      head->eh_version != CINQ_EXPORT_VERSION ||
+      head->eh_rec_size != sizeof(struct cinq_export_rec)) {
+    DEBUG_("[Error@import_head_] not an export of version %d.\n",
+           CINQ_EXPORT_VERSION);
+    return -EINVAL;
+  }
+  if (!*im->im_name) strncpy(im->im_name, head->eh_name, MAX_NAME_LEN);
+  if (cfs_find_syn(&file_systems, im->im_name)) return -EEXIST;
+  if (snprintf(name, sizeof(name), "%s%c%s", im->im_parent, FS_DELIM,
+               im->im_name) > MAX_NAME_LEN) {
+    return -ENAMETOOLONG;
+  }
+
+  qname = (struct qstr) { .name = (unsigned char *)name, .len = strlen(name) };
+  dentry = d_alloc(im->im_root, &qname);
+  if (unlikely(!dentry)) return -ENOMEM;
+  err = dir->i_op->mkdir(dir, dentry, mode);
+  dput(dentry); // held by the view if made
+  if (unlikely(err)) return err;
+  im->im_fs = cfs_find_syn(&file_systems, im->im_name);
+  return im->im_fs ? 0 : -ENOENT;
+}
+
+// Handles a whole piece in the buffer: the header, the fixed part of a
+// record, or a record with its strings.
+static int import_piece_(struct cinq_import *im) {
+  struct cinq_export_rec *rec = (struct cinq_export_rec *)im->im_buf;
+  const char *path, *link, *symname;
+  struct cinq_tag *tag;
+
+  if (!im->im_fs) {
+    im->im_len = 0;
+    im->im_need = sizeof(struct cinq_export_rec);
+    return import_head_(im);
+  }
+  if (im->im_need == sizeof(struct cinq_export_rec)) {
+    if (rec->er_path_len > CINQ_EXPORT_PATH_MAX ||
+        rec->er_link_len > CINQ_EXPORT_PATH_MAX ||
+        rec->er_sym_len > CINQ_EXPORT_PATH_MAX) {
+      return -EINVAL;
+    }
+    im->im_need += rec->er_path_len + rec->er_link_len + rec->er_sym_len + 3;
+    return 0;
+  }
+
+  path = im->im_buf + sizeof(struct cinq_export_rec);
+  link = path + rec->er_path_len + 1;
+  symname = link + rec->er_link_len + 1;
+  if (path[rec->er_path_len] || link[rec->er_link_len] ||
+      symname[rec->er_sym_len]) {
+    return -EINVAL;
+  }
+  im->im_len = 0;
+  im->im_need = sizeof(struct cinq_export_rec);
+
+  switch (rec->er_kind) {
+    case CINQ_EXPORT_END:
+      im->im_done = 1;
+      return rec->er_nchild == im->im_recs ? 0 : -EIO;
+    case CINQ_EXPORT_INODE:
+    case CINQ_EXPORT_LINK:
+    case CINQ_EXPORT_WHITEOUT:
+      tag = cnode_graft(i_cnode(im->im_root->d_inode), im->im_fs, rec,
+                        path, link, symname);
+      if (IS_ERR(tag)) return PTR_ERR(tag);
+      ++im->im_recs;
+      return 0;
+    default:
+      return -EINVAL;
+  }
+}
+
+int cinq_import_feed(void *arg, const void *buf, size_t len) {
+  struct cinq_import *im = arg;
+  const char *p = buf;
+  size_t n;
+
+  while (len && !im->im_err) {
+    if (unlikely(im->im_done)) { // bytes after the end
+      im->im_err = -EINVAL;
+      break;
+    }
+    n = im->im_need - im->im_len;
+    if (n > len) n = len;
+    memcpy(im->im_buf + im->im_len, p, n);
+    im->im_len += n;
+    p += n;
+    len -= n;
+    if (im->im_len == im->im_need) im->im_err = import_piece_(im);
+  }
+  DEBUG_ON_(im->im_err, "[Error@cinq_import_feed] %d after %ld tags.\n",
+            im->im_err, im->im_recs);
+  return im->im_err;
+}
+
+int cinq_import_fini(struct cinq_import *im) {
+  if (im->im_buf) export_free_(im->im_buf);
+  im->im_buf = NULL;
+  if (!im->im_err && !im->im_done) im->im_err = -EIO; // cut short
+  return im->im_err;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  extent.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "extent.h"
+
+#ifdef __KERNEL__
+
+#define ext_malloc_(n) ((struct cinq_extent *)kmalloc( \
+    (n) * sizeof(struct cinq_extent), GFP_KERNEL))
+#define ext_realloc_(p, n) ((struct cinq_extent *)krealloc(p, \
+    (n) * sizeof(struct cinq_extent), GFP_KERNEL))
+#define ext_free_(p) (kfree(p))
+
+#else
+
+#define ext_malloc_(n) \
+    ((struct cinq_extent *)malloc((n) * sizeof(struct cinq_extent)))
+#define ext_realloc_(p, n) \
+    ((struct cinq_extent *)realloc(p, (n) * sizeof(struct cinq_extent)))
+#define ext_free_(p) (free(p))
+
+#endif // __KERNEL__
+
+void extent_map_init(struct cinq_extent_map *map) {
+  rwlock_init(&map->em_lock);
+  map->em_num = 0;
+  map->em_max = 0;
+  map->em_ext = NULL;
+}
+
+void extent_map_destroy(struct cinq_extent_map *map) {
+  ext_free_(map->em_ext);
+  map->em_ext = NULL;
+  map->em_num = map->em_max = 0;
+}
+
+// Index of the first extent ending at or after @pos.
+// Called with em_lock held.
+static int extent_search_(struct cinq_extent_map *map, loff_t pos) {
+  int lo = 0, hi = map->em_num, mid;
+  while (lo < hi) {
+    mid = (lo + hi) >> 1;
+    if (map->em_ext[mid].e_end < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int extent_map_add(struct cinq_extent_map *map, loff_t start, loff_t end) {
+  struct cinq_extent *grown;
+  int i, j;
+
+  if (start >= end) return 0;
+  write_lock(&map->em_lock);
+  i = extent_search_(map, start); // first one touching or after @start
+  if (i < map->em_num && map->em_ext[i].e_start <= start &&
+      map->em_ext[i].e_end >= end) { // common for rewrites
+    wr_release_return(&map->em_lock, 0);
+  }
+  for (j = i; j < map->em_num && map->em_ext[j].e_start <= end; ++j);
+
+  if (i == j) { // touches nothing, so a new extent is inserted at i
+    if (map->em_num == map->em_max) {
+      int max = map->em_max ? map->em_max << 1 : 4;
+      grown = ext_realloc_(map->em_ext, max);
+      if (unlikely(!grown)) wr_release_return(&map->em_lock, -ENOMEM);
+      map->em_ext = grown;
+      map->em_max = max;
+    }
+    memmove(map->em_ext + i + 1, map->em_ext + i,
+            (map->em_num - i) * sizeof(struct cinq_extent));
+    map->em_ext[i].e_start = start;
+    map->em_ext[i].e_end = end;
+    ++map->em_num;
+  } else { // merges [i, j) into i
+    if (map->em_ext[i].e_start < start) start = map->em_ext[i].e_start;
+    if (map->em_ext[j - 1].e_end > end) end = map->em_ext[j - 1].e_end;
+    map->em_ext[i].e_start = start;
+    map->em_ext[i].e_end = end;
+    memmove(map->em_ext + i + 1, map->em_ext + j,
+            (map->em_num - j) * sizeof(struct cinq_extent));
+    map->em_num -= j - i - 1;
+  }
+  write_unlock(&map->em_lock);
+  return 0;
+}
+
+loff_t extent_map_punch(struct cinq_extent_map *map, loff_t start, loff_t end) {
+  struct cinq_extent left, right, *grown;
+  int i, j, has_left, has_right, num;
+  loff_t last;
+
+  if (start >= end) return start;
+  write_lock(&map->em_lock);
+  i = extent_search_(map, start + 1); // skips the one ending at @start
+  for (j = i; j < map->em_num && map->em_ext[j].e_start < end; ++j);
+  if (i == j) wr_release_return(&map->em_lock, start);
+
+  last = map->em_ext[j - 1].e_end < end ? map->em_ext[j - 1].e_end : end;
+  has_left = map->em_ext[i].e_start < start;
+  left.e_start = map->em_ext[i].e_start;
+  left.e_end = start;
+  has_right = map->em_ext[j - 1].e_end > end;
+  right.e_start = end;
+  right.e_end = map->em_ext[j - 1].e_end;
+
+  num = map->em_num - (j - i) + has_left + has_right;
+  if (num > map->em_max) { // only when splitting one extent into two
+    grown = ext_realloc_(map->em_ext, map->em_max << 1);
+    if (unlikely(!grown)) wr_release_return(&map->em_lock, -ENOMEM);
+    map->em_ext = grown;
+    map->em_max <<= 1;
+  }
+  memmove(map->em_ext + i + has_left + has_right, map->em_ext + j,
+          (map->em_num - j) * sizeof(struct cinq_extent));
+  if (has_left) map->em_ext[i++] = left;
+  if (has_right) map->em_ext[i] = right;
+  map->em_num = num;
+  write_unlock(&map->em_lock);
+  return last;
+}
+
+int extent_map_get(struct cinq_extent_map *map, loff_t pos, loff_t end,
+                   struct cinq_extent **ext_p) {
+  struct cinq_extent *ext;
+  int i, j, n;
+
+  read_lock(&map->em_lock);
+  i = extent_search_(map, pos + 1); // skips the one ending at @pos
+  for (j = i; j < map->em_num && map->em_ext[j].e_start < end; ++j);
+  n = j - i;
+  if (!n) {
+    *ext_p = NULL;
+    rd_release_return(&map->em_lock, 0);
+  }
+  ext = ext_malloc_(n);
+  if (unlikely(!ext)) rd_release_return(&map->em_lock, -ENOMEM);
+  memcpy(ext, map->em_ext + i, n * sizeof(struct cinq_extent));
+  read_unlock(&map->em_lock);
+
+  if (ext[0].e_start < pos) ext[0].e_start = pos;
+  if (ext[n - 1].e_end > end) ext[n - 1].e_end = end;
+  *ext_p = ext;
+  return n;
+}
+
+void extent_free(struct cinq_extent *ext) {
+  ext_free_(ext);
+}
+
+loff_t extent_map_seek(struct cinq_extent_map *map, loff_t pos, int data) {
+  struct cinq_extent *ext;
+  int i;
+
+  read_lock(&map->em_lock);
+  i = extent_search_(map, pos + 1);
+  ext = i < map->em_num ? &map->em_ext[i] : NULL;
+  if (data) {
+    if (ext && ext->e_start > pos) pos = ext->e_start;
+    else if (!ext) pos = -ENXIO;
+  } else if (ext && ext->e_start <= pos) {
+    pos = ext->e_end; // extents never touch, so a hole follows
+  }
+  read_unlock(&map->em_lock);
+  return pos;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  extent.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_EXTENT_H_
+#define CINQUAIN_META_EXTENT_H_
+
+#include "util.h"
+
+/* Written ranges of a sparse file */
+
+struct cinq_extent {
+  loff_t e_start;
+  loff_t e_end; // exclusive
+};
+
+// Extents are sorted, disjoint and never adjacent, since touching ones
+// are merged. A VM image written in large runs thus needs few of them.
+// Anything outside the extents is a hole that reads as zeros.
+struct cinq_extent_map {
+  rwlock_t em_lock;
+  int em_num;
+  int em_max;
+  struct cinq_extent *em_ext;
+};
+
+extern void extent_map_init(struct cinq_extent_map *map);
+extern void extent_map_destroy(struct cinq_extent_map *map);
+
+// Marks [start, end) as written.
+extern int extent_map_add(struct cinq_extent_map *map,
+                          loff_t start, loff_t end);
+
+// Drops whatever is written in [start, end), splitting an extent if needed.
+// Returns the end of the data dropped (@start if none), or a negative
+// error code.
+extern loff_t extent_map_punch(struct cinq_extent_map *map,
+                               loff_t start, loff_t end);
+
+// Gets copies of extents overlapping [pos, end), trimmed to the range.
+// Returns the number of extents and the array in @ext_p to be freed by
+// extent_free(), or a negative error code.
+extern int extent_map_get(struct cinq_extent_map *map, loff_t pos, loff_t end,
+                          struct cinq_extent **ext_p);
+extern void extent_free(struct cinq_extent *ext);
+
+// Finds the first offset at or after @pos that is in data (@data non-zero)
+// or in a hole. Offsets beyond the last extent are in a hole.
+extern loff_t extent_map_seek(struct cinq_extent_map *map, loff_t pos,
+                              int data);
+
+#endif // CINQUAIN_META_EXTENT_H_
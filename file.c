@@ -12,13 +12,72 @@
 
 #include "cinq_meta.h"
 #include "cinq_cache/cinq_cache.h"
+#include "thread.h"
+
+#ifdef __KERNEL__
+
+#define read_set_malloc_(nvec, nsets) ((struct cinq_read_set *)kmalloc( \
+    sizeof(struct cinq_read_set) + (nvec) * sizeof(struct iovec) + \
+    (nsets) * sizeof(struct data_set *), GFP_KERNEL))
+#define read_set_free_(p) (kfree(p))
+
+#define data_entry_free_(p) (kfree(p))
+#define data_set_free_(p) (kfree(p))
+
+#define stage_malloc_() ((char *)kmalloc(CINQ_WRITE_STAGE, GFP_KERNEL))
+#define stage_free_(p) (kfree(p))
+
+#define spans_malloc_(n) ((struct read_span_ *)kmalloc( \
+    (n) * sizeof(struct read_span_), GFP_KERNEL))
+#define spans_realloc_(p, n) ((struct read_span_ *)krealloc(p, \
+    (n) * sizeof(struct read_span_), GFP_KERNEL))
+#define spans_free_(p) (kfree(p))
+
+#define fdata_malloc_() \
+    ((struct cinq_fdata *)kmalloc(sizeof(struct cinq_fdata), GFP_KERNEL))
+#define fdata_free_(p) (kfree(p))
+
+#define found_malloc_(n) ((struct cinq_inode **)kmalloc( \
+    (n) * sizeof(struct cinq_inode *), GFP_KERNEL))
+#define found_free_(p) (kfree(p))
+
+#else
+
+#define read_set_malloc_(nvec, nsets) ((struct cinq_read_set *)malloc( \
+    sizeof(struct cinq_read_set) + (nvec) * sizeof(struct iovec) + \
+    (nsets) * sizeof(struct data_set *)))
+#define read_set_free_(p) (free(p))
+
+#define data_entry_free_(p) (free(p))
+#define data_set_free_(p) (free(p))
+
+#define stage_malloc_() ((char *)malloc(CINQ_WRITE_STAGE))
+#define stage_free_(p) (free(p))
+
+#define spans_malloc_(n) \
+    ((struct read_span_ *)malloc((n) * sizeof(struct read_span_)))
+#define spans_realloc_(p, n) \
+    ((struct read_span_ *)realloc(p, (n) * sizeof(struct read_span_)))
+#define spans_free_(p) (free(p))
+
+#define fdata_malloc_() \
+    ((struct cinq_fdata *)malloc(sizeof(struct cinq_fdata)))
+#define fdata_free_(p) (free(p))
+
+#define found_malloc_(n) \
+    ((struct cinq_inode **)malloc((n) * sizeof(struct cinq_inode *)))
+#define found_free_(p) (free(p))
+
+#endif // __KERNEL__
 
 #ifdef SPNFS_
 
 #define SPNFS_DELIM_POS 7 // for spnfs style file name
 
-static inline void cfp_set_value(struct fingerprint *fp, struct file *filp) {
-  char *spnfs_name = (char *)filp->f_dentry->d_name.name;
+// Files are keyed by name, so a copy-up shares the cached data.
+static inline void cfp_set_value(struct fingerprint *fp,
+                                 struct dentry *dentry, struct inode *inode) {
+  char *spnfs_name = (char *)dentry->d_name.name;
   strncpy(fp->value, spnfs_name, SPNFS_DELIM_POS - 1);
   strncpy((char *)fp->value + SPNFS_DELIM_POS - 1,
           spnfs_name + SPNFS_DELIM_POS,
@@ -26,123 +85,1211 @@ static inline void cfp_set_value(struct fingerprint *fp, struct file *filp) {
 }
 #else
 
-static inline void cfp_set_value(struct fingerprint *fp, struct file *filp) {
+static inline void cfp_set_ino_(struct fingerprint *fp, unsigned long ino) {
   memset(fp->value, 0, sizeof(fp->value));
-  u64 hash = hash_64((u64)filp->f_path.dentry->d_inode->i_ino, 64);
+  u64 hash = hash_64((u64)ino, 64);
   *((unsigned long *)&fp->value) = hash;
 }
 
+// @inode: that of @dentry, or the copy-up of it that a change lands on
+static inline void cfp_set_value(struct fingerprint *fp,
+                                 struct dentry *dentry, struct inode *inode) {
+  cfp_set_ino_(fp, inode->i_ino);
+}
+
 #endif // SPNFS_
 
+#ifdef CINQ_DEDUP
+
+#define DEDUP_REF_BATCH 32 // refs handed to the chunk map at a time
+
+#if CHUNK_MAX_SIZE > CINQ_WRITE_STAGE
+#error "The staging buffer cannot hold a chunk of the maximum size."
+#endif
+
+// Chunks are keyed by content alone, so identical chunks written
+// through any inode or view share one cache object.
+static inline void cfp_set_chunk_(struct fingerprint *fp,
+                                  const unsigned char *value) {
+  fp->uid = 0;
+  memcpy(fp->value, value, FILE_HASH_WIDTH);
+}
+
+#endif // CINQ_DEDUP
+
+// Finds a dentry of @inode seen through @fs, or makes a disconnected one.
+// Consumes the reference of @inode.
+static struct dentry *cinq_fh_alias_(struct inode *inode,
+                                     struct cinq_fsnode *fs) {
+  struct dentry *alias;
+  spin_lock(&inode->i_lock);
+  list_for_each_entry(alias, &inode->i_dentry, d_alias) {
+    if (alias->d_fsdata == fs) {
+      dget(alias);
+      spin_unlock(&inode->i_lock);
+      iput(inode);
+      return alias;
+    }
+  }
+  spin_unlock(&inode->i_lock);
+
+  alias = d_obtain_alias(inode);
+  if (IS_ERR(alias)) return alias;
+  if (!alias->d_fsdata) {
+    alias->d_fsdata = fs;
+  } else if (alias->d_fsdata != fs) { // another view holds the alias
+    dput(alias);
+    return ERR_PTR(-ESTALE);
+  }
+  return alias;
+}
+
+// Gets the dentry of @cnode as seen through @fs.
+static struct dentry *cinq_fh_dentry_(struct super_block *sb,
+                                      struct cinq_fsnode *fs,
+                                      struct cinq_inode *cnode) {
+  struct cinq_tag *ino;
+  struct inode *inode;
+  if (fs == META_FS) { // only the meta root lives in META_FS
+    if (cnode->ci_parent != cnode) return ERR_PTR(-ESTALE);
+    return dget(sb->s_root);
+  }
+  if (cnode->ci_parent == cnode) return dget(fs->fs_root);
+
+  ino = cnode_lookup_tag(cnode, fs);
+  if (unlikely(!ino)) return ERR_PTR(-ESTALE);
+  inode = cinq_iget(sb, (unsigned long)ino);
+  if (unlikely(!inode)) return ERR_PTR(-ENOMEM);
+  return cinq_fh_alias_(inode, fs);
+}
+
+// Resolves the pair of fsnode and cnode IDs to a dentry of the view.
+// Costs two bounds checks and generation compares plus the usual
+// ancestor walk on the cnode's tags.
+static struct dentry *cinq_fh_resolve_(struct super_block *sb,
+                                       __u32 fs_id, __u32 fs_gen,
+                                       __u32 ci_id, __u32 ci_gen) {
+  struct cinq_fsnode *fs = META_FS;
+  struct cinq_inode *cnode;
+
+  cnode = idtable_find(&cnode_ids, ci_id, ci_gen);
+  if (unlikely(!cnode)) return ERR_PTR(-ESTALE);
+  if (unlikely(cnode->ci_id != ci_id)) { // the stub of a spilled subtree
+    if (cinq_tier_fault(cnode)) return ERR_PTR(-EIO);
+    cnode = idtable_find(&cnode_ids, ci_id, ci_gen);
+    if (unlikely(!cnode || cnode->ci_id != ci_id)) return ERR_PTR(-ESTALE);
+  }
+  cnode_touch(cnode);
+
+  if (fs_id != IDT_NONE) {
+    fs = fsnode_live(idtable_find(&fsnode_ids, fs_id, fs_gen));
+    if (unlikely(!fs)) return ERR_PTR(-ESTALE);
+  }
+  return cinq_fh_dentry_(sb, fs, cnode);
+}
+
+// The cnode found by ID is not pinned until its inode is got.
+static struct dentry *cinq_fh_decode_(struct super_block *sb,
+                                      __u32 fs_id, __u32 fs_gen,
+                                      __u32 ci_id, __u32 ci_gen) {
+  const int grace = cinq_grace_enter();
+  struct dentry *dentry = cinq_fh_resolve_(sb, fs_id, fs_gen, ci_id, ci_gen);
+  cinq_grace_exit(grace);
+  return dentry;
+}
+
 struct dentry *cinq_fh_to_dentry(struct super_block *sb,
                                  struct fid *fid, int fh_len,
                                  int fh_type) {
-  u64 daddr, fs_id;
+  struct cinq_fh *fh = (struct cinq_fh *)fid->raw;
   struct dentry *dentry;
 
-  if (fh_len < 4) return NULL;
+  if (fh_len < CINQ_FH_LEN ||
+      (fh_type != CINQ_FH_TYPE && fh_type != CINQ_FH_TYPE_PARENT))
+    return NULL;
 
-  daddr = fid->raw[3];
-  daddr = (daddr << 32) | fid->raw[2];
-  fs_id = fid->raw[1];
-  fs_id = (fs_id << 32) | fid->raw[0];
+  dentry = cinq_fh_decode_(sb, fh->fs_id, fh->fs_gen, fh->ci_id, fh->ci_gen);
+  DEBUG_ON_(IS_ERR(dentry), "cinq_fh_to_dentry: stale handle "
+            "'%x.%x-%x.%x'.\n", fh->fs_id, fh->fs_gen, fh->ci_id, fh->ci_gen);
+  return dentry;
+}
+
+struct dentry *cinq_fh_to_parent(struct super_block *sb,
+                                 struct fid *fid, int fh_len,
+                                 int fh_type) {
+  struct cinq_fh *fh = (struct cinq_fh *)fid->raw;
 
-  dentry = (struct dentry *)daddr;
-  dget(dentry); // extra count to pin the dentry in core
-  if(!dentry) DEBUG_(KERN_ERR "cinq_fh_to_dentry: NOT found dentry for fid '%x-%x-%x-%x'.\n",
-			  fid->raw[3], fid->raw[2], fid->raw[1], fid->raw[0]);
-  else DEBUG_("cinq_fh_to_dentry: handle '%x-%x-%x-%x' ==> dentry '%s' by '%s'.\n",
-		      fid->raw[3], fid->raw[2], fid->raw[1], fid->raw[0], dentry->d_name.name,
-			  ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name);
+  if (fh_len < CINQ_FH_PARENT_LEN || fh_type != CINQ_FH_TYPE_PARENT)
+    return NULL;
+  if (fh->parent_id == fh->ci_id) // parent of a view root
+    return dget(sb->s_root);
 
-  return dentry;
+  return cinq_fh_decode_(sb, fh->fs_id, fh->fs_gen,
+                         fh->parent_id, fh->parent_gen);
 }
 
 int cinq_encode_fh(struct dentry *dentry, __u32 *fh, int *len,
                    int connectable) {
-	struct cinq_fsnode *fs = dentry->d_fsdata;
+  struct cinq_fh *cfh = (struct cinq_fh *)fh;
+  struct cinq_fsnode *fs = dentry_fs(dentry);
+  struct cinq_inode *cnode = i_cnode(dentry->d_inode);
+  struct cinq_inode *parent;
+  int type = CINQ_FH_TYPE;
+  int fh_len = CINQ_FH_LEN;
 
-	if (*len < 4)
-		return 255;
+  if (connectable && !S_ISDIR(dentry->d_inode->i_mode)) {
+    type = CINQ_FH_TYPE_PARENT;
+    fh_len = CINQ_FH_PARENT_LEN;
+  }
+  if (*len < fh_len) {
+    *len = fh_len;
+    return 255;
+  }
 
-	fh[0] = fs->fs_id;
-	fh[1] = ((__u64)fs->fs_id) >> 32;
-	fh[2] = (__u64)dentry;
-	fh[3] = ((__u64)dentry) >> 32;
+  if (fs == META_FS) {
+    cfh->fs_id = cfh->fs_gen = IDT_NONE;
+  } else {
+    cfh->fs_id = fs->fs_id;
+    cfh->fs_gen = idtable_gen(&fsnode_ids, fs->fs_id);
+  }
+  cfh->ci_id = cnode->ci_id;
+  cfh->ci_gen = idtable_gen(&cnode_ids, cnode->ci_id);
+
+  if (type == CINQ_FH_TYPE_PARENT) {
+    // A hard link's inode belongs to the cnode of its first name,
+    // so the connected parent is preferred over ci_parent.
+    spin_lock(&dentry->d_lock);
+    parent = dentry->d_parent != dentry ?
+        i_cnode(dentry->d_parent->d_inode) : cnode->ci_parent;
+    spin_unlock(&dentry->d_lock);
+    cfh->parent_id = parent->ci_id;
+    cfh->parent_gen = idtable_gen(&cnode_ids, parent->ci_id);
+  }
 
-	*len = 4;
-	DEBUG_("cinq_encode_fh: dentry %s by '%s' ==> handle '%x-%x-%x-%x'.\n",
-			dentry->d_name.name,
-			((struct cinq_fsnode *)dentry->d_fsdata)->fs_name,
-			fh[3], fh[2], fh[1], fh[0]);
-	return 1;
+  *len = fh_len;
+  DEBUG_("cinq_encode_fh: dentry %s by '%s' ==> handle '%x.%x-%x.%x'.\n",
+         dentry->d_name.name, fs == META_FS ? "META_FS" : fs->fs_name,
+         cfh->fs_id, cfh->fs_gen, cfh->ci_id, cfh->ci_gen);
+  return type;
 }
 
+// Each call climbs a single cnode, so reconnecting a disconnected dentry
+// costs as many hops as its depth.
 struct dentry *cinq_get_parent(struct dentry *child) {
-	return ERR_PTR(-ESTALE);
+  struct cinq_fsnode *fs = dentry_fs(child);
+  struct cinq_inode *cnode = i_cnode(child->d_inode);
+
+  if (fs == META_FS || cnode->ci_parent == cnode) // meta or view root
+    return dget(child->d_sb->s_root);
+  return cinq_fh_dentry_(child->d_sb, fs, cnode->ci_parent);
+}
+
+// The cnode of the inode has its first name, which is taken if it is in
+// @parent. A hard link elsewhere is found among the children of @parent
+// by the inode its tag in the view refers to.
+int cinq_get_name(struct dentry *parent, char *name, struct dentry *child) {
+  struct cinq_fsnode *fs = dentry_fs(child);
+  struct cinq_inode *cnode = i_cnode(child->d_inode);
+  struct cinq_inode *dir = i_cnode(parent->d_inode), *cur;
+  struct cinq_tag *ino = i_tag(child->d_inode);
+  int err;
+
+  if (cnode->ci_parent == cnode) { // view root under the meta root
+    if (fs == META_FS) return -EINVAL;
+    strncpy(name, fs->fs_name, MAX_NAME_LEN + 1);
+    return 0;
+  }
+  if (cnode->ci_parent == dir && cnode_lookup_tag(cnode, fs) == ino) {
+    strncpy(name, cnode->ci_name, MAX_NAME_LEN + 1);
+    return 0;
+  }
+  err = children_read_lock_in(dir);
+  if (unlikely(err)) return err;
+  for (cur = cnode_next_child(dir, NULL); cur;
+       cur = cnode_next_child(dir, cur)) {
+    if (cnode_lookup_tag(cur, fs) == ino) {
+      strncpy(name, cur->ci_name, MAX_NAME_LEN + 1);
+      rd_release_return(&dir->ci_children_lock, 0);
+    }
+  }
+  read_unlock(&dir->ci_children_lock);
+  return -ENOENT;
+}
+
+static const char cinq_zero_page_[PAGE_CACHE_SIZE];
+
+// Describes a hole of @len bytes with zero-page segments.
+// @vec: NULL to only count the segments.
+static int read_set_hole_(struct iovec *vec, loff_t len) {
+  int n = 0;
+  size_t seg;
+  while (len > 0) {
+    seg = len > PAGE_CACHE_SIZE ? PAGE_CACHE_SIZE : len;
+    if (vec) {
+      vec[n].iov_base = (void *)cinq_zero_page_;
+      vec[n].iov_len = seg;
+    }
+    ++n;
+    len -= seg;
+  }
+  return n;
+}
+
+// Maps [pos, end) onto cache entries of @ds in a single pass.
+// @vec: NULL to only count the segments.
+static int read_set_fill_(struct iovec *vec, struct data_set *ds,
+                          loff_t pos, loff_t end) {
+  struct data_entry *de;
+  loff_t start, stop;
+  int n = 0;
+
+  list_for_each_entry(de, &ds->entries, entry) {
+    start = (loff_t)de->offset > pos ? (loff_t)de->offset : pos;
+    stop = (loff_t)(de->offset + de->len) < end ?
+        (loff_t)(de->offset + de->len) : end;
+    if (stop <= start) continue;
+    n += read_set_hole_(vec ? vec + n : NULL, start - pos);
+    if (vec) {
+      vec[n].iov_base = de->data + (start - de->offset);
+      vec[n].iov_len = stop - start;
+    }
+    ++n;
+    pos = stop;
+  }
+  return n + read_set_hole_(vec ? vec + n : NULL, end - pos);
+}
+
+// Releases a data set returned by wcache_read(), but not the cached data
+// its entries point to.
+static void data_set_release_(struct data_set *ds) {
+  struct data_entry *de, *tmp;
+  if (!ds) return;
+  list_for_each_entry_safe(de, tmp, &ds->entries, entry) {
+    list_del(&de->entry);
+    data_entry_free_(de);
+  }
+  data_set_free_(ds);
+}
+
+static struct cinq_read_set *read_set_new_(int nvec, int nsets,
+                                           loff_t pos, loff_t end) {
+  struct cinq_read_set *rs = read_set_malloc_(nvec, nsets);
+  if (unlikely(!rs)) return NULL;
+  atomic_set(&rs->rs_count, 1);
+  rs->rs_sets = (struct data_set **)(rs->rs_vec + nvec);
+  rs->rs_nsets = 0;
+  rs->rs_pos = pos;
+  rs->rs_len = end - pos;
+  return rs;
+}
+
+// A range of the file served by the cache entries of one data set.
+struct read_span_ {
+  loff_t off; // file offset
+  loff_t skip; // offset of the range in the cache object
+  size_t len;
+  struct data_set *ds;
+};
+
+// Maps [pos, end) onto @spans, which are sorted and disjoint.
+// Ranges covered by no span are holes and read as zeros.
+// @vec: NULL to only count the segments.
+static int read_set_spans_(struct iovec *vec, struct read_span_ *spans, int n,
+                           loff_t pos, loff_t end) {
+  int nvec = 0, i;
+  for (i = 0; i < n; ++i) {
+    nvec += read_set_hole_(vec ? vec + nvec : NULL, spans[i].off - pos);
+    nvec += read_set_fill_(vec ? vec + nvec : NULL, spans[i].ds,
+                           spans[i].skip, spans[i].skip + spans[i].len);
+    pos = spans[i].off + spans[i].len;
+  }
+  return nvec + read_set_hole_(vec ? vec + nvec : NULL, end - pos);
+}
+
+#ifdef CINQ_DEDUP
+
+// Each span is a part of a chunk.
+static int read_spans_get_(struct dentry *dentry, struct inode *inode,
+                           struct cinq_fdata *fdata, loff_t pos, loff_t end,
+                           struct read_span_ **spans_p) {
+  struct cinq_chunk_ref *refs;
+  struct read_span_ *spans;
+  struct fingerprint fp;
+  int n, i;
+
+  n = chunk_map_get(&fdata->fd_chunks, pos, end, &refs);
+  if (n <= 0) return n;
+  spans = spans_malloc_(n);
+  if (unlikely(!spans)) {
+    chunk_refs_free(refs);
+    return -ENOMEM;
+  }
+  for (i = 0; i < n; ++i) {
+    spans[i].off = refs[i].cr_off;
+    spans[i].skip = refs[i].cr_skip;
+    spans[i].len = refs[i].cr_len;
+    cfp_set_chunk_(&fp, refs[i].cr_fp);
+    spans[i].ds = wcache_read(&fp, spans[i].skip, spans[i].len);
+  }
+  chunk_refs_free(refs);
+  *spans_p = spans;
+  return n;
+}
+
+#else
+
+// Spans gathered over the layers of copy-ups
+struct span_buf_ {
+  struct read_span_ *spans;
+  int num;
+  int max;
+};
+
+// Adds [pos, end) of the cache object @fp to @buf.
+static int span_add_(struct span_buf_ *buf, struct fingerprint *fp,
+                     loff_t pos, loff_t end) {
+  struct read_span_ *grown, *span;
+  int max;
+
+  if (buf->num == buf->max) {
+    max = buf->max ? buf->max << 1 : 4;
+    grown = spans_realloc_(buf->spans, max);
+    if (unlikely(!grown)) return -ENOMEM;
+    buf->spans = grown;
+    buf->max = max;
+  }
+  span = buf->spans + buf->num++;
+  span->off = span->skip = pos;
+  span->len = end - pos;
+  span->ds = wcache_read(fp, pos, end - pos);
+  return 0;
+}
+
+// Adds [pos, end) of @fdata, cached under @fp, to @buf. The range is all
+// written. Of a copy-up, the parts not written since are those of the
+// origin, which is frozen, and are looked up there in turn.
+static int span_layers_(struct span_buf_ *buf, struct cinq_fdata *fdata,
+                        struct fingerprint *fp, loff_t pos, loff_t end) {
+#ifndef SPNFS_
+  struct cinq_extent *own;
+  struct fingerprint origin;
+  int n, i, err = 0;
+
+  if (!fdata->fd_origin) return span_add_(buf, fp, pos, end);
+  n = extent_map_get(&fdata->fd_own, pos, end, &own);
+  if (unlikely(n < 0)) return n;
+  origin.uid = 0;
+  cfp_set_ino_(&origin, (unsigned long)fdata->fd_origin);
+  for (i = 0; i < n && !err; ++i) {
+    if (pos < own[i].e_start) {
+      err = span_layers_(buf, fdata->fd_origin->t_data, &origin,
+                         pos, own[i].e_start);
+    }
+    if (!err) err = span_add_(buf, fp, own[i].e_start, own[i].e_end);
+    pos = own[i].e_end;
+  }
+  if (n > 0) extent_free(own);
+  if (!err && pos < end) {
+    err = span_layers_(buf, fdata->fd_origin->t_data, &origin, pos, end);
+  }
+  return err;
+#else
+  return span_add_(buf, fp, pos, end); // a copy-up shares the key
+#endif
+}
+
+// Each span is a written extent, or a part of one from a single layer,
+// so holes never reach the cache.
+static int read_spans_get_(struct dentry *dentry, struct inode *inode,
+                           struct cinq_fdata *fdata, loff_t pos, loff_t end,
+                           struct read_span_ **spans_p) {
+  struct span_buf_ buf = { NULL, 0, 0 };
+  struct cinq_extent *ext;
+  struct fingerprint fp;
+  int n, i, err = 0;
+
+  n = extent_map_get(&fdata->fd_extents, pos, end, &ext);
+  if (n <= 0) return n;
+  fp.uid = 0;
+  cfp_set_value(&fp, dentry, inode);
+  for (i = 0; i < n && !err; ++i) {
+    err = span_layers_(&buf, fdata, &fp, ext[i].e_start, ext[i].e_end);
+  }
+  extent_free(ext);
+  if (unlikely(err)) {
+    for (i = 0; i < buf.num; ++i) {
+      data_set_release_(buf.spans[i].ds);
+    }
+    spans_free_(buf.spans);
+    return err;
+  }
+  *spans_p = buf.spans;
+  return buf.num;
+}
+
+#endif // CINQ_DEDUP
+
+// @inode: got by cinq_view_inode() on @dentry
+static struct cinq_read_set *read_get_(struct dentry *dentry,
+                                       struct inode *inode,
+                                       size_t len, loff_t pos) {
+  struct cinq_fdata *fdata = i_tag(inode)->t_data;
+  struct read_span_ *spans = NULL;
+  struct cinq_read_set *rs;
+  loff_t end;
+  int n = 0, i;
+
+  if (pos >= inode->i_size) return NULL;
+  end = pos + len > inode->i_size ? inode->i_size : pos + len;
+
+  if (fdata) { // otherwise nothing has been written
+    n = read_spans_get_(dentry, inode, fdata, pos, end, &spans);
+    if (unlikely(n < 0)) return ERR_PTR(n);
+  }
+  rs = read_set_new_(read_set_spans_(NULL, spans, n, pos, end), n, pos, end);
+  if (likely(rs)) {
+    rs->rs_nvec = read_set_spans_(rs->rs_vec, spans, n, pos, end);
+    for (i = 0; i < n; ++i) {
+      rs->rs_sets[i] = spans[i].ds;
+    }
+    rs->rs_nsets = n;
+  } else {
+    for (i = 0; i < n; ++i) {
+      data_set_release_(spans[i].ds);
+    }
+  }
+  if (spans) spans_free_(spans);
+  return rs ? rs : ERR_PTR(-ENOMEM);
+}
+
+struct cinq_read_set *cinq_read_get(struct dentry *dentry,
+                                    size_t len, loff_t pos) {
+  struct inode *inode = cinq_view_inode(dentry);
+  struct cinq_read_set *rs;
+
+  if (IS_ERR(inode)) return ERR_PTR(PTR_ERR(inode));
+  rs = read_get_(dentry, inode, len, pos);
+  iput(inode);
+  return rs;
+}
+
+void cinq_read_set_put(struct cinq_read_set *rs) {
+  int i;
+  if (atomic_dec_and_test(&rs->rs_count)) {
+    for (i = 0; i < rs->rs_nsets; ++i) {
+      data_set_release_(rs->rs_sets[i]);
+    }
+    read_set_free_(rs);
+  }
+}
+
+// Copies [skip, skip + len) of the range covered by @rs to @buf.
+static ssize_t read_set_copy_(struct cinq_read_set *rs, char *buf,
+                              size_t skip, size_t len) {
+  struct iovec *vec;
+  size_t seg, copied = 0;
+
+  for (vec = rs->rs_vec; vec < rs->rs_vec + rs->rs_nvec && copied < len;
+       ++vec) {
+    if (skip >= vec->iov_len) {
+      skip -= vec->iov_len;
+      continue;
+    }
+    seg = vec->iov_len - skip < len - copied ? vec->iov_len - skip :
+        len - copied;
+    if (vec->iov_base == cinq_zero_page_) {
+      bufclr(buf + copied, seg);
+    } else {
+      bufcpy(buf + copied, (char *)vec->iov_base + skip, seg);
+    }
+    copied += seg;
+    skip = 0;
+  }
+  return copied;
+}
+
+// Drops the windows read ahead, as their data is about to change or has.
+// Bumping fd_ra_gen also keeps out a window fetched before the change.
+static void ra_window_drop_(struct cinq_fdata *fdata) {
+  struct cinq_read_set *ra[2];
+  int i;
+
+  spin_lock(&fdata->fd_ra_lock);
+  ++fdata->fd_ra_gen;
+  for (i = 0; i < 2; ++i) {
+    ra[i] = fdata->fd_ra[i];
+    fdata->fd_ra[i] = NULL;
+  }
+  spin_unlock(&fdata->fd_ra_lock);
+  for (i = 0; i < 2; ++i) {
+    if (ra[i]) cinq_read_set_put(ra[i]);
+  }
+}
+
+// Serves [pos, pos + len) from a window read ahead that covers it.
+// Returns the number of bytes copied, or 0 on a miss.
+static ssize_t ra_window_read_(struct cinq_fdata *fdata, char *buf,
+                               size_t len, loff_t pos) {
+  struct cinq_read_set *rs = NULL;
+  ssize_t copied;
+  int i;
+
+  spin_lock(&fdata->fd_ra_lock);
+  for (i = 0; i < 2; ++i) {
+    rs = fdata->fd_ra[i];
+    if (rs && pos >= rs->rs_pos && pos + len <= rs->rs_pos + rs->rs_len) {
+      cinq_read_set_hold(rs);
+      break;
+    }
+    rs = NULL;
+  }
+  spin_unlock(&fdata->fd_ra_lock);
+  if (!rs) return 0;
+  copied = read_set_copy_(rs, buf, pos - rs->rs_pos, len);
+  cinq_read_set_put(rs);
+  return copied;
+}
+
+static void ra_window_fill_(struct dentry *dentry, struct inode *inode,
+                            size_t len, loff_t pos) {
+  struct cinq_fdata *fdata = i_tag(inode)->t_data;
+  struct cinq_read_set *rs, *old;
+  unsigned int gen;
+
+  if (!fdata) return; // nothing written, so all reads are holes
+  spin_lock(&fdata->fd_ra_lock);
+  gen = fdata->fd_ra_gen;
+  spin_unlock(&fdata->fd_ra_lock);
+
+  rs = read_get_(dentry, inode, len, pos);
+  if (!rs || IS_ERR(rs)) return;
+
+  spin_lock(&fdata->fd_ra_lock);
+  if (gen == fdata->fd_ra_gen) { // the older window is left to the reader
+    old = fdata->fd_ra[1];
+    fdata->fd_ra[1] = fdata->fd_ra[0];
+    fdata->fd_ra[0] = rs;
+    rs = old;
+  }
+  spin_unlock(&fdata->fd_ra_lock);
+  if (rs) cinq_read_set_put(rs);
+}
+
+void cinq_read_ahead(struct dentry *dentry, size_t len, loff_t pos) {
+  struct inode *inode = cinq_view_inode(dentry);
+  if (IS_ERR(inode)) return;
+  ra_window_fill_(dentry, inode, len, pos);
+  iput(inode);
+}
+
+static ssize_t cinq_do_read_(struct file *filp, char *buf, size_t len,
+                             loff_t *ppos) {
+  struct dentry *dentry = filp->f_path.dentry;
+  struct inode *inode = cinq_view_inode(dentry);
+  struct cinq_fdata *fdata;
+  struct cinq_read_set *rs;
+  ssize_t copied = 0;
+
+  if (IS_ERR(inode)) return PTR_ERR(inode);
+  fdata = i_tag(inode)->t_data;
+  cinq_file_ra(filp, *ppos, len);
+  if (*ppos >= inode->i_size) goto out;
+  if (*ppos + len > inode->i_size) len = inode->i_size - *ppos;
+  if (fdata) copied = ra_window_read_(fdata, buf, len, *ppos);
+
+  if (!copied) {
+    rs = read_get_(dentry, inode, len, *ppos);
+    if (!rs) goto out;
+    if (IS_ERR(rs)) {
+      copied = PTR_ERR(rs);
+      goto out;
+    }
+    copied = read_set_copy_(rs, buf, 0, rs->rs_len);
+    DEBUG_ON_(copied != rs->rs_len,
+              "[Err@cinq_file_read] segments cover %ld rather than %ld.\n",
+              (long)copied, (long)rs->rs_len);
+    cinq_read_set_put(rs);
+  }
+  *ppos += copied;
+out:
+  iput(inode);
+  return copied;
 }
 
 ssize_t cinq_file_read(struct file *filp, char *buf, size_t len, loff_t *ppos) {
+  TRACE_BEGIN_(t);
+  ssize_t ret = cinq_do_read_(filp, buf, len, ppos);
+  STAT_END_(CINQ_STAT_READ, t, ret < 0);
+  TRACE_END_(CINQ_STAT_READ, t, i_cnode(filp->f_dentry->d_inode)->ci_id,
+             fsnode_id(i_fs(filp->f_dentry->d_inode)), ret);
+  return ret;
+}
+
+// Hands [pos, pos + len) of @data to the cache as a single entry.
+static inline void cinq_write_entry_(struct fingerprint *fp, char *data,
+                                     loff_t pos, size_t len) {
+  struct data_entry de;
+  de.data = data;
+  de.offset = pos;
+  de.len = len;
+  wcache_write(fp, &de);
+}
+
+#ifndef CINQ_DEDUP
+
+// Writes the segments at @pos through the inode-keyed fingerprint.
+// Returns the number of bytes written, or a negative error code.
+static ssize_t cache_writev_(struct file *filp, struct inode *inode,
+                             const struct iovec *iov,
+                             unsigned long nr_segs, loff_t pos) {
   struct fingerprint fp;
-  struct data_set *ds;
-  struct data_entry *cur;
-  loff_t buf_offset;
-  loff_t data_offset;
-  size_t cpy_len;
-  loff_t filend = filp->f_pos + len;
-  loff_t curend;
-  
-  if (*ppos >= filp->f_dentry->d_inode->i_size) return 0;
-  
+  const struct iovec *seg;
+  char *stage = NULL;
+  size_t staged = 0, total = 0;
+  int err = 0;
+
   fp.uid = 0;
-  cfp_set_value(&fp, filp);
+  cfp_set_value(&fp, filp->f_path.dentry, inode);
 
-  ds = wcache_read(&fp, filp->f_pos, len);
-  
-  list_for_each_entry(cur, &ds->entries, entry) {
-    curend = cur->offset + cur->len;
-    if (cur->offset < filp->f_pos) {
-      buf_offset = 0;
-      data_offset = filp->f_pos - cur->offset;
+  for (seg = iov; seg < iov + nr_segs; ++seg) {
+    if (!seg->iov_len) continue;
+    if (staged && staged + seg->iov_len > CINQ_WRITE_STAGE) {
+      cinq_write_entry_(&fp, stage, pos - staged, staged);
+      staged = 0;
+    }
+    // A lone segment, or one too large to merge, goes to the cache as is.
+    if (seg->iov_len >= CINQ_WRITE_STAGE ||
+        (!staged && (seg + 1 == iov + nr_segs ||
+                     seg->iov_len + seg[1].iov_len > CINQ_WRITE_STAGE))) {
+      cinq_write_entry_(&fp, seg->iov_base, pos, seg->iov_len);
     } else {
-      buf_offset = cur->offset - filp->f_pos;
-      data_offset = 0;
+      if (!stage && !(stage = stage_malloc_())) {
+        err = -ENOMEM;
+        break;
+      }
+      if (bufget(stage + staged, seg->iov_base, seg->iov_len)) {
+        err = -EFAULT;
+        break;
+      }
+      staged += seg->iov_len;
     }
-    cpy_len = curend > filend ?
-        filend - cur->offset - data_offset : cur->len - data_offset;
-    bufcpy(buf + buf_offset, cur->data + data_offset, cpy_len);
-    DEBUG_ON_(cur->offset + data_offset + cpy_len > filend,
-              "[Err@cinq_file_read] cache provides more than expected: %lld.\n",
-              cur->offset + data_offset + cpy_len);
-    *ppos += cpy_len;
+    pos += seg->iov_len;
+    total += seg->iov_len;
+  }
+  if (staged) {
+    cinq_write_entry_(&fp, stage, pos - staged, staged);
+  }
+  if (stage) stage_free_(stage);
+  return total ? total : err;
+}
+
+#else
+
+// Fingerprints a chunk and stores it unless the cache holds it already.
+// Chunks are stored whole, so probing for their last byte suffices.
+static void dedup_emit_(const char *chunk, size_t len, loff_t pos,
+                        struct cinq_chunk_ref *ref) {
+  struct fingerprint fp;
+  struct data_set *ds;
+  int cached;
+
+  ref->cr_off = pos;
+  ref->cr_len = len;
+  ref->cr_skip = 0;
+  chunk_fingerprint(chunk, len, ref->cr_fp);
+  cfp_set_chunk_(&fp, ref->cr_fp);
+
+  ds = wcache_read(&fp, len - 1, 1);
+  cached = ds && !list_empty(&ds->entries);
+  data_set_release_(ds);
+  if (!cached) {
+    cinq_write_entry_(&fp, (char *)chunk, 0, len);
   }
-  return *ppos - filp->f_pos;
+}
+
+// Cuts the written stream into content-defined chunks, so that the same
+// data written by clones of a VM image maps onto the same cache objects.
+// Each write starts a new chunk; chunks do not span separate writes.
+static ssize_t dedup_writev_(struct file *filp, struct inode *inode,
+                             const struct iovec *iov,
+                             unsigned long nr_segs, loff_t pos) {
+  struct cinq_chunk_map *map = &i_tag(inode)->t_data->fd_chunks;
+  struct cinq_chunk_ref refs[DEDUP_REF_BATCH];
+  const struct iovec *seg;
+  char *buf;
+  size_t begin = 0, scan = 0, fill = 0, off, n, cut;
+  loff_t start = pos; // file offset of the current chunk
+  u64 hash = 0;
+  int nref = 0, err = 0;
+
+  buf = stage_malloc_();
+  if (unlikely(!buf)) return -ENOMEM;
+
+  // The current chunk is buf[begin, fill), of which [begin, scan) is hashed.
+  for (seg = iov; seg < iov + nr_segs && !err; ++seg) {
+    for (off = 0; off < seg->iov_len; off += n) {
+      if (fill == CHUNK_MAX_SIZE) { // a chunk never reaches the full buffer
+        memmove(buf, buf + begin, fill - begin);
+        scan -= begin;
+        fill -= begin;
+        begin = 0;
+      }
+      n = seg->iov_len - off < CHUNK_MAX_SIZE - fill ?
+          seg->iov_len - off : CHUNK_MAX_SIZE - fill;
+      if (bufget(buf + fill, (char *)seg->iov_base + off, n)) {
+        err = -EFAULT;
+        break;
+      }
+      fill += n;
+      for (; scan < fill; begin = scan) {
+        cut = chunk_cut(buf + scan, fill - scan, scan - begin, &hash);
+        if (!cut) {
+          scan = fill;
+          break;
+        }
+        scan += cut;
+        dedup_emit_(buf + begin, scan - begin, start, &refs[nref]);
+        start += scan - begin;
+        if (++nref == DEDUP_REF_BATCH) {
+          if ((err = chunk_map_set(map, refs, nref))) {
+            start = refs[0].cr_off; // not mapped, so not written
+            break;
+          }
+          nref = 0;
+        }
+      }
+      if (err) break;
+    }
+  }
+  if (!err && fill > begin) { // the end of a write ends its last chunk
+    dedup_emit_(buf + begin, fill - begin, start, &refs[nref++]);
+    start += fill - begin;
+  }
+  if (nref && !err) {
+    err = chunk_map_set(map, refs, nref);
+    if (err) start = refs[0].cr_off; // not mapped, so not written
+  }
+  stage_free_(buf);
+  return start > pos ? start - pos : err;
+}
+
+#endif // CINQ_DEDUP
+
+static struct cinq_fdata *fdata_new_(void) {
+  struct cinq_fdata *fdata = fdata_malloc_();
+  if (unlikely(!fdata)) return NULL;
+  range_tree_init(&fdata->fd_ranges);
+  extent_map_init(&fdata->fd_extents);
+  spin_lock_init(&fdata->fd_ra_lock);
+  fdata->fd_ra[0] = fdata->fd_ra[1] = NULL;
+  fdata->fd_ra_gen = 0;
+#ifdef CINQ_DEDUP
+  chunk_map_init(&fdata->fd_chunks);
+#else
+  fdata->fd_origin = NULL;
+  extent_map_init(&fdata->fd_own);
+#endif
+  return fdata;
+}
+
+static struct cinq_fdata *fdata_get_(struct inode *inode) {
+  struct cinq_tag *tag = i_tag(inode);
+  struct cinq_fdata *fdata;
+
+  if (likely(tag->t_data)) return tag->t_data;
+  fdata = fdata_new_();
+  if (unlikely(!fdata)) return NULL;
+  spin_lock(&inode->i_lock);
+  if (!tag->t_data) {
+    tag->t_data = fdata;
+    fdata = NULL;
+  }
+  spin_unlock(&inode->i_lock);
+  cinq_fdata_free(fdata); // lost the race
+  return tag->t_data;
+}
+
+void cinq_fdata_free(struct cinq_fdata *fdata) {
+  if (!fdata) return;
+  ra_window_drop_(fdata);
+  range_tree_destroy(&fdata->fd_ranges);
+  extent_map_destroy(&fdata->fd_extents);
+#ifdef CINQ_DEDUP
+  chunk_map_destroy(&fdata->fd_chunks);
+#else
+  extent_map_destroy(&fdata->fd_own);
+  if (fdata->fd_origin) atomic_dec(&fdata->fd_origin->t_count);
+#endif
+  fdata_free_(fdata);
+}
+
+// The origin is frozen, so no writer is at it but one that began before
+// the snapshot, which the range lock waits for. The copy holds the origin
+// tag, so that the key of the data read through it is not reused.
+// Chunks are keyed by content, so under dedup the copy needs no origin.
+struct cinq_fdata *cinq_fdata_copy(struct cinq_tag *from) {
+  struct cinq_fdata *fdata = from->t_data, *copy = fdata_new_();
+  struct cinq_extent *ext;
+  struct cinq_range range;
+  int n, i, err = 0;
+#ifdef CINQ_DEDUP
+  struct cinq_chunk_ref *refs;
+#endif
+
+  if (unlikely(!copy)) return ERR_PTR(-ENOMEM);
+  range_tree_lock(&fdata->fd_ranges, &range, 0, MAX_LFS_FILESIZE);
+
+  n = extent_map_get(&fdata->fd_extents, 0, MAX_LFS_FILESIZE, &ext);
+  for (i = 0; i < n && !err; ++i) {
+    err = extent_map_add(&copy->fd_extents, ext[i].e_start, ext[i].e_end);
+  }
+  if (n > 0) extent_free(ext);
+  else err = n;
+#ifdef CINQ_DEDUP
+  n = err ? 0 : chunk_map_get(&fdata->fd_chunks, 0, MAX_LFS_FILESIZE, &refs);
+  if (n > 0) {
+    err = chunk_map_set(&copy->fd_chunks, refs, n);
+    chunk_refs_free(refs);
+  } else if (n < 0) {
+    err = n;
+  }
+#elif !defined(SPNFS_)
+  if (!err) {
+    copy->fd_origin = from;
+    atomic_inc(&from->t_count);
+  }
+#endif
+
+  range_tree_unlock(&fdata->fd_ranges, &range);
+  if (unlikely(err)) {
+    cinq_fdata_free(copy);
+    return ERR_PTR(err);
+  }
+  return copy;
+}
+
+// Writers of overlapping ranges are serialized by the range lock of the
+// file, while those of disjoint ranges only meet at the size update.
+static ssize_t cinq_do_writev_(struct file *filp, const struct iovec *iov,
+                               unsigned long nr_segs, loff_t *ppos) {
+  struct cinq_fsnode *fs;
+  struct inode *inode = cinq_change_get(filp->f_path.dentry, &fs);
+  struct cinq_fdata *fdata;
+  struct cinq_range range;
+  const loff_t pos = *ppos;
+  size_t len = 0;
+  ssize_t ret = -ENOMEM;
+  unsigned long i;
+
+  if (IS_ERR(inode)) return PTR_ERR(inode);
+  fdata = fdata_get_(inode);
+  if (unlikely(!fdata)) goto out;
+  for (i = 0; i < nr_segs; ++i) {
+    len += iov[i].iov_len;
+  }
+  range_tree_lock(&fdata->fd_ranges, &range, pos, pos + len);
+
+#ifdef CINQ_DEDUP
+  ret = dedup_writev_(filp, inode, iov, nr_segs, pos);
+#else
+  ret = cache_writev_(filp, inode, iov, nr_segs, pos);
+  if (ret > 0 && fdata->fd_origin &&
+      unlikely(extent_map_add(&fdata->fd_own, pos, pos + ret))) {
+    ret = -ENOMEM; // still read from the origin
+  }
+#endif
+
+  if (ret > 0 && unlikely(extent_map_add(&fdata->fd_extents, pos, pos + ret))) {
+    ret = -ENOMEM; // unreachable by reads
+  }
+  if (ret > 0) ra_window_drop_(fdata);
+  if (ret > 0) {
+    spin_lock(&inode->i_lock);
+    if (pos + ret > inode->i_size) {
+      i_size_write(inode, pos + ret);
+    }
+    spin_unlock(&inode->i_lock);
+    *ppos = pos + ret;
+  }
+  range_tree_unlock(&fdata->fd_ranges, &range);
+out:
+  cinq_change_put(inode, fs);
+  return ret;
+}
+
+// Also serves the write ring.
+ssize_t cinq_file_writev(struct file *filp, const struct iovec *iov,
+                         unsigned long nr_segs, loff_t *ppos) {
+  TRACE_BEGIN_(t);
+  ssize_t ret = cinq_do_writev_(filp, iov, nr_segs, ppos);
+  STAT_END_(CINQ_STAT_WRITE, t, ret < 0);
+  TRACE_END_(CINQ_STAT_WRITE, t, i_cnode(filp->f_dentry->d_inode)->ci_id,
+             fsnode_id(i_fs(filp->f_dentry->d_inode)), ret);
+  return ret;
 }
 
 ssize_t cinq_file_write(struct file *filp, const char *buf, size_t len,
                         loff_t *ppos) {
-  struct fingerprint fp;
-  struct data_entry de;
-  struct inode *inode = filp->f_path.dentry->d_inode;
-  char *fname = (char *)filp->f_dentry->d_name.name;
-  
-  DEBUG_("cinq_file_write: write to file '%s' with len = %ld\n", fname, len);
-  
-  fp.uid = 0;
-  cfp_set_value(&fp, filp);
+  struct iovec vec = { .iov_base = (void *)buf, .iov_len = len };
+  return cinq_file_writev(filp, &vec, 1, ppos);
+}
 
-  de.data = (char *)buf;
-  de.offset = filp->f_pos;
-  de.len = len;
-  
-  wcache_write(&fp, &de);
-  *ppos += len;
-  if (*ppos > inode->i_size) {
-    i_size_write(inode, *ppos);
+#ifdef __KERNEL__
+
+// With .aio_write set, the VFS hands writev(2) over as one vector
+// instead of one .write call per segment.
+ssize_t cinq_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                            unsigned long nr_segs, loff_t pos) {
+  ssize_t ret = cinq_file_writev(iocb->ki_filp, iov, nr_segs, &pos);
+  if (ret > 0) iocb->ki_pos = pos;
+  return ret;
+}
+
+#endif // __KERNEL__
+
+// Unmaps [pos, end) of the file, which then reads as a hole.
+// cinq_cache has no call to evict a range, so the cached data stays until
+// the cache replaces it; it is never read again, as reads only go where
+// the extent map says. Chunks are unmapped likewise.
+// Called with the range held.
+static long file_punch_(struct cinq_fdata *fdata, loff_t pos, loff_t end) {
+  loff_t last = extent_map_punch(&fdata->fd_extents, pos, end);
+  if (unlikely(last < 0)) return last;
+  ra_window_drop_(fdata);
+#ifdef CINQ_DEDUP
+  return chunk_map_punch(&fdata->fd_chunks, pos, end);
+#else
+  last = extent_map_punch(&fdata->fd_own, pos, end);
+  return last < 0 ? last : 0;
+#endif
+}
+
+void cinq_file_truncate(struct inode *inode, loff_t size) {
+  struct cinq_fdata *fdata = i_tag(inode)->t_data;
+  struct cinq_range range;
+
+  if (fdata) { // waits for writers beyond the new size
+    range_tree_lock(&fdata->fd_ranges, &range, size, MAX_LFS_FILESIZE);
+  }
+  spin_lock(&inode->i_lock);
+  i_size_write(inode, size);
+  spin_unlock(&inode->i_lock);
+  if (!fdata) return; // nothing written
+
+  // Never splits an extent, so cannot fail
+  file_punch_(fdata, size, MAX_LFS_FILESIZE);
+  range_tree_unlock(&fdata->fd_ranges, &range);
+}
+
+long cinq_file_fallocate(struct file *filp, int mode,
+                         loff_t offset, loff_t len) {
+  struct dentry *dentry = filp->f_path.dentry;
+  struct cinq_fsnode *fs;
+  struct inode *inode;
+  struct cinq_fdata *fdata;
+  struct cinq_range range;
+  long err = 0;
+
+  if (offset < 0 || len <= 0) return -EINVAL;
+  if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+    return -EOPNOTSUPP;
+  if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+    return -EOPNOTSUPP;
+
+  inode = cinq_change_get(dentry, &fs);
+  if (IS_ERR(inode)) return PTR_ERR(inode);
+  if (!(mode & FALLOC_FL_PUNCH_HOLE)) {
+    spin_lock(&inode->i_lock);
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + len > inode->i_size) {
+      i_size_write(inode, offset + len);
+    }
+    spin_unlock(&inode->i_lock);
+  } else if ((fdata = i_tag(inode)->t_data)) { // or all a hole already
+    range_tree_lock(&fdata->fd_ranges, &range, offset, offset + len);
+    err = file_punch_(fdata, offset, offset + len);
+    range_tree_unlock(&fdata->fd_ranges, &range);
   }
-  return len;
+  cinq_change_put(inode, fs);
+  return err;
 }
 
+// Answers from the extent map, without probing the cache.
+// The end of file counts as a hole.
+loff_t cinq_file_llseek(struct file *filp, loff_t offset, int origin) {
+  struct inode *inode = filp->f_path.dentry->d_inode, *view;
+  struct cinq_fdata *fdata;
+
+  if (origin != SEEK_DATA && origin != SEEK_HOLE)
+    return generic_file_llseek(filp, offset, origin);
+
+  view = cinq_view_inode(filp->f_path.dentry);
+  if (IS_ERR(view)) return PTR_ERR(view);
+  mutex_lock(&inode->i_mutex);
+  if (offset < 0 || offset >= view->i_size) {
+    offset = -ENXIO;
+  } else if ((fdata = i_tag(view)->t_data)) {
+    offset = extent_map_seek(&fdata->fd_extents, offset, origin == SEEK_DATA);
+  } else if (origin == SEEK_DATA) { // nothing written
+    offset = -ENXIO;
+  }
+  if (offset > view->i_size) offset = view->i_size;
+  if (offset >= 0 && offset != filp->f_pos) {
+    filp->f_pos = offset;
+    filp->f_version = 0;
+  }
+  mutex_unlock(&inode->i_mutex);
+  iput(view);
+  return offset;
+}
+
+#ifndef __KERNEL__
+
+// Takes a run of SQEs on the same file at contiguous positions,
+// starting from @head, and writes them through one vectored call.
+// Returns the number of SQEs consumed.
+static unsigned int wring_write_run_(struct cinq_wring *ring,
+                                     unsigned int head, unsigned int tail) {
+  struct iovec vec[CINQ_WRING_MAX_RUN];
+  struct cinq_wsqe *first = &ring->sq[head & ring->mask];
+  struct cinq_wsqe *sqe = first;
+  struct cinq_wcqe *cqe;
+  loff_t pos = first->pos;
+  ssize_t res;
+  unsigned int n = 0, i;
+
+  do {
+    vec[n].iov_base = (void *)sqe->buf;
+    vec[n].iov_len = sqe->len;
+    pos += sqe->len;
+    if (++n == CINQ_WRING_MAX_RUN || head + n == tail) break;
+    sqe = &ring->sq[(head + n) & ring->mask];
+  } while (sqe->filp == first->filp && sqe->pos == pos);
+
+  pos = first->pos;
+  res = cinq_file_writev(first->filp, vec, n, &pos);
+
+  spin_lock(&ring->lock);
+  for (i = 0; i < n; ++i) {
+    sqe = &ring->sq[(head + i) & ring->mask];
+    cqe = &ring->cq[ring->cq_tail++ & ring->mask];
+    cqe->user_data = sqe->user_data;
+    if (res < 0) {
+      cqe->res = res;
+    } else {
+      cqe->res = res > (ssize_t)sqe->len ? (ssize_t)sqe->len : res;
+      res -= cqe->res;
+    }
+  }
+  ring->sq_head = head + n;
+  pthread_cond_broadcast(&ring->done);
+  spin_unlock(&ring->lock);
+  return n;
+}
+
+static void *wring_worker_(void *data) {
+  struct cinq_wring *ring = data;
+  unsigned int head, tail;
+
+  spin_lock(&ring->lock);
+  while (!ring->stop || ring->sq_head != ring->sq_submitted) {
+    if (ring->sq_head == ring->sq_submitted) {
+      pthread_cond_wait(&ring->work, &ring->lock);
+      continue;
+    }
+    head = ring->sq_head;
+    tail = ring->sq_submitted;
+    spin_unlock(&ring->lock);
+    while (head != tail) { // SQEs in [head, tail) are owned by the worker
+      head += wring_write_run_(ring, head, tail);
+    }
+    spin_lock(&ring->lock);
+  }
+  spin_unlock(&ring->lock);
+  return NULL;
+}
+
+int cinq_wring_init(struct cinq_wring *ring, unsigned int entries) {
+  unsigned int size = 1;
+  while (size < entries) size <<= 1;
+
+  memset(ring, 0, sizeof(struct cinq_wring));
+  ring->mask = size - 1;
+  ring->sq = calloc(size, sizeof(struct cinq_wsqe));
+  ring->cq = calloc(size, sizeof(struct cinq_wcqe));
+  if (!ring->sq || !ring->cq) {
+    free(ring->sq);
+    free(ring->cq);
+    return -ENOMEM;
+  }
+  spin_lock_init(&ring->lock);
+  pthread_cond_init(&ring->work, NULL);
+  pthread_cond_init(&ring->done, NULL);
+  if (pthread_create(&ring->worker, NULL, wring_worker_, ring)) {
+    free(ring->sq);
+    free(ring->cq);
+    return -EAGAIN;
+  }
+  return 0;
+}
+
+// Waits for all submitted writes before stopping the worker.
+// Completions not yet reaped are dropped.
+void cinq_wring_exit(struct cinq_wring *ring) {
+  spin_lock(&ring->lock);
+  ring->stop = 1;
+  pthread_cond_signal(&ring->work);
+  spin_unlock(&ring->lock);
+  pthread_join(ring->worker, NULL);
+
+  pthread_cond_destroy(&ring->work);
+  pthread_cond_destroy(&ring->done);
+  free(ring->sq);
+  free(ring->cq);
+}
+
+struct cinq_wsqe *cinq_wring_get_sqe(struct cinq_wring *ring) {
+  struct cinq_wsqe *sqe = NULL;
+  spin_lock(&ring->lock);
+  // A slot is reusable only after its completion has been reaped.
+  if (ring->sq_tail - ring->cq_head <= ring->mask) {
+    sqe = &ring->sq[ring->sq_tail++ & ring->mask];
+  }
+  spin_unlock(&ring->lock);
+  return sqe;
+}
+
+int cinq_wring_submit(struct cinq_wring *ring) {
+  int n;
+  spin_lock(&ring->lock);
+  n = ring->sq_tail - ring->sq_submitted;
+  ring->sq_submitted = ring->sq_tail;
+  if (n) pthread_cond_signal(&ring->work);
+  spin_unlock(&ring->lock);
+  return n;
+}
+
+int cinq_wring_wait_cqe(struct cinq_wring *ring, struct cinq_wcqe **cqe_p,
+                        int wait) {
+  spin_lock(&ring->lock);
+  while (ring->cq_head == ring->cq_tail) {
+    if (!wait || ring->cq_tail == ring->sq_submitted) {
+      sp_release_return(&ring->lock, -EAGAIN); // nothing in flight
+    }
+    pthread_cond_wait(&ring->done, &ring->lock);
+  }
+  *cqe_p = &ring->cq[ring->cq_head & ring->mask];
+  spin_unlock(&ring->lock);
+  return 0;
+}
+
+void cinq_wring_cqe_seen(struct cinq_wring *ring) {
+  spin_lock(&ring->lock);
+  ++ring->cq_head;
+  spin_unlock(&ring->lock);
+}
+
+#endif // __KERNEL__
+
 int cinq_dir_open(struct inode *inode, struct file *filp) {
   struct inode *dir = filp->f_dentry->d_inode;
   struct cinq_inode *cnode;
@@ -155,14 +1302,15 @@ int cinq_dir_open(struct inode *inode, struct file *filp) {
 
   if (unlikely(inode_meta_root(dir))) {
     struct cinq_tag *cur;
-    read_lock(&cnode->ci_tags_lock);
+    tags_read_lock(cnode);
     cur = filp->private_data = cnode->ci_tags;
     read_unlock(&cnode->ci_tags_lock);
     if (cur) atomic_inc(&cur->t_count); // prevents from being evicted
   } else {
     struct cinq_inode *cur;
-    read_lock(&cnode->ci_children_lock);
-    cur = filp->private_data = cnode->ci_children;
+    int err = children_read_lock_in(cnode);
+    if (unlikely(err)) return err;
+    cur = filp->private_data = cnode_next_child(cnode, NULL);
     read_unlock(&cnode->ci_children_lock);
     if (cur) atomic_inc(&cur->ci_count); // prevents from being evicted
   }
@@ -188,8 +1336,31 @@ int cinq_dir_release(struct inode * inode, struct file * filp) {
   return 0;
 }
 
+// The f_version of a directory file records the order its cursor was
+// placed in, as the children are moved from the hash to the sorted index
+// once the directory grows past cinq_dirindex_min.
+#define CURSOR_HASHED_ 0
+#define CURSOR_SORTED_ 1
+
+static inline u64 cursor_order_(struct cinq_inode *cnode) {
+  return cnode->ci_index ? CURSOR_SORTED_ : CURSOR_HASHED_;
+}
+
+// Skips the first @n children of @cnode visible to @fs, in the order
+// the children are kept in now. Called with ci_children_lock held.
+static struct cinq_inode *cursor_skip_(struct cinq_inode *cnode,
+                                       struct cinq_fsnode *fs, loff_t n) {
+  struct cinq_inode *cur = cnode_next_child(cnode, NULL);
+  while (n && cur) {
+    if (cnode_lookup_tag(cur, fs)) --n;
+    cur = cnode_next_child(cnode, cur);
+  }
+  return cur;
+}
+
 loff_t cinq_dir_lseek(struct file *filp, loff_t offset, int origin) {
   struct dentry *dentry = filp->f_path.dentry;
+  struct cinq_fsnode *fs = dentry_fs(dentry);
   struct inode *inode = dentry->d_inode;
   struct cinq_inode *cnode = i_cnode(inode);
 
@@ -210,7 +1381,7 @@ loff_t cinq_dir_lseek(struct file *filp, loff_t offset, int origin) {
       if (unlikely(inode_meta_root(inode))) {
     	struct cinq_tag *cur = filp->private_data;
 
-        read_lock(&cnode->ci_tags_lock);
+        tags_read_lock(cnode);
         if (cur) atomic_dec(&cur->t_count);
         cur = cnode->ci_tags;
         while (n && cur) {
@@ -222,20 +1393,17 @@ loff_t cinq_dir_lseek(struct file *filp, loff_t offset, int origin) {
         atomic_inc(&cur->t_count);
         read_unlock(&cnode->ci_tags_lock);
       } else {
-    	struct inode *target;
     	struct cinq_inode *cur = filp->private_data;
 
-    	read_lock(&cnode->ci_children_lock);
-    	if (cur) atomic_dec(&cur->ci_count);
-    	cur = cnode->ci_children;
-    	if (cur)
-    	while (n && cur) {
-    	  target = cnode_lookup_inode(cur, dentry->d_fsdata);
-    	  if (target) --n;
-          cur = cur->ci_child.next;
+    	if (unlikely(children_read_lock_in(cnode))) {
+    	  mutex_unlock(&dentry->d_inode->i_mutex);
+    	  return -EIO;
     	}
-    	if (!cur) cur = cnode->ci_children;
+    	if (cur) atomic_dec(&cur->ci_count);
+    	cur = cursor_skip_(cnode, fs, n);
+    	if (!cur) cur = cnode_next_child(cnode, NULL);
     	filp->private_data = cur;
+    	filp->f_version = cursor_order_(cnode);
     	atomic_inc(&cur->ci_count);
     	read_unlock(&cnode->ci_children_lock);
       }
@@ -244,13 +1412,13 @@ loff_t cinq_dir_lseek(struct file *filp, loff_t offset, int origin) {
   mutex_unlock(&dentry->d_inode->i_mutex);
   DEBUG_("cinq_dir_lseek: for offset %ld in dir %s (%p) by FS %s.\n",
 		 (long int)offset, cnode->ci_name, dentry,
-		 ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name);
+		 fs->fs_name);
   return offset;
 }
 
 /* Relationship between i_mode and the DT_xxx types */
-static inline unsigned char dt_type(struct inode *inode) {
-  return (inode->i_mode >> 12) & 15;
+static inline unsigned char dt_type(umode_t mode) {
+  return (mode >> 12) & 15;
 }
 
 #define move_cursor(cur, count, hh) ( \
@@ -260,8 +1428,37 @@ static inline unsigned char dt_type(struct inode *inode) {
   filp->private_data = cur \
 )
 
-int cinq_readdir(struct file *filp, void *dirent, filldir_t filldir) {
+// Fills from the cursor on through the sorted blocks of @cnode,
+// decoding the names in turn, and leaves the cursor at the first child
+// not filled.
+static void readdir_index_(struct file *filp, void *dirent,
+                           filldir_t filldir, struct cinq_inode *cnode) {
+  struct cinq_fsnode *fs = filp->f_path.dentry->d_fsdata;
+  struct cinq_inode *cursor = filp->private_data, *child;
+  struct cinq_tag *target;
+  struct cinq_dirpos pos;
+
+  if (!cursor) return;
+  child = dirindex_seek(cnode->ci_index, cursor->ci_name, &pos);
+  for (; child; child = dirindex_next(cnode->ci_index, &pos)) {
+    target = cnode_lookup_tag(child, fs);
+    if (!target) continue;
+    if (filldir(dirent, pos.dp_name, pos.dp_len, filp->f_pos,
+                (unsigned long)target, dt_type(target->t_attr.a_mode)) < 0)
+      break;
+    filp->f_pos++;
+  }
+  if (child != cursor) {
+    atomic_dec(&cursor->ci_count);
+    if (child) atomic_inc(&child->ci_count);
+    filp->private_data = child;
+  }
+}
+
+static int cinq_do_readdir_(struct file *filp, void *dirent,
+                            filldir_t filldir) {
   struct dentry *dentry = filp->f_path.dentry;
+  struct cinq_fsnode *fs = dentry_fs(dentry);
   struct inode *inode = dentry->d_inode;
   struct cinq_inode *cnode = i_cnode(inode);
   char *name;
@@ -273,18 +1470,16 @@ int cinq_readdir(struct file *filp, void *dirent, filldir_t filldir) {
       case 0:
         if (filldir(dirent, ".", 1, filp->f_pos, inode->i_ino, DT_DIR) < 0)
           break;
-        DEBUG_("cinq_readdir(1): filldir '.'\n");
         filp->f_pos++;
         /* fallthrough */
       case 1:
         if (filldir(dirent, "..", 2, filp->f_pos,
                     parent_ino(dentry), DT_DIR) < 0)
           break;
-        DEBUG_("cinq_readdir(1): filldir '..'\n");
         filp->f_pos++;
         /* fallthrough */
       default:
-        read_lock(&cnode->ci_tags_lock);
+        tags_read_lock(cnode);
         if (filp->f_pos == 2) { // atomic
           if (cursor) atomic_dec(&cursor->t_count);
           cursor = cnode->ci_tags;
@@ -295,51 +1490,60 @@ int cinq_readdir(struct file *filp, void *dirent, filldir_t filldir) {
           if (cursor->t_fs == META_FS) continue;
           name = cursor->t_fs->fs_name;
           if (filldir(dirent, name, strlen(name),
-                      filp->f_pos, cursor->t_inode->i_ino, DT_DIR) < 0)
+                      filp->f_pos, (unsigned long)cursor->t_ino, DT_DIR) < 0)
             return 0;
-          DEBUG_("cinq_readdir(1): filldir %s (%ld).\n", name, strlen(name));
           filp->f_pos++;
         }
         read_unlock(&cnode->ci_tags_lock);
     }
   } else {
     struct cinq_inode *cursor = filp->private_data;
-    struct inode *target;
+    struct cinq_tag *target;
     ino_t ino;
 
     switch (filp->f_pos) {
       case 0:
         if (filldir(dirent, ".", 1, filp->f_pos, inode->i_ino, DT_DIR) < 0)
           break;
-        DEBUG_("cinq_readdir(2): filldir '.'\n");
         filp->f_pos++;
         /* fallthrough */
       case 1:
-        ino = cnode_lookup_inode(cnode->ci_parent, dentry->d_fsdata)->i_ino;
+        ino = (unsigned long)cnode_lookup_tag(cnode->ci_parent, fs);
         if (filldir(dirent, "..", 2, filp->f_pos, ino, DT_DIR) < 0)
           break;
-        DEBUG_("cinq_readdir(2): filldir '..'\n");
         filp->f_pos++;
         /* fallthrough */
       default:
-        read_lock(&cnode->ci_children_lock);
+        if (unlikely(children_read_lock_in(cnode))) return -EIO;
 		if (filp->f_pos == 2) { // atomic
 		  if (cursor) atomic_dec(&cursor->ci_count);
-		  cursor = cnode->ci_children;
+		  cursor = cnode_next_child(cnode, NULL);
+		  if (cursor) atomic_inc(&cursor->ci_count);
+		  filp->private_data = cursor;
+		  filp->f_version = cursor_order_(cnode);
+		} else if (cursor && filp->f_version != cursor_order_(cnode)) {
+		  // Placed in hash order, the cursor tells nothing of which names
+		  // sort before it, so it is re-seeked by the count listed so far.
+		  atomic_dec(&cursor->ci_count);
+		  cursor = cursor_skip_(cnode, fs, filp->f_pos - 2);
 		  if (cursor) atomic_inc(&cursor->ci_count);
 		  filp->private_data = cursor;
+		  filp->f_version = cursor_order_(cnode);
 		}
+        if (cnode->ci_index) {
+          readdir_index_(filp, dirent, filldir, cnode);
+          read_unlock(&cnode->ci_children_lock);
+          break;
+        }
         for (; cursor != NULL; move_cursor(cursor, ci_count, ci_child)) {
-          DEBUG_("cinq_readdir: reach cnode %s (for FS %s)\n",
-        		  cursor->ci_name, ((struct cinq_fsnode *)dentry->d_fsdata)->fs_name);
-          target = cnode_lookup_inode(cursor, dentry->d_fsdata);
+          // The type bits are never changed, so no inode is needed.
+          target = cnode_lookup_tag(cursor, fs);
           if (!target) continue;
           name = cursor->ci_name;
-          if (filldir(dirent, name, strlen(name),
-                      filp->f_pos, target->i_ino, dt_type(target)) < 0) {
+          if (filldir(dirent, name, strlen(name), filp->f_pos,
+                      (unsigned long)target, dt_type(target->t_attr.a_mode)) < 0) {
         	rd_release_return(&cnode->ci_children_lock, 0);
           }
-          DEBUG_("cinq_readdir(2): filldir %s (%ld).\n", name, strlen(name));
           filp->f_pos++;
         }
         read_unlock(&cnode->ci_children_lock);
@@ -348,3 +1552,127 @@ int cinq_readdir(struct file *filp, void *dirent, filldir_t filldir) {
   return 0;
 }
 
+int cinq_readdir(struct file *filp, void *dirent, filldir_t filldir) {
+  TRACE_BEGIN_(t);
+  int err = cinq_do_readdir_(filp, dirent, filldir);
+  STAT_END_(CINQ_STAT_READDIR, t, err);
+  TRACE_END_(CINQ_STAT_READDIR, t, i_cnode(filp->f_dentry->d_inode)->ci_id,
+             fsnode_id(filp->f_dentry->d_fsdata), err);
+  return err;
+}
+
+void cinq_scan_range(struct cinq_scan *scan, const char *from, const char *to) {
+  strncpy(scan->sc_from, from, MAX_NAME_LEN);
+  scan->sc_from[MAX_NAME_LEN] = '\0';
+  strncpy(scan->sc_to, to ? to : "", MAX_NAME_LEN);
+  scan->sc_to[MAX_NAME_LEN] = '\0';
+  scan->sc_after = 0;
+  scan->sc_pos = 0;
+}
+
+void cinq_scan_prefix(struct cinq_scan *scan, const char *prefix) {
+  int i;
+  cinq_scan_range(scan, prefix, NULL);
+  // The least name after all those with the prefix
+  strcpy(scan->sc_to, scan->sc_from);
+  for (i = strlen(scan->sc_to) - 1; i >= 0; --i) {
+    if ((unsigned char)scan->sc_to[i] != 0xff) {
+      ++scan->sc_to[i];
+      break;
+    }
+  }
+  scan->sc_to[i + 1] = '\0'; // none if empty
+}
+
+// Returns 0 if @name is in the rest of @scan, < 0 if before and > 0 if
+// past it.
+static inline int scan_in_(const struct cinq_scan *scan, const char *name) {
+  int cmp = strcmp(name, scan->sc_from);
+  if (cmp < 0 || (!cmp && scan->sc_after)) return -1;
+  if (scan->sc_to[0] && strcmp(name, scan->sc_to) >= 0) return 1;
+  return 0;
+}
+
+// Returns 1 if @child is filled, 0 if it is not seen through @fs,
+// or -1 if @filldir stops.
+static int scan_fill_(struct cinq_scan *scan, struct cinq_inode *child,
+                      const char *name, int len, struct cinq_fsnode *fs,
+                      void *dirent, filldir_t filldir) {
+  struct cinq_tag *target = cnode_lookup_tag(child, fs);
+  if (!target) return 0;
+  if (filldir(dirent, name, len, scan->sc_pos, (unsigned long)target,
+              dt_type(target->t_attr.a_mode)) < 0) {
+    return -1;
+  }
+  memcpy(scan->sc_from, name, len + 1);
+  scan->sc_after = 1;
+  ++scan->sc_pos;
+  return 1;
+}
+
+static int scan_cmp_(const void *a, const void *b) {
+  return strcmp((*(struct cinq_inode **)a)->ci_name,
+                (*(struct cinq_inode **)b)->ci_name);
+}
+
+// Without an index, the children in range are gathered and sorted.
+static int scan_hash_(struct cinq_inode *cnode, struct cinq_fsnode *fs,
+                      struct cinq_scan *scan, void *dirent,
+                      filldir_t filldir) {
+  struct cinq_inode **found, *child, *tmp;
+  int num = 0, filled = 0, i, ret;
+
+  if (!cnode->ci_children) return 0;
+  found = found_malloc_(HASH_CNT(ci_child, cnode->ci_children));
+  if (unlikely(!found)) return -ENOMEM;
+  HASH_ITER(ci_child, cnode->ci_children, child, tmp) {
+    if (!scan_in_(scan, child->ci_name)) found[num++] = child;
+  }
+  sort(found, num, sizeof(*found), scan_cmp_, NULL);
+  for (i = 0; i < num; ++i) {
+    ret = scan_fill_(scan, found[i], found[i]->ci_name,
+                     strlen(found[i]->ci_name), fs, dirent, filldir);
+    if (ret < 0) break;
+    filled += ret;
+  }
+  found_free_(found);
+  return filled;
+}
+
+static int scan_index_(struct cinq_inode *cnode, struct cinq_fsnode *fs,
+                       struct cinq_scan *scan, void *dirent,
+                       filldir_t filldir) {
+  struct cinq_dirpos pos;
+  struct cinq_inode *child;
+  int filled = 0, in, ret;
+
+  child = dirindex_seek(cnode->ci_index, scan->sc_from, &pos);
+  for (; child; child = dirindex_next(cnode->ci_index, &pos)) {
+    in = scan_in_(scan, pos.dp_name);
+    if (in > 0) break;
+    if (in < 0) continue; // where the last call stopped
+    ret = scan_fill_(scan, child, pos.dp_name, pos.dp_len, fs,
+                     dirent, filldir);
+    if (ret < 0) break;
+    filled += ret;
+  }
+  return filled;
+}
+
+int cinq_scan_dir(struct inode *dir, struct cinq_fsnode *fs,
+                  struct cinq_scan *scan, void *dirent, filldir_t filldir) {
+  TRACE_BEGIN_(t);
+  struct cinq_inode *cnode = i_cnode(dir);
+  int ret = children_read_lock_in(cnode);
+  if (likely(!ret)) {
+    ret = cnode->ci_index ?
+        scan_index_(cnode, fs, scan, dirent, filldir) :
+        scan_hash_(cnode, fs, scan, dirent, filldir);
+    read_unlock(&cnode->ci_children_lock);
+  }
+  STAT_END_(CINQ_STAT_READDIR, t, ret < 0 ? ret : 0);
+  TRACE_END_(CINQ_STAT_READDIR, t, cnode->ci_id, fsnode_id(fs),
+             ret < 0 ? ret : 0);
+  return ret;
+}
+
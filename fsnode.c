@@ -20,12 +20,18 @@ static struct kmem_cache *cinq_fsnode_cachep;
     ((struct cinq_fsnode *)kmem_cache_alloc(cinq_fsnode_cachep, GFP_KERNEL))
 #define fsnode_free_(p) (kmem_cache_free(cinq_fsnode_cachep, p))
 
+static DEFINE_MUTEX(snapshot_mutex_);
+#define snap_publish_() smp_wmb()
+
 #else
 
 #define fsnode_malloc_() \
     ((struct cinq_fsnode *)malloc(sizeof(struct cinq_fsnode)))
 #define fsnode_free_(p) (free(p))
 
+static mutex_t snapshot_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+#define snap_publish_() __sync_synchronize()
+
 #endif // __KERNEL__
 
 // Checks wether two fsnodes have direct relation.
@@ -39,25 +45,57 @@ static inline int fsnode_ancestor_(struct cinq_fsnode *ancestor,
   return 0;
 }
 
-struct cinq_fsnode *fsnode_new(struct cinq_fsnode *parent, const char *name) {
-  
+// Makes an fsnode that is neither named in file_systems nor a child.
+static struct cinq_fsnode *fsnode_alloc_(struct cinq_fsnode *parent,
+                                         const char *name) {
   struct cinq_fsnode *fsnode = fsnode_malloc_();
-  fsnode->fs_id = (unsigned long)fsnode;
-  DEBUG_ON_((void *)fsnode->fs_id != fsnode,
-           "[Error@cnode_new] conversion fails: fs_id %lx != fsnode %p",
-           fsnode->fs_id, fsnode);
+  if (unlikely(!fsnode)) return NULL;
   strncpy(fsnode->fs_name, name, MAX_NAME_LEN);
   fsnode->fs_parent = parent;
   fsnode->fs_root = NULL; // filled after registeration
   fsnode->fs_children = NULL; // required by uthash
   rwlock_init(&fsnode->fs_children_lock);
+  INIT_LIST_HEAD(&fsnode->fs_tags);
+  spin_lock_init(&fsnode->fs_tags_lock);
+  atomic_set(&fsnode->fs_spilled, 0);
+  fsnode->fs_live = NULL;
+  init_rwsem(&fsnode->fs_snap_sem);
+  fsnode->fs_readonly = 0;
+  // Bound last, as cinq_compact() walks the views by ID.
+  fsnode->fs_id = idtable_alloc(&fsnode_ids, fsnode);
+  if (unlikely(fsnode->fs_id == IDT_NONE)) {
+    fsnode_free_(fsnode);
+    return NULL;
+  }
+  return fsnode;
+}
+
+// Frees an fsnode that is out of file_systems and its parent.
+// Its tags stay in cnodes but out of the list.
+static void fsnode_drop_(struct cinq_fsnode *fsnode) {
+  cinq_tier_pause(); // out of any compaction pass
+  spin_lock(&fsnode->fs_tags_lock);
+  while (!list_empty(&fsnode->fs_tags)) {
+    list_del_init(fsnode->fs_tags.next);
+  }
+  spin_unlock(&fsnode->fs_tags_lock);
+  idtable_free(&fsnode_ids, fsnode->fs_id);
+  cinq_tier_resume();
+  fsnode_free_(fsnode);
+}
+
+struct cinq_fsnode *fsnode_new(struct cinq_fsnode *parent, const char *name) {
+  
+  struct cinq_fsnode *fsnode = fsnode_alloc_(parent, name);
+  if (unlikely(!fsnode)) return NULL;
   
   write_lock(&file_systems.lock);
   struct cinq_fsnode *dup = cfs_find_(&file_systems, name);
   if (unlikely(dup)) {
+    write_unlock(&file_systems.lock);
     DEBUG_("[Warn@fsnode_new] duplicate names: %s\n", name);
-    fsnode_free_(fsnode);
-    wr_release_return(&file_systems.lock, NULL);
+    fsnode_drop_(fsnode);
+    return NULL;
   }
   cfs_add_(&file_systems, fsnode);
   write_unlock(&file_systems.lock);
@@ -78,21 +116,24 @@ void fsnode_evict(struct cinq_fsnode *fsnode) {
     return;
   }
   
-  cfs_rm_syn(&file_systems, fsnode);
+  // A frozen one has left its name to the live one.
+  if (!fsnode->fs_live) cfs_rm_syn(&file_systems, fsnode);
   
   if (fsnode->fs_parent != META_FS) {
     write_lock(&fsnode->fs_parent->fs_children_lock);
     HASH_DELETE(fs_child, fsnode->fs_parent->fs_children, fsnode);
     write_unlock(&fsnode->fs_parent->fs_children_lock);
   }
-  fsnode_free_(fsnode);
+  fsnode_drop_(fsnode);
 }
 
 void fsnode_evict_all(struct cinq_fsnode *fsnode) {
   if (fsnode == META_FS) {
-    struct cinq_fsnode *cur, *tmp;
-    HASH_ITER(fs_member, file_systems.cfs_table, cur, tmp) {
-      if (cur->fs_parent == META_FS) fsnode_evict_all(cur);
+    // Roots of frozen views are not named, so go up from named ones.
+    struct cinq_fsnode *cur;
+    while ((cur = file_systems.cfs_table)) {
+      while (cur->fs_parent != META_FS) cur = cur->fs_parent;
+      fsnode_evict_all(cur);
     }
     return;
   }
@@ -139,6 +180,81 @@ void fsnode_bridge(struct cinq_fsnode *out) {
   fsnode_evict(out);
 }
 
+// The frozen view keeps its tags, its place among views and its ID,
+// which file handles made before still carry. The swap is done with
+// its snapshot semaphore held for write, so no request is halfway
+// through it; requests that come later are led to the live view by
+// fs_live, set after everything else is published.
+struct cinq_fsnode *fsnode_snapshot(struct cinq_fsnode *fs,
+                                    const char *name) {
+  struct cinq_fsnode *live = NULL, *snap = NULL;
+  struct dentry *root, *dentry = NULL;
+  struct inode *inode = NULL;
+  struct cinq_tag *tag = NULL;
+  struct qstr qname;
+  int err = 0;
+
+  mutex_lock(&snapshot_mutex_);
+  if (unlikely(fs == META_FS || fs->fs_live || fs->fs_readonly ||
+               !fs->fs_root)) {
+    err = -EINVAL;
+    goto out;
+  }
+  root = fs->fs_root;
+  live = fsnode_alloc_(fs, fs->fs_name);
+  snap = live ? fsnode_new(fs, name) : NULL;
+  if (unlikely(!snap)) {
+    err = live ? -EEXIST : -ENOMEM;
+    goto out;
+  }
+  snap->fs_readonly = 1;
+
+  // Each gets a root tag of its own and sees the rest through @fs.
+  if (cnode_copy_tag(i_cnode(root->d_inode), fs, live)) {
+    tag = cnode_copy_tag(i_cnode(root->d_inode), fs, snap);
+  }
+  if (tag) inode = cinq_iget(root->d_sb, (unsigned long)tag);
+  if (inode) {
+    qname.name = (const unsigned char *)name;
+    qname.len = strlen(name);
+    dentry = d_alloc(root->d_parent, &qname);
+  }
+  if (unlikely(!dentry)) {
+    if (inode) iput(inode);
+    err = -ENOMEM;
+    goto out;
+  }
+  d_instantiate(dentry, inode);
+  dentry->d_fsdata = snap;
+  snap->fs_root = dentry; // held by the fsnode
+
+  write_lock(&fs->fs_children_lock);
+  HASH_ADD_BY_PTR(fs_child, fs->fs_children, fs_id, live);
+  write_unlock(&fs->fs_children_lock);
+  live->fs_root = root;
+
+  down_write(&fs->fs_snap_sem);
+  write_lock(&file_systems.lock);
+  cfs_rm_(&file_systems, fs);
+  cfs_add_(&file_systems, live);
+  write_unlock(&file_systems.lock);
+  root->d_fsdata = live;
+  fs->fs_root = NULL;
+  snap_publish_();
+  fs->fs_live = live;
+  up_write(&fs->fs_snap_sem);
+
+out:
+  if (unlikely(err)) {
+    if (snap) fsnode_evict(snap);
+    if (live && !live->fs_root) fsnode_drop_(live);
+  }
+  mutex_unlock(&snapshot_mutex_);
+  DEBUG_ON_(err, "[Error@fsnode_snapshot] %d on %s as %s.\n", err,
+            fs == META_FS ? "META_FS" : fs->fs_name, name);
+  return err ? ERR_PTR(err) : snap;
+}
+
 #ifdef __KERNEL__
 
 int init_fsnode_cache(void) {
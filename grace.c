@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  grace.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+#include "thread.h"
+
+#ifdef __KERNEL__
+
+#include <linux/srcu.h>
+
+// Readers may sleep, e.g., to allocate an inode, so plain RCU won't do.
+static struct srcu_struct grace_srcu_;
+
+int cinq_grace_init(void) {
+  return init_srcu_struct(&grace_srcu_);
+}
+
+void cinq_grace_fini(void) {
+  cleanup_srcu_struct(&grace_srcu_);
+}
+
+int cinq_grace_enter(void) {
+  return srcu_read_lock(&grace_srcu_);
+}
+
+void cinq_grace_exit(int idx) {
+  srcu_read_unlock(&grace_srcu_, idx);
+}
+
+void cinq_grace_wait(void) {
+  synchronize_srcu(&grace_srcu_);
+}
+
+#else
+
+#include <sched.h>
+
+// Readers count themselves under the phase they see. A grace period flips
+// the phase and waits for the readers of the old one to drain. It does so
+// twice, as a reader that saw the phase just before a flip may count
+// itself under it only after the drain was checked.
+static atomic_t grace_readers_[2];
+static int grace_phase_;
+static pthread_mutex_t grace_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+int cinq_grace_init(void) {
+  atomic_set(&grace_readers_[0], 0);
+  atomic_set(&grace_readers_[1], 0);
+  grace_phase_ = 0;
+  return 0;
+}
+
+void cinq_grace_fini(void) {
+}
+
+int cinq_grace_enter(void) {
+  const int idx = *(volatile int *)&grace_phase_ & 1;
+  atomic_inc(&grace_readers_[idx]);
+  __sync_synchronize(); // counted before anything is looked at
+  return idx;
+}
+
+void cinq_grace_exit(int idx) {
+  __sync_synchronize(); // done with what was looked at before leaving
+  atomic_dec(&grace_readers_[idx]);
+}
+
+void cinq_grace_wait(void) {
+  int i, idx;
+  pthread_mutex_lock(&grace_mutex_);
+  for (i = 0; i < 2; ++i) {
+    __sync_synchronize();
+    idx = grace_phase_ & 1;
+    grace_phase_ = idx ^ 1;
+    __sync_synchronize();
+    while (atomic_read(&grace_readers_[idx])) {
+      sched_yield();
+    }
+  }
+  pthread_mutex_unlock(&grace_mutex_);
+}
+
+#endif // __KERNEL__
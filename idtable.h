@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  idtable.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_IDTABLE_H_
+#define CINQUAIN_META_IDTABLE_H_
+
+#include "util.h"
+
+/* Dense, generation-checked ID table mapping compact 32-bit IDs to objects */
+
+// Slots are kept in fixed-size chunks that never move once allocated,
+// so a lookup is a bounds check, two array indexings and a generation
+// compare, without taking any lock.
+#define IDT_CHUNK_SHIFT 10
+#define IDT_CHUNK_SIZE (1 << IDT_CHUNK_SHIFT)
+#define IDT_CHUNK_MASK (IDT_CHUNK_SIZE - 1)
+#define IDT_MAX_CHUNKS (1 << 14) // up to 16M IDs per table
+
+#define IDT_NONE 0 // ID 0 is reserved and never handed out
+
+struct cinq_idslot {
+  void *obj; // NULL when the slot is free
+  __u32 gen;
+  __u32 next_free;
+};
+
+struct cinq_idtable {
+  struct cinq_idslot *chunks[IDT_MAX_CHUNKS];
+  __u32 limit; // number of slots ever used, including the reserved one
+  __u32 free_head; // IDT_NONE when the free list is empty
+  __u32 seed; // generation of never-used slots
+  spinlock_t lock; // serializes alloc, free, rebind and restore
+};
+
+#ifdef __KERNEL__
+
+#define idt_chunk_malloc_() \
+    ((struct cinq_idslot *)kzalloc( \
+        sizeof(struct cinq_idslot) << IDT_CHUNK_SHIFT, GFP_KERNEL))
+#define idt_chunk_free_(p) (kfree(p))
+#define idt_publish_() smp_wmb()
+#define idt_consume_() smp_rmb()
+
+#else
+
+#define idt_chunk_malloc_() \
+    ((struct cinq_idslot *)calloc(IDT_CHUNK_SIZE, sizeof(struct cinq_idslot)))
+#define idt_chunk_free_(p) (free(p))
+#define idt_publish_() __sync_synchronize()
+#define idt_consume_() __sync_synchronize()
+
+#endif // __KERNEL__
+
+static inline struct cinq_idslot *idtable_slot_(struct cinq_idtable *table,
+                                                __u32 id) {
+  return &table->chunks[id >> IDT_CHUNK_SHIFT][id & IDT_CHUNK_MASK];
+}
+
+// @seed: generation given to slots on first use. Passing a value that
+//    differs across mounts (e.g. the mount time) keeps handles issued
+//    before a restart from matching objects created after it.
+static inline void idtable_init(struct cinq_idtable *table, __u32 seed) {
+  memset(table->chunks, 0, sizeof(table->chunks));
+  table->limit = 1; // skips IDT_NONE
+  table->free_head = IDT_NONE;
+  table->seed = seed ? seed : 1;
+  spin_lock_init(&table->lock);
+}
+
+static inline void idtable_destroy(struct cinq_idtable *table) {
+  int i;
+  for (i = 0; i < IDT_MAX_CHUNKS && table->chunks[i]; ++i) {
+    idt_chunk_free_(table->chunks[i]);
+    table->chunks[i] = NULL;
+  }
+  table->limit = 1;
+  table->free_head = IDT_NONE;
+}
+
+// Makes sure the chunk holding @id exists. Called with table->lock held.
+static inline int idtable_expand_(struct cinq_idtable *table, __u32 id) {
+  const __u32 c = id >> IDT_CHUNK_SHIFT;
+  struct cinq_idslot *chunk;
+  if (unlikely(c >= IDT_MAX_CHUNKS)) return -ENOSPC;
+  if (likely(table->chunks[c])) return 0;
+  chunk = idt_chunk_malloc_();
+  if (unlikely(!chunk)) return -ENOMEM;
+  idt_publish_(); // zeroed slots visible before the chunk pointer
+  table->chunks[c] = chunk;
+  return 0;
+}
+
+static inline __u32 idtable_gen(struct cinq_idtable *table, __u32 id) {
+  return idtable_slot_(table, id)->gen;
+}
+
+// Returns a new ID bound to @obj, or IDT_NONE if the table is exhausted.
+static inline __u32 idtable_alloc(struct cinq_idtable *table, void *obj) {
+  struct cinq_idslot *slot;
+  __u32 id;
+  spin_lock(&table->lock);
+  id = table->free_head;
+  if (id != IDT_NONE) {
+    slot = idtable_slot_(table, id);
+    table->free_head = slot->next_free;
+  } else {
+    id = table->limit;
+    if (unlikely(idtable_expand_(table, id))) {
+      DEBUG_("[Error@idtable_alloc] no more ID for %p.\n", obj);
+      sp_release_return(&table->lock, IDT_NONE);
+    }
+    slot = idtable_slot_(table, id);
+    slot->gen = table->seed;
+    idt_publish_(); // the chunk and generation before the limit
+    ++table->limit;
+  }
+  slot->next_free = IDT_NONE;
+  slot->obj = obj;
+  spin_unlock(&table->lock);
+  return id;
+}
+
+// Releases @id. Its generation is bumped so that stale handles no longer
+// resolve when the ID is reused.
+static inline void idtable_free(struct cinq_idtable *table, __u32 id) {
+  struct cinq_idslot *slot;
+  if (unlikely(id == IDT_NONE || id >= table->limit)) return;
+  slot = idtable_slot_(table, id);
+  spin_lock(&table->lock);
+  DEBUG_ON_(!slot->obj, "[Warn@idtable_free] free unused ID %x.\n", id);
+  slot->obj = NULL;
+  idt_publish_(); // cleared before the generation moves on
+  if (++slot->gen == 0) slot->gen = 1;
+  slot->next_free = table->free_head;
+  table->free_head = id;
+  spin_unlock(&table->lock);
+}
+
+// Rebinds @obj to an ID and generation recorded before a checkpoint,
+// so that handles issued earlier keep resolving after a reload.
+// Returns -EEXIST if the ID is held by another object.
+static inline int idtable_restore(struct cinq_idtable *table, __u32 id,
+                                  __u32 gen, void *obj) {
+  struct cinq_idslot *slot;
+  __u32 *link;
+  int err;
+  if (unlikely(id == IDT_NONE)) return -EINVAL;
+  spin_lock(&table->lock);
+  while (table->limit <= id) { // adds skipped IDs to the free list
+    err = idtable_expand_(table, table->limit);
+    if (unlikely(err)) sp_release_return(&table->lock, err);
+    slot = idtable_slot_(table, table->limit);
+    slot->gen = table->seed;
+    slot->next_free = table->free_head;
+    table->free_head = table->limit;
+    idt_publish_();
+    ++table->limit;
+  }
+  slot = idtable_slot_(table, id);
+  if (unlikely(slot->obj)) sp_release_return(&table->lock, -EEXIST);
+  for (link = &table->free_head; *link != id;
+       link = &idtable_slot_(table, *link)->next_free);
+  *link = slot->next_free;
+  slot->next_free = IDT_NONE;
+  slot->gen = gen;
+  idt_publish_(); // a handle of the old generation never sees @obj
+  slot->obj = obj;
+  spin_unlock(&table->lock);
+  return 0;
+}
+
+// Binds @id in use to @obj instead, keeping its generation, so that
+// handles issued for the old object resolve to the new one.
+static inline void idtable_rebind(struct cinq_idtable *table, __u32 id,
+                                  void *obj) {
+  struct cinq_idslot *slot;
+  if (unlikely(id == IDT_NONE || id >= table->limit)) return;
+  slot = idtable_slot_(table, id);
+  spin_lock(&table->lock);
+  DEBUG_ON_(!slot->obj, "[Warn@idtable_rebind] rebind unused ID %x.\n", id);
+  slot->obj = obj;
+  spin_unlock(&table->lock);
+}
+
+// Returns the object bound to @id now, or NULL, for walks over the IDs
+// below the limit.
+static inline void *idtable_get(struct cinq_idtable *table, __u32 id) {
+  if (unlikely(id == IDT_NONE || id >= table->limit)) return NULL;
+  return idtable_slot_(table, id)->obj;
+}
+
+// Resolves (@id, @gen) to its object, or NULL if the ID is out of range,
+// unused or was reused since the handle was issued. The generation is
+// read again after the object: a free clears the object before it moves
+// the generation on, so an object read while the generation stayed is
+// the one the handle was issued for. The object is not referenced, which
+// the caller does under its own locks.
+static inline void *idtable_find(struct cinq_idtable *table, __u32 id,
+                                 __u32 gen) {
+  struct cinq_idslot *slot;
+  void *obj;
+  if (unlikely(id == IDT_NONE || id >= table->limit)) return NULL;
+  idt_consume_(); // the chunk is there below the limit
+  slot = idtable_slot_(table, id);
+  if (slot->gen != gen) return NULL;
+  idt_consume_();
+  obj = slot->obj;
+  idt_consume_();
+  return slot->gen == gen ? obj : NULL;
+}
+
+#endif // CINQUAIN_META_IDTABLE_H_
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  lockprof.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "util.h"
+#include "stats.h"
+
+#ifdef CINQ_LOCK_PROF
+
+struct lockprof_held_ {
+  void *lock;
+  struct lockprof_site *site;
+  u64 since;
+};
+
+// Locks held by a thread (or CPU), whose release ends the hold time.
+struct lockprof_stack_ {
+  int depth;
+  struct lockprof_held_ held[LOCKPROF_MAX_HELD];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#define raw_read_lock_(p) _raw_read_lock(p)
+#define raw_read_trylock_(p) _raw_read_trylock(p)
+#define raw_read_unlock_(p) _raw_read_unlock(p)
+#define raw_write_lock_(p) _raw_write_lock(p)
+#define raw_write_trylock_(p) _raw_write_trylock(p)
+#define raw_write_unlock_(p) _raw_write_unlock(p)
+
+#define prof_add_(p, v) atomic64_add(v, (atomic64_t *)(p))
+#define prof_cas_(p, old, new) cmpxchg(p, old, new)
+#define prof_zero_(p) atomic64_set((atomic64_t *)(p), 0)
+#define prof_wmb_() smp_wmb()
+#define prof_rmb_() smp_rmb()
+#define prof_print_(out, ...) seq_printf((struct seq_file *)(out), __VA_ARGS__)
+
+#define sites_malloc_(n) ((struct lockprof_site **)vmalloc( \
+    (n) * sizeof(struct lockprof_site *)))
+#define sites_free_(p) (vfree(p))
+
+// A spinning rwlock pins its holder on the CPU.
+static DEFINE_PER_CPU(struct lockprof_stack_, lockprof_stack_);
+#define prof_stack_() (&__get_cpu_var(lockprof_stack_))
+
+static DEFINE_SPINLOCK(sites_lock_);
+
+#else
+
+#define raw_read_lock_(p) pthread_rwlock_rdlock(p)
+#define raw_read_trylock_(p) (!pthread_rwlock_tryrdlock(p))
+#define raw_read_unlock_(p) pthread_rwlock_unlock(p)
+#define raw_write_lock_(p) pthread_rwlock_wrlock(p)
+#define raw_write_trylock_(p) (!pthread_rwlock_trywrlock(p))
+#define raw_write_unlock_(p) pthread_rwlock_unlock(p)
+
+#define prof_add_(p, v) __sync_fetch_and_add(p, v)
+#define prof_cas_(p, old, new) __sync_val_compare_and_swap(p, old, new)
+#define prof_zero_(p) __sync_fetch_and_and(p, 0)
+#define prof_wmb_() __sync_synchronize()
+#define prof_rmb_() __sync_synchronize()
+#define prof_print_(out, ...) fprintf((FILE *)(out), __VA_ARGS__)
+
+#define sites_malloc_(n) \
+    ((struct lockprof_site **)malloc((n) * sizeof(struct lockprof_site *)))
+#define sites_free_(p) (free(p))
+
+static __thread struct lockprof_stack_ lockprof_stack_;
+#define prof_stack_() (&lockprof_stack_)
+
+static spinlock_t sites_lock_ = SPIN_LOCK_UNLOCKED;
+
+#endif // __KERNEL__
+
+static struct lockprof_site *sites_; // registered on first use
+static int num_sites_;
+
+static struct lockprof_hot hot_[LOCKPROF_HOT_SLOTS];
+
+static void site_register_(struct lockprof_site *site) {
+  spin_lock(&sites_lock_);
+  if (!site->registered) {
+    site->next = sites_;
+    sites_ = site;
+    ++num_sites_;
+    site->registered = 1;
+  }
+  spin_unlock(&sites_lock_);
+}
+
+// Finds or claims the slot of a named lock. Returns NULL when the
+// probed slots are all taken by others, dropping the sample.
+// A slot is claimed through hot->claimed and filled before hot->lock
+// publishes it, so whoever sees the lock also sees its kind and name.
+static struct lockprof_hot *hot_get_(void *lock, const char *kind,
+                                     const char *name) {
+  const unsigned int i = hash_64((u64)(unsigned long)lock, LOCKPROF_HOT_BITS);
+  struct lockprof_hot *hot;
+  int probe;
+  for (probe = 0; probe < 8; ++probe) {
+    hot = &hot_[(i + probe) & (LOCKPROF_HOT_SLOTS - 1)];
+    if (hot->lock == lock) return hot;
+    if (!hot->claimed && !prof_cas_(&hot->claimed, 0, 1)) {
+      hot->kind = kind;
+      strncpy(hot->name, name, LOCKPROF_NAME_LEN - 1);
+      prof_wmb_();
+      hot->lock = lock;
+      return hot;
+    }
+    if (!hot->lock) return NULL; // being filled, maybe for this very lock
+  }
+  return NULL;
+}
+
+static void prof_acquired_(void *lock, struct lockprof_site *site,
+                           const char *kind, const char *name,
+                           u64 start, int contended) {
+  struct lockprof_stack_ *stack = prof_stack_();
+  const u64 now = contended ? cinq_stat_clock() : start;
+  struct lockprof_hot *hot;
+
+  if (unlikely(!site->registered)) site_register_(site);
+  prof_add_(&site->acquires, 1);
+  if (contended) {
+    prof_add_(&site->contended, 1);
+    prof_add_(&site->wait_ns, now - start);
+  }
+  if (name && (hot = hot_get_(lock, kind, name))) {
+    prof_add_(&hot->acquires, 1);
+    if (contended) {
+      prof_add_(&hot->contended, 1);
+      prof_add_(&hot->wait_ns, now - start);
+    }
+  }
+  if (stack->depth < LOCKPROF_MAX_HELD) {
+    stack->held[stack->depth].lock = lock;
+    stack->held[stack->depth].site = site;
+    stack->held[stack->depth].since = now;
+  }
+  ++stack->depth;
+}
+
+static void prof_released_(void *lock) {
+  struct lockprof_stack_ *stack = prof_stack_();
+  const int top = (stack->depth < LOCKPROF_MAX_HELD ?
+                   stack->depth : LOCKPROF_MAX_HELD) - 1;
+  int i;
+
+  if (unlikely(!stack->depth)) return;
+  for (i = top; i >= 0 && stack->held[i].lock != lock; --i);
+  --stack->depth;
+  if (i < 0) return; // taken beyond those tracked
+  prof_add_(&stack->held[i].site->hold_ns,
+            cinq_stat_clock() - stack->held[i].since);
+  stack->held[i] = stack->held[top];
+}
+
+// An uncontended acquire costs one clock read.
+void lockprof_read_lock(rwlock_t *lock, struct lockprof_site *site,
+                        const char *kind, const char *name) {
+  const u64 start = cinq_stat_clock();
+  int contended = !raw_read_trylock_(lock);
+  if (contended) raw_read_lock_(lock);
+  prof_acquired_(lock, site, kind, name, start, contended);
+}
+
+void lockprof_write_lock(rwlock_t *lock, struct lockprof_site *site,
+                         const char *kind, const char *name) {
+  const u64 start = cinq_stat_clock();
+  int contended = !raw_write_trylock_(lock);
+  if (contended) raw_write_lock_(lock);
+  prof_acquired_(lock, site, kind, name, start, contended);
+}
+
+void lockprof_read_unlock(rwlock_t *lock) {
+  prof_released_(lock);
+  raw_read_unlock_(lock);
+}
+
+void lockprof_write_unlock(rwlock_t *lock) {
+  prof_released_(lock);
+  raw_write_unlock_(lock);
+}
+
+// Counters are zeroed atomically as others keep adding to them. Claimed
+// slots are kept, since their locks may be taken meanwhile.
+void lockprof_reset(void) {
+  struct lockprof_site *site;
+  struct lockprof_hot *hot;
+  spin_lock(&sites_lock_);
+  for (site = sites_; site; site = site->next) {
+    prof_zero_(&site->acquires);
+    prof_zero_(&site->contended);
+    prof_zero_(&site->wait_ns);
+    prof_zero_(&site->hold_ns);
+  }
+  spin_unlock(&sites_lock_);
+  for (hot = hot_; hot < hot_ + LOCKPROF_HOT_SLOTS; ++hot) {
+    prof_zero_(&hot->acquires);
+    prof_zero_(&hot->contended);
+    prof_zero_(&hot->wait_ns);
+  }
+}
+
+int lockprof_dump(void *out, int top_n) {
+  struct lockprof_site **sorted, *site;
+  struct lockprof_hot *top, *hot;
+  u64 floor = ~0ULL;
+  int max = num_sites_ + 1, n = 0, i, j;
+
+  sorted = sites_malloc_(max); // sites registered meanwhile are skipped
+  if (unlikely(!sorted)) return -ENOMEM;
+  spin_lock(&sites_lock_);
+  for (site = sites_; site && n < max; site = site->next) { // by wait_ns
+    if (!site->acquires) continue;
+    for (i = n++; i > 0 && sorted[i - 1]->wait_ns < site->wait_ns; --i) {
+      sorted[i] = sorted[i - 1];
+    }
+    sorted[i] = site;
+  }
+  spin_unlock(&sites_lock_);
+
+  prof_print_(out, "%-24s %5s %-5s %10s %10s %12s %12s\n", "file", "line",
+              "op", "acquires", "contended", "wait_ns", "hold_ns");
+  for (i = 0; i < n; ++i) {
+    site = sorted[i];
+    prof_print_(out, "%-24s %5d %-5s %10llu %10llu %12llu %12llu\n",
+                site->file, site->line, site->op,
+                (unsigned long long)site->acquires,
+                (unsigned long long)site->contended,
+                (unsigned long long)site->wait_ns,
+                (unsigned long long)site->hold_ns);
+  }
+  sites_free_(sorted);
+
+  // Picks the top ones by repeated scans, which is fine for small @top_n.
+  prof_print_(out, "%-32s %-8s %10s %10s %12s\n", "hottest", "lock",
+              "acquires", "contended", "wait_ns");
+  for (j = 0; j < top_n; ++j) {
+    top = NULL;
+    for (hot = hot_; hot < hot_ + LOCKPROF_HOT_SLOTS; ++hot) {
+      if (!hot->lock) continue;
+      prof_rmb_(); // pairs with the publish in hot_get_()
+      if (!hot->contended || hot->wait_ns >= floor) continue;
+      if (!top || hot->wait_ns > top->wait_ns) top = hot;
+    }
+    if (!top) break;
+    floor = top->wait_ns;
+    prof_print_(out, "%-32s %-8s %10llu %10llu %12llu\n", top->name,
+                top->kind, (unsigned long long)top->acquires,
+                (unsigned long long)top->contended,
+                (unsigned long long)top->wait_ns);
+  }
+  return n;
+}
+
+#ifdef __KERNEL__
+
+static int lockprof_proc_show_(struct seq_file *m, void *v) {
+  lockprof_dump(m, 20);
+  return 0;
+}
+
+static int lockprof_proc_open_(struct inode *inode, struct file *file) {
+  return single_open(file, lockprof_proc_show_, NULL);
+}
+
+static const struct file_operations lockprof_proc_fops_ = {
+  .owner    = THIS_MODULE,
+  .open     = lockprof_proc_open_,
+  .read     = seq_read,
+  .llseek   = seq_lseek,
+  .release  = single_release,
+};
+
+int lockprof_proc_init(void) {
+  if (!proc_create("fs/cinqfs_locks", S_IRUGO, NULL, &lockprof_proc_fops_))
+    return -ENOMEM;
+  return 0;
+}
+
+void lockprof_proc_exit(void) {
+  remove_proc_entry("fs/cinqfs_locks", NULL);
+}
+
+#endif // __KERNEL__
+
+#endif // CINQ_LOCK_PROF
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  lockprof.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_LOCKPROF_H_
+#define CINQUAIN_META_LOCKPROF_H_
+
+/* Contention profiler of rwlocks, enabled by CINQ_LOCK_PROF.
+ * Included at the end of util.h, whose lock macros it takes over. */
+
+#define LOCKPROF_HOT_BITS 10
+#define LOCKPROF_HOT_SLOTS (1 << LOCKPROF_HOT_BITS) // named locks tracked
+#define LOCKPROF_NAME_LEN 32
+#define LOCKPROF_MAX_HELD 16 // nested locks per thread whose hold is timed
+
+// Statically allocated at every place that takes a lock.
+struct lockprof_site {
+  const char *file;
+  int line;
+  const char *op;
+  int registered;
+  struct lockprof_site *next;
+
+  u64 acquires;
+  u64 contended; // acquires that had to wait
+  u64 wait_ns;
+  u64 hold_ns;
+};
+
+// A lock taken with a name, such as one of a cnode.
+struct lockprof_hot {
+  void *lock; // set last, once the slot is filled
+  int claimed;
+  const char *kind;
+  char name[LOCKPROF_NAME_LEN];
+  u64 acquires;
+  u64 contended;
+  u64 wait_ns;
+};
+
+#define LOCKPROF_SITE_(op_name) \
+    static struct lockprof_site site_ = \
+        { .file = __FILE__, .line = __LINE__, .op = op_name }
+
+extern void lockprof_read_lock(rwlock_t *lock, struct lockprof_site *site,
+                               const char *kind, const char *name);
+extern void lockprof_write_lock(rwlock_t *lock, struct lockprof_site *site,
+                                const char *kind, const char *name);
+extern void lockprof_read_unlock(rwlock_t *lock);
+extern void lockprof_write_unlock(rwlock_t *lock);
+
+extern void lockprof_reset(void);
+
+// Prints the sites by total wait, and the @top_n named locks waited for
+// the longest, to @out (a struct seq_file in the kernel or a FILE in
+// user space). Returns the number of sites that took any lock.
+extern int lockprof_dump(void *out, int top_n);
+
+#ifdef __KERNEL__
+extern int lockprof_proc_init(void); // /proc/fs/cinqfs_locks
+extern void lockprof_proc_exit(void);
+#endif // __KERNEL__
+
+#undef read_lock
+#undef write_lock
+#undef read_unlock
+#undef write_unlock
+
+#define read_lock_named(lock_p, kind, name) ({ \
+  LOCKPROF_SITE_("read"); \
+  lockprof_read_lock(lock_p, &site_, kind, name); \
+})
+#define write_lock_named(lock_p, kind, name) ({ \
+  LOCKPROF_SITE_("write"); \
+  lockprof_write_lock(lock_p, &site_, kind, name); \
+})
+#define read_lock(lock_p) read_lock_named(lock_p, NULL, NULL)
+#define write_lock(lock_p) write_lock_named(lock_p, NULL, NULL)
+#define read_unlock(lock_p) lockprof_read_unlock(lock_p)
+#define write_unlock(lock_p) lockprof_write_unlock(lock_p)
+
+#endif // CINQUAIN_META_LOCKPROF_H_
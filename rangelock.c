@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  rangelock.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "rangelock.h"
+
+#ifdef __KERNEL__
+
+#include <linux/sched.h>
+
+#define tree_malloc_() ((struct cinq_range_tree *)kmalloc( \
+    sizeof(struct cinq_range_tree), GFP_KERNEL))
+#define tree_free_(p) (kfree(p))
+
+#define range_wait_init_(tree) init_waitqueue_head(&(tree)->rt_wait)
+#define range_wait_destroy_(tree)
+#define range_wake_(tree) wake_up_all(&(tree)->rt_wait)
+
+// Sleeps until woken with rt_lock released.
+static inline void range_wait_(struct cinq_range_tree *tree) {
+  DEFINE_WAIT(wait);
+  prepare_to_wait(&tree->rt_wait, &wait, TASK_UNINTERRUPTIBLE);
+  spin_unlock(&tree->rt_lock);
+  schedule();
+  finish_wait(&tree->rt_wait, &wait);
+  spin_lock(&tree->rt_lock);
+}
+
+#else
+
+#define tree_malloc_() \
+    ((struct cinq_range_tree *)malloc(sizeof(struct cinq_range_tree)))
+#define tree_free_(p) (free(p))
+
+#define range_wait_init_(tree) pthread_cond_init(&(tree)->rt_wait, NULL)
+#define range_wait_destroy_(tree) pthread_cond_destroy(&(tree)->rt_wait)
+#define range_wake_(tree) pthread_cond_broadcast(&(tree)->rt_wait)
+#define range_wait_(tree) pthread_cond_wait(&(tree)->rt_wait, &(tree)->rt_lock)
+
+#endif // __KERNEL__
+
+static inline loff_t range_max_(const struct cinq_range *node) {
+  return node ? node->r_max : 0;
+}
+
+static inline void range_update_(struct cinq_range *node) {
+  loff_t max = node->r_end;
+  if (range_max_(node->r_left) > max) max = node->r_left->r_max;
+  if (range_max_(node->r_right) > max) max = node->r_right->r_max;
+  node->r_max = max;
+}
+
+static struct cinq_range *range_rotate_right_(struct cinq_range *node) {
+  struct cinq_range *left = node->r_left;
+  node->r_left = left->r_right;
+  left->r_right = node;
+  range_update_(node);
+  range_update_(left);
+  return left;
+}
+
+static struct cinq_range *range_rotate_left_(struct cinq_range *node) {
+  struct cinq_range *right = node->r_right;
+  node->r_right = right->r_left;
+  right->r_left = node;
+  range_update_(node);
+  range_update_(right);
+  return right;
+}
+
+// Whether any range in the subtree overlaps [start, end).
+static int range_overlap_(const struct cinq_range *node,
+                          loff_t start, loff_t end) {
+  while (node && node->r_max > start) {
+    if (node->r_start < end && start < node->r_end) return 1;
+    if (range_max_(node->r_left) > start) {
+      node = node->r_left; // ranges on the right start even later
+    } else if (node->r_start < end) {
+      node = node->r_right;
+    } else {
+      break;
+    }
+  }
+  return 0;
+}
+
+static struct cinq_range *range_insert_(struct cinq_range *node,
+                                        struct cinq_range *range) {
+  if (!node) return range;
+  if (range->r_start < node->r_start) {
+    node->r_left = range_insert_(node->r_left, range);
+    if (node->r_left->r_prio > node->r_prio) node = range_rotate_right_(node);
+  } else {
+    node->r_right = range_insert_(node->r_right, range);
+    if (node->r_right->r_prio > node->r_prio) node = range_rotate_left_(node);
+  }
+  range_update_(node);
+  return node;
+}
+
+// Held ranges have distinct starts since they do not overlap.
+static struct cinq_range *range_delete_(struct cinq_range *node,
+                                        struct cinq_range *range) {
+  if (!node) return NULL;
+  if (node == range) {
+    if (!node->r_left) return node->r_right;
+    if (!node->r_right) return node->r_left;
+    if (node->r_left->r_prio > node->r_right->r_prio) {
+      node = range_rotate_right_(node);
+      node->r_right = range_delete_(node->r_right, range);
+    } else {
+      node = range_rotate_left_(node);
+      node->r_left = range_delete_(node->r_left, range);
+    }
+  } else if (range->r_start < node->r_start) {
+    node->r_left = range_delete_(node->r_left, range);
+  } else {
+    node->r_right = range_delete_(node->r_right, range);
+  }
+  range_update_(node);
+  return node;
+}
+
+static inline void range_init_(struct cinq_range *range,
+                               loff_t start, loff_t end) {
+  range->r_start = start;
+  range->r_end = end;
+  range->r_max = end;
+  range->r_prio = (unsigned int)hash_64((u64)(unsigned long)range, 32);
+  range->r_left = range->r_right = NULL;
+}
+
+void range_tree_init(struct cinq_range_tree *tree) {
+  spin_lock_init(&tree->rt_lock);
+  tree->rt_root = NULL;
+  range_wait_init_(tree);
+}
+
+void range_tree_destroy(struct cinq_range_tree *tree) {
+  DEBUG_ON_(tree->rt_root, "[Warn@range_tree_destroy] range [%lld, %lld) "
+            "still held.\n", (long long)tree->rt_root->r_start,
+            (long long)tree->rt_root->r_end);
+  range_wait_destroy_(tree);
+}
+
+struct cinq_range_tree *range_tree_new(void) {
+  struct cinq_range_tree *tree = tree_malloc_();
+  if (likely(tree)) range_tree_init(tree);
+  return tree;
+}
+
+void range_tree_free(struct cinq_range_tree *tree) {
+  if (!tree) return;
+  range_tree_destroy(tree);
+  tree_free_(tree);
+}
+
+void range_tree_lock(struct cinq_range_tree *tree, struct cinq_range *range,
+                     loff_t start, loff_t end) {
+  range_init_(range, start, end);
+  if (start >= end) return;
+  spin_lock(&tree->rt_lock);
+  while (range_overlap_(tree->rt_root, start, end)) {
+    range_wait_(tree);
+  }
+  tree->rt_root = range_insert_(tree->rt_root, range);
+  spin_unlock(&tree->rt_lock);
+}
+
+int range_tree_trylock(struct cinq_range_tree *tree, struct cinq_range *range,
+                       loff_t start, loff_t end) {
+  range_init_(range, start, end);
+  if (start >= end) return 0;
+  spin_lock(&tree->rt_lock);
+  if (range_overlap_(tree->rt_root, start, end)) {
+    sp_release_return(&tree->rt_lock, -EBUSY);
+  }
+  tree->rt_root = range_insert_(tree->rt_root, range);
+  spin_unlock(&tree->rt_lock);
+  return 0;
+}
+
+void range_tree_unlock(struct cinq_range_tree *tree, struct cinq_range *range) {
+  if (range->r_start >= range->r_end) return;
+  spin_lock(&tree->rt_lock);
+  tree->rt_root = range_delete_(tree->rt_root, range);
+  range_wake_(tree);
+  spin_unlock(&tree->rt_lock);
+}
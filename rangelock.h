@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  rangelock.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_RANGELOCK_H_
+#define CINQUAIN_META_RANGELOCK_H_
+
+#include "util.h"
+
+/* Byte-range locks of a file, kept in an interval treap */
+
+#ifdef __KERNEL__
+#include <linux/wait.h>
+typedef wait_queue_head_t range_wait_t;
+#else
+typedef pthread_cond_t range_wait_t;
+#endif // __KERNEL__
+
+// A held range, usually on the stack of its holder.
+struct cinq_range {
+  loff_t r_start;
+  loff_t r_end; // exclusive
+  loff_t r_max; // max r_end in the subtree
+  unsigned int r_prio; // heap order of the treap
+  struct cinq_range *r_left;
+  struct cinq_range *r_right;
+};
+
+// Held ranges never overlap, so writers of disjoint ranges proceed in
+// parallel and only those overlapping a held range wait.
+struct cinq_range_tree {
+  spinlock_t rt_lock;
+  struct cinq_range *rt_root;
+  range_wait_t rt_wait; // woken whenever a range is released
+};
+
+extern void range_tree_init(struct cinq_range_tree *tree);
+extern void range_tree_destroy(struct cinq_range_tree *tree);
+extern struct cinq_range_tree *range_tree_new(void);
+extern void range_tree_free(struct cinq_range_tree *tree);
+
+// Blocks until [start, end) overlaps no held range and then holds it.
+// An empty range is held trivially.
+extern void range_tree_lock(struct cinq_range_tree *tree,
+                            struct cinq_range *range,
+                            loff_t start, loff_t end);
+
+// Returns 0 if held, or -EBUSY if the range overlaps a held one.
+extern int range_tree_trylock(struct cinq_range_tree *tree,
+                              struct cinq_range *range,
+                              loff_t start, loff_t end);
+
+extern void range_tree_unlock(struct cinq_range_tree *tree,
+                              struct cinq_range *range);
+
+#endif // CINQUAIN_META_RANGELOCK_H_
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  readahead.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+#include "thread.h"
+
+struct cinq_ra_req {
+  struct dentry *dentry; // referenced until the request is done
+  loff_t pos;
+  size_t len;
+  struct cinq_work work;
+};
+
+static atomic_t ra_queued_; // requests not done yet
+static int ra_stop_;
+
+#ifdef __KERNEL__
+
+#define ra_req_malloc_() \
+    ((struct cinq_ra_req *)kmalloc(sizeof(struct cinq_ra_req), GFP_NOFS))
+#define ra_req_free_(p) (kfree(p))
+
+#else
+
+#define ra_req_malloc_() \
+    ((struct cinq_ra_req *)malloc(sizeof(struct cinq_ra_req)))
+#define ra_req_free_(p) (free(p))
+
+#endif // __KERNEL__
+
+// Fetches the range from cinq_cache and keeps it with the file, so that
+// the reader is served without going to the cache. Requests run at high
+// priority on the executor, so the windows of several readers are
+// fetched in parallel.
+static void ra_work_fn_(struct cinq_work *work) {
+  struct cinq_ra_req *req = container_of(work, struct cinq_ra_req, work);
+
+  if (!ra_stop_) {
+    cinq_read_ahead(req->dentry, req->len, req->pos);
+  }
+  dput(req->dentry);
+  ra_req_free_(req);
+  atomic_dec(&ra_queued_);
+}
+
+void cinq_ra_init(void) {
+  atomic_set(&ra_queued_, 0);
+  ra_stop_ = 0;
+}
+
+// Requests not yet served are dropped as they come up.
+void cinq_ra_fini(void) {
+  ra_stop_ = 1;
+  cinq_exec_flush();
+}
+
+// Readahead is a hint, so requests beyond the queue limit are dropped.
+static void ra_submit_(struct dentry *dentry, pgoff_t index,
+                       unsigned int nr_pages) {
+  struct cinq_ra_req *req;
+
+  if (ra_stop_ || atomic_read(&ra_queued_) >= CINQ_RA_MAX_QUEUE) {
+    return; // racy but harmless
+  }
+
+  req = ra_req_malloc_();
+  if (unlikely(!req)) return;
+  req->dentry = dget(dentry);
+  req->pos = (loff_t)index << PAGE_CACHE_SHIFT;
+  req->len = (size_t)nr_pages << PAGE_CACHE_SHIFT;
+  cinq_work_init(&req->work, ra_work_fn_, CINQ_PRIO_HIGH);
+
+  atomic_inc(&ra_queued_);
+  cinq_exec_submit(&req->work);
+}
+
+// The window [start, start + size) is the range fetched ahead most
+// recently. Once a sequential reader enters it, the following window,
+// twice as large up to CINQ_RA_MAX_PAGES, is submitted, so the fetch of
+// one window overlaps the consumption of the previous one.
+void cinq_file_ra(struct file *filp, loff_t pos, size_t len) {
+  struct file_ra_state *ra = &filp->f_ra;
+  struct inode *inode = filp->f_path.dentry->d_inode;
+  const pgoff_t eof = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+  pgoff_t index, last;
+  int sequential;
+
+  if (unlikely(!len)) return;
+  index = pos >> PAGE_CACHE_SHIFT;
+  last = (pos + len - 1) >> PAGE_CACHE_SHIFT;
+  sequential = !pos || pos == ra->prev_pos ||
+      (ra->size && index >= ra->start && index < ra->start + ra->size);
+  ra->prev_pos = pos + len;
+
+  if (!sequential) { // random access ends the stream
+    ra->size = 0;
+    return;
+  }
+  if (!ra->size) { // starts a stream
+    ra->start = last + 1;
+    ra->size = 2 * (last - index + 1);
+    if (ra->size < CINQ_RA_MIN_PAGES) ra->size = CINQ_RA_MIN_PAGES;
+    if (ra->size > CINQ_RA_MAX_PAGES) ra->size = CINQ_RA_MAX_PAGES;
+  } else if (last >= ra->start + ra->size - ra->async_size) {
+    ra->start += ra->size;
+    if (ra->start <= last) ra->start = last + 1; // the reader ran past it
+    ra->size = ra->size * 2 > CINQ_RA_MAX_PAGES ?
+        CINQ_RA_MAX_PAGES : ra->size * 2;
+  } else {
+    return; // still ahead of the reader
+  }
+  ra->async_size = ra->size;
+
+  if (ra->start >= eof) return;
+  ra_submit_(filp->f_path.dentry, ra->start,
+             ra->start + ra->size > eof ? eof - ra->start : ra->size);
+}
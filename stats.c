@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  stats.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "stats.h"
+
+#ifdef CINQ_STATS
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+typedef atomic64_t stat_t;
+#define stat_inc_(s, v) atomic64_add(v, &(s))
+#define stat_get_(s) ((u64)atomic64_read(&(s)))
+#define stat_clr_(s) atomic64_set(&(s), 0)
+
+#define stat_shard_() (raw_smp_processor_id() & (CINQ_STAT_SHARDS - 1))
+#define stat_print_(out, ...) seq_printf((struct seq_file *)(out), __VA_ARGS__)
+
+#else
+
+typedef u64 stat_t;
+#define stat_inc_(s, v) __sync_fetch_and_add(&(s), v)
+#define stat_get_(s) (*(volatile u64 *)&(s))
+#define stat_clr_(s) ((s) = 0)
+
+static atomic_t stat_next_shard_;
+static __thread int stat_shard_id_ = -1;
+
+static inline int stat_shard_(void) {
+  if (unlikely(stat_shard_id_ < 0)) { // threads take shards round robin
+    stat_shard_id_ = atomic_inc_return(&stat_next_shard_) &
+        (CINQ_STAT_SHARDS - 1);
+  }
+  return stat_shard_id_;
+}
+
+#define stat_print_(out, ...) fprintf((FILE *)(out), __VA_ARGS__)
+
+#endif // __KERNEL__
+
+// Updated by the CPUs (or threads) that map to it only, mostly, so the
+// hot path never bounces cache lines between CPUs.
+struct cinq_stat_shard {
+  stat_t count[CINQ_STAT_NUM];
+  stat_t errors[CINQ_STAT_NUM];
+  stat_t total_ns[CINQ_STAT_NUM];
+  stat_t hist[CINQ_STAT_NUM][CINQ_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+static struct cinq_stat_shard stat_shards_[CINQ_STAT_SHARDS];
+
+static const char *stat_names_[CINQ_STAT_NUM] = {
+  "lookup", "mkdir", "create", "link", "unlink", "rename", "readdir",
+  "read", "write", "tags_lock_wait", "children_lock_wait"
+};
+
+void cinq_stat_add(enum cinq_stat_id id, u64 start, int err) {
+  struct cinq_stat_shard *shard = &stat_shards_[stat_shard_()];
+  const u64 ns = cinq_stat_clock() - start;
+  stat_inc_(shard->count[id], 1);
+  if (err) stat_inc_(shard->errors[id], 1);
+  stat_inc_(shard->total_ns[id], ns);
+  stat_inc_(shard->hist[id][cinq_hist_bucket(ns)], 1);
+}
+
+// Reads without stopping writers, so a summary may be slightly torn.
+void cinq_stats_read(enum cinq_stat_id id, struct cinq_stat_summary *sum) {
+  u64 *marks[] = { &sum->p50_ns, &sum->p99_ns, &sum->p999_ns };
+  const int per_mille[] = { 500, 990, 999 };
+  u64 seen = 0;
+  int i, b, m = 0;
+
+  memset(sum, 0, sizeof(*sum));
+  for (i = 0; i < CINQ_STAT_SHARDS; ++i) {
+    sum->count += stat_get_(stat_shards_[i].count[id]);
+    sum->errors += stat_get_(stat_shards_[i].errors[id]);
+    sum->total_ns += stat_get_(stat_shards_[i].total_ns[id]);
+  }
+  for (b = 0; b < CINQ_HIST_BUCKETS && m < 3 && sum->count; ++b) {
+    for (i = 0; i < CINQ_STAT_SHARDS; ++i) {
+      seen += stat_get_(stat_shards_[i].hist[id][b]);
+    }
+    while (m < 3 && seen * 1000 >= sum->count * per_mille[m]) {
+      *marks[m++] = cinq_hist_bound(b);
+    }
+  }
+}
+
+void cinq_stats_reset(void) {
+  int i, id, b;
+  for (i = 0; i < CINQ_STAT_SHARDS; ++i) {
+    struct cinq_stat_shard *shard = &stat_shards_[i];
+    for (id = 0; id < CINQ_STAT_NUM; ++id) {
+      stat_clr_(shard->count[id]);
+      stat_clr_(shard->errors[id]);
+      stat_clr_(shard->total_ns[id]);
+      for (b = 0; b < CINQ_HIST_BUCKETS; ++b) {
+        stat_clr_(shard->hist[id][b]);
+      }
+    }
+  }
+}
+
+void cinq_stats_dump(void *out) {
+  struct cinq_stat_summary sum;
+  int id;
+
+  stat_print_(out, "%-20s %12s %8s %12s %12s %12s %12s\n", "op", "count",
+              "errors", "avg_ns", "p50_ns", "p99_ns", "p999_ns");
+  for (id = 0; id < CINQ_STAT_NUM; ++id) {
+    cinq_stats_read(id, &sum);
+    if (!sum.count) continue;
+    stat_print_(out, "%-20s %12llu %8llu %12llu %12llu %12llu %12llu\n",
+                stat_names_[id], (unsigned long long)sum.count,
+                (unsigned long long)sum.errors,
+                (unsigned long long)(sum.total_ns / sum.count),
+                (unsigned long long)sum.p50_ns,
+                (unsigned long long)sum.p99_ns,
+                (unsigned long long)sum.p999_ns);
+  }
+}
+
+#ifdef __KERNEL__
+
+static int stats_proc_show_(struct seq_file *m, void *v) {
+  cinq_stats_dump(m);
+  return 0;
+}
+
+static int stats_proc_open_(struct inode *inode, struct file *file) {
+  return single_open(file, stats_proc_show_, NULL);
+}
+
+static const struct file_operations stats_proc_fops_ = {
+  .owner    = THIS_MODULE,
+  .open     = stats_proc_open_,
+  .read     = seq_read,
+  .llseek   = seq_lseek,
+  .release  = single_release,
+};
+
+int cinq_stats_proc_init(void) {
+  if (!proc_create("fs/cinqfs_stats", S_IRUGO, NULL, &stats_proc_fops_))
+    return -ENOMEM;
+  return 0;
+}
+
+void cinq_stats_proc_exit(void) {
+  remove_proc_entry("fs/cinqfs_stats", NULL);
+}
+
+#endif // __KERNEL__
+
+#endif // CINQ_STATS
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  stats.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_STATS_H_
+#define CINQUAIN_META_STATS_H_
+
+#include "util.h"
+
+/* Counters and latency histograms of operations, enabled by CINQ_STATS */
+
+enum cinq_stat_id {
+  CINQ_STAT_LOOKUP = 0,
+  CINQ_STAT_MKDIR,
+  CINQ_STAT_CREATE,
+  CINQ_STAT_LINK,
+  CINQ_STAT_UNLINK,
+  CINQ_STAT_RENAME,
+  CINQ_STAT_READDIR,
+  CINQ_STAT_READ,
+  CINQ_STAT_WRITE,
+  CINQ_STAT_TAGS_WAIT, // waiting for ci_tags_lock
+  CINQ_STAT_CHILDREN_WAIT, // waiting for ci_children_lock
+  CINQ_STAT_NUM
+};
+
+// Log-linear buckets: values below 2^(CINQ_HIST_SUB_BITS + 1) ns are
+// exact, and each power of two above is split into 2^CINQ_HIST_SUB_BITS
+// buckets, so any value is within 12.5% of its bucket bound.
+// Values of 2^CINQ_HIST_MAX_SHIFT ns (about a minute) and beyond share
+// the last bucket.
+#define CINQ_HIST_SUB_BITS 3
+#define CINQ_HIST_MAX_SHIFT 36
+#define CINQ_HIST_BUCKETS \
+    ((CINQ_HIST_MAX_SHIFT - CINQ_HIST_SUB_BITS + 1) << CINQ_HIST_SUB_BITS)
+
+#define CINQ_STAT_SHARDS 16 // a power of 2
+
+struct cinq_stat_summary {
+  u64 count;
+  u64 errors;
+  u64 total_ns;
+  u64 p50_ns; // upper bounds of the buckets holding the percentiles
+  u64 p99_ns;
+  u64 p999_ns;
+};
+
+static inline int cinq_hist_bucket(u64 ns) {
+  int shift;
+  if (ns < (2 << CINQ_HIST_SUB_BITS)) return (int)ns;
+  if (ns >> CINQ_HIST_MAX_SHIFT) return CINQ_HIST_BUCKETS - 1;
+  shift = 63 - __builtin_clzll(ns) - CINQ_HIST_SUB_BITS;
+  return ((shift + 1) << CINQ_HIST_SUB_BITS) +
+      (int)((ns >> shift) & ((1 << CINQ_HIST_SUB_BITS) - 1));
+}
+
+// The largest value falling in @bucket.
+static inline u64 cinq_hist_bound(int bucket) {
+  const int sub = 1 << CINQ_HIST_SUB_BITS;
+  const int shift = (bucket >> CINQ_HIST_SUB_BITS) - 1;
+  if (bucket < 2 * sub) return bucket;
+  return ((u64)(sub + (bucket & (sub - 1)) + 1) << shift) - 1;
+}
+
+#ifdef __KERNEL__
+#include <linux/ktime.h>
+#endif
+
+// Monotonic nanoseconds, also used by the lock profiler.
+static inline u64 cinq_stat_clock(void) {
+#ifdef __KERNEL__
+  return ktime_to_ns(ktime_get());
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif // __KERNEL__
+}
+
+#ifdef CINQ_STATS
+
+// Accounts one event of @id that began at @start.
+extern void cinq_stat_add(enum cinq_stat_id id, u64 start, int err);
+
+extern void cinq_stats_read(enum cinq_stat_id id,
+                            struct cinq_stat_summary *sum);
+extern void cinq_stats_reset(void);
+
+// Prints all non-empty stats to @out,
+// a struct seq_file in the kernel or a FILE in user space.
+extern void cinq_stats_dump(void *out);
+
+#ifdef __KERNEL__
+extern int cinq_stats_proc_init(void); // /proc/fs/cinqfs_stats
+extern void cinq_stats_proc_exit(void);
+#endif // __KERNEL__
+
+#define STAT_BEGIN_(t) const u64 t = cinq_stat_clock()
+#define STAT_END_(id, t, err) cinq_stat_add(id, t, err)
+
+#define stat_lock_(lock_stmt, id) do { \
+  STAT_BEGIN_(t_); \
+  lock_stmt; \
+  STAT_END_(id, t_, 0); \
+} while (0)
+
+#else
+
+#define STAT_BEGIN_(t)
+#define STAT_END_(id, t, err)
+#define stat_lock_(lock_stmt, id) lock_stmt
+
+#endif // CINQ_STATS
+
+#endif // CINQUAIN_META_STATS_H_
@@ -193,6 +193,41 @@ struct dentry *d_splice_alias(struct inode *inode,
 	return NULL;
 }
 
+/**
+ * d_obtain_alias - find or allocate a dentry for a given inode
+ * @inode: inode to allocate the dentry for
+ *
+ * Obtain a dentry for an inode resulting from NFS filehandle conversion or
+ * similar open by handle operations.  The returned dentry may be anonymous,
+ * or may have a full name (if the inode was already in the cache).
+ *
+ * On successful return, the reference to the inode has been transferred
+ * to the dentry.  In case of an error the reference on the inode is released.
+ */
+struct dentry *d_obtain_alias(struct inode *inode) {
+  static const struct qstr anonstring = {
+      .name = (unsigned char *)"/", .len = 1 };
+	struct dentry *res;
+
+	if (!inode)
+		return ERR_PTR(-ESTALE);
+	if (IS_ERR(inode))
+		return ERR_PTR(PTR_ERR(inode));
+
+  // The user-space dcache does not keep aliases hashed, so a new
+  // anonymous dentry is always allocated.
+	res = d_alloc(NULL, &anonstring);
+	if (!res) {
+		iput(inode);
+		return ERR_PTR(-ENOMEM);
+	}
+	res->d_sb = inode->i_sb;
+	res->d_parent = res;
+	res->d_flags |= DCACHE_DISCONNECTED;
+	d_instantiate(res, inode);
+	return res;
+}
+
 /*
  * Release the dentry's inode, using the filesystem
  * d_iput() operation if defined. Dentry has no refcount
@@ -15,8 +15,11 @@
 #include "thread.h"
 
 struct cinq_file_systems file_systems;
-static struct thread_task journal_thread;
+struct cinq_idtable fsnode_ids;
+struct cinq_idtable cnode_ids;
 static struct cinq_journal cinq_journal;
+static struct cinq_work journal_work_;
+static int journal_stop_;
 
 #ifdef CINQ_DEBUG
 #ifndef __KERNEL__
@@ -25,6 +28,20 @@ atomic_t num_dentry_;
 atomic_t num_inode_;
 #endif // CINQ_DEBUG
 
+// Drains the journal every second on the executor.
+static void journal_writeback_(struct cinq_work *work) {
+  int i = 0;
+  struct cinq_jentry *entry;
+
+  for (i = 0; i < NUM_WAY; ++i) {
+    while (!journal_empty_syn(&cinq_journal, i)) {
+      entry = journal_get_syn(&cinq_journal, i);
+      jentry_free(entry);
+    }
+  }
+  if (!journal_stop_) cinq_exec_later(work, 1);
+}
+
 // @data: can be NULL
 static int cinq_fill_super_(struct super_block *sb, void *data, int silent) {
   struct inode *inode = NULL;
@@ -44,8 +61,8 @@ static int cinq_fill_super_(struct super_block *sb, void *data, int silent) {
   sb->s_time_gran	= 1;
   
   inode = cnode_make_tree(sb);
-  if (!inode) {
-	return -ENOMEM;
+  if (IS_ERR(inode)) {
+	return PTR_ERR(inode);
   }
   
   root = d_alloc_root(inode);
@@ -55,60 +72,56 @@ static int cinq_fill_super_(struct super_block *sb, void *data, int silent) {
   }
   root->d_fsdata = META_FS;
   sb->s_root = root;
+  cinq_tier_init(i_cnode(inode));
+  cinq_compact_init();
   
   return 0;
 }
 
 struct dentry *cinq_mount(struct file_system_type *fs_type, int flags,
                            const char *dev_name, void *data) {
+#ifdef CINQ_DEDUP
+  int err = chunk_init();
+  if (unlikely(err)) return ERR_PTR(err);
+#endif
+  cinq_grace_init();
   cfs_init(&file_systems);
+  idtable_init(&fsnode_ids, get_seconds());
+  idtable_init(&cnode_ids, get_seconds());
   journal_init(&cinq_journal, "Cinquain");
   rwcache_init();
-  thread_init(&journal_thread, journal_writeback, &cinq_journal,
-              "cinquain-journal");
-  thread_run(&journal_thread);
+  cinq_exec_init();
+  journal_stop_ = 0;
+  cinq_work_init(&journal_work_, journal_writeback_, CINQ_PRIO_NORMAL);
+  cinq_exec_later(&journal_work_, 1);
+  cinq_ra_init();
   return mount_nodev(fs_type, flags, data, cinq_fill_super_);
 }
 
 void cinq_kill_sb(struct super_block *sb) {
   if (sb->s_root) {
-    int i = 0;
-    for (i = 0; i < NUM_WAY; ++i) {
-      while (!journal_empty_syn(&cinq_journal, i)) {
-        sleep(1);
-      }
-    }
+    cinq_ra_fini();
+    cinq_compact_fini();
+    cinq_tier_fini();
     rwcache_fini();
-    thread_stop(&journal_thread);
+#ifdef CINQ_DEDUP
+    chunk_exit();
+#endif
+    journal_stop_ = 1;
+    cinq_exec_cancel(&journal_work_);
+    journal_writeback_(&journal_work_); // what is left
     fsnode_evict_all(META_FS);
     d_genocide(sb->s_root);
-    cnode_evict_all(i_cnode(sb->s_root->d_inode));
+    cnode_evict_tree(i_cnode(sb->s_root->d_inode));
+    idtable_destroy(&cnode_ids);
+    idtable_destroy(&fsnode_ids);
+    cinq_exec_fini();
+    cinq_grace_fini();
     // dput(sb->s_root); // cancel the extra reference and delete // FIX ME
   }
   DEBUG_ON_(!sb->s_root, "[Warn@cinq_kill_sb]: invoked on null dentry.\n");
 }
 
-THREAD_FUNC_(journal_writeback)(void *data) {
-  int i = 0;
-  struct cinq_journal *journal = data;
-  struct cinq_jentry *entry;
-  
-  while (!thread_should_stop()) {
-    set_current_state(TASK_RUNNING);
-    
-    for (i = 0; i < NUM_WAY; ++i) {
-	  while (!journal_empty_syn(journal, i)) {
-		entry = journal_get_syn(journal, i);
-		jentry_free(entry);
-      }
-    }
-    
-    set_current_state(TASK_INTERRUPTIBLE);
-    sleep(1);
-  }
-  THREAD_RETURN_;
-}
-
 void journal_fsnode(struct cinq_fsnode *fsnode, enum journal_action action) {
   struct cinq_jentry *entry = jentry_new(&fsnode->fs_id,
                                                   fsnode, action);
@@ -13,6 +13,7 @@
 #include <stdio.h>
 
 #include "cinq_meta.h"
+#include "thread.h"
 
 /* Test config */
 #define FS_CHILDREN_ 4
@@ -270,6 +271,7 @@ static void *rand_lookup(void *droot) {
 
 
 atomic_t readdir_is_ok = { 1 };
+static struct super_block *ls_sb; // of the dir being listed
 
 struct some_entry {
   char name[MAX_NAME_LEN + 1];
@@ -283,7 +285,7 @@ static int example_filldir(void *dirent, const char *name, int name_len,
   // User-defined way to use dirent
   struct list_head *list = (struct list_head *)dirent;
   // The way to retrieve inode
-  struct inode *inode = cinq_iget(NULL, ino);
+  struct inode *inode = cinq_iget(ls_sb, ino);
   
   struct some_entry *cur =
       (struct some_entry *)malloc(sizeof(struct some_entry));
@@ -299,6 +301,7 @@ static int example_filldir(void *dirent, const char *name, int name_len,
            name);
     atomic_set(&readdir_is_ok, 0);
   }
+  iput(inode);
   return 0;
 }
 
@@ -309,6 +312,7 @@ static void do_ls_(struct dentry *dent) {
   struct some_entry *cur, *tmp;
   
   struct file *filp = dentry_open(dent, NULL, 0, NULL);
+  ls_sb = dent->d_sb;
   filp->f_op->open(NULL, filp);
   filp->f_op->readdir(filp, &entries, example_filldir);
   list_for_each_entry_safe_reverse(cur, tmp, &entries, member) {
@@ -577,6 +581,313 @@ static void *rand_sym(void *droot) {
   pthread_exit(NULL);
 }
 
+atomic_t num_fh_ok = { .counter = 0 };
+atomic_t num_fh_test = { .counter = 0 };
+
+// Encodes the handle of a dentry, decodes it back and checks the inode.
+// Also checks that a handle with a wrong generation is rejected.
+static void check_fh_(struct dentry *dent) {
+  const struct export_operations *op = dent->d_sb->s_export_op;
+  struct cinq_fh fh;
+  int len = CINQ_FH_LEN;
+  int pass = 1;
+  
+  atomic_inc(&num_fh_test);
+  int type = op->encode_fh(dent, (__u32 *)&fh, &len, 0);
+  struct dentry *found = op->fh_to_dentry(dent->d_sb, (struct fid *)&fh,
+                                          len, type);
+  if (!found || IS_ERR(found) || found->d_inode != dent->d_inode ||
+      found->d_fsdata != dent->d_fsdata) {
+    pass = 0;
+  }
+  if (found && !IS_ERR(found)) dput(found);
+  ++fh.ci_gen; // makes the handle stale
+  struct dentry *stale = op->fh_to_dentry(dent->d_sb, (struct fid *)&fh,
+                                          len, type);
+  if (!IS_ERR(stale) || PTR_ERR(stale) != -ESTALE) {
+    pass = 0;
+  }
+  
+  // Reconnects to the parent as NFS does for disconnected dentries
+  if (dent->d_parent != dent) {
+    struct dentry *parent = op->get_parent(dent);
+    if (IS_ERR(parent) || parent->d_inode != dent->d_parent->d_inode) {
+      pass = 0;
+    }
+    char name[MAX_NAME_LEN + 1];
+    if (!IS_ERR(parent) && (op->get_name(parent, name, dent) ||
+                            strcmp(name, (char *)dent->d_name.name))) {
+      pass = 0;
+    }
+    if (!IS_ERR(parent)) dput(parent);
+  }
+  // Connectable handles carry the parent of non-directories
+  len = CINQ_FH_PARENT_LEN;
+  type = op->encode_fh(dent, (__u32 *)&fh, &len, 1);
+  if (type == CINQ_FH_TYPE_PARENT) {
+    struct dentry *parent = op->fh_to_parent(dent->d_sb, (struct fid *)&fh,
+                                             len, type);
+    if (IS_ERR(parent) || parent->d_inode != dent->d_parent->d_inode) {
+      pass = 0;
+    }
+    if (!IS_ERR(parent)) dput(parent);
+  } else if (!S_ISDIR(dent->d_inode->i_mode) || len != CINQ_FH_LEN) {
+    pass = 0;
+  }
+  fprintf(stdout, "cinq_fh: %s\t%s\n", dent->d_name.name,
+          pass ? "OK" : "WRONG");
+  if (pass) atomic_inc(&num_fh_ok);
+}
+
+// Decodes the handle of @dir/@dname/@fname after their dentries are
+// dropped, and reconnects the disconnected dentry it gets up to @droot
+// by get_parent and get_name, as nfsd does. @names are expected on the
+// way up after the two made here, the nearest first.
+static void check_fh_reconnect_(struct dentry *droot, struct dentry *dir,
+                                char names[][MAX_NAME_LEN + 1], int num) {
+  const struct export_operations *op = dir->d_sb->s_export_op;
+  const int dir_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU;
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  char dname[] = "fh_dir", fname[] = "fh_leaf";
+  struct qstr qd = { .name = (unsigned char *)dname, .len = strlen(dname) };
+  struct qstr qf = { .name = (unsigned char *)fname, .len = strlen(fname) };
+  char name[MAX_NAME_LEN + 1];
+  struct dentry *sub, *leaf, *cur, *parent;
+  struct cinq_fh fh;
+  int len = CINQ_FH_LEN, type, hops = 0, pass;
+
+  atomic_inc(&num_fh_test);
+  sub = d_alloc(dir, &qd);
+  leaf = NULL;
+  pass = !dir->d_inode->i_op->mkdir(dir->d_inode, sub, dir_mode);
+  if (pass) {
+    leaf = d_alloc(sub, &qf);
+    pass = !sub->d_inode->i_op->create(sub->d_inode, leaf, file_mode, NULL);
+  }
+  if (pass) type = op->encode_fh(leaf, (__u32 *)&fh, &len, 0);
+  dput(leaf); // both are dropped from the dcache, and their inodes evicted
+  dput(sub);
+  if (!pass) goto out;
+
+  cur = op->fh_to_dentry(droot->d_sb, (struct fid *)&fh, len, type);
+  if (!cur || IS_ERR(cur) || !(cur->d_flags & DCACHE_DISCONNECTED)) {
+    pass = 0;
+    goto out;
+  }
+  while (cur != droot) {
+    parent = op->get_parent(cur);
+    if (IS_ERR(parent) || op->get_name(parent, name, cur) ||
+        strcmp(name, hops == 0 ? fname : hops == 1 ? dname :
+               hops - 2 < num ? names[hops - 2] : "")) {
+      pass = 0;
+    }
+    dput(cur);
+    if (IS_ERR(parent)) goto out;
+    cur = parent;
+    if (++hops > num + 2) break;
+  }
+  dput(cur);
+  pass = pass && hops == num + 2;
+out:
+  fprintf(stdout, "cinq_fh: %s reconnected in %d hops\t%s\n", fname, hops,
+          pass ? "OK" : "WRONG");
+  if (pass) atomic_inc(&num_fh_ok);
+}
+
+// Includes examples for invoking export operations
+static void test_fh(struct dentry *droot) {
+  struct dentry *dent;
+  const int k_num_seg = 4;
+  char dir[k_num_seg][MAX_NAME_LEN + 1];
+  
+  strcpy(dir[0], "0_2_1");
+  strcpy(dir[1], "4");
+  strcpy(dir[2], "4.3");
+  strcpy(dir[3], "4.3.2");
+  
+  fprintf(stdout, "\nTest file handles:\n");
+  check_fh_(droot);
+  int i;
+  for (i = 1; i <= k_num_seg; ++i) {
+    dent = do_lookup_(droot, dir, i);
+    if (!dent || !dent->d_inode) {
+      DEBUG_("[Error@test_fh] cannot find %s of %s.\n", dir[i - 1], dir[0]);
+      continue;
+    }
+    check_fh_(dent);
+    if (i < k_num_seg) dput(dent);
+  }
+  
+  // a regular file for connectable handles
+  int mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXO | S_IRGRP;
+  char *filename = "fh_file";
+  const struct qstr q_filename =
+      { .name = (unsigned char *)filename, .len = strlen(filename) };
+  char name[MAX_NAME_LEN + 1];
+  struct dentry* const file_dent = d_alloc(dent, &q_filename);
+  if (dent->d_inode->i_op->create(dent->d_inode, file_dent, mode, NULL)) {
+    DEBUG_("[Error@test_fh] failed to create %s.\n", filename);
+    return;
+  }
+  check_fh_(file_dent);
+
+  // A hard link in 4.3 is named there by the link, not the file.
+  char *linkname = "fh_link";
+  const struct qstr q_linkname =
+      { .name = (unsigned char *)linkname, .len = strlen(linkname) };
+  struct dentry *dir43 = do_lookup_(droot, dir, k_num_seg - 1);
+  int pass = 0;
+  atomic_inc(&num_fh_test);
+  if (dir43 && dir43->d_inode) {
+    struct dentry *link_dent = d_alloc(dir43, &q_linkname);
+    pass = !dir43->d_inode->i_op->link(file_dent, dir43->d_inode, link_dent) &&
+        !dent->d_sb->s_export_op->get_name(dir43, name, file_dent) &&
+        !strcmp(name, linkname);
+    dput(link_dent);
+  }
+  if (dir43) dput(dir43);
+  fprintf(stdout, "cinq_fh: %s named through a hard link\t%s\n", filename,
+          pass ? "OK" : "WRONG");
+  if (pass) atomic_inc(&num_fh_ok);
+
+  // A time before 1970 is kept in the tag over an eviction.
+  struct cinq_tag *file_tag = i_tag(file_dent->d_inode);
+  const struct timespec old_time = { -1000000000L, 5 }; // in 1938
+  file_dent->d_inode->i_mtime = old_time;
+  dput(file_dent);
+  struct inode *file_inode = cinq_iget(droot->d_sb, (unsigned long)file_tag);
+  fprintf(stdout, "cinq_attr: %s kept its mtime before 1970\t%s\n", filename,
+          file_inode && file_inode->i_mtime.tv_sec == old_time.tv_sec &&
+          file_inode->i_mtime.tv_nsec == old_time.tv_nsec ? "OK" : "WRONG");
+  iput(file_inode);
+
+  for (i = 0; i < k_num_seg / 2; ++i) { // nearest first
+    strcpy(name, dir[i]);
+    strcpy(dir[i], dir[k_num_seg - 1 - i]);
+    strcpy(dir[k_num_seg - 1 - i], name);
+  }
+  check_fh_reconnect_(droot, dent, dir, k_num_seg);
+  dput(dent);
+}
+
+#define STRIPE_THR_NUM_ 4
+#define STRIPE_LEN_ 4096
+
+struct stripe_arg_ {
+  struct dentry *dent;
+  int no;
+};
+
+// Writes every STRIPE_THR_NUM_-th stripe, filled with its index.
+static void *write_stripes_(void *data) {
+  struct stripe_arg_ *arg = data;
+  struct file *filp = dentry_open(arg->dent, NULL, 0, NULL);
+  char buf[STRIPE_LEN_];
+  loff_t offset;
+  int i;
+  for (i = arg->no; i < STRIPE_THR_NUM_ * 16; i += STRIPE_THR_NUM_) {
+    memset(buf, 'A' + i % 26, STRIPE_LEN_);
+    offset = (loff_t)i * STRIPE_LEN_;
+    filp->f_op->write(filp, buf, STRIPE_LEN_, &offset);
+  }
+  put_filp(filp);
+  return NULL;
+}
+
+// Disjoint stripes are written in parallel through the range lock.
+static void test_stripes_(struct dentry *file_dent) {
+  struct cinq_range_tree tree;
+  struct cinq_range r1, r2, r3;
+  struct stripe_arg_ args[STRIPE_THR_NUM_];
+  pthread_t thr[STRIPE_THR_NUM_];
+  const size_t len = STRIPE_THR_NUM_ * 16 * STRIPE_LEN_;
+  char *back = malloc(len);
+  struct file *filp;
+  loff_t offset = 0;
+  int ok, i;
+
+  range_tree_init(&tree);
+  range_tree_lock(&tree, &r1, 0, 10);
+  ok = range_tree_trylock(&tree, &r2, 5, 15) == -EBUSY &&
+      range_tree_trylock(&tree, &r3, 10, 20) == 0;
+  range_tree_unlock(&tree, &r3);
+  range_tree_unlock(&tree, &r1);
+  ok = ok && !range_tree_trylock(&tree, &r2, 5, 15);
+  range_tree_unlock(&tree, &r2);
+  range_tree_destroy(&tree);
+
+  for (i = 0; i < STRIPE_THR_NUM_; ++i) {
+    args[i].dent = file_dent;
+    args[i].no = i;
+    pthread_create(&thr[i], NULL, write_stripes_, &args[i]);
+  }
+  for (i = 0; i < STRIPE_THR_NUM_; ++i) {
+    pthread_join(thr[i], NULL);
+  }
+
+  filp = dentry_open(file_dent, NULL, 0, NULL);
+  while (offset < len &&
+         filp->f_op->read(filp, back + offset, len - offset, &offset) > 0);
+  put_filp(filp);
+  for (i = 0; i < len && ok; ++i) {
+    ok = back[i] == 'A' + (i / STRIPE_LEN_) % 26;
+  }
+  fprintf(stdout, "range lock: %d stripes by %d writers\t%s\n",
+          STRIPE_THR_NUM_ * 16, STRIPE_THR_NUM_,
+          ok && file_dent->d_inode->i_size >= len ? "OK" : "WRONG");
+  free(back);
+}
+
+// Writes far beyond the end, leaving a hole that reads as zeros.
+static void test_sparse_(struct dentry *file_dent) {
+  struct inode *inode = file_dent->d_inode;
+  const loff_t data = inode->i_size + (1 << 20);
+  char buf[STRIPE_LEN_], back[STRIPE_LEN_];
+  struct file *filp;
+  loff_t offset = data, hole, next;
+  int ok = 1, i;
+
+  memset(buf, 's', STRIPE_LEN_);
+  filp = dentry_open(file_dent, NULL, 0, NULL);
+  filp->f_op->write(filp, buf, STRIPE_LEN_, &offset);
+  offset = data - STRIPE_LEN_ / 2; // half hole, half data
+  filp->f_op->read(filp, back, STRIPE_LEN_, &offset);
+  for (i = 0; i < STRIPE_LEN_ && ok; ++i) {
+    ok = back[i] == (i < STRIPE_LEN_ / 2 ? '\0' : 's');
+  }
+
+  hole = filp->f_op->llseek(filp, 0, SEEK_HOLE);
+  next = filp->f_op->llseek(filp, hole, SEEK_DATA);
+  ok = ok && hole == data - (1 << 20) && next == data &&
+      filp->f_op->llseek(filp, next, SEEK_HOLE) == inode->i_size &&
+      filp->f_op->llseek(filp, inode->i_size, SEEK_DATA) == -ENXIO;
+
+  cinq_file_truncate(file_dent->d_inode, data + 1);
+  offset = data;
+  ok = ok && filp->f_op->read(filp, back, STRIPE_LEN_, &offset) == 1;
+  cinq_file_truncate(file_dent->d_inode, data + STRIPE_LEN_);
+  ok = ok && filp->f_op->llseek(filp, data + 1, SEEK_HOLE) == data + 1;
+
+  // Punches the middle quarter, and then rewrites over the hole
+  offset = data;
+  filp->f_op->write(filp, buf, STRIPE_LEN_, &offset);
+  filp->f_op->fallocate(filp, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        data + STRIPE_LEN_ / 4, STRIPE_LEN_ / 4);
+  offset = data;
+  filp->f_op->read(filp, back, STRIPE_LEN_, &offset);
+  for (i = 0; i < STRIPE_LEN_ && ok; ++i) {
+    ok = back[i] == (i / (STRIPE_LEN_ / 4) == 1 ? '\0' : 's');
+  }
+  offset = data;
+  filp->f_op->write(filp, buf, STRIPE_LEN_, &offset);
+  offset = data;
+  filp->f_op->read(filp, back, STRIPE_LEN_, &offset);
+  ok = ok && !memcmp(back, buf, STRIPE_LEN_);
+  put_filp(filp);
+  fprintf(stdout, "sparse: hole of %d KB\t%s\n", (int)((data - hole) >> 10),
+          ok ? "OK" : "WRONG");
+}
+
 // Includes examples for invoking cinq_file_read(), cinq_file_write()
 static void test_rw(struct dentry *droot) {
   struct dentry *dent;
@@ -629,6 +940,739 @@ static void test_rw(struct dentry *droot) {
   result[in_filp->f_pos] = '\0';
   put_filp(in_filp);
   fprintf(stdout, "read: %s\n", result);
+  
+  // Example for invoking cinq_file_read_get(): segments are not copied
+  char gathered[100];
+  size_t pos = 0;
+  in_filp = dentry_open(file_dent, NULL, 0, NULL);
+  struct cinq_read_set *rs = cinq_file_read_get(in_filp, sizeof(gathered) - 1,
+                                                 0);
+  int i;
+  for (i = 0; rs && !IS_ERR(rs) && i < rs->rs_nvec; ++i) {
+    memcpy(gathered + pos, rs->rs_vec[i].iov_base, rs->rs_vec[i].iov_len);
+    pos += rs->rs_vec[i].iov_len;
+  }
+  gathered[pos] = '\0';
+  if (rs && !IS_ERR(rs)) cinq_read_set_put(rs);
+  put_filp(in_filp);
+  fprintf(stdout, "read set: %s\t%s\n", gathered,
+          strcmp(gathered, result) ? "WRONG" : "OK");
+
+  // Example for invoking cinq_file_writev(): segments merge into one entry
+  struct iovec vec[3] = {
+    { .iov_base = "abc", .iov_len = 3 },
+    { .iov_base = "defg", .iov_len = 4 },
+    { .iov_base = "hij", .iov_len = 3 }
+  };
+  out_filp = dentry_open(file_dent, NULL, 0, NULL);
+  offset = 0;
+  cinq_file_writev(out_filp, vec, 3, &offset);
+  put_filp(out_filp);
+
+  // Example for the write ring: contiguous submissions are merged
+  const char *pieces[] = { "klm", "nop", "qrs", "tuv" };
+  struct cinq_wring ring;
+  struct cinq_wsqe *sqe;
+  struct cinq_wcqe *cqe;
+  int reaped = 0;
+  out_filp = dentry_open(file_dent, NULL, 0, NULL);
+  cinq_wring_init(&ring, 4);
+  for (i = 0; i < 4; ++i) {
+    sqe = cinq_wring_get_sqe(&ring);
+    sqe->filp = out_filp;
+    sqe->buf = pieces[i];
+    sqe->len = 3;
+    sqe->pos = offset + 3 * i;
+    sqe->user_data = i;
+  }
+  cinq_wring_submit(&ring);
+  while (!cinq_wring_wait_cqe(&ring, &cqe, 1)) {
+    if (cqe->res == 3) ++reaped;
+    cinq_wring_cqe_seen(&ring);
+  }
+  cinq_wring_exit(&ring);
+  put_filp(out_filp);
+
+  in_filp = dentry_open(file_dent, NULL, 0, NULL);
+  offset = 0;
+  len = in_filp->f_op->read(in_filp, gathered, 22, &offset);
+  gathered[len] = '\0';
+  put_filp(in_filp);
+  fprintf(stdout, "writev and ring (%d completions): %s\t%s\n", reaped,
+          gathered, strcmp(gathered, "abcdefghijklmnopqrstuv") || reaped != 4 ?
+          "WRONG" : "OK");
+
+  // A sequential scan grows the readahead window of the open file
+  const size_t big_len = 64 * PAGE_CACHE_SIZE;
+  char *big = malloc(big_len), *back = malloc(PAGE_CACHE_SIZE);
+  int same = 1;
+  memset(big, 'r', big_len);
+  out_filp = dentry_open(file_dent, NULL, 0, NULL);
+  offset = 0;
+  out_filp->f_op->write(out_filp, big, big_len, &offset);
+  put_filp(out_filp);
+
+  in_filp = dentry_open(file_dent, NULL, 0, NULL);
+  offset = 0;
+  while ((len = in_filp->f_op->read(in_filp, back, PAGE_CACHE_SIZE, &offset))) {
+    same = same && !memcmp(back, big, len);
+  }
+  const unsigned int ra_size = in_filp->f_ra.size;
+  cinq_exec_flush(); // the last window is kept with the file
+  struct cinq_read_set *ra = i_tag(file_dent->d_inode)->t_data->fd_ra[0];
+  if (ra) {
+    offset = ra->rs_pos;
+    len = in_filp->f_op->read(in_filp, back, PAGE_CACHE_SIZE, &offset);
+    same = same && len == PAGE_CACHE_SIZE && !memcmp(back, big, len);
+  }
+  fprintf(stdout, "readahead: window of %u pages\t%s\n", ra_size,
+          same && ra && ra_size > CINQ_RA_MIN_PAGES ? "OK" : "WRONG");
+  put_filp(in_filp);
+  free(big);
+  free(back);
+
+  test_stripes_(file_dent);
+  test_sparse_(file_dent);
+}
+
+#ifdef CINQ_DEDUP
+
+static struct dentry *dedup_write_(struct dentry *dent, char *filename,
+                                   char *data, size_t len) {
+  int mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXO | S_IRGRP;
+  const struct qstr q_filename =
+      { .name = (unsigned char *)filename, .len = strlen(filename) };
+  struct dentry *file_dent = d_alloc(dent, &q_filename);
+  struct file *filp;
+  loff_t offset = 0;
+
+  if (dent->d_inode->i_op->create(dent->d_inode, file_dent, mode, NULL)) {
+    DEBUG_("[Error@dedup_write_] failed to create %s.\n", filename);
+    return NULL;
+  }
+  filp = dentry_open(file_dent, NULL, 0, NULL);
+  filp->f_op->write(filp, data, len, &offset);
+  put_filp(filp);
+  return file_dent;
+}
+
+// Identical content written to two files shares all chunk fingerprints.
+static void test_dedup(struct dentry *droot) {
+  const unsigned char abc_sha256[] = { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01,
+      0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23 };
+  unsigned char value[FILE_HASH_WIDTH];
+  const size_t len = 256 * 1024;
+  char dir[3][MAX_NAME_LEN + 1];
+  char *data = malloc(len), *back = malloc(len);
+  struct dentry *dent, *a, *b;
+  struct cinq_chunk_map *ma, *mb;
+  struct file *filp;
+  loff_t offset = 0;
+  int same, i;
+
+  chunk_fingerprint("abc", 3, value);
+  fprintf(stdout, "\nsha256 of 'abc'\t%s\n",
+          memcmp(value, abc_sha256, FILE_HASH_WIDTH) ? "WRONG" : "OK");
+
+  strcpy(dir[0], "0_4_3");
+  strcpy(dir[1], "3");
+  strcpy(dir[2], "3.2");
+  dent = do_lookup_(droot, dir, 3);
+  if (!dent || !dent->d_inode) return;
+  for (i = 0; i < len; ++i) data[i] = rand();
+
+  a = dedup_write_(dent, "dedup.a", data, len);
+  b = dedup_write_(dent, "dedup.b", data, len);
+  if (!a || !b) return;
+  ma = &i_tag(a->d_inode)->t_data->fd_chunks;
+  mb = &i_tag(b->d_inode)->t_data->fd_chunks;
+  same = ma->cm_num == mb->cm_num && !memcmp(ma->cm_refs, mb->cm_refs,
+      ma->cm_num * sizeof(struct cinq_chunk_ref));
+
+  filp = dentry_open(b, NULL, 0, NULL);
+  while (offset < len &&
+         filp->f_op->read(filp, back + offset, len - offset, &offset) > 0);
+  put_filp(filp);
+  fprintf(stdout, "dedup: %d chunks shared\t%s\n", ma->cm_num,
+          same && !memcmp(data, back, len) ? "OK" : "WRONG");
+  free(data);
+  free(back);
+}
+
+#endif // CINQ_DEDUP
+
+// Spills a tree left with no dentries, then looks into it again.
+static void test_tier_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_1", "tier", "" };
+  char tier_file[] = "/tmp/cinq_tier_XXXXXX";
+  const int dir_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU;
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  struct dentry *view, *top, *sub, *file;
+  struct qstr name;
+  long spilled;
+  int i, j, fd, ok;
+
+  view = do_lookup_(droot, seg, 1);
+  fd = mkstemp(tier_file);
+  if (!view || fd < 0) return;
+  close(fd);
+  name = (struct qstr) { .name = (unsigned char *)seg[1], .len = 4 };
+  top = d_alloc(view, &name);
+  if (view->d_inode->i_op->mkdir(view->d_inode, top, dir_mode)) return;
+  for (i = 0; i < 4; ++i) {
+    char dname[2] = { '0' + i, '\0' };
+    name = (struct qstr) { .name = (unsigned char *)dname, .len = 1 };
+    sub = d_alloc(top, &name);
+    top->d_inode->i_op->mkdir(top->d_inode, sub, dir_mode);
+    for (j = 0; j < 4; ++j) {
+      char fname[3] = { 'f', '0' + j, '\0' };
+      name = (struct qstr) { .name = (unsigned char *)fname, .len = 2 };
+      file = d_alloc(sub, &name);
+      sub->d_inode->i_op->create(sub->d_inode, file, file_mode, NULL);
+      dput(file);
+    }
+    dput(sub);
+  }
+
+  ok = !cinq_tier_start(tier_file, 0);
+  unlink(tier_file);
+  spilled = cinq_tier_sweep(0);
+  ok = ok && i_cnode(top->d_inode)->ci_spill;
+  strcpy(seg[1], "3");
+  strcpy(seg[2], "f2");
+  sub = do_lookup_(top, seg + 1, 2); // faults the subtree in
+  ok = ok && sub && !strcmp(i_cnode(sub->d_inode)->ci_name, "f2") &&
+      !i_cnode(top->d_inode)->ci_spill;
+  fprintf(stdout, "tier: %ld cnodes spilled and faulted\t%s\n", spilled,
+          ok && spilled >= 20 ? "OK" : "WRONG");
+}
+
+struct dirindex_check_ {
+  int count;
+  int limit; // of entries to take in a call
+  int sorted;
+  char last[MAX_NAME_LEN + 1];
+};
+
+static int dirindex_filldir_(void *dirent, const char *name, int name_len,
+                             loff_t pos, u64 ino, unsigned dt_type) {
+  struct dirindex_check_ *check = dirent;
+  if (name[0] == '.') return 0;
+  if (check->limit-- == 0) return -1;
+  if (check->count && strcmp(check->last, name) >= 0) check->sorted = 0;
+  strcpy(check->last, name);
+  ++check->count;
+  return 0;
+}
+
+// Fills a directory past the index threshold, removes every other file,
+// and reads the rest back in pieces. Another reader, opened while the
+// directory is still hashed, is left half way and finished afterwards.
+static void test_dirindex_(struct dentry *droot) {
+  char seg[2][MAX_NAME_LEN + 1] = { "0_2_1", "dirindex" };
+  const unsigned int old_min = cinq_dirindex_min;
+  const int dir_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU;
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  const int k_num = 300;
+  struct dirindex_check_ check = { .sorted = 1 }, early = { .sorted = 1 };
+  struct dentry *view, *dir, *file;
+  struct cinq_dirindex *index;
+  char name[MAX_NAME_LEN + 1];
+  struct qstr qname;
+  struct file *filp, *early_filp = NULL;
+  int i, prev, ok;
+
+  view = do_lookup_(droot, seg, 1);
+  if (!view) return;
+  qname = (struct qstr) { .name = (unsigned char *)seg[1], .len = 8 };
+  dir = d_alloc(view, &qname);
+  if (view->d_inode->i_op->mkdir(view->d_inode, dir, dir_mode)) return;
+  qname.name = (unsigned char *)name;
+
+  cinq_dirindex_min = 64;
+  for (i = 0; i < k_num; ++i) {
+    qname.len = sprintf(name, "libcinquain-plugin-%03d.so", i * 7 % k_num);
+    file = d_alloc(dir, &qname);
+    dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL);
+    dput(file);
+    if (i == 32) {
+      early_filp = dentry_open(dir, NULL, 0, NULL);
+      early_filp->f_op->open(NULL, early_filp);
+      early.limit = 16;
+      early_filp->f_op->readdir(early_filp, &early, dirindex_filldir_);
+    }
+  }
+  for (i = 0; i < k_num; i += 2) {
+    qname.len = sprintf(name, "libcinquain-plugin-%03d.so", i);
+    file = d_alloc(dir, &qname);
+    dir->d_inode->i_op->lookup(dir->d_inode, file, NULL);
+    if (file->d_inode) dir->d_inode->i_op->unlink(dir->d_inode, file);
+    dput(file);
+  }
+  cinq_dirindex_min = old_min;
+
+  filp = dentry_open(dir, NULL, 0, NULL);
+  filp->f_op->open(NULL, filp);
+  do {
+    prev = check.count;
+    check.limit = 16;
+    filp->f_op->readdir(filp, &check, dirindex_filldir_);
+  } while (check.count != prev);
+  filp->f_op->release(NULL, filp);
+  put_filp(filp);
+  do {
+    prev = early.count;
+    early.limit = 16;
+    early_filp->f_op->readdir(early_filp, &early, dirindex_filldir_);
+  } while (early.count != prev);
+  early_filp->f_op->release(NULL, early_filp);
+  put_filp(early_filp);
+
+  index = i_cnode(dir->d_inode)->ci_index;
+  ok = index && index->di_count == k_num && check.sorted &&
+      check.count == k_num / 2 && early.count == k_num / 2;
+  strcpy(seg[1], "libcinquain-plugin-123.so");
+  file = do_lookup_(dir, seg + 1, 1);
+  ok = ok && file;
+  strcpy(seg[1], "libcinquain-plugin-124.so");
+  ok = ok && !do_lookup_(dir, seg + 1, 1);
+  fprintf(stdout, "dir index: %d children in %u blocks, %d read in order\t%s\n",
+          k_num, index ? index->di_nblks : 0, check.count, ok ? "OK" : "WRONG");
+}
+
+// Scans by prefix, in pieces, the indexed directory of test_dirindex_()
+// and the small one of test_tier_().
+static void test_scan_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_1", "dirindex", "" };
+  struct dirindex_check_ big = { 0, 0, 1 }, small = { 0, 0, 1 };
+  struct cinq_scan scan;
+  struct dentry *dir;
+
+  dir = do_lookup_(droot, seg, 2);
+  if (!dir) return;
+  cinq_scan_prefix(&scan, "libcinquain-plugin-1");
+  do {
+    big.limit = 7;
+  } while (cinq_scan_dir(dir->d_inode, dir->d_fsdata, &scan, &big,
+                         dirindex_filldir_) > 0);
+
+  strcpy(seg[1], "tier");
+  dir = do_lookup_(droot, seg, 2);
+  if (!dir) return;
+  cinq_scan_range(&scan, "1", "3");
+  do {
+    small.limit = 1;
+  } while (cinq_scan_dir(dir->d_inode, dir->d_fsdata, &scan, &small,
+                         dirindex_filldir_) > 0);
+
+  fprintf(stdout, "scan: %d by prefix and %d by range, in order\t%s\n",
+          big.count, small.count, big.count == 50 && big.sorted &&
+          small.count == 2 && !strcmp(small.last, "2") ? "OK" : "WRONG");
+}
+
+struct diff_check_ {
+  int num[3]; // by kind
+  int wrong;
+};
+
+static int diff_collect_(void *arg, struct cinq_inode *cnode,
+                         struct cinq_tag *tag, enum cinq_diff_kind kind) {
+  static const char *expected[] = { "/diff/new", "/diff/redo", "/diff/gone" };
+  struct diff_check_ *check = arg;
+  char path[MAX_NAME_LEN + 1];
+  if (cnode_path(cnode, path, sizeof(path)) < 0 ||
+      strncmp(path, "/diff", 5)) {
+    return 0; // made by the other tests
+  }
+  if (!strcmp(path, "/diff")) kind = CINQ_DIFF_MODIFIED; // by the view
+  else if (strcmp(path, expected[kind])) check->wrong = 1;
+  ++check->num[kind];
+  return 0;
+}
+
+// Makes a directory in 0_2_0, where its child view 0_2_1 then adds,
+// removes and remakes a file each.
+static void test_diff_(struct dentry *droot) {
+  char seg[2][MAX_NAME_LEN + 1] = { "0_2_0", "diff" };
+  const int dir_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFDIR | S_IRWXU;
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  const char *base_files[] = { "keep", "gone", "redo" };
+  const char *view_files[] = { "new", "redo" };
+  struct diff_check_ check = { { 0, 0, 0 }, 0 };
+  struct dentry *root, *dir, *file;
+  struct inode *idir;
+  struct qstr qname;
+  int i, ret;
+
+  root = do_lookup_(droot, seg, 1);
+  if (!root) return;
+  qname = (struct qstr) { .name = (unsigned char *)seg[1], .len = 4 };
+  dir = d_alloc(root, &qname);
+  if (root->d_inode->i_op->mkdir(root->d_inode, dir, dir_mode)) return;
+  for (i = 0; i < 3; ++i) {
+    qname = (struct qstr) { .name = (unsigned char *)base_files[i],
+                            .len = strlen(base_files[i]) };
+    file = d_alloc(dir, &qname);
+    dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL);
+    dput(file);
+  }
+
+  strcpy(seg[0], "0_2_1");
+  root = do_lookup_(droot, seg, 2);
+  if (!root) return;
+  idir = root->d_inode;
+  for (i = 1; i < 3; ++i) {
+    qname = (struct qstr) { .name = (unsigned char *)base_files[i],
+                            .len = strlen(base_files[i]) };
+    file = d_alloc(root, &qname);
+    idir->i_op->lookup(idir, file, NULL);
+    if (file->d_inode) idir->i_op->unlink(idir, file);
+    dput(file);
+  }
+  for (i = 0; i < 2; ++i) {
+    qname = (struct qstr) { .name = (unsigned char *)view_files[i],
+                            .len = strlen(view_files[i]) };
+    file = d_alloc(root, &qname);
+    idir->i_op->create(idir, file, file_mode, NULL);
+    dput(file);
+  }
+
+  ret = cinq_view_diff(cfs_find_syn(&file_systems, "0_2_1"),
+                       cfs_find_syn(&file_systems, "0_2_0"),
+                       diff_collect_, &check);
+  fprintf(stdout, "diff: %d added, %d modified and %d removed\t%s\n",
+          check.num[CINQ_DIFF_ADDED], check.num[CINQ_DIFF_MODIFIED],
+          check.num[CINQ_DIFF_REMOVED],
+          !ret && !check.wrong && check.num[CINQ_DIFF_ADDED] == 1 &&
+          check.num[CINQ_DIFF_MODIFIED] == 2 &&
+          check.num[CINQ_DIFF_REMOVED] == 1 ? "OK" : "WRONG");
+}
+
+static int diff_count_(void *arg, struct cinq_inode *cnode,
+                       struct cinq_tag *tag, enum cinq_diff_kind kind) {
+  ++((long *)arg)[kind];
+  return 0;
+}
+
+// Passes an export on to the import in pieces of 7 bytes.
+struct export_pipe_ {
+  struct cinq_import im;
+  size_t max; // bytes of a call
+};
+
+static int export_chop_(void *arg, const void *buf, size_t len) {
+  struct export_pipe_ *pipe = arg;
+  const char *p = buf;
+  size_t n;
+  int err = 0;
+  if (len > pipe->max) pipe->max = len;
+  for (; len && !err; p += n, len -= n) {
+    n = len < 7 ? len : 7;
+    err = cinq_import_feed(&pipe->im, p, n);
+  }
+  return err;
+}
+
+// Copies 0_2_1 as 0_2_9 under the same parent, which should then differ
+// from the parent in the same way.
+static void test_export_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_9", "diff", "new" };
+  struct cinq_fsnode *base = cfs_find_syn(&file_systems, "0_2_0");
+  long before[3] = { 0, 0, 0 }, after[3] = { 0, 0, 0 };
+  struct export_pipe_ pipe = { .max = 0 };
+  int err;
+
+  cinq_import_init(&pipe.im, droot, "0_2_0", "0_2_9");
+  err = cinq_export(cfs_find_syn(&file_systems, "0_2_1"), export_chop_, &pipe);
+  err = cinq_import_fini(&pipe.im) ?: err;
+  if (!err) {
+    cinq_view_diff(cfs_find_syn(&file_systems, "0_2_1"), base,
+                   diff_count_, before);
+    cinq_view_diff(pipe.im.im_fs, base, diff_count_, after);
+  }
+  fprintf(stdout, "export: %ld tags in records of %lu bytes at most\t%s\n",
+          pipe.im.im_recs, (unsigned long)pipe.max,
+          !err && !memcmp(before, after, sizeof(before)) && before[0] &&
+          do_lookup_(droot, seg, 3) ? "OK" : "WRONG");
+}
+
+// Snapshots 0_2_1 as 0_2_1s and makes a file through a dentry got
+// before, which should land in the live view only.
+static void test_snapshot_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_1", "diff", "snap" };
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  struct cinq_fsnode *fs = cfs_find_syn(&file_systems, "0_2_1");
+  struct cinq_fsnode *snap, *live;
+  long added[3] = { 0, 0, 0 };
+  struct dentry *dir, *file;
+  struct qstr qname = { .name = (unsigned char *)seg[2], .len = 4 };
+  int ok, err;
+
+  dir = do_lookup_(droot, seg, 2);
+  if (!fs || !dir) return;
+  snap = fsnode_snapshot(fs, "0_2_1s");
+  if (IS_ERR(snap)) {
+    fprintf(stdout, "snapshot: %ld\tWRONG\n", PTR_ERR(snap));
+    return;
+  }
+  live = cfs_find_syn(&file_systems, "0_2_1");
+  file = d_alloc(dir, &qname);
+  err = dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL);
+  dput(file);
+  ok = !err && live == fs->fs_live && do_lookup_(droot, seg, 3);
+  cinq_view_diff(live, fs, diff_count_, added);
+
+  strcpy(seg[0], "0_2_1s");
+  ok = ok && !do_lookup_(droot, seg, 3);
+  strcpy(seg[2], "new");
+  ok = ok && do_lookup_(droot, seg, 3);
+  dir = do_lookup_(droot, seg, 2);
+  if (dir) {
+    file = d_alloc(dir, &qname);
+    err = dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL);
+    dput(file);
+  }
+  fprintf(stdout, "snapshot: %ld added since\t%s\n", added[CINQ_DIFF_ADDED],
+          ok && err == -EROFS && added[CINQ_DIFF_ADDED] == 1 ? "OK" : "WRONG");
+}
+
+// Writes a file in 0_2_1 and snapshots the view as 0_2_1t. The file is
+// then written through a handle got before, and truncated and chmod-ed
+// through a new lookup, none of which the snapshot should see.
+static void test_snapshot_copy_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_1", "diff", "frozen" };
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  const char data[] = "point in time";
+  struct iattr attr = { .ia_valid = ATTR_MODE | ATTR_SIZE,
+                        .ia_mode = S_IFREG | S_IRUSR, .ia_size = 5 };
+  struct qstr qname = { .name = (unsigned char *)seg[2], .len = 6 };
+  struct dentry *dir, *file, *live, *frozen;
+  struct cinq_fsnode *snap;
+  struct file *filp, *snap_filp;
+  char back[sizeof(data)];
+  loff_t pos = 0;
+  int ok;
+
+  dir = do_lookup_(droot, seg, 2);
+  if (!dir) return;
+  file = d_alloc(dir, &qname);
+  if (dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL)) return;
+  filp = dentry_open(file, NULL, 0, NULL);
+  filp->f_op->write(filp, data, sizeof(data) - 1, &pos);
+  snap = fsnode_snapshot(cfs_find_syn(&file_systems, "0_2_1"), "0_2_1t");
+  if (IS_ERR(snap)) {
+    fprintf(stdout, "snapshot copy-up: %ld\tWRONG\n", PTR_ERR(snap));
+    put_filp(filp);
+    return;
+  }
+
+  pos = 0;
+  ok = filp->f_op->write(filp, "POINT", 5, &pos) == 5;
+  pos = 0; // the rest is still read from the frozen origin
+  ok = ok && filp->f_op->read(filp, back, sizeof(back), &pos) ==
+      sizeof(data) - 1 && !memcmp(back, "POINT in time", sizeof(data) - 1);
+  live = do_lookup_(droot, seg, 3);
+  ok = ok && live && !live->d_inode->i_op->setattr(live, &attr) &&
+      live->d_inode->i_size == 5 && !(live->d_inode->i_mode & S_IWUSR);
+  pos = 0;
+  ok = ok && filp->f_op->read(filp, back, sizeof(back), &pos) == 5 &&
+      !memcmp(back, "POINT", 5);
+  put_filp(filp);
+
+  strcpy(seg[0], "0_2_1t");
+  frozen = do_lookup_(droot, seg, 3);
+  ok = ok && frozen && frozen->d_inode->i_size == sizeof(data) - 1 &&
+      (frozen->d_inode->i_mode & S_IRWXU) == S_IRWXU &&
+      frozen->d_inode->i_op->setattr(frozen, &attr) == -EROFS;
+  if (frozen) {
+    snap_filp = dentry_open(frozen, NULL, 0, NULL);
+    pos = 0;
+    ok = ok && snap_filp->f_op->write(snap_filp, "x", 1, &pos) == -EROFS;
+    ok = ok && snap_filp->f_op->read(snap_filp, back, sizeof(back), &pos) ==
+        sizeof(data) - 1 && !memcmp(back, data, sizeof(data) - 1);
+    put_filp(snap_filp);
+  }
+  fprintf(stdout, "snapshot copy-up: unchanged after a write, truncate "
+          "and chmod\t%s\n", ok ? "OK" : "WRONG");
+}
+
+static int count_children_(struct dentry *dir) {
+  struct cinq_inode *cnode = i_cnode(dir->d_inode), *child;
+  int num = 0;
+  children_read_lock(cnode);
+  for (child = cnode_next_child(cnode, NULL); child;
+       child = cnode_next_child(cnode, child)) {
+    ++num;
+  }
+  read_unlock(&cnode->ci_children_lock);
+  return num;
+}
+
+// Makes and removes files in 0_2_0, which no view above has, so their
+// whiteouts and cnodes go, while the one of 0_2_1 on a file of 0_2_0
+// stays.
+static void test_compact_(struct dentry *droot) {
+  char seg[3][MAX_NAME_LEN + 1] = { "0_2_0", "diff", "gone" };
+  const int file_mode = (CINQ_VISIBLE << CINQ_MODE_SHIFT) | S_IFREG | S_IRWXU;
+  const int num = 8;
+  char name[MAX_NAME_LEN + 1];
+  struct dentry *dir, *file;
+  struct qstr qname;
+  int before, i, ok;
+  long taken;
+
+  dir = do_lookup_(droot, seg, 2);
+  if (!dir) return;
+  before = count_children_(dir);
+  for (i = 0; i < num; ++i) {
+    sprintf(name, "tmp%d", i);
+    qname = (struct qstr) { .name = (unsigned char *)name,
+                            .len = strlen(name) };
+    file = d_alloc(dir, &qname);
+    dir->d_inode->i_op->create(dir->d_inode, file, file_mode, NULL);
+    dir->d_inode->i_op->unlink(dir->d_inode, file);
+    dput(file);
+  }
+  ok = count_children_(dir) == before + num;
+  taken = cinq_compact();
+  // Freed by the pass itself, after a grace period
+  ok = ok && taken >= num && !cnode_reap_flush() &&
+      count_children_(dir) == before &&
+      do_lookup_(droot, seg, 3);
+  strcpy(seg[0], "0_2_1");
+  ok = ok && !do_lookup_(droot, seg, 3);
+  strcpy(seg[0], "0_2_1s");
+  ok = ok && !do_lookup_(droot, seg, 3);
+  fprintf(stdout, "compact: %ld whiteouts taken off\t%s\n", taken,
+          ok ? "OK" : "WRONG");
+}
+
+static struct cinq_idtable test_ids_;
+
+// Reuses a freed ID under a new generation, then reloads the table and
+// restores a recorded ID, whose old handle must resolve again.
+static void test_idtable_(void) {
+  int objs[3];
+  __u32 id[3], gen[3];
+  int ok;
+
+  idtable_init(&test_ids_, 7);
+  id[0] = idtable_alloc(&test_ids_, &objs[0]);
+  id[1] = idtable_alloc(&test_ids_, &objs[1]);
+  gen[0] = idtable_gen(&test_ids_, id[0]);
+  gen[1] = idtable_gen(&test_ids_, id[1]);
+  idtable_free(&test_ids_, id[0]);
+  id[2] = idtable_alloc(&test_ids_, &objs[2]);
+  gen[2] = idtable_gen(&test_ids_, id[2]);
+  ok = id[2] == id[0] && gen[2] != gen[0] &&
+      !idtable_find(&test_ids_, id[0], gen[0]) &&
+      idtable_find(&test_ids_, id[2], gen[2]) == &objs[2];
+
+  idtable_destroy(&test_ids_);
+  idtable_init(&test_ids_, 8);
+  ok = ok && !idtable_restore(&test_ids_, id[1], gen[1], &objs[1]) &&
+      idtable_find(&test_ids_, id[1], gen[1]) == &objs[1] &&
+      idtable_restore(&test_ids_, id[1], gen[1], &objs[0]) == -EEXIST &&
+      idtable_alloc(&test_ids_, &objs[0]) != id[1];
+  idtable_destroy(&test_ids_);
+  fprintf(stdout, "idtable: reuse and restore\t%s\n", ok ? "OK" : "WRONG");
+}
+
+#define EXEC_WORKS_ 64
+
+struct exec_test_ {
+  struct cinq_work work;
+  struct exec_test_ *child; // submitted when this one runs
+  atomic_t runs;
+};
+
+static void exec_test_fn_(struct cinq_work *work) {
+  struct exec_test_ *t = container_of(work, struct exec_test_, work);
+  atomic_inc(&t->runs);
+  if (t->child) cinq_exec_submit(&t->child->work);
+}
+
+static void test_exec_(void) {
+  struct exec_test_ tests[2 * EXEC_WORKS_], late;
+  int i, ok;
+
+  for (i = 0; i < 2 * EXEC_WORKS_; ++i) {
+    cinq_work_init(&tests[i].work, exec_test_fn_, i % CINQ_NUM_PRIOS);
+    tests[i].child = i < EXEC_WORKS_ ? &tests[EXEC_WORKS_ + i] : NULL;
+    atomic_set(&tests[i].runs, 0);
+  }
+  cinq_work_init(&late.work, exec_test_fn_, CINQ_PRIO_LOW);
+  late.child = NULL;
+  atomic_set(&late.runs, 0);
+  ok = cinq_exec_later(&late.work, 60) && !cinq_exec_later(&late.work, 1) &&
+      !cinq_exec_submit(&late.work);
+
+  for (i = 0; i < EXEC_WORKS_; ++i) {
+    cinq_exec_submit(&tests[i].work);
+  }
+  cinq_exec_flush(); // the children as well
+  for (i = 0; i < 2 * EXEC_WORKS_; ++i) {
+    ok = ok && atomic_read(&tests[i].runs) == 1;
+  }
+  cinq_exec_cancel(&late.work);
+  ok = ok && !atomic_read(&late.runs) &&
+      atomic_read(&late.work.w_state) == CINQ_WORK_IDLE;
+  fprintf(stdout, "exec: %d works on %d workers\t%s\n", 2 * EXEC_WORKS_,
+          cinq_exec_workers(), ok ? "OK" : "WRONG");
+}
+
+// Every value falls within the bounds of its bucket.
+static void test_stats_(void) {
+  u64 ns, prev = 0;
+  int b, ok = 1;
+  for (b = 0; b < CINQ_HIST_BUCKETS && ok; ++b) {
+    ns = cinq_hist_bound(b);
+    ok = cinq_hist_bucket(ns) == b &&
+        (!b || (ns > prev && cinq_hist_bucket(prev + 1) == b));
+    prev = ns;
+  }
+  ok = ok && cinq_hist_bucket(~0ULL) == CINQ_HIST_BUCKETS - 1;
+#ifdef CINQ_STATS
+  struct cinq_stat_summary sum;
+  cinq_stats_read(CINQ_STAT_LOOKUP, &sum);
+  ok = ok && sum.count && sum.p50_ns <= sum.p99_ns &&
+      sum.p99_ns <= sum.p999_ns;
+  fprintf(stdout, "\n");
+  cinq_stats_dump(stdout);
+#endif
+  fprintf(stdout, "stats: %d histogram buckets\t%s\n", CINQ_HIST_BUCKETS,
+          ok ? "OK" : "WRONG");
+#ifdef CINQ_LOCK_PROF
+  fprintf(stdout, "\n");
+  int sites = lockprof_dump(stdout, 10);
+  fprintf(stdout, "lock profile: %d sites\t%s\n", sites,
+          sites > 0 ? "OK" : "WRONG");
+#endif
+}
+
+// Saves the trace and reads it back as the decoder does.
+static void test_trace_(void) {
+  struct cinq_trace_header header;
+  struct cinq_trace_rec rec;
+  long n, read = 0, ops[CINQ_TRACE_NUM_OPS] = { 0 };
+  int ok;
+  FILE *file = tmpfile();
+  if (!file) return;
+
+  n = cinq_trace_save(file);
+  rewind(file);
+  ok = fread(&header, sizeof(header), 1, file) == 1 &&
+      header.th_magic == CINQ_TRACE_MAGIC &&
+      header.th_rec_size == sizeof(struct cinq_trace_rec);
+  while (ok && fread(&rec, sizeof(rec), 1, file) == 1) {
+    ok = rec.tr_op < CINQ_TRACE_NUM_OPS;
+    if (ok) ++ops[rec.tr_op];
+    ++read;
+  }
+  fclose(file);
+  ok = ok && read == n && ops[CINQ_STAT_MKDIR] && ops[CINQ_STAT_LOOKUP] &&
+      ops[CINQ_STAT_WRITE];
+  fprintf(stdout, "trace: %ld events\t%s\n", n, ok ? "OK" : "WRONG");
 }
 
 int main(int argc, const char * argv[]) {
@@ -720,12 +1764,29 @@ int main(int argc, const char * argv[]) {
   fprintf(stdout, "\nTest readdir:\n");
   test_readdir(meta_dent);
 
+  test_fh(meta_dent);
+
 #ifdef CINQ_DEBUG
   int max_dentry_num = atomic_read(&num_dentry_);
   int max_inode_num = atomic_read(&num_inode_);
 #endif
 
   test_rw(meta_dent);
+#ifdef CINQ_DEDUP
+  test_dedup(meta_dent);
+#endif
+  test_tier_(meta_dent);
+  test_dirindex_(meta_dent);
+  test_scan_(meta_dent);
+  test_diff_(meta_dent);
+  test_export_(meta_dent);
+  test_snapshot_(meta_dent);
+  test_snapshot_copy_(meta_dent);
+  test_compact_(meta_dent);
+  test_idtable_();
+  test_exec_();
+  test_stats_();
+  test_trace_();
   
   // Kill file systems
   cinqfs.kill_sb(meta_dent->d_sb);
@@ -754,6 +1815,11 @@ int main(int argc, const char * argv[]) {
           atomic_read(&num_sym_ok) < atomic_read(&num_sym_test) ?
           "NOT Passed" : "Passed");
   
+  fprintf(stdout, "fh: %d/%d checked ok [%s].\n",
+          atomic_read(&num_fh_ok), atomic_read(&num_fh_test),
+          atomic_read(&num_fh_ok) < atomic_read(&num_fh_test) ?
+          "NOT Passed" : "Passed");
+  
   fprintf(stdout, "readdir also needs manual check of log [%s].\n",
           atomic_read(&readdir_is_ok) ?
           "Passed" : "NOT Passed");
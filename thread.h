@@ -99,15 +99,75 @@ static inline void thread_run(struct thread_task *thr_task) {
             " %d.\n", err);
 }
 
+// The thread is not cancelled but waited for, so it should have been
+// told to return by then.
 static inline int thread_stop(struct thread_task *thr_task) {
-  int err = pthread_cancel(*thr_task->thread);
+  int err = pthread_join(*thr_task->thread, NULL);
   free(thr_task->thread);
   return err;
 }
 
 #endif // __KERNEL__
 
-// super.c
-extern THREAD_FUNC_(journal_writeback)(void *data);
+/* Executor of background work (exec.c). A worker runs per online CPU,
+ * up to CINQ_EXEC_MAX_WORKERS, each with a deque per priority. A worker
+ * takes its own newest work first and steals the oldest of others when
+ * it runs out, higher priorities before lower ones. */
+
+#define CINQ_EXEC_MAX_WORKERS 16
+
+enum cinq_prio {
+  CINQ_PRIO_HIGH = 0, // in the way of a client, e.g., readahead
+  CINQ_PRIO_NORMAL,
+  CINQ_PRIO_LOW, // housekeeping and teardown
+  CINQ_NUM_PRIOS
+};
+
+enum cinq_work_state {
+  CINQ_WORK_IDLE = 0, // or running
+  CINQ_WORK_QUEUED,
+  CINQ_WORK_DELAYED
+};
+
+struct cinq_work;
+typedef void (*cinq_work_fn)(struct cinq_work *work);
+
+// Embedded in what it works on, which @w_fn gets by container_of().
+// It is idle again once @w_fn is called, so it may free or resubmit it.
+struct cinq_work {
+  cinq_work_fn w_fn;
+  enum cinq_prio w_prio;
+  atomic_t w_state;
+  unsigned long w_due; // in seconds, if delayed
+  struct list_head w_list; // in a deque or the delayed list
+};
+
+static inline void cinq_work_init(struct cinq_work *work, cinq_work_fn fn,
+                                  enum cinq_prio prio) {
+  work->w_fn = fn;
+  work->w_prio = prio;
+  atomic_set(&work->w_state, CINQ_WORK_IDLE);
+  work->w_due = 0;
+  INIT_LIST_HEAD(&work->w_list);
+}
+
+extern void cinq_exec_init(void);
+extern void cinq_exec_fini(void);
+extern int cinq_exec_workers(void);
+extern int cinq_exec_submit(struct cinq_work *work);
+extern int cinq_exec_later(struct cinq_work *work, unsigned int secs);
+extern void cinq_exec_cancel(struct cinq_work *work);
+extern void cinq_exec_flush(void);
+
+/* Grace periods (grace.c), SRCU in the kernel. Cnodes and tags taken off
+ * the tree are freed only after a grace period, so that a walk that found
+ * them unpinned is done with them. Such walks run between enter and exit
+ * and may sleep, but must not wait for a grace period themselves. */
+
+extern int cinq_grace_init(void);
+extern void cinq_grace_fini(void);
+extern int cinq_grace_enter(void); // returns what to pass to exit
+extern void cinq_grace_exit(int idx);
+extern void cinq_grace_wait(void);
 
 #endif // CINQUAIN_META_THREAD_H_
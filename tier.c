@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  tier.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "cinq_meta.h"
+#include "thread.h"
+
+/* Tiering of cold metadata. Lookups stamp cnodes with the time in
+ * seconds, and a sweep moves each largest subtree that has not been
+ * used for the idle period, and is pinned by no inode or open dir, into
+ * a segment of the tier file. The root of the subtree stays in core as a
+ * stub, under which any lookup, readdir, create or file handle faults the
+ * subtree back in. Spills and faults are serialized by the tier mutex,
+ * which is taken only on those slow paths. Segments are appended and
+ * the space of faulted ones is not reused until the next mount. */
+
+int cinq_tier_on;
+
+static struct cinq_inode *tier_root_;
+static u32 tier_start_; // cnodes count as used then at least
+static unsigned int tier_idle_;
+static loff_t tier_end_; // of the file
+static loff_t tier_dead_; // bytes of faulted segments
+static struct thread_task sweep_thread_;
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+static char *tier_file;
+module_param(tier_file, charp, 0444);
+MODULE_PARM_DESC(tier_file, "File to spill cold metadata to, off if unset");
+
+static unsigned int tier_idle = 600;
+module_param(tier_idle, uint, 0444);
+MODULE_PARM_DESC(tier_idle, "Seconds unused before a subtree is spilled");
+
+static DEFINE_MUTEX(tier_mutex_);
+static DEFINE_MUTEX(sweep_mutex_);
+static struct file *tier_filp_;
+
+#define sweep_should_stop_() kthread_should_stop()
+
+static int tier_open_(const char *path) {
+  tier_filp_ = filp_open(path, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE,
+                         0600);
+  if (IS_ERR(tier_filp_)) {
+    int err = PTR_ERR(tier_filp_);
+    tier_filp_ = NULL;
+    return err;
+  }
+  return 0;
+}
+
+static void tier_close_(void) {
+  filp_close(tier_filp_, NULL);
+  tier_filp_ = NULL;
+}
+
+static int tier_write_(const void *buf, u32 len, loff_t pos) {
+  mm_segment_t old_fs = get_fs();
+  ssize_t ret;
+  set_fs(KERNEL_DS);
+  ret = vfs_write(tier_filp_, (const char __user *)buf, len, &pos);
+  set_fs(old_fs);
+  return ret == len ? 0 : -EIO;
+}
+
+static int tier_read_(void *buf, u32 len, loff_t pos) {
+  return kernel_read(tier_filp_, pos, buf, len) == len ? 0 : -EIO;
+}
+
+#else
+
+#include <fcntl.h>
+
+static mutex_t tier_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static mutex_t sweep_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static int tier_fd_ = -1;
+static int sweep_stop_;
+
+#define sweep_should_stop_() sweep_stop_
+
+static int tier_open_(const char *path) {
+  tier_fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  return tier_fd_ < 0 ? -EIO : 0;
+}
+
+static void tier_close_(void) {
+  close(tier_fd_);
+  tier_fd_ = -1;
+}
+
+static int tier_write_(const void *buf, u32 len, loff_t pos) {
+  return pwrite(tier_fd_, buf, len, pos) == len ? 0 : -EIO;
+}
+
+static int tier_read_(void *buf, u32 len, loff_t pos) {
+  return pread(tier_fd_, buf, len, pos) == len ? 0 : -EIO;
+}
+
+#endif // __KERNEL__
+
+int cinq_tier_store(const void *buf, u32 len, loff_t *pos) {
+  int err = tier_write_(buf, len, tier_end_);
+  if (unlikely(err)) return err;
+  *pos = tier_end_;
+  tier_end_ += len;
+  return 0;
+}
+
+int cinq_tier_load(void *buf, u32 len, loff_t pos) {
+  return tier_read_(buf, len, pos);
+}
+
+void cinq_tier_release(loff_t pos, u32 len) {
+  tier_dead_ += len;
+}
+
+int cinq_tier_fault(struct cinq_inode *cnode) {
+  int err;
+  mutex_lock(&tier_mutex_);
+  err = cnode_fault(cnode);
+  mutex_unlock(&tier_mutex_);
+  DEBUG_ON_(err, "[Error@cinq_tier_fault] %d on the subtree of %s.\n",
+            err, cnode->ci_name);
+  return err;
+}
+
+void cinq_tier_pause(void) {
+  mutex_lock(&sweep_mutex_);
+}
+
+void cinq_tier_resume(void) {
+  mutex_unlock(&sweep_mutex_);
+}
+
+int cinq_tier_fault_all(void) {
+  struct cinq_inode *stub;
+  int err = 0;
+  do {
+    mutex_lock(&tier_mutex_);
+    stub = cnode_any_stub();
+    if (stub) err = cnode_fault(stub);
+    mutex_unlock(&tier_mutex_);
+  } while (stub && !err);
+  return err;
+}
+
+// Returns the number of descendants of @cnode if all of them are cold,
+// or -1, gathering into @found the cnodes whose descendants are all cold
+// but whose parents' are not.
+static long sweep_walk_(struct cinq_inode *cnode, u32 cutoff,
+                        struct cinq_inode **found, int *num_found) {
+  struct cinq_inode *child;
+  const int mark = *num_found;
+  long n, total = 0;
+
+  children_read_lock(cnode);
+  for (child = cnode_next_child(cnode, NULL); child;
+       child = cnode_next_child(cnode, child)) {
+    n = sweep_walk_(child, cutoff, found, num_found);
+    if (n >= CINQ_TIER_MIN_CNODES && *num_found < CINQ_TIER_BATCH) {
+      found[(*num_found)++] = child;
+    }
+    if (total >= 0) {
+      total = n >= 0 && cnode_cold(child, cutoff) ? total + n + 1 : -1;
+    }
+  }
+  read_unlock(&cnode->ci_children_lock);
+
+  if (total >= 0) *num_found = mark; // to be spilled along with this one
+  return total;
+}
+
+long cinq_tier_sweep(unsigned int idle_secs) {
+  struct cinq_inode *found[CINQ_TIER_BATCH];
+  u32 cutoff = get_seconds() - idle_secs;
+  int num_found = 0, i;
+  long n, total = 0;
+
+  if (!cinq_tier_on) return 0;
+  mutex_lock(&sweep_mutex_);
+
+  if (tier_start_ <= cutoff &&
+      sweep_walk_(tier_root_, cutoff, found, &num_found) >=
+          CINQ_TIER_MIN_CNODES) {
+    found[num_found++] = tier_root_;
+  }
+  for (i = 0; i < num_found; ++i) {
+    mutex_lock(&tier_mutex_);
+    n = cnode_spill(found[i], cutoff);
+    mutex_unlock(&tier_mutex_);
+    if (n > 0) total += n;
+  }
+  // Only sweeps spill, so the limbo holds no more than what has waited
+  // for the grace period. Lookups fault subtrees in under the tier mutex,
+  // so the wait must not hold it.
+  if (total) {
+    cinq_grace_wait();
+    mutex_lock(&tier_mutex_);
+    cnode_limbo_flush();
+    mutex_unlock(&tier_mutex_);
+  }
+  mutex_unlock(&sweep_mutex_);
+  DEBUG_ON_(total, "cinq_tier_sweep: spilled %ld cnodes in %d subtrees, "
+            "%lld bytes in file, %lld dead.\n", total, num_found,
+            (long long)tier_end_, (long long)tier_dead_);
+  return total;
+}
+
+static THREAD_FUNC_(sweep_worker_)(void *data) {
+  unsigned int ticks = 0;
+  while (!sweep_should_stop_()) {
+    sleep(1);
+    if (++ticks < tier_idle_ / 2 + 1) continue;
+    cinq_tier_sweep(tier_idle_);
+    ticks = 0;
+  }
+  THREAD_RETURN_;
+}
+
+void cinq_tier_init(struct cinq_inode *root) {
+  tier_root_ = root;
+#ifdef __KERNEL__
+  if (tier_file && cinq_tier_start(tier_file, tier_idle)) {
+    printk(KERN_ERR "cinqfs: failed to open tier file %s.\n", tier_file);
+  }
+#endif
+}
+
+int cinq_tier_start(const char *path, unsigned int idle_secs) {
+  int err = tier_open_(path);
+  if (unlikely(err)) return err;
+  tier_end_ = tier_dead_ = 0;
+  tier_start_ = get_seconds();
+  tier_idle_ = idle_secs;
+  cinq_tier_on = 1;
+  if (idle_secs) {
+#ifndef __KERNEL__
+    sweep_stop_ = 0;
+#endif
+    thread_init(&sweep_thread_, sweep_worker_, NULL, "cinquain-tier");
+    thread_run(&sweep_thread_);
+  }
+  return 0;
+}
+
+// Spilled subtrees are left to be freed with their stubs.
+void cinq_tier_fini(void) {
+  if (!cinq_tier_on) return;
+  if (tier_idle_) {
+#ifdef __KERNEL__
+    thread_stop(&sweep_thread_);
+#else
+    sweep_stop_ = 1;
+    pthread_join(*sweep_thread_.thread, NULL);
+    free(sweep_thread_.thread);
+#endif
+  }
+  cinq_tier_on = 0;
+  cinq_grace_wait();
+  mutex_lock(&tier_mutex_);
+  cnode_limbo_flush();
+  tier_close_();
+  mutex_unlock(&tier_mutex_);
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  trace.c
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE (1 << CINQ_TRACE_RING_BITS)
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+// Written by its owner only. A reader tells the records it copied intact
+// by the head read after the copy, as one slot is reused per new record.
+struct trace_ring_ {
+  u64 head; // number of records ever added
+  u16 thread;
+  struct trace_ring_ *next; // in trace_rings_
+  struct trace_ring_ *free_next; // in the free list, once the owner exited
+  struct cinq_trace_rec recs[TRACE_RING_SIZE];
+};
+
+int cinq_trace_on = 1;
+
+static struct trace_ring_ *trace_rings_;
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#define trace_wmb_() smp_wmb()
+#define trace_rmb_() smp_rmb()
+#define trace_write_(out, buf, len) \
+    seq_write((struct seq_file *)(out), buf, len)
+
+#define ring_malloc_() ((struct trace_ring_ *)vzalloc(sizeof(struct trace_ring_)))
+#define ring_free_(p) (vfree(p))
+#define recs_malloc_() ((struct cinq_trace_rec *)vmalloc( \
+    TRACE_RING_SIZE * sizeof(struct cinq_trace_rec)))
+#define recs_free_(p) (vfree(p))
+
+// Ops sleep, so preemption is off only while an event is stored.
+static DEFINE_PER_CPU(struct trace_ring_ *, trace_ring_);
+#define ring_get_() get_cpu_var(trace_ring_)
+#define ring_put_() put_cpu_var(trace_ring_)
+
+#else
+
+#define trace_wmb_() __sync_synchronize()
+#define trace_rmb_() __sync_synchronize()
+#define trace_write_(out, buf, len) fwrite(buf, len, 1, (FILE *)(out))
+
+#define ring_malloc_() \
+    ((struct trace_ring_ *)calloc(1, sizeof(struct trace_ring_)))
+#define ring_free_(p) (free(p))
+#define recs_malloc_() ((struct cinq_trace_rec *)malloc( \
+    TRACE_RING_SIZE * sizeof(struct cinq_trace_rec)))
+#define recs_free_(p) (free(p))
+
+static __thread struct trace_ring_ *trace_ring_;
+static atomic_t trace_num_threads_;
+
+// Rings of exited threads, which new threads take over before allocating.
+static struct trace_ring_ *trace_free_rings_;
+static spinlock_t trace_free_lock_ = SPIN_LOCK_UNLOCKED;
+static pthread_key_t trace_key_;
+static pthread_once_t trace_key_once_ = PTHREAD_ONCE_INIT;
+
+// Called on thread exit with the ring of the thread.
+static void ring_release_(void *data) {
+  struct trace_ring_ *ring = (struct trace_ring_ *)data;
+  spin_lock(&trace_free_lock_);
+  ring->free_next = trace_free_rings_;
+  trace_free_rings_ = ring;
+  spin_unlock(&trace_free_lock_);
+}
+
+static void trace_key_init_(void) {
+  pthread_key_create(&trace_key_, ring_release_);
+}
+
+// Rings outlive their threads, so events before an exit stay readable
+// until a later thread takes the ring over and overwrites them. Hence
+// there are no more rings than threads alive at once.
+static inline struct trace_ring_ *ring_get_(void) {
+  struct trace_ring_ *ring = trace_ring_;
+  if (likely(ring)) return ring;
+
+  pthread_once(&trace_key_once_, trace_key_init_);
+  spin_lock(&trace_free_lock_);
+  ring = trace_free_rings_;
+  if (ring) trace_free_rings_ = ring->free_next;
+  spin_unlock(&trace_free_lock_);
+
+  if (!ring) {
+    ring = ring_malloc_();
+    if (unlikely(!ring)) return NULL;
+    do {
+      ring->next = trace_rings_;
+    } while (__sync_val_compare_and_swap(&trace_rings_, ring->next, ring) !=
+             ring->next);
+  }
+  ring->thread = (u16)atomic_inc_return(&trace_num_threads_);
+  pthread_setspecific(trace_key_, ring);
+  return trace_ring_ = ring;
+}
+
+#define ring_put_()
+
+#endif // __KERNEL__
+
+void cinq_trace(enum cinq_stat_id op, u64 start, unsigned long cnode,
+                unsigned long fs, long result) {
+  const u64 ns = cinq_stat_clock() - start;
+  struct trace_ring_ *ring = ring_get_();
+  struct cinq_trace_rec *rec;
+  u64 head;
+
+  if (likely(ring)) {
+    head = ring->head;
+    rec = &ring->recs[head & TRACE_RING_MASK];
+    rec->tr_time = start;
+    rec->tr_cnode = cnode;
+    rec->tr_fs = (u32)fs;
+    rec->tr_latency = ns > 0xffffffffULL ? 0xffffffffU : (u32)ns;
+    rec->tr_result = result < -MAX_ERRNO ? -MAX_ERRNO :
+        (result > 0x7fffffffL ? 0x7fffffff : (s32)result);
+    rec->tr_op = op;
+    rec->tr_thread = ring->thread;
+    trace_wmb_(); // the record is complete before it is counted
+    ring->head = head + 1;
+  }
+  ring_put_();
+}
+
+// Copies the records of @ring into @buf, returning how many of them,
+// from @buf + *@first on, were not overwritten during the copy.
+static long ring_copy_(struct trace_ring_ *ring, struct cinq_trace_rec *buf,
+                       long *first) {
+  const u64 end = *(volatile u64 *)&ring->head;
+  const u64 begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+  u64 i, head;
+
+  trace_rmb_();
+  for (i = begin; i < end; ++i) {
+    buf[i - begin] = ring->recs[i & TRACE_RING_MASK];
+  }
+  trace_rmb_();
+  // Record @head may be half written in the slot of head - SIZE.
+  head = *(volatile u64 *)&ring->head;
+  i = head + 1 > begin + TRACE_RING_SIZE ?
+      head + 1 - TRACE_RING_SIZE : begin;
+  if (i >= end) return *first = 0;
+  *first = (long)(i - begin);
+  return (long)(end - i);
+}
+
+long cinq_trace_save(void *out) {
+  struct cinq_trace_header header = {
+    .th_magic = CINQ_TRACE_MAGIC,
+    .th_version = CINQ_TRACE_VERSION,
+    .th_rec_size = sizeof(struct cinq_trace_rec),
+  };
+  struct cinq_trace_rec *buf = recs_malloc_();
+  struct trace_ring_ *ring;
+  long n = 0, len, first;
+
+  if (unlikely(!buf)) return -ENOMEM;
+  trace_write_(out, &header, sizeof(header));
+  for (ring = trace_rings_; ring; ring = ring->next) {
+    len = ring_copy_(ring, buf, &first);
+    if (!len) continue;
+    trace_write_(out, buf + first, len * sizeof(struct cinq_trace_rec));
+    n += len;
+  }
+  recs_free_(buf);
+  return n;
+}
+
+void cinq_trace_reset(void) {
+  struct trace_ring_ *ring;
+  for (ring = trace_rings_; ring; ring = ring->next) {
+    ring->head = 0;
+  }
+}
+
+#ifdef __KERNEL__
+
+#define TRACE_CHUNK_RECS 64 // records per seq_file element
+#define TRACE_RING_CHUNKS (TRACE_RING_SIZE / TRACE_CHUNK_RECS)
+
+// Walks the rings in chunks of records, so that seq_file never needs a
+// buffer larger than a chunk. A ring is copied when its first chunk is
+// reached and served from the copy until the next ring.
+struct trace_iter_ {
+  long ring_idx; // of the ring copied in recs, or -1
+  long chunk; // current one of the ring
+  long first, len; // intact records in recs
+  struct cinq_trace_rec *recs;
+};
+
+// Positions @it at element *@pos - 1, skipping the chunks that hold no
+// records and moving *@pos past them. Returns NULL after the last ring.
+static void *trace_iter_at_(struct trace_iter_ *it, loff_t *pos) {
+  struct trace_ring_ *ring;
+  long idx, i;
+
+  for (;;) {
+    idx = (long)(*pos - 1) / TRACE_RING_CHUNKS;
+    for (ring = trace_rings_, i = 0; ring && i < idx; ring = ring->next, ++i);
+    if (!ring) return NULL;
+    if (idx != it->ring_idx) {
+      it->len = ring_copy_(ring, it->recs, &it->first);
+      it->ring_idx = idx;
+    }
+    it->chunk = (long)(*pos - 1) % TRACE_RING_CHUNKS;
+    if (it->chunk * TRACE_CHUNK_RECS < it->len) return it;
+    *pos = (idx + 1) * TRACE_RING_CHUNKS + 1; // on to the next ring
+  }
+}
+
+static void *trace_seq_start_(struct seq_file *m, loff_t *pos) {
+  struct trace_iter_ *it = m->private;
+  if (!*pos) {
+    it->ring_idx = -1; // copies afresh when read again from the start
+    return SEQ_START_TOKEN;
+  }
+  return trace_iter_at_(it, pos);
+}
+
+static void *trace_seq_next_(struct seq_file *m, void *v, loff_t *pos) {
+  ++*pos;
+  return trace_iter_at_(m->private, pos);
+}
+
+static void trace_seq_stop_(struct seq_file *m, void *v) {
+}
+
+static int trace_seq_show_(struct seq_file *m, void *v) {
+  struct cinq_trace_header header = {
+    .th_magic = CINQ_TRACE_MAGIC,
+    .th_version = CINQ_TRACE_VERSION,
+    .th_rec_size = sizeof(struct cinq_trace_rec),
+  };
+  struct trace_iter_ *it = v;
+  long off, n;
+
+  // An element that does not fit is shown again in a larger buffer.
+  if (v == SEQ_START_TOKEN) {
+    seq_write(m, &header, sizeof(header));
+    return 0;
+  }
+  off = it->chunk * TRACE_CHUNK_RECS;
+  n = it->len - off < TRACE_CHUNK_RECS ? it->len - off : TRACE_CHUNK_RECS;
+  seq_write(m, it->recs + it->first + off, n * sizeof(struct cinq_trace_rec));
+  return 0;
+}
+
+static const struct seq_operations trace_seq_ops_ = {
+  .start = trace_seq_start_,
+  .next  = trace_seq_next_,
+  .stop  = trace_seq_stop_,
+  .show  = trace_seq_show_,
+};
+
+static int trace_proc_open_(struct inode *inode, struct file *file) {
+  struct trace_iter_ *it = __seq_open_private(file, &trace_seq_ops_,
+                                              sizeof(struct trace_iter_));
+  if (unlikely(!it)) return -ENOMEM;
+  it->recs = recs_malloc_();
+  if (unlikely(!it->recs)) {
+    seq_release_private(inode, file);
+    return -ENOMEM;
+  }
+  it->ring_idx = -1;
+  return 0;
+}
+
+static int trace_proc_release_(struct inode *inode, struct file *file) {
+  struct trace_iter_ *it = ((struct seq_file *)file->private_data)->private;
+  recs_free_(it->recs);
+  return seq_release_private(inode, file);
+}
+
+static const struct file_operations trace_proc_fops_ = {
+  .owner    = THIS_MODULE,
+  .open     = trace_proc_open_,
+  .read     = seq_read,
+  .llseek   = seq_lseek,
+  .release  = trace_proc_release_,
+};
+
+static void rings_free_(void) {
+  struct trace_ring_ *ring;
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    per_cpu(trace_ring_, cpu) = NULL;
+  }
+  synchronize_sched(); // no event is being stored then
+  while ((ring = trace_rings_)) {
+    trace_rings_ = ring->next;
+    ring_free_(ring);
+  }
+}
+
+int cinq_trace_init(void) {
+  struct trace_ring_ *ring;
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    ring = ring_malloc_();
+    if (unlikely(!ring)) goto fail;
+    ring->thread = cpu;
+    ring->next = trace_rings_;
+    trace_rings_ = ring;
+    per_cpu(trace_ring_, cpu) = ring;
+  }
+  if (!proc_create("fs/cinqfs_trace", S_IRUSR, NULL, &trace_proc_fops_))
+    goto fail;
+  return 0;
+fail:
+  rings_free_();
+  return -ENOMEM;
+}
+
+void cinq_trace_exit(void) {
+  remove_proc_entry("fs/cinqfs_trace", NULL);
+  rings_free_();
+}
+
+#endif // __KERNEL__
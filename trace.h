@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ */
+
+//
+//  trace.h
+//  cinquain-meta
+//
+//  Created by agent <agent@local> on 10/19/26.
+//
+
+#ifndef CINQUAIN_META_TRACE_H_
+#define CINQUAIN_META_TRACE_H_
+
+#include "stats.h"
+
+/* Binary trace of operations, kept in per-thread (per-CPU in the kernel)
+ * rings that are overwritten when full. Recording an event is a clock
+ * read and a 32-byte store, with no lock or shared write, so it stays on
+ * in production; it can be turned off at runtime by cinq_trace_enable(0).
+ * Saved traces are read by benchmark/trace_decode.c. */
+
+#define CINQ_TRACE_MAGIC 0x43545243 // "CRTC"
+#define CINQ_TRACE_VERSION 1
+#define CINQ_TRACE_RING_BITS 12 // records per ring, a power of 2
+
+// Names of the ops by their cinq_stat_id, which records carry.
+#define CINQ_TRACE_OP_NAMES { "lookup", "mkdir", "create", "link", "unlink", \
+                              "rename", "readdir", "read", "write" }
+#define CINQ_TRACE_NUM_OPS (CINQ_STAT_WRITE + 1)
+
+// Layout saved as is, so fields are of fixed width and order.
+struct cinq_trace_rec {
+  u64 tr_time; // ns on the monotonic clock when the op began
+  u64 tr_cnode; // ci_id of the cnode operated on or under
+  u32 tr_fs; // fs_id of the requesting fsnode, IDT_NONE if none
+  u32 tr_latency; // ns, saturated at 0xffffffff (about 4 s)
+  s32 tr_result; // 0 or a positive count on success, or -errno
+  u16 tr_op; // enum cinq_stat_id
+  u16 tr_thread; // thread (or CPU) of the ring
+};
+
+// Precedes the records in a saved trace, which run to its end.
+struct cinq_trace_header {
+  u32 th_magic;
+  u16 th_version;
+  u16 th_rec_size;
+};
+
+extern int cinq_trace_on;
+
+static inline void cinq_trace_enable(int on) {
+  cinq_trace_on = on;
+}
+
+// Appends an event to the ring of the current thread.
+extern void cinq_trace(enum cinq_stat_id op, u64 start, unsigned long cnode,
+                       unsigned long fs, long result);
+
+// Writes a header and all records kept so far to @out (a struct seq_file
+// in the kernel or a FILE in user space), ring by ring. Records may still
+// be added meanwhile, in which case those overwritten during the copy are
+// left out. Returns the number of records written.
+extern long cinq_trace_save(void *out);
+
+// Forgets the recorded events. Not safe against concurrent tracing.
+extern void cinq_trace_reset(void);
+
+#ifdef __KERNEL__
+extern int cinq_trace_init(void); // rings and /proc/fs/cinqfs_trace
+extern void cinq_trace_exit(void);
+#endif // __KERNEL__
+
+// The time at start also serves CINQ_STATS, so it is read in any case then.
+#ifdef CINQ_STATS
+#define TRACE_BEGIN_(t) const u64 t = cinq_stat_clock()
+#else
+#define TRACE_BEGIN_(t) \
+    const u64 t = likely(cinq_trace_on) ? cinq_stat_clock() : 0
+#endif // CINQ_STATS
+
+#define TRACE_END_(op, t, cnode, fs, result) do { \
+  if (likely(cinq_trace_on) && (t)) cinq_trace(op, t, cnode, fs, result); \
+} while (0)
+
+#endif // CINQUAIN_META_TRACE_H_
@@ -27,6 +27,10 @@
 #include <linux/pagemap.h>
 #include <linux/delay.h>
 #include <linux/hash.h>
+#include <linux/uio.h>
+#include <linux/falloc.h>
+#include <linux/sort.h>
+#include <linux/rwsem.h>
 
 #else
 
@@ -37,7 +41,9 @@
 #include <sys/types.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
+#include <sys/uio.h>
 #include "atomic.h"
 #include "list.h"
 
@@ -70,7 +76,9 @@ typedef uint64_t __u64;
 typedef uint8_t u8;
 typedef uint32_t u32;
 typedef uint16_t u16;
+typedef int32_t s32;
 typedef uint64_t u64;
+typedef int64_t s64;
 typedef unsigned fmode_t;
 
 #ifndef _SYS_TYPES_H // linux sys/types.h has defined loff_t
@@ -91,13 +99,39 @@ typedef pthread_mutex_t spinlock_t;
 #define spin_trylock(lock_p) (pthread_mutex_trylock(lock_p))
 #define spin_unlock(lock_p) (pthread_mutex_unlock(lock_p))
 
+// lib/dec_and_lock.c: decrements @v and returns 1 with @lock held if it
+// drops to 0, only taking the lock for the last reference.
+static inline int atomic_dec_and_lock(atomic_t *v, spinlock_t *lock) {
+  if (atomic_add_unless(v, -1, 1)) return 0;
+  spin_lock(lock);
+  if (atomic_dec_and_test(v)) return 1;
+  spin_unlock(lock);
+  return 0;
+}
+
+#define cpu_relax() sched_yield()
+
 #define mutex_lock(lock_p) (pthread_mutex_lock(lock_p))
 #define mutex_unlock(lock_p) (pthread_mutex_unlock(lock_p))
 
 typedef pthread_mutex_t mutex_t;
+
+// Sleeping reader-writer lock, which may be held across allocations
+struct rw_semaphore {
+  pthread_rwlock_t lock;
+};
+#define init_rwsem(sem) (pthread_rwlock_init(&(sem)->lock, NULL))
+#define down_read(sem) (pthread_rwlock_rdlock(&(sem)->lock))
+#define up_read(sem) (pthread_rwlock_unlock(&(sem)->lock))
+#define down_write(sem) (pthread_rwlock_wrlock(&(sem)->lock))
+#define up_write(sem) (pthread_rwlock_unlock(&(sem)->lock))
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+// linux/kernel.h
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
 static inline void *ERR_PTR(long error) { // include/linux/err.h
   return (void *) error;
 }
@@ -129,6 +163,13 @@ static inline u64 hash_64(u64 val, unsigned int bits)
 	return hash >> (64 - bits);
 }
 
+// lib/sort.c, where @swap is only a hint
+static inline void sort(void *base, size_t num, size_t size,
+                        int (*cmp)(const void *, const void *),
+                        void (*swap)(void *, void *, int)) {
+  qsort(base, num, size, cmp);
+}
+
 #include "include-asm-generic-errno.h"
 #include "include-linux-stat.h"
 
@@ -148,6 +189,18 @@ static inline u64 hash_64(u64 val, unsigned int bits)
 #define MAX_LFS_FILESIZE 0x7fffffffffffffffUL
 #define MAX_NESTED_LINKS 6
 
+// linux/fs.h: not in unistd.h without _GNU_SOURCE
+#ifndef SEEK_DATA
+#define SEEK_DATA 3 // seek to the next data
+#define SEEK_HOLE 4 // seek to the next hole
+#endif
+
+// linux/falloc.h
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01 // default is extend size
+#define FALLOC_FL_PUNCH_HOLE 0x02 // de-allocates range
+#endif
+
 // include/linux/pagemap.h
 #define PAGE_CACHE_SHIFT        13 // 8KB
 #define PAGE_CACHE_SIZE         ((uint64_t)1 << PAGE_CACHE_SHIFT)
@@ -167,6 +220,8 @@ static inline u64 hash_64(u64 val, unsigned int bits)
 #define malloc(n) kmalloc(n, GFP_KERNEL)
 
 #define bufcpy(des, src, len) __copy_to_user(des, src, len)
+#define bufget(des, src, len) __copy_from_user(des, src, len)
+#define bufclr(des, len) __clear_user(des, len)
 
 #define sleep(n) ssleep(n)
 
@@ -179,9 +234,13 @@ static inline u64 hash_64(u64 val, unsigned int bits)
 #endif // CINQ_DEBUG
 
 #define bufcpy(des, src, len) memcpy(des, src, len)
+#define bufget(des, src, len) (memcpy(des, src, len), 0)
+#define bufclr(des, len) memset(des, 0, len)
 
 #define CURRENT_TIME ((struct timespec) { time(NULL), 0 })
 
+#define get_seconds() ((unsigned long)time(NULL))
+
 #endif // __KERNEL__
 
 
@@ -214,4 +273,12 @@ static inline u64 hash_64(u64 val, unsigned int bits)
 #define HASH_ADD_BY_PTR(hh, head, ptrfield, add) \
     HASH_ADD(hh, head, ptrfield, sizeof(void *), add)
 
+// Named locks are those the lock profiler reports one by one.
+#ifdef CINQ_LOCK_PROF
+#include "lockprof.h"
+#else
+#define read_lock_named(lock_p, kind, name) read_lock(lock_p)
+#define write_lock_named(lock_p, kind, name) write_lock(lock_p)
+#endif // CINQ_LOCK_PROF
+
 #endif // CINQUAIN_META_UTIL_H_
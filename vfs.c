@@ -388,7 +388,7 @@ static struct file *__dentry_open(struct dentry *dentry, struct vfsmount *mnt,
   
 	f->f_flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
   
-//	file_ra_state_init(&f->f_ra, f->f_mapping->host->i_mapping);
+	file_ra_state_init(&f->f_ra, NULL); // f_mapping is not kept
   
 	/* NB: we're sure to have correct a_ops only after f_op->open */
 //	if (f->f_flags & O_DIRECT) {
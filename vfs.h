@@ -381,6 +381,12 @@ struct inode {
 	void			*i_private; /* fs or device private pointer */
 };
 
+// include/linux/dcache.h: d_flags entries
+#define DCACHE_DISCONNECTED	0x0004
+     /* This dentry is possibly not currently connected to the dcache tree, in
+      * which case its parent will either be itself, or will have this flag as
+      * well. */
+
 struct dentry {
 	/* RCU lookup touched fields */
 	unsigned int d_flags;		/* protected by d_lock */
@@ -435,6 +441,30 @@ struct nameidata {
   // Omits intent data
 };
 
+typedef unsigned long pgoff_t;
+
+/*
+ * Track a single file's readahead state
+ */
+struct file_ra_state {
+	pgoff_t start;			/* where readahead started */
+	unsigned int size;		/* # of readahead pages */
+	unsigned int async_size;	/* do asynchronous readahead when
+					   there are only # of pages ahead */
+
+	unsigned int ra_pages;		/* Maximum readahead window */
+	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
+	loff_t prev_pos;		/* Cache last read() position */
+};
+
+struct address_space;
+
+static inline void file_ra_state_init(struct file_ra_state *ra,
+                                      struct address_space *mapping) {
+	memset(ra, 0, sizeof(struct file_ra_state));
+	ra->prev_pos = -1;
+}
+
 struct file {
 	/*
 	 * fu_list becomes invalid after file_free is called and queued via
@@ -458,7 +488,7 @@ struct file {
 	loff_t			f_pos;
   //	struct fown_struct	f_owner;
 	const struct cred	*f_cred;
-  //	struct file_ra_state	f_ra;
+	struct file_ra_state	f_ra;
   
 	u64			f_version;
   //#ifdef CONFIG_SECURITY
@@ -639,6 +669,8 @@ extern void d_instantiate(struct dentry *dentry, struct inode * inode);
 
 extern struct dentry *d_splice_alias(struct inode *inode,
                                      struct dentry *dentry);
+
+extern struct dentry *d_obtain_alias(struct inode *inode);
 extern struct dentry *dget(struct dentry *dentry);
 
 extern void dput(struct dentry *dentry);
@@ -715,6 +747,19 @@ static inline void ihold(struct inode *inode) {
             "[Warn@ihold] caller must already hold a reference.");
 }
 
+// fs/inode.c: called with inode->i_lock held by the last iput
+static inline void iput_final_(struct inode *inode)
+  __releases(inode->i_lock) {
+  const struct super_operations *op = inode->i_sb->s_op;
+  // Unhashed inodes are never kept in core without references.
+  inode->i_state |= I_FREEING;
+  spin_unlock(&inode->i_lock);
+  // evict(inode); // expanded as following
+  if (op->evict_inode) op->evict_inode(inode);
+  inode->i_state = I_FREEING | I_CLEAR;
+  destroy_inode(inode);
+}
+
 /**
  *      iput    - put an inode
  *      @inode: inode to put
@@ -726,11 +771,8 @@ static inline void iput(struct inode *inode) {
   if (inode) {
     DEBUG_ON_(inode->i_state & I_CLEAR,
               "[Bug@iput] violating kernel specification.\n");
-    // if (atomic_dec_and_lock(&inode->i_count, &inode->i_lock))
-    if (atomic_dec_and_test(&inode->i_count)) {
-      // spin_lock(&inode->i_lock);
-      // iput_final(inode);
-      destroy_inode(inode);
+    if (atomic_dec_and_lock(&inode->i_count, &inode->i_lock)) {
+      iput_final_(inode);
     }
   }
 }